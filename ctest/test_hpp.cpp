@@ -0,0 +1,237 @@
+/* Tests of the C++ interface in sep.hpp, on a synthetic image. */
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "sep.hpp"
+
+static int nfail = 0;
+
+#define CHECK(cond)                                                      \
+  do {                                                                   \
+    if (!(cond)) {                                                       \
+      std::printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+      nfail++;                                                           \
+    }                                                                    \
+  } while (0)
+
+static const int W = 128, H = 96;
+static const double BACK = 10.0;
+
+/* a flat background with a small deterministic ripple and three Gaussian
+ * sources of unit sigma and known flux */
+static const double XS[3] = {30.0, 70.5, 100.25};
+static const double YS[3] = {20.0, 50.0, 75.5};
+static const double FLUX[3] = {1000.0, 2000.0, 1500.0};
+
+static std::vector<float> make_image() {
+  std::vector<float> im((std::size_t)W * H);
+  for (int y = 0; y < H; y++) {
+    for (int x = 0; x < W; x++) {
+      double v = BACK + 0.5 * std::sin(0.7 * x + 1.3 * y);
+      for (int i = 0; i < 3; i++) {
+        double dx = x - XS[i], dy = y - YS[i];
+        v += FLUX[i] / (2.0 * M_PI) * std::exp(-0.5 * (dx * dx + dy * dy));
+      }
+      im[(std::size_t)y * W + x] = (float)v;
+    }
+  }
+  return im;
+}
+
+static void test_view() {
+  std::vector<float> im = make_image();
+  sep::ImageView<float> v(im.data(), W, H);
+
+  CHECK(v.dtype == SEP_TFLOAT);
+  CHECK(v.row_bytes() == W * (std::int64_t)sizeof(float));
+  CHECK(&v(3, 2) == &im[2 * W + 3]);
+  CHECK(v.row(5).size() == (std::size_t)W);
+
+  sep::ImageView<float> s = v.sub(10, 20, 8, 4);
+  CHECK(s.width() == 8 && s.height() == 4);
+  CHECK(&s(0, 0) == &v(10, 20));
+  CHECK(&s(7, 3) == &v(17, 23));
+
+  /* the same image read bottom-up through a negative stride */
+  sep::ImageView<const float> flip(
+      im.data() + (std::size_t)(H - 1) * W, W, H, -W * (std::int64_t)sizeof(float)
+  );
+  CHECK(flip.dtype == SEP_TFLOAT);
+  CHECK(&flip(4, 0) == &v(4, H - 1));
+  CHECK(&flip(4, H - 1) == &v(4, 0));
+}
+
+static void test_background() {
+  std::vector<float> im = make_image();
+  sep::ImageView<float> v(im.data(), W, H);
+  sep::BackgroundParams p;
+  p.bw = p.bh = 32;
+
+  sep::Background bkg(sep::Image(v), p);
+  CHECK(bkg.width() == W && bkg.height() == H);
+  CHECK(std::fabs(bkg.global() - BACK) < 0.5);
+  CHECK(bkg.globalrms() > 0.0f && bkg.globalrms() < 1.0f);
+
+  std::vector<float> back = bkg.back();
+  std::vector<double> rms = bkg.rms<double>();
+  CHECK(back.size() == (std::size_t)W * H);
+  CHECK(rms.size() == (std::size_t)W * H);
+  /* pix() interpolates linearly, the arrays with the spline */
+  CHECK(std::fabs(back[(std::size_t)7 * W + 9] - bkg.pix(9, 7)) < 1e-3);
+
+  /* subtracting in place gives the image minus back() */
+  std::vector<float> sub = im;
+  bkg.subtract_from(sep::ImageView<float>(sub.data(), W, H));
+  bool same = true;
+  for (std::size_t i = 0; i < sub.size(); i++) {
+    same = same && std::fabs(sub[i] - (im[i] - back[i])) < 1e-4f;
+  }
+  CHECK(same);
+
+  /* the background is owned by exactly one object */
+  sep::Background moved(std::move(bkg));
+  CHECK(moved.get() != nullptr);
+  CHECK(bkg.get() == nullptr);
+}
+
+static void test_extract() {
+  std::vector<float> im = make_image();
+  sep::ImageView<float> v(im.data(), W, H);
+  sep::Background bkg{sep::Image(v)};
+  bkg.subtract_from(v);
+
+  sep::Image image(v);
+  image.noise(1.0);
+  sep::ExtractParams p;
+  p.thresh_type = SEP_THRESH_ABS;
+  sep::Catalog cat = sep::extract(image, 3.0f, p);
+
+  CHECK(cat.size() == 3);
+  for (std::size_t i = 0; i < cat.size() && i < 3; i++) {
+    /* the catalog is in order of first appearance from the bottom row */
+    CHECK(std::fabs(cat->x[i] - XS[i]) < 0.05);
+    CHECK(std::fabs(cat->y[i] - YS[i]) < 0.05);
+    CHECK((std::size_t)cat->npix[i] == cat.pixels(i).size());
+    for (std::int64_t k : cat.pixels(i)) {
+      CHECK(k >= 0 && k < (std::int64_t)W * H);
+    }
+    CHECK(cat.values(i).empty());
+  }
+
+  /* a bottom-up view finds the same objects, mirrored in y */
+  sep::ImageView<const float> flip(
+      im.data() + (std::size_t)(H - 1) * W, W, H, -W * (std::int64_t)sizeof(float)
+  );
+  sep::Catalog fcat = sep::extract(flip, 3.0f, p);
+  CHECK(fcat.size() == 3);
+  for (std::size_t i = 0; i < fcat.size() && i < 3; i++) {
+    CHECK(std::fabs(fcat->y[i] - (H - 1 - YS[2 - i])) < 0.05);
+  }
+
+  /* pixel values follow the order of the pixel indices */
+  int pixvalues = sep_get_extract_pixvalues();
+  sep_set_extract_pixvalues(1);
+  sep::Catalog vcat = sep::extract(image, 3.0f, p);
+  sep_set_extract_pixvalues(pixvalues);
+  CHECK(vcat.size() == 3);
+  for (std::size_t i = 0; i < vcat.size(); i++) {
+    sep::Span<const std::int64_t> pix = vcat.pixels(i);
+    sep::Span<const float> val = vcat.values(i);
+    CHECK(val.size() == pix.size());
+    CHECK(vcat.variances(i).size() == pix.size());
+    for (std::size_t k = 0; k < val.size() && k < pix.size(); k++) {
+      CHECK(val[k] == im[(std::size_t)pix[k]]);
+    }
+  }
+
+  sep::Catalog moved(std::move(cat));
+  CHECK(moved.size() == 3);
+  CHECK(cat.empty());
+
+  p.conv = {1, 2, 1};
+  bool thrown = false;
+  try {
+    sep::extract(image, 3.0f, p);
+  } catch (const std::invalid_argument &) {
+    thrown = true;
+  }
+  CHECK(thrown);
+}
+
+static void test_aperture() {
+  std::vector<float> im = make_image();
+  std::vector<double> imd(im.begin(), im.end());
+  for (double & d : imd) {
+    d -= BACK;
+  }
+  sep::ImageView<const double> v(imd.data(), W, H);
+  sep::Image image(v);
+  image.noise(1.0);
+  sep::ApertureParams exact;
+  exact.subpix = 0;
+
+  sep::ApertureSum s = sep::sum_circle(image, XS[1], YS[1], 5.0, exact);
+  CHECK(std::fabs(s.sum - FLUX[1]) < 0.01 * FLUX[1]);
+  CHECK(std::fabs(s.area - M_PI * 25.0) < 1e-6);
+  CHECK(std::fabs(s.sumerr - std::sqrt(s.area)) < 1e-6);
+  CHECK(s.flag == 0);
+
+  /* the typed overload gives the same sum, without noise */
+  sep::ApertureSum t = sep::sum_circle(v, XS[1], YS[1], 5.0, exact);
+  CHECK(t.sum == s.sum);
+  CHECK(t.sumerr == 0.0);
+
+  /* the batched form matches object by object and reuses the output */
+  std::vector<sep::ApertureSum> out(10);
+  sep::sum_circle(
+      image, sep::Span<const double>(XS, 3), sep::Span<const double>(YS, 3), 5.0, out
+  );
+  CHECK(out.size() == 3);
+  for (std::size_t i = 0; i < out.size(); i++) {
+    sep::ApertureSum one = sep::sum_circle(image, XS[i], YS[i], 5.0);
+    CHECK(out[i].sum == one.sum && out[i].sumerr == one.sumerr);
+    CHECK(out[i].area == one.area && out[i].flag == one.flag);
+  }
+
+  sep::ApertureSum ann = sep::sum_circann(image, XS[1], YS[1], 6.0, 8.0, exact);
+  CHECK(std::fabs(ann.area - M_PI * 28.0) < 1e-6);
+  sep::ApertureSum ell =
+      sep::sum_ellipse(image, XS[1], YS[1], 1.0, 1.0, 0.0, 5.0, exact);
+  CHECK(std::fabs(ell.sum - s.sum) < 1e-6 * FLUX[1]);
+
+  /* near the edge the aperture is truncated and flagged */
+  sep::ApertureSum edge = sep::sum_circle(image, 1.0, 1.0, 5.0);
+  CHECK(edge.flag & SEP_APER_TRUNC);
+
+  /* C errors come back as sep::error with the status code and message */
+  int status = 0;
+  std::string msg;
+  try {
+    sep::sum_circle(image, XS[1], YS[1], -1.0);
+  } catch (const sep::error & e) {
+    status = e.status();
+    msg = e.what();
+  }
+  CHECK(status != 0);
+  CHECK(!msg.empty());
+}
+
+int main() {
+  test_view();
+  test_background();
+  test_extract();
+  test_aperture();
+
+  if (nfail) {
+    std::printf("%d checks failed\n", nfail);
+    return 1;
+  }
+  std::printf("all checks passed\n");
+  return 0;
+}
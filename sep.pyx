@@ -5,6 +5,8 @@ Source Extraction and Photometry
 
 This module is a wrapper of the SEP C library.
 """
+import os
+
 import numpy as np
 
 cimport cython
@@ -23,9 +25,13 @@ from _version import version as __version__
 
 # macro definitions from sep.h
 DEF SEP_TBYTE = 11
+DEF SEP_TUSHORT = 20
+DEF SEP_TSHORT = 21
 DEF SEP_TINT = 31
 DEF SEP_TFLOAT = 42
 DEF SEP_TDOUBLE = 82
+DEF SEP_TBIT = 1
+DEF SEP_TSWAP = 0x100
 
 # input flag values (C macros)
 DEF SEP_NOISE_NONE = 0
@@ -35,6 +41,9 @@ DEF SEP_NOISE_VAR = 2
 # filter types for sep_extract
 DEF SEP_FILTER_CONV = 0
 DEF SEP_FILTER_MATCHED = 1
+DEF SEP_CONV_AUTO = 0
+DEF SEP_CONV_DIRECT = 1
+DEF SEP_CONV_SEPARABLE = 2
 
 # Threshold types
 DEF SEP_THRESH_REL = 0
@@ -43,6 +52,14 @@ DEF SEP_THRESH_ABS = 1
 # input flags for aperture photometry
 DEF SEP_MASK_IGNORE = 0x0004
 
+# aperture types for sep_pipeline
+DEF SEP_PIPE_CIRCLE = 0
+DEF SEP_PIPE_ELLIPSE = 1
+
+# catalog file formats for sep_catwriter_open
+DEF SEP_CATFMT_FITS = 0
+DEF SEP_CATFMT_ARROW = 1
+
 # Output flag values accessible from python
 OBJ_MERGED = np.short(0x0001)
 OBJ_TRUNC = np.short(0x0002)
@@ -79,12 +96,29 @@ cdef extern from "sep.h":
         short noise_type
         double gain
         double maskthresh
+        const void *ref
+        const void *refnoise
+        int rdtype
+        int rndtype
+        double refscale
+        double refnoiseval
+        np.int64_t dstride
+        np.int64_t nstride
+        np.int64_t mstride
+        np.int64_t sstride
+        np.int64_t rstride
+        np.int64_t rnstride
 
     ctypedef struct sep_bkg:
         np.int64_t w
         np.int64_t h
+        np.int64_t nx
+        np.int64_t ny
         float globalback
         float globalrms
+        np.int64_t subsample
+        np.int64_t nsample
+        float *backerr
 
     ctypedef struct sep_catalog:
         np.int64_t  nobj
@@ -120,18 +154,50 @@ cdef extern from "sep.h":
         short       *flag
         np.int64_t  **pix
         np.int64_t  *objectspix
+        float       *objectsvalue
+        float       *objectscdvalue
+        float       *objectsvar
 
     int sep_background(const sep_image *im,
                        np.int64_t bw, np.int64_t bh,
                        np.int64_t fw, np.int64_t fh,
                        double fthresh,
                        sep_bkg **bkg)
+    int sep_background_masked(const sep_image *im,
+                              np.int64_t bw, np.int64_t bh,
+                              np.int64_t fw, np.int64_t fh,
+                              double fthresh, double nsigma,
+                              np.int64_t dilate, int niter,
+                              sep_bkg **bkg)
+    int sep_background_multiscale(const sep_image *im,
+                                  np.int64_t bw, np.int64_t bh,
+                                  np.int64_t fw, np.int64_t fh,
+                                  double fthresh, int nscales,
+                                  sep_bkg **bkgs)
 
     float sep_bkg_global(const sep_bkg *bkg)
     float sep_bkg_globalrms(const sep_bkg *bkg)
     int sep_bkg_array(const sep_bkg *bkg, void *arr, int dtype)
     int sep_bkg_rmsarray(const sep_bkg *bkg, void *arr, int dtype)
     int sep_bkg_subarray(const sep_bkg *bkg, void *arr, int dtype)
+    int sep_bkg_eval(const sep_bkg *bkg, const double *x, const double *y,
+                     np.int64_t n, double *back, double *rms)
+    int sep_bkg_tile(const sep_bkg *bkg, np.int64_t x0, np.int64_t y0,
+                     np.int64_t w, np.int64_t h, void *out, int dtype)
+    int sep_bkg_rmstile(const sep_bkg *bkg, np.int64_t x0, np.int64_t y0,
+                        np.int64_t w, np.int64_t h, void *out, int dtype)
+    int sep_bkg_subtile(const sep_bkg *bkg, np.int64_t x0, np.int64_t y0,
+                        np.int64_t w, np.int64_t h, void *arr, int dtype)
+    int sep_stats_box(const sep_image *image, const np.int64_t *xmin,
+                      const np.int64_t *xmax, const np.int64_t *ymin,
+                      const np.int64_t *ymax, np.int64_t n, double *mean,
+                      double *mode, double *sigma, np.int64_t *npix,
+                      short *flag)
+    int sep_stats_circann(const sep_image *image, const double *x,
+                          const double *y, const double *rin,
+                          const double *rout, np.int64_t n, double *mean,
+                          double *mode, double *sigma, np.int64_t *npix,
+                          short *flag)
     void sep_bkg_free(sep_bkg *bkg)
 
     int sep_extract(const sep_image *image,
@@ -149,6 +215,23 @@ cdef extern from "sep.h":
 
     void sep_catalog_free(sep_catalog *catalog)
 
+    int sep_extract_update(const sep_image *image,
+                           const sep_catalog *prev,
+                           const np.int64_t *xmin, const np.int64_t *xmax,
+                           const np.int64_t *ymin, const np.int64_t *ymax,
+                           np.int64_t ndirty,
+                           float thresh,
+                           int thresh_type,
+                           int minarea,
+                           float *conv,
+                           np.int64_t convw, np.int64_t convh,
+                           int filter_type,
+                           int deblend_nthresh,
+                           double deblend_cont,
+                           int clean_flag,
+                           double clean_param,
+                           sep_catalog **catalog)
+
     int sep_sum_circle(const sep_image *image,
                        double x, double y, double r,
                        int id, int subpix, short inflags,
@@ -173,6 +256,18 @@ cdef extern from "sep.h":
                          double *sum, double *sumerr, double *area,
                          short *flag)
 
+    ctypedef struct sep_psf:
+        const void *data
+        int dtype
+        np.int64_t w, h
+        np.int64_t nx, ny
+        np.int64_t tw, th
+
+    int sep_sum_psf(const sep_image *image, const sep_psf *psf,
+                    const double *x, const double *y, const int *id,
+                    np.int64_t n, int nshift, double *flux, double *fluxerr,
+                    short *flag)
+
     int sep_flux_radius(const sep_image *image,
                         double x, double y, double rmax, int id, int subpix,
                         short inflag,
@@ -188,6 +283,15 @@ cdef extern from "sep.h":
                      double x, double y, double sig, int subpix, short inflag,
                      double *xout, double *yout, int *niter, short *flag)
 
+    int sep_windowed_moments(const sep_image *image,
+                             const double *x, const double *y,
+                             const double *sig, np.int64_t n, int subpix,
+                             short inflag, double *xout, double *yout,
+                             double *x2, double *y2, double *xy,
+                             double *a, double *b, double *theta,
+                             double *errx2, double *erry2, double *errxy,
+                             short *flag)
+
     int sep_ellipse_axes(double cxx, double cyy, double cxy,
                          double *a, double *b, double *theta)
 
@@ -207,6 +311,95 @@ cdef extern from "sep.h":
 
     void sep_set_sub_object_limit(int val)
     int sep_get_sub_object_limit()
+    void sep_set_extract_pixvalues(int val)
+    int sep_get_extract_pixvalues()
+    void sep_set_background_subsample(int val)
+    int sep_get_background_subsample()
+    void sep_set_overlap_tolerance(double tol)
+    double sep_get_overlap_tolerance()
+    void sep_set_conv_plan(int plan)
+    int sep_get_conv_plan()
+    int sep_conv_plan(const float *conv, np.int64_t convw, np.int64_t convh,
+                      np.int64_t w, int *plan)
+    int sep_set_tune_cache(const char *path)
+
+    ctypedef struct sep_catwriter:
+        pass
+
+    int sep_catwriter_open(const char *path, int format, np.int64_t rowgroup,
+                           sep_catwriter **writer)
+    int sep_catwriter_write(sep_catwriter *writer, const sep_catalog *catalog)
+    int sep_catwriter_flush(sep_catwriter *writer)
+    np.int64_t sep_catwriter_nrows(const sep_catwriter *writer)
+    int sep_catwriter_close(sep_catwriter *writer)
+
+    ctypedef struct sep_index:
+        pass
+
+    int sep_index_build(const double *x, const double *y, np.int64_t n,
+                        double cellsize, sep_index **index)
+    void sep_index_free(sep_index *index)
+    np.int64_t sep_index_size(const sep_index *index)
+    int sep_index_count_radius(const sep_index *index, const double *x,
+                               const double *y, const double *r,
+                               np.int64_t n, np.int64_t *counts)
+    int sep_index_query_radius(const sep_index *index, const double *x,
+                               const double *y, const double *r,
+                               np.int64_t n, const np.int64_t *offsets,
+                               np.int64_t *indices)
+    int sep_index_query_nearest(const sep_index *index, const double *x,
+                                const double *y, np.int64_t n, np.int64_t k,
+                                np.int64_t *indices, double *dist)
+
+    ctypedef struct sep_tile:
+        np.int64_t x0
+        np.int64_t y0
+        np.int64_t w
+        np.int64_t h
+        double cxmin
+        double cxmax
+        double cymin
+        double cymax
+
+    int sep_tile_select(const double *x, const double *y, const int *tile,
+                        np.int64_t n, const sep_tile *tiles, double matchrad,
+                        unsigned char *keep)
+
+    ctypedef struct sep_pipeline_aper:
+        int type
+        double r
+        int subpix
+
+    ctypedef struct sep_pipeline_config:
+        np.int64_t bw, bh, fw, fh
+        double fthresh
+        float thresh
+        int minarea
+        const float *conv
+        np.int64_t convw, convh
+        int filter_type
+        int deblend_nthresh
+        double deblend_cont
+        int clean_flag
+        double clean_param
+        int rmsmap
+        const sep_pipeline_aper *apers
+        int naper
+
+    ctypedef struct sep_pipeline_result:
+        sep_bkg *bkg
+        sep_catalog *catalog
+        int naper
+        double *flux
+        double *fluxerr
+        short *flag
+
+    int sep_pipeline(const sep_image *image, const sep_pipeline_config *config,
+                     sep_pipeline_result **result)
+    void sep_pipeline_free(sep_pipeline_result *result)
+
+    void sep_set_nthreads(int val)
+    int sep_get_nthreads()
 
     void sep_get_errmsg(int status, char *errtext)
     void sep_get_errdetail(char *errtext)
@@ -231,9 +424,20 @@ cdef int _get_sep_dtype(dtype) except -1:
         return SEP_TDOUBLE
     elif dtype == np.intc:
         return SEP_TINT
+    elif dtype == np.int16:
+        return SEP_TSHORT
+    elif dtype == np.uint16:
+        return SEP_TUSHORT
     raise ValueError('input array dtype not supported: {0}'.format(dtype))
 
 
+cdef int _get_sep_input_dtype(dtype) except -1:
+    """SEP dtype code of an input array, which may have either byte order."""
+    if dtype.isnative:
+        return _get_sep_dtype(dtype)
+    return _get_sep_dtype(dtype.newbyteorder("=")) | SEP_TSWAP
+
+
 cdef int _check_array_get_dims(np.ndarray arr, np.int64_t *w, np.int64_t *h) except -1:
     """Check some things about an array and return dimensions"""
 
@@ -241,6 +445,11 @@ cdef int _check_array_get_dims(np.ndarray arr, np.int64_t *w, np.int64_t *h) exc
     if not arr.flags["C_CONTIGUOUS"]:
         raise ValueError("array is not C-contiguous")
 
+    return _get_array_dims(arr, w, h)
+
+cdef int _get_array_dims(np.ndarray arr, np.int64_t *w, np.int64_t *h) except -1:
+    """Check that an array is 2-d and return its dimensions"""
+
     # Check that there are exactly 2 dimensions
     if arr.ndim != 2:
         raise ValueError("array must be 2-d")
@@ -258,6 +467,48 @@ cdef int _check_array_get_dims(np.ndarray arr, np.int64_t *w, np.int64_t *h) exc
                          .format(arr.shape[1], limits.INT_MAX))
     return 0
 
+cdef object _as_array(arr):
+    """View an input array as a numpy array, without copying it. Besides
+    numpy arrays, this accepts any object exporting the buffer protocol
+    (PEP 3118), such as a memoryview, or DLPack, such as a CPU tensor of
+    another array library."""
+    if isinstance(arr, np.ndarray):
+        return arr
+    if hasattr(arr, "__dlpack__"):
+        return np.from_dlpack(arr)
+    return np.asarray(memoryview(arr))
+
+cdef object _output_dtype(arr):
+    """Default dtype of arrays derived from an input, such as a background
+    image: the input dtype in native byte order, or float32 for 16-bit
+    integers, which are only read."""
+    dt = _as_array(arr).dtype.newbyteorder("=")
+    if dt.kind in "iu" and dt.itemsize == 2:
+        return np.dtype(np.float32)
+    return dt
+
+cdef object _input_array(arr, np.int64_t *w, np.int64_t *h, const void **ptr,
+                         int *dtype, np.int64_t *stride):
+    """View an input array without copying it (see _as_array) and describe
+    it to C: dimensions, data pointer, dtype code (with SEP_TSWAP for
+    non-native byte order) and row stride in bytes (0 if the rows are
+    contiguous). The rows can be anywhere in memory, but the elements of
+    each row must be adjacent. Returns the numpy view."""
+
+    arr = _as_array(arr)
+    _get_array_dims(arr, w, h)
+    if w[0] > 1 and arr.strides[1] != arr.itemsize:
+        raise ValueError("array elements within a row are not adjacent in "
+                         "memory")
+    stride[0] = arr.strides[0]
+    if h[0] < 2 or stride[0] == w[0] * arr.itemsize:
+        stride[0] = 0
+    elif stride[0] == 0:
+        raise ValueError("array rows overlap in memory")
+    dtype[0] = _get_sep_input_dtype(arr.dtype)
+    ptr[0] = np.PyArray_DATA(arr)
+    return arr
+
 cdef int _assert_ok(int status) except -1:
     """Get the SEP error message corresponding to status code"""
     cdef char *errmsg
@@ -296,13 +547,14 @@ cdef int _assert_ok(int status) except -1:
     raise Exception(msg)
 
 
-cdef int _parse_arrays(np.ndarray data, err, var, mask, segmap,
-                       sep_image *im) except -1:
+cdef tuple _parse_arrays(data, err, var, mask, segmap, sep_image *im):
     """Helper function for functions accepting data, error, mask & segmap arrays.
-    Fills in an sep_image struct."""
+    Fills in an sep_image struct. The arrays are viewed in place (see
+    _input_array), never copied. Returns the views, which own any DLPack
+    capsule or buffer export of the inputs: the caller must keep them until
+    the C call using `im` returns."""
 
     cdef np.int64_t ew, eh, mw, mh, sw, sh
-    cdef np.uint8_t[:,:] buf, ebuf, mbuf, sbuf
 
     # Clear im fields we might not touch (everything besides data, dtype, w, h)
     im.noise = NULL
@@ -315,12 +567,21 @@ cdef int _parse_arrays(np.ndarray data, err, var, mask, segmap,
     im.noise_type = SEP_NOISE_NONE
     im.gain = 0.0
     im.maskthresh = 0.0
+    im.ref = NULL
+    im.refnoise = NULL
+    im.rdtype = 0
+    im.rndtype = 0
+    im.refscale = 0.0
+    im.refnoiseval = 0.0
+    im.nstride = 0
+    im.mstride = 0
+    im.sstride = 0
+    im.rstride = 0
+    im.rnstride = 0
 
     # Get main image info
-    _check_array_get_dims(data, &(im.w), &(im.h))
-    im.dtype = _get_sep_dtype(data.dtype)
-    buf = data.view(dtype=np.uint8)
-    im.data = <void*>&buf[0, 0]
+    data = _input_array(data, &(im.w), &(im.h), &(im.data), &(im.dtype),
+                        &(im.dstride))
 
     # Check if noise is error or variance.
     noise = None  # will point to either error or variance.
@@ -332,51 +593,139 @@ cdef int _parse_arrays(np.ndarray data, err, var, mask, segmap,
     elif var is not None:
         noise = var
         im.noise_type = SEP_NOISE_VAR
+    if noise is not None and not np.isscalar(noise):
+        noise = _as_array(noise)
 
     # parse noise
     if noise is None:
         im.noise = NULL
         im.noise_type = SEP_NOISE_NONE
         im.noiseval = 0.0
-    elif isinstance(noise, np.ndarray):
-        if noise.ndim == 0:
-            im.noise = NULL
-            im.noiseval = noise
-        elif noise.ndim == 2:
-            _check_array_get_dims(noise, &ew, &eh)
-            if ew != im.w or eh != im.h:
-                raise ValueError("size of error/variance array must match"
-                                 " data")
-            im.ndtype = _get_sep_dtype(noise.dtype)
-            ebuf = noise.view(dtype=np.uint8)
-            im.noise = <void*>&ebuf[0, 0]
-        else:
-            raise ValueError("error/variance array must be 0-d or 2-d")
-    else:
+    elif np.ndim(noise) == 0:
         im.noise = NULL
         im.noiseval = noise
+    elif np.ndim(noise) == 2:
+        noise = _input_array(noise, &ew, &eh, &(im.noise), &(im.ndtype),
+                             &(im.nstride))
+        if ew != im.w or eh != im.h:
+            raise ValueError("size of error/variance array must match"
+                             " data")
+    else:
+        raise ValueError("error/variance array must be 0-d or 2-d")
 
     # Optional input: mask
     if mask is None:
         im.mask = NULL
+    elif isinstance(mask, BitMask):
+        mask = _input_array(mask, &mw, &mh, &(im.mask), &(im.mdtype),
+                            &(im.mstride))
+        if mask.width != im.w or mw != (im.w + 7) // 8 or mh != im.h:
+            raise ValueError("size of mask array must match data")
+        im.mdtype = SEP_TBIT
     else:
-        _check_array_get_dims(mask, &mw, &mh)
+        mask = _input_array(mask, &mw, &mh, &(im.mask), &(im.mdtype),
+                            &(im.mstride))
         if mw != im.w or mh != im.h:
             raise ValueError("size of mask array must match data")
-        im.mdtype = _get_sep_dtype(mask.dtype)
-        mbuf = mask.view(dtype=np.uint8)
-        im.mask = <void*>&mbuf[0, 0]
 
     # Optional input: segmap
     if segmap is None:
         im.segmap = NULL
     else:
-        _check_array_get_dims(segmap, &sw, &sh)
+        segmap = _input_array(segmap, &sw, &sh, &(im.segmap), &(im.sdtype),
+                              &(im.sstride))
         if sw != im.w or sh != im.h:
             raise ValueError("size of segmap array must match data")
-        im.sdtype = _get_sep_dtype(segmap.dtype)
-        sbuf = segmap.view(dtype=np.uint8)
-        im.segmap = <void*>&sbuf[0, 0]
+
+    return (data, noise, mask, segmap)
+
+
+cdef tuple _parse_ref(ref, double ref_scale, ref_noise, sep_image *im):
+    """Helper function filling in the reference (template) image fields of
+    an sep_image struct already set up by _parse_arrays. The reference noise
+    is interpreted in the same way (error or variance) as the image noise.
+    Returns the views of the arrays, to be kept as for _parse_arrays."""
+
+    cdef np.int64_t rw, rh
+
+    if ref is None:
+        if ref_noise is not None:
+            raise ValueError("ref_noise given without ref")
+        return (None, None)
+
+    ref = _input_array(ref, &rw, &rh, &(im.ref), &(im.rdtype), &(im.rstride))
+    if rw != im.w or rh != im.h:
+        raise ValueError("size of ref array must match data")
+    im.refscale = ref_scale
+    if ref_noise is not None and not np.isscalar(ref_noise):
+        ref_noise = _as_array(ref_noise)
+
+    if ref_noise is None:
+        im.refnoiseval = 0.0
+    elif np.ndim(ref_noise) == 2:
+        ref_noise = _input_array(ref_noise, &rw, &rh, &(im.refnoise),
+                                 &(im.rndtype), &(im.rnstride))
+        if rw != im.w or rh != im.h:
+            raise ValueError("size of ref_noise array must match data")
+    elif np.ndim(ref_noise) == 0:
+        im.refnoiseval = ref_noise
+    else:
+        raise ValueError("ref_noise array must be 0-d or 2-d")
+
+    return (ref, ref_noise)
+
+    return 0
+
+
+# -----------------------------------------------------------------------------
+# Bit-packed masks
+
+class BitMask(np.ndarray):
+    """
+    BitMask(mask)
+
+    A mask packed to one bit per pixel.
+
+    A `BitMask` can be passed wherever a mask array is accepted. It takes
+    an eighth of the memory of a boolean or ``uint8`` mask, and runs of 64
+    unmasked pixels are skipped without being expanded. A set bit counts
+    as a mask value of 1, so with the default ``maskthresh`` of 0 set bits
+    are masked.
+
+    Parameters
+    ----------
+    mask : 2-d array_like
+        Pixels with nonzero (or `True`) values are set.
+
+    Attributes
+    ----------
+    width : int
+        Width of the unpacked mask, in pixels.
+
+    Notes
+    -----
+    The bits are stored as by ``numpy.packbits(mask != 0, axis=1)``: most
+    significant bit first, with each row padded to a whole number of
+    bytes. The array itself has shape ``(height, (width + 7) // 8)``.
+    """
+
+    def __new__(cls, mask):
+        mask = np.asarray(mask)
+        if mask.ndim != 2:
+            raise ValueError("array must be 2-d")
+        obj = np.ascontiguousarray(np.packbits(mask != 0, axis=1)).view(cls)
+        obj.width = mask.shape[1]
+        return obj
+
+    def __array_finalize__(self, obj):
+        self.width = getattr(obj, "width", None)
+
+    def unpack(self):
+        """unpack()
+
+        Return the mask as a boolean array of shape ``(height, width)``."""
+        return np.unpackbits(np.asarray(self), axis=1,
+                             count=self.width).astype(bool)
 
 # -----------------------------------------------------------------------------
 # Background Estimation
@@ -384,7 +733,7 @@ cdef int _parse_arrays(np.ndarray data, err, var, mask, segmap,
 cdef class Background:
     """
     Background(data, mask=None, maskthresh=0.0, bw=64, bh=64,
-               fw=3, fh=3, fthresh=0.0)
+               fw=3, fh=3, fthresh=0.0, niter=0, nsigma=3.0, dilate=3)
 
     Representation of spatially variable image background and noise.
 
@@ -392,7 +741,7 @@ cdef class Background:
     ----------
     data : 2-d `~numpy.ndarray`
         Data array.
-    mask : 2-d `~numpy.ndarray`, optional
+    mask : 2-d `~numpy.ndarray` or `BitMask`, optional
         Mask array, optional
     maskthresh : float, optional
         Mask threshold. This is the inclusive upper limit on the mask value
@@ -406,6 +755,20 @@ cdef class Background:
         Filter width and height in boxes. Default is 3.
     fthresh : float, optional
         Filter threshold. Default is 0.0.
+    niter : int, optional
+        Number of source-masked iterations. In each, pixels whose 3x3 sum
+        is more than ``nsigma`` standard deviations above the current
+        background, and all pixels within ``dilate`` pixels of them, are
+        excluded and the background is re-estimated. This replaces the
+        usual recipe of extracting, masking the dilated segmentation map
+        and measuring the background again, without any intermediate
+        full-size arrays. Default is 0 (no masking).
+    nsigma : float, optional
+        Detection threshold for source masking, in standard deviations.
+        Default is 3.0.
+    dilate : int, optional
+        Half-width in pixels of the square excluded around each detected
+        pixel. Default is 3.
     """
 
     cdef sep_bkg *ptr      # pointer to C struct
@@ -413,27 +776,38 @@ cdef class Background:
 
     @cython.boundscheck(False)
     @cython.wraparound(False)
-    def __cinit__(self, np.ndarray data not None, np.ndarray mask=None,
+    def __cinit__(self, data=None, mask=None,
                   float maskthresh=0.0, int bw=64, int bh=64,
-                  int fw=3, int fh=3, float fthresh=0.0):
+                  int fw=3, int fh=3, float fthresh=0.0, int niter=0,
+                  double nsigma=3.0, int dilate=3):
 
         cdef int status
         cdef sep_image im
 
-        _parse_arrays(data, None, None, mask, None, &im)
+        # no data: wrapping an existing sep_bkg (see background_multiscale)
+        if data is None:
+            return
+
+        arrays = _parse_arrays(data, None, None, mask, None, &im)
         im.maskthresh = maskthresh
-        status = sep_background(&im, bw, bh, fw, fh, fthresh, &self.ptr)
+        if niter > 0:
+            status = sep_background_masked(&im, bw, bh, fw, fh, fthresh,
+                                           nsigma, dilate, niter, &self.ptr)
+        else:
+            status = sep_background(&im, bw, bh, fw, fh, fthresh, &self.ptr)
         _assert_ok(status)
 
-        self.orig_dtype = data.dtype
+        self.orig_dtype = _output_dtype(data)
 
     # Note: all initialization work is done in __cinit__. This is just here
     # for the docstring.
-    def __init__(self, np.ndarray data not None, np.ndarray mask=None,
+    def __init__(self, data not None, mask=None,
                  float maskthresh=0.0, int bw=64, int bh=64,
-                 int fw=3, int fh=3, float fthresh=0.0):
+                 int fw=3, int fh=3, float fthresh=0.0, int niter=0,
+                 double nsigma=3.0, int dilate=3):
         """Background(data, mask=None, maskthresh=0.0, bw=64, bh=64,
-                      fw=3, fh=3, fthresh=0.0)"""
+                      fw=3, fh=3, fthresh=0.0, niter=0, nsigma=3.0,
+                      dilate=3)"""
         pass
 
     property globalback:
@@ -446,6 +820,25 @@ cdef class Background:
         def __get__(self):
             return sep_bkg_globalrms(self.ptr)
 
+    property subsample:
+        """Pixel stride used to measure the background (see
+        `sep.set_background_subsample`)."""
+        def __get__(self):
+            return self.ptr.subsample
+
+    property nsample:
+        """Number of valid pixels used to measure the background."""
+        def __get__(self):
+            return self.ptr.nsample
+
+    property backerr:
+        """Statistical error of the background in each box, as a 2-d array
+        with one element per box (NaN for boxes with too few valid
+        pixels)."""
+        def __get__(self):
+            cdef float[::1] view = <float[:self.ptr.nx * self.ptr.ny]>self.ptr.backerr
+            return np.array(view).reshape(self.ptr.ny, self.ptr.nx)
+
     def back(self, dtype=None, copy=None):
         """back(dtype=None)
 
@@ -546,6 +939,169 @@ cdef class Background:
         status = sep_bkg_subarray(self.ptr, &buf[0, 0], sep_dtype)
         _assert_ok(status)
 
+    def evaluate(self, x, y):
+        """evaluate(x, y)
+
+        Evaluate the background and its RMS at arbitrary positions.
+
+        The same bicubic spline as `back` and `rms` is used, so that at
+        integer positions the results match those arrays (to float
+        precision). Positions outside the image are moved to the nearest
+        pixel of the image, since the spline is not extrapolated, and
+        non-finite positions give NaN. Positions are evaluated in parallel with the number of
+        threads set by `sep.set_nthreads`.
+
+        Parameters
+        ----------
+        x, y : array_like
+            Positions, following the same convention as elsewhere in SEP:
+            ``x, y = (0.0, 0.0)`` is the center of the first element of the
+            image. These inputs obey numpy broadcasting rules.
+
+        Returns
+        -------
+        back, rms : `~numpy.ndarray`
+            Background and background RMS at each position.
+        """
+
+        cdef int status
+        cdef double[::1] xbuf, ybuf, bbuf, rbuf
+
+        dt = np.dtype(np.double)
+        x, y = np.broadcast_arrays(np.asarray(x, dtype=dt),
+                                   np.asarray(y, dtype=dt))
+        shape = x.shape
+        x = np.ascontiguousarray(x).ravel()
+        y = np.ascontiguousarray(y).ravel()
+        back = np.empty(shape, dtype=dt)
+        rms = np.empty(shape, dtype=dt)
+        if x.shape[0] == 0:
+            return back, rms
+
+        xbuf = x
+        ybuf = y
+        bbuf = back.ravel()
+        rbuf = rms.ravel()
+        status = sep_bkg_eval(self.ptr, &xbuf[0], &ybuf[0], x.shape[0],
+                              &bbuf[0], &rbuf[0])
+        _assert_ok(status)
+
+        return back, rms
+
+    def _tile(self, np.int64_t x0, np.int64_t y0, np.int64_t w, np.int64_t h,
+              dtype, bint rms):
+        cdef int status, sep_dtype
+        cdef np.uint8_t[:, :] buf
+
+        if w < 0 or h < 0:
+            raise ValueError("tile dimensions must be non-negative")
+        if dtype is None:
+            dtype = self.orig_dtype
+        else:
+            dtype = np.dtype(dtype)
+        sep_dtype = _get_sep_dtype(dtype)
+
+        result = np.empty((h, w), dtype=dtype)
+        if w == 0 or h == 0:
+            return result
+        buf = result.view(dtype=np.uint8)
+        if rms:
+            status = sep_bkg_rmstile(self.ptr, x0, y0, w, h, &buf[0, 0],
+                                     sep_dtype)
+        else:
+            status = sep_bkg_tile(self.ptr, x0, y0, w, h, &buf[0, 0],
+                                  sep_dtype)
+        _assert_ok(status)
+
+        return result
+
+    def back_tile(self, x0, y0, w, h, dtype=None):
+        """back_tile(x0, y0, w, h, dtype=None)
+
+        Create an array of the background in a rectangular region only.
+
+        Equivalent to ``back()[y0:y0+h, x0:x0+w]``, but only the region is
+        computed. Rows are evaluated in parallel with the number of threads
+        set by `sep.set_nthreads`. ``bkg[y0:y1, x0:x1]`` is a shorthand.
+
+        Parameters
+        ----------
+        x0, y0 : int
+            Position of the first pixel of the region in the original image.
+        w, h : int
+            Width and height of the region. Pixels outside the image take
+            the value of the nearest edge pixel, as in `evaluate`.
+        dtype : `~numpy.dtype`, optional
+             Data type of output array. Default is the dtype of the original
+             data.
+
+        Returns
+        -------
+        back : `~numpy.ndarray`
+            Array of shape ``(h, w)``.
+        """
+        return self._tile(x0, y0, w, h, dtype, False)
+
+    def rms_tile(self, x0, y0, w, h, dtype=None):
+        """rms_tile(x0, y0, w, h, dtype=None)
+
+        Create an array of the background rms in a rectangular region only.
+
+        Equivalent to ``rms()[y0:y0+h, x0:x0+w]``. See `back_tile` for
+        parameters.
+
+        Returns
+        -------
+        rms : `~numpy.ndarray`
+            Array of shape ``(h, w)``.
+        """
+        return self._tile(x0, y0, w, h, dtype, True)
+
+    def subfrom_tile(self, np.ndarray data not None, x0, y0):
+        """subfrom_tile(data, x0, y0)
+
+        Subtract the background from an existing array covering a region.
+
+        Like ``data -= bkg.back()[y0:y0+h, x0:x0+w]``, where ``(h, w)`` is
+        the shape of ``data``, but without computing the background outside
+        the region or making a copy of the data.
+
+        Parameters
+        ----------
+        data : `~numpy.ndarray`
+            Input array, which will be updated in-place.
+        x0, y0 : int
+            Position of the first pixel of ``data`` in the original image.
+        """
+
+        cdef np.int64_t w, h
+        cdef int status, sep_dtype
+        cdef np.uint8_t[:, :] buf
+
+        assert self.ptr is not NULL
+
+        _check_array_get_dims(data, &w, &h)
+        sep_dtype = _get_sep_dtype(data.dtype)
+        if w == 0 or h == 0:
+            return
+        buf = data.view(dtype=np.uint8)
+
+        status = sep_bkg_subtile(self.ptr, x0, y0, w, h, &buf[0, 0],
+                                 sep_dtype)
+        _assert_ok(status)
+
+    def __getitem__(self, key):
+        if not (isinstance(key, tuple) and len(key) == 2 and
+                isinstance(key[0], slice) and isinstance(key[1], slice)):
+            raise TypeError("Background can only be indexed with two slices; "
+                            "use back() for other indexing")
+        y0, y1, ystep = key[0].indices(self.ptr.h)
+        x0, x1, xstep = key[1].indices(self.ptr.w)
+        if xstep != 1 or ystep != 1:
+            raise ValueError("slice steps other than 1 are not supported")
+        return self._tile(x0, y0, max(x1 - x0, 0), max(y1 - y0, 0),
+                          None, False)
+
     def __array__(self, dtype=None, copy=None):
         return self.back(dtype=dtype, copy=copy)
 
@@ -558,6 +1114,214 @@ cdef class Background:
         if self.ptr is not NULL:
             sep_bkg_free(self.ptr)
 
+
+def background_multiscale(data not None, mask=None,
+                          float maskthresh=0.0, int bw=64, int bh=64,
+                          int nscales=3, int fw=3, int fh=3,
+                          float fthresh=0.0):
+    """background_multiscale(data, mask=None, maskthresh=0.0, bw=64, bh=64,
+                             nscales=3, fw=3, fh=3, fthresh=0.0)
+
+    Estimate the background at several mesh sizes in one pass.
+
+    Statistics are gathered once at the finest mesh size; coarser meshes
+    (2x, 4x, ... the size in each dimension) are derived by merging the
+    histograms of the finest meshes, without reading the pixels again.
+    This is useful for choosing ``bw``, ``bh``.
+
+    Parameters
+    ----------
+    data, mask, maskthresh, fw, fh, fthresh
+        As for `Background`.
+    bw, bh : int, optional
+        Size of the finest background boxes in pixels. Default is 64.
+    nscales : int, optional
+        Number of mesh sizes. Default is 3.
+
+    Returns
+    -------
+    bkgs : list of `Background`
+        ``bkgs[i]`` has boxes of size ``(bw * 2**i, bh * 2**i)``.
+        ``bkgs[0]`` is identical to ``Background(data, bw=bw, bh=bh, ...)``;
+        coarser ones agree with `Background` at that box size to within a
+        small fraction of the noise.
+    """
+
+    cdef int i, status
+    cdef sep_image im
+    cdef Background bkg
+
+    if nscales < 1:
+        raise ValueError("nscales must be at least 1")
+
+    ptrs = np.zeros(nscales, dtype=np.uintp)
+    cdef np.uintp_t[:] pbuf = ptrs
+
+    arrays = _parse_arrays(data, None, None, mask, None, &im)
+    im.maskthresh = maskthresh
+    status = sep_background_multiscale(&im, bw, bh, fw, fh, fthresh, nscales,
+                                       <sep_bkg **>&pbuf[0])
+    _assert_ok(status)
+
+    bkgs = []
+    for i in range(nscales):
+        bkg = Background.__new__(Background)
+        bkg.ptr = <sep_bkg *>pbuf[i]
+        bkg.orig_dtype = _output_dtype(data)
+        bkgs.append(bkg)
+    return bkgs
+
+def stats_box(data not None, xmin, xmax, ymin, ymax,
+              mask=None, double maskthresh=0.0):
+    """stats_box(data, xmin, xmax, ymin, ymax, mask=None, maskthresh=0.0)
+
+    Clipped statistics of data in rectangular region(s).
+
+    Each region is treated like a single background mesh in `Background`:
+    its mean and standard deviation are estimated from a histogram of
+    the pixel values after iterative clipping. Regions are processed in
+    parallel (see `set_nthreads`).
+
+    Parameters
+    ----------
+    data : `~numpy.ndarray`
+        2-d array.
+    xmin, xmax, ymin, ymax : array_like
+        Inclusive pixel bounds of region(s). ``x`` corresponds to the
+        second ("fast") axis of the input array. These inputs obey numpy
+        broadcasting rules. Parts of a region outside the array are
+        ignored.
+    mask : `~numpy.ndarray`, optional
+        Mask array. If supplied, a given pixel is masked if its value
+        is greater than ``maskthresh``.
+    maskthresh : float, optional
+        Threshold for a pixel to be masked. Default is ``0.0``.
+
+    Returns
+    -------
+    mean, mode, sigma : `~numpy.ndarray`
+        Clipped mean, mode estimate (``2.5 * median - 1.5 * mean``, or the
+        median if the distribution is strongly skewed) and standard
+        deviation. NaN for regions without valid pixels.
+    npix : `~numpy.ndarray`
+        Number of valid (unmasked, finite) pixels in each region.
+    flags : `~numpy.ndarray`
+        Integer giving flags. (0 if no flags set.)
+    """
+
+    cdef int status
+    cdef sep_image im
+    cdef np.int64_t[::1] x0buf, x1buf, y0buf, y1buf
+
+    arrays = _parse_arrays(data, None, None, mask, None, &im)
+    im.maskthresh = maskthresh
+
+    dt = np.dtype(np.int64)
+    xmin, xmax, ymin, ymax = np.broadcast_arrays(
+        np.asarray(xmin, dtype=dt), np.asarray(xmax, dtype=dt),
+        np.asarray(ymin, dtype=dt), np.asarray(ymax, dtype=dt))
+    shape = xmin.shape
+    xmin, xmax, ymin, ymax = [np.ascontiguousarray(a).ravel()
+                              for a in (xmin, xmax, ymin, ymax)]
+    mean, mode, sigma, npix, flag = _stats_outputs(shape)
+    if xmin.shape[0] == 0:
+        return mean, mode, sigma, npix, flag
+
+    x0buf = xmin
+    x1buf = xmax
+    y0buf = ymin
+    y1buf = ymax
+    status = _stats_call(&im, &x0buf[0], &x1buf[0], &y0buf[0], &y1buf[0],
+                         NULL, NULL, NULL, NULL, xmin.shape[0],
+                         mean, mode, sigma, npix, flag)
+    _assert_ok(status)
+
+    return mean, mode, sigma, npix, flag
+
+
+def stats_circann(data not None, x, y, rin, rout,
+                  mask=None, double maskthresh=0.0):
+    """stats_circann(data, x, y, rin, rout, mask=None, maskthresh=0.0)
+
+    Clipped statistics of data in circular annulus (or annuli).
+
+    As `stats_box`, for the pixels whose centers lie at a distance ``r``
+    from ``(x, y)`` with ``rin <= r < rout``. This is the usual local sky
+    estimate around a source.
+
+    Parameters
+    ----------
+    data : `~numpy.ndarray`
+        2-d array.
+    x, y, rin, rout : array_like
+        Center coordinates and inner and outer radii of annuli. These
+        inputs obey numpy broadcasting rules. Use ``rin = 0`` for a full
+        circle.
+    mask, maskthresh
+        As for `stats_box`.
+
+    Returns
+    -------
+    mean, mode, sigma, npix, flags : `~numpy.ndarray`
+        As for `stats_box`.
+    """
+
+    cdef int status
+    cdef sep_image im
+    cdef double[::1] xbuf, ybuf, rinbuf, routbuf
+
+    arrays = _parse_arrays(data, None, None, mask, None, &im)
+    im.maskthresh = maskthresh
+
+    dt = np.dtype(np.double)
+    x, y, rin, rout = np.broadcast_arrays(
+        np.asarray(x, dtype=dt), np.asarray(y, dtype=dt),
+        np.asarray(rin, dtype=dt), np.asarray(rout, dtype=dt))
+    shape = x.shape
+    x, y, rin, rout = [np.ascontiguousarray(a).ravel()
+                       for a in (x, y, rin, rout)]
+    mean, mode, sigma, npix, flag = _stats_outputs(shape)
+    if x.shape[0] == 0:
+        return mean, mode, sigma, npix, flag
+
+    xbuf = x
+    ybuf = y
+    rinbuf = rin
+    routbuf = rout
+    status = _stats_call(&im, NULL, NULL, NULL, NULL,
+                         &xbuf[0], &ybuf[0], &rinbuf[0], &routbuf[0],
+                         x.shape[0], mean, mode, sigma, npix, flag)
+    _assert_ok(status)
+
+    return mean, mode, sigma, npix, flag
+
+
+def _stats_outputs(shape):
+    dt = np.dtype(np.double)
+    return (np.empty(shape, dtype=dt), np.empty(shape, dtype=dt),
+            np.empty(shape, dtype=dt), np.empty(shape, dtype=np.int64),
+            np.empty(shape, dtype=np.short))
+
+
+cdef int _stats_call(sep_image *im, np.int64_t *xmin, np.int64_t *xmax,
+                     np.int64_t *ymin, np.int64_t *ymax, double *x, double *y,
+                     double *rin, double *rout, np.int64_t n,
+                     np.ndarray mean, np.ndarray mode, np.ndarray sigma,
+                     np.ndarray npix, np.ndarray flag):
+    cdef double[::1] meanbuf = mean.ravel()
+    cdef double[::1] modebuf = mode.ravel()
+    cdef double[::1] sigbuf = sigma.ravel()
+    cdef np.int64_t[::1] npixbuf = npix.ravel()
+    cdef short[::1] flagbuf = flag.ravel()
+
+    if xmin != NULL:
+        return sep_stats_box(im, xmin, xmax, ymin, ymax, n, &meanbuf[0],
+                             &modebuf[0], &sigbuf[0], &npixbuf[0],
+                             &flagbuf[0])
+    return sep_stats_circann(im, x, y, rin, rout, n, &meanbuf[0],
+                             &modebuf[0], &sigbuf[0], &npixbuf[0],
+                             &flagbuf[0])
+
 # -----------------------------------------------------------------------------
 # Source Extraction
 
@@ -598,19 +1362,194 @@ default_kernel = np.array([[1.0, 2.0, 1.0],
                            [2.0, 4.0, 2.0],
                            [1.0, 2.0, 1.0]], dtype=np.float32)
 
+cdef _catalog_array(sep_catalog *catalog):
+    """Copy a C catalog to a structured array (see `extract`)."""
+
+    cdef int i
+    cdef np.ndarray[Object] result
+
+    result = np.empty(catalog.nobj,
+                      dtype=np.dtype([('thresh', np.float64),
+                                      ('npix', np.int64),
+                                      ('tnpix', np.int64),
+                                      ('xmin', np.int64),
+                                      ('xmax', np.int64),
+                                      ('ymin', np.int64),
+                                      ('ymax', np.int64),
+                                      ('x', np.float64),
+                                      ('y', np.float64),
+                                      ('x2', np.float64),
+                                      ('y2', np.float64),
+                                      ('xy', np.float64),
+                                      ('errx2', np.float64),
+                                      ('erry2', np.float64),
+                                      ('errxy', np.float64),
+                                      ('a', np.float64),
+                                      ('b', np.float64),
+                                      ('theta', np.float64),
+                                      ('cxx', np.float64),
+                                      ('cyy', np.float64),
+                                      ('cxy', np.float64),
+                                      ('cflux', np.float64),
+                                      ('flux', np.float64),
+                                      ('cpeak', np.float64),
+                                      ('peak', np.float64),
+                                      ('xcpeak', np.int64),
+                                      ('ycpeak', np.int64),
+                                      ('xpeak', np.int64),
+                                      ('ypeak', np.int64),
+                                      ('flag', np.short)]))
+
+    for i in range(catalog.nobj):
+        result['thresh'][i] = catalog.thresh[i]
+        result['npix'][i] = catalog.npix[i]
+        result['tnpix'][i] = catalog.tnpix[i]
+        result['xmin'][i] = catalog.xmin[i]
+        result['xmax'][i] = catalog.xmax[i]
+        result['ymin'][i] = catalog.ymin[i]
+        result['ymax'][i] = catalog.ymax[i]
+        result['x'][i] = catalog.x[i]
+        result['y'][i] = catalog.y[i]
+        result['x2'][i] = catalog.x2[i]
+        result['y2'][i] = catalog.y2[i]
+        result['xy'][i] = catalog.xy[i]
+        result['errx2'][i] = catalog.errx2[i]
+        result['erry2'][i] = catalog.erry2[i]
+        result['errxy'][i] = catalog.errxy[i]
+        result['a'][i] = catalog.a[i]
+        result['b'][i] = catalog.b[i]
+        result['theta'][i] = catalog.theta[i]
+        result['cxx'][i] = catalog.cxx[i]
+        result['cyy'][i] = catalog.cyy[i]
+        result['cxy'][i] = catalog.cxy[i]
+        result['cflux'][i] = catalog.cflux[i]
+        result['flux'][i] = catalog.flux[i]
+        result['cpeak'][i] = catalog.cpeak[i]
+        result['peak'][i] = catalog.peak[i]
+        result['xcpeak'][i] = catalog.xcpeak[i]
+        result['ycpeak'][i] = catalog.ycpeak[i]
+        result['xpeak'][i] = catalog.xpeak[i]
+        result['ypeak'][i] = catalog.ypeak[i]
+        result['flag'][i] = catalog.flag[i]
+
+    return result
+
+
+cdef _catalog_pixels(sep_catalog *catalog, np.int64_t w):
+    """Copy the pixel lists and values of a C catalog to a structured
+    array (see `extract`)."""
+
+    cdef np.int64_t i, n
+
+    n = 0
+    for i in range(catalog.nobj):
+        n += catalog.npix[i]
+    pixels = np.empty(n, dtype=np.dtype([('x', np.int64), ('y', np.int64),
+                                         ('value', np.float32),
+                                         ('cvalue', np.float32),
+                                         ('var', np.float32)]))
+    if n == 0:
+        return pixels
+
+    # objects' pixels follow each other in the buffers
+    index = np.asarray(<np.int64_t[:n]>catalog.objectspix)
+    pixels['x'] = index % w
+    pixels['y'] = index // w
+    pixels['value'] = np.asarray(<float[:n]>catalog.objectsvalue)
+    pixels['cvalue'] = np.asarray(<float[:n]>catalog.objectscdvalue)
+    if catalog.objectsvar is NULL:
+        pixels['var'] = np.nan
+    else:
+        pixels['var'] = np.asarray(<float[:n]>catalog.objectsvar)
+    return pixels
+
+# C type of each catalog column, in order (see `_catalog_array`)
+_catalog_ctypes = (
+    ('thresh', np.float32), ('npix', np.int64), ('tnpix', np.int64),
+    ('xmin', np.int64), ('xmax', np.int64), ('ymin', np.int64),
+    ('ymax', np.int64), ('x', np.float64), ('y', np.float64),
+    ('x2', np.float64), ('y2', np.float64), ('xy', np.float64),
+    ('errx2', np.float64), ('erry2', np.float64), ('errxy', np.float64),
+    ('a', np.float32), ('b', np.float32), ('theta', np.float32),
+    ('cxx', np.float32), ('cyy', np.float32), ('cxy', np.float32),
+    ('cflux', np.float32), ('flux', np.float32), ('cpeak', np.float32),
+    ('peak', np.float32), ('xcpeak', np.int64), ('ycpeak', np.int64),
+    ('xpeak', np.int64), ('ypeak', np.int64), ('flag', np.short))
+
+cdef list _catalog_view(objects, sep_catalog *catalog):
+    """Point a C catalog (without pixel lists) at the columns of a
+    structured array from `extract`. Returns the column arrays, which must
+    be kept alive while the catalog is used."""
+
+    cdef void **fields[30]
+    fields[:] = [<void **>&catalog.thresh, <void **>&catalog.npix,
+                 <void **>&catalog.tnpix, <void **>&catalog.xmin,
+                 <void **>&catalog.xmax, <void **>&catalog.ymin,
+                 <void **>&catalog.ymax, <void **>&catalog.x,
+                 <void **>&catalog.y, <void **>&catalog.x2,
+                 <void **>&catalog.y2, <void **>&catalog.xy,
+                 <void **>&catalog.errx2, <void **>&catalog.erry2,
+                 <void **>&catalog.errxy, <void **>&catalog.a,
+                 <void **>&catalog.b, <void **>&catalog.theta,
+                 <void **>&catalog.cxx, <void **>&catalog.cyy,
+                 <void **>&catalog.cxy, <void **>&catalog.cflux,
+                 <void **>&catalog.flux, <void **>&catalog.cpeak,
+                 <void **>&catalog.peak, <void **>&catalog.xcpeak,
+                 <void **>&catalog.ycpeak, <void **>&catalog.xpeak,
+                 <void **>&catalog.ypeak, <void **>&catalog.flag]
+    columns = []
+    for i, (name, dt) in enumerate(_catalog_ctypes):
+        col = np.ascontiguousarray(objects[name], dtype=dt)
+        # keep a valid pointer for empty catalogs
+        if len(col) == 0:
+            col = np.zeros(1, dtype=dt)
+        columns.append(col)
+        fields[i][0] = np.PyArray_DATA(col)
+    catalog.nobj = len(objects)
+    catalog.pix = NULL
+    catalog.objectspix = NULL
+    catalog.objectsvalue = NULL
+    catalog.objectscdvalue = NULL
+    catalog.objectsvar = NULL
+    return columns
+
+cdef object _dirty_boxes(dirty, np.int64_t w, np.int64_t h):
+    """Changed boxes as an (n, 4) int64 array of ``xmin, xmax, ymin, ymax``
+    (inclusive), from such an array or from a boolean change mask."""
+
+    dirty = np.asarray(dirty)
+    if dirty.dtype != np.bool_:
+        return np.ascontiguousarray(dirty, dtype=np.int64).reshape(-1, 4)
+    if dirty.shape != (h, w):
+        raise ValueError("dirty mask must have the same shape as data")
+
+    # cover the changed pixels with 32 x 32 tiles
+    ny = (h + 31) // 32
+    nx = (w + 31) // 32
+    tiles = np.zeros((ny * 32, nx * 32), dtype=np.bool_)
+    tiles[:h, :w] = dirty
+    ty, tx = np.nonzero(tiles.reshape(ny, 32, nx, 32).any(axis=(1, 3)))
+    return np.ascontiguousarray(
+        np.column_stack((32 * tx, 32 * tx + 31, 32 * ty, 32 * ty + 31)),
+        dtype=np.int64)
+
 @cython.boundscheck(False)
 @cython.wraparound(False)
-def extract(np.ndarray data not None, float thresh, err=None, var=None,
-            gain=None, np.ndarray mask=None, double maskthresh=0.0,
+def extract(data not None, float thresh, err=None, var=None,
+            gain=None, mask=None, double maskthresh=0.0,
             int minarea=5,
             np.ndarray filter_kernel=default_kernel, filter_type='matched',
             int deblend_nthresh=32, double deblend_cont=0.005,
             bint clean=True, double clean_param=1.0,
-            segmentation_map=None):
+            segmentation_map=None, ref=None,
+            double ref_scale=1.0, ref_noise=None,
+            previous=None, dirty=None, bint pixel_values=False):
     """extract(data, thresh, err=None, mask=None, minarea=5,
                filter_kernel=default_kernel, filter_type='matched',
                deblend_nthresh=32, deblend_cont=0.005, clean=True,
-               clean_param=1.0, segmentation_map=False)
+               clean_param=1.0, segmentation_map=False, ref=None,
+               ref_scale=1.0, ref_noise=None, previous=None, dirty=None,
+               pixel_values=False)
 
     Extract sources from an image.
 
@@ -632,7 +1571,7 @@ def extract(np.ndarray data not None, float thresh, err=None, var=None,
         does not affect detection; it is used only in calculating Poisson
         noise contribution to uncertainty parameters such as ``errx2``. If
         not given, no Poisson noise will be added.
-    mask : `~numpy.ndarray`, optional
+    mask : `~numpy.ndarray` or `BitMask`, optional
         Mask array. ``True`` values, or numeric values greater than
         ``maskthresh``, are considered masked. Masking a pixel is equivalent
         to setting data to zero and noise (if present) to infinity.
@@ -673,6 +1612,38 @@ def extract(np.ndarray data not None, float thresh, err=None, var=None,
         the form of an `~numpy.ndarray`. If this is the case, then the
         object detection stage is skipped, and the objects in the
         segmentation map are analysed and extracted.
+    ref : `~numpy.ndarray`, optional
+        Reference (template) image with the same shape as ``data``. If
+        given, sources are detected and measured on the difference image
+        ``data - ref_scale * ref``, which is formed line-by-line without
+        allocating a full-size temporary array.
+    ref_scale : float, optional
+        Scale applied to ``ref`` before subtraction. Default is 1.0.
+    ref_noise : float or `~numpy.ndarray`, optional
+        Noise of the reference image, in the same form as the image noise
+        (error if ``err`` is given, variance if ``var`` is given). It is
+        scaled by ``ref_scale`` and added in quadrature to the image noise.
+        Ignored if neither ``err`` nor ``var`` is given.
+    previous : `~numpy.ndarray`, optional
+        Objects returned by an earlier call for the same frame, with the
+        same parameters. If given, only the neighbourhood of the pixels
+        changed since (see ``dirty``) is extracted again: objects of
+        ``previous`` far from any change are returned unchanged (first),
+        followed by the objects found around the changes. With
+        ``clean=False`` the objects are those of a full extraction. Cleaning
+        only considers the objects around each change, so a faint object
+        next to a change can be kept or removed where a full extraction
+        would do the opposite. Cannot be combined with
+        ``segmentation_map``.
+    dirty : `~numpy.ndarray`, optional
+        Pixels changed since ``previous`` was extracted, required with
+        ``previous``: either a boolean array with the same shape as
+        ``data``, or an array of shape ``(n, 4)`` giving boxes ``xmin,
+        xmax, ymin, ymax`` (inclusive). Every pixel whose data, error or
+        mask changed must be included.
+    pixel_values : bool, optional
+        If True, also return the member pixels of each object with their
+        values. Cannot be combined with ``previous``. Default is False.
 
     Returns
     -------
@@ -705,6 +1676,15 @@ def extract(np.ndarray data not None, float thresh, err=None, var=None,
         any object have value 0. All pixels belonging to the ``i``-th object
         (e.g., ``objects[i]``) have value ``i+1``. Only returned if
         ``segmentation_map = True | ~numpy.ndarray``.
+
+    pixels : `~numpy.ndarray`, optional
+        Member pixels of all objects (structured array), those of
+        ``objects[i]`` being ``pixels[start[i]:start[i] + objects['npix'][i]]``
+        with ``start = np.cumsum(objects['npix']) - objects['npix']``.
+        Fields are ``x``, ``y`` (int), ``value`` (the data as measured:
+        masked pixels are 0 and ``ref`` is subtracted), ``cvalue`` (the
+        filtered data) and ``var`` (the variance, NaN if there is no
+        error information). Only returned if ``pixel_values = True``.
     """
 
     cdef int kernelw, kernelh, status, i, j
@@ -718,10 +1698,21 @@ def extract(np.ndarray data not None, float thresh, err=None, var=None,
     cdef np.int64_t *objpix
     cdef sep_image im
     cdef np.int64_t[:] idbuf, countbuf
+    cdef sep_catalog prevcat
+    cdef np.int64_t[:] bxmin, bxmax, bymin, bymax
+
+    if previous is not None:
+        if dirty is None:
+            raise ValueError("dirty must be given with previous")
+        if segmentation_map is not None and segmentation_map is not False:
+            raise ValueError("segmentation_map cannot be combined with "
+                             "previous")
+        if pixel_values:
+            raise ValueError("pixel_values cannot be combined with previous")
 
     # parse arrays
     if type(segmentation_map) is np.ndarray:
-        _parse_arrays(data, err, var, mask, segmentation_map, &im)
+        arrays = _parse_arrays(data, err, var, mask, segmentation_map, &im)
 
         ids, counts = np.unique(segmentation_map, return_counts=True)
 
@@ -745,7 +1736,8 @@ def extract(np.ndarray data not None, float thresh, err=None, var=None,
         im.idcounts = <np.int64_t*>&countbuf[0]
         im.numids = len(segids)
     else:
-        _parse_arrays(data, err, var, mask, None, &im)
+        arrays = _parse_arrays(data, err, var, mask, None, &im)
+    refarrays = _parse_ref(ref, ref_scale, ref_noise, &im)
     im.maskthresh = maskthresh
     if gain is not None:
         im.gain = gain
@@ -762,97 +1754,54 @@ def extract(np.ndarray data not None, float thresh, err=None, var=None,
         kernelh = kernelflt.shape[0]
 
     if filter_type == 'matched':
-        filter_typecode = SEP_FILTER_MATCHED
-    elif filter_type == 'conv':
-        filter_typecode = SEP_FILTER_CONV
-    else:
-        raise ValueError("unknown filter_type: {!r}".format(filter_type))
-
-    # If image has error info, the threshold is relative, otherwise
-    # it is absolute.
-    if im.noise_type == SEP_NOISE_NONE:
-        thresh_type = SEP_THRESH_ABS
-    else:
-        thresh_type = SEP_THRESH_REL
-
-    status = sep_extract(&im,
-                         thresh, thresh_type, minarea,
-                         kernelptr, kernelw, kernelh, filter_typecode,
-                         deblend_nthresh, deblend_cont, clean, clean_param,
-                         &catalog)
-    _assert_ok(status)
-
-    # Allocate result record array and fill it
-    result = np.empty(catalog.nobj,
-                      dtype=np.dtype([('thresh', np.float64),
-                                      ('npix', np.int64),
-                                      ('tnpix', np.int64),
-                                      ('xmin', np.int64),
-                                      ('xmax', np.int64),
-                                      ('ymin', np.int64),
-                                      ('ymax', np.int64),
-                                      ('x', np.float64),
-                                      ('y', np.float64),
-                                      ('x2', np.float64),
-                                      ('y2', np.float64),
-                                      ('xy', np.float64),
-                                      ('errx2', np.float64),
-                                      ('erry2', np.float64),
-                                      ('errxy', np.float64),
-                                      ('a', np.float64),
-                                      ('b', np.float64),
-                                      ('theta', np.float64),
-                                      ('cxx', np.float64),
-                                      ('cyy', np.float64),
-                                      ('cxy', np.float64),
-                                      ('cflux', np.float64),
-                                      ('flux', np.float64),
-                                      ('cpeak', np.float64),
-                                      ('peak', np.float64),
-                                      ('xcpeak', np.int64),
-                                      ('ycpeak', np.int64),
-                                      ('xpeak', np.int64),
-                                      ('ypeak', np.int64),
-                                      ('flag', np.short)]))
-
-    for i in range(catalog.nobj):
-        result['thresh'][i] = catalog.thresh[i]
-        result['npix'][i] = catalog.npix[i]
-        result['tnpix'][i] = catalog.tnpix[i]
-        result['xmin'][i] = catalog.xmin[i]
-        result['xmax'][i] = catalog.xmax[i]
-        result['ymin'][i] = catalog.ymin[i]
-        result['ymax'][i] = catalog.ymax[i]
-        result['x'][i] = catalog.x[i]
-        result['y'][i] = catalog.y[i]
-        result['x2'][i] = catalog.x2[i]
-        result['y2'][i] = catalog.y2[i]
-        result['xy'][i] = catalog.xy[i]
-        result['errx2'][i] = catalog.errx2[i]
-        result['erry2'][i] = catalog.erry2[i]
-        result['errxy'][i] = catalog.errxy[i]
-        result['a'][i] = catalog.a[i]
-        result['b'][i] = catalog.b[i]
-        result['theta'][i] = catalog.theta[i]
-        result['cxx'][i] = catalog.cxx[i]
-        result['cyy'][i] = catalog.cyy[i]
-        result['cxy'][i] = catalog.cxy[i]
-        result['cflux'][i] = catalog.cflux[i]
-        result['flux'][i] = catalog.flux[i]
-        result['cpeak'][i] = catalog.cpeak[i]
-        result['peak'][i] = catalog.peak[i]
-        result['xcpeak'][i] = catalog.xcpeak[i]
-        result['ycpeak'][i] = catalog.ycpeak[i]
-        result['xpeak'][i] = catalog.xpeak[i]
-        result['ypeak'][i] = catalog.ypeak[i]
-        result['flag'][i] = catalog.flag[i]
+        filter_typecode = SEP_FILTER_MATCHED
+    elif filter_type == 'conv':
+        filter_typecode = SEP_FILTER_CONV
+    else:
+        raise ValueError("unknown filter_type: {!r}".format(filter_type))
+
+    # If image has error info, the threshold is relative, otherwise
+    # it is absolute.
+    if im.noise_type == SEP_NOISE_NONE:
+        thresh_type = SEP_THRESH_ABS
+    else:
+        thresh_type = SEP_THRESH_REL
+
+    # the setting is per thread, so this does not affect other threads
+    pixvalues = sep_get_extract_pixvalues()
+    if previous is None:
+        sep_set_extract_pixvalues(pixel_values)
+        status = sep_extract(&im,
+                             thresh, thresh_type, minarea,
+                             kernelptr, kernelw, kernelh, filter_typecode,
+                             deblend_nthresh, deblend_cont, clean,
+                             clean_param, &catalog)
+    else:
+        columns = _catalog_view(previous, &prevcat)
+        boxes = _dirty_boxes(dirty, im.w, im.h)
+        if len(boxes) == 0:
+            return np.array(previous)
+        bxmin = np.ascontiguousarray(boxes[:, 0])
+        bxmax = np.ascontiguousarray(boxes[:, 1])
+        bymin = np.ascontiguousarray(boxes[:, 2])
+        bymax = np.ascontiguousarray(boxes[:, 3])
+        sep_set_extract_pixvalues(pixel_values)
+        status = sep_extract_update(&im, &prevcat,
+                                    &bxmin[0], &bxmax[0], &bymin[0],
+                                    &bymax[0], len(boxes),
+                                    thresh, thresh_type, minarea,
+                                    kernelptr, kernelw, kernelh,
+                                    filter_typecode, deblend_nthresh,
+                                    deblend_cont, clean, clean_param,
+                                    &catalog)
+    sep_set_extract_pixvalues(pixvalues)
+    _assert_ok(status)
+
+    result = _catalog_array(catalog)
 
     # construct a segmentation map, if it was requested.
     if type(segmentation_map) is np.ndarray or segmentation_map:
-        # Note: We have to write out `(data.shape[0], data.shape[1])` because
-        # because Cython turns `data.shape` later into an int pointer when
-        # the function argument is typed as np.ndarray.
-        segmap = np.zeros((data.shape[0], data.shape[1]), dtype=np.int32)
+        segmap = np.zeros((im.h, im.w), dtype=np.int32)
         segmap_buf = segmap
         segmap_ptr = &segmap_buf[0, 0]
         for i in range(catalog.nobj):
@@ -860,23 +1809,176 @@ def extract(np.ndarray data not None, float thresh, err=None, var=None,
             for j in range(catalog.npix[i]):
                 segmap_ptr[objpix[j]] = i + 1
 
+    if pixel_values:
+        pixels = _catalog_pixels(catalog, im.w)
+
     # Free the C catalog
     sep_catalog_free(catalog)
 
+    output = (result,)
     if type(segmentation_map) is np.ndarray or segmentation_map:
-        return result, segmap
+        output += (segmap,)
+    if pixel_values:
+        output += (pixels,)
+    return output if len(output) > 1 else result
+
+def pipeline(data not None, float thresh=1.5, err=None, var=None,
+             gain=None, mask=None, double maskthresh=0.0,
+             int bw=64, int bh=64, int fw=3, int fh=3, double fthresh=0.0,
+             int minarea=5, np.ndarray filter_kernel=default_kernel,
+             filter_type='matched', int deblend_nthresh=32,
+             double deblend_cont=0.005, bint clean=True,
+             double clean_param=1.0, bint rmsmap=True, apertures=(),
+             ref=None, double ref_scale=1.0, ref_noise=None):
+    """pipeline(data, thresh=1.5, err=None, var=None, gain=None, mask=None,
+                maskthresh=0.0, bw=64, bh=64, fw=3, fh=3, fthresh=0.0,
+                minarea=5, filter_kernel=default_kernel,
+                filter_type='matched', deblend_nthresh=32,
+                deblend_cont=0.005, clean=True, clean_param=1.0,
+                rmsmap=True, apertures=(), ref=None, ref_scale=1.0,
+                ref_noise=None)
+
+    Measure the background, detect sources and measure aperture fluxes in
+    one call.
+
+    This gives the same result as `Background`, subtracting the background
+    from a copy of ``data``, `extract` and `sum_circle` or `sum_ellipse`
+    for each aperture, but without any full-size copy of the image: the
+    background is subtracted line by line during detection and around each
+    object during photometry.
+
+    Parameters
+    ----------
+    data, err, var, gain, mask, maskthresh, ref, ref_scale, ref_noise
+        As for `extract`. ``data`` is *not* background-subtracted.
+    thresh : float, optional
+        Detection threshold in units of the noise. Default is 1.5.
+    bw, bh, fw, fh, fthresh
+        As for `Background`.
+    minarea, filter_kernel, filter_type, deblend_nthresh, deblend_cont, clean, clean_param
+        As for `extract`.
+    rmsmap : bool, optional
+        If neither ``err`` nor ``var`` is given, the noise is the
+        background rms: its spatially varying map if True (default), or
+        its global value if False.
+    apertures : sequence of tuples, optional
+        Apertures measured on every object: ``('circle', r)`` for a circle
+        of radius ``r``, or ``('ellipse', r)`` for the object's ellipse
+        (``a``, ``b``, ``theta``) scaled by ``r``. A third element sets
+        ``subpix`` (default 5, as for `sum_circle`).
+
+    Returns
+    -------
+    bkg : `Background`
+        The background.
+    objects : `~numpy.ndarray`
+        Extracted objects, as for `extract`.
+    flux, fluxerr : `~numpy.ndarray`
+        Shape ``(len(objects), len(apertures))``: flux and its error in
+        each aperture, NaN for an ellipse that the object does not define.
+    flag : `~numpy.ndarray`
+        Aperture flags (`int16`), with the same shape.
+    """
+
+    cdef int i, naper, status
+    cdef int filter_typecode
+    cdef sep_image im
+    cdef sep_pipeline_config cfg
+    cdef sep_pipeline_result *res = NULL
+    cdef sep_pipeline_aper *apers = NULL
+    cdef float[:, :] kernelflt
+    cdef Background bkg
+
+    arrays = _parse_arrays(data, err, var, mask, None, &im)
+    refarrays = _parse_ref(ref, ref_scale, ref_noise, &im)
+    im.maskthresh = maskthresh
+    if gain is not None:
+        im.gain = gain
+
+    if filter_type == 'matched':
+        filter_typecode = SEP_FILTER_MATCHED
+    elif filter_type == 'conv':
+        filter_typecode = SEP_FILTER_CONV
     else:
-        return result
+        raise ValueError("unknown filter_type: {!r}".format(filter_type))
+
+    cfg.bw = bw
+    cfg.bh = bh
+    cfg.fw = fw
+    cfg.fh = fh
+    cfg.fthresh = fthresh
+    cfg.thresh = thresh
+    cfg.minarea = minarea
+    if filter_kernel is None:
+        cfg.conv = NULL
+        cfg.convw = 0
+        cfg.convh = 0
+    else:
+        kernelflt = filter_kernel.astype(np.float32)
+        cfg.conv = &kernelflt[0, 0]
+        cfg.convw = kernelflt.shape[1]
+        cfg.convh = kernelflt.shape[0]
+    cfg.filter_type = filter_typecode
+    cfg.deblend_nthresh = deblend_nthresh
+    cfg.deblend_cont = deblend_cont
+    cfg.clean_flag = clean
+    cfg.clean_param = clean_param
+    cfg.rmsmap = rmsmap
+
+    naper = len(apertures)
+    apers = <sep_pipeline_aper *>PyMem_Malloc(
+        (naper + 1) * sizeof(sep_pipeline_aper))
+    if apers is NULL:
+        raise MemoryError
+    try:
+        for i in range(naper):
+            aper = apertures[i]
+            if aper[0] == 'circle':
+                apers[i].type = SEP_PIPE_CIRCLE
+            elif aper[0] == 'ellipse':
+                apers[i].type = SEP_PIPE_ELLIPSE
+            else:
+                raise ValueError("unknown aperture type: {!r}".format(aper[0]))
+            apers[i].r = aper[1]
+            apers[i].subpix = aper[2] if len(aper) > 2 else 5
+        cfg.apers = apers
+        cfg.naper = naper
+
+        status = sep_pipeline(&im, &cfg, &res)
+        _assert_ok(status)
+    finally:
+        PyMem_Free(apers)
+
+    try:
+        objects = _catalog_array(res.catalog)
+        nobj = res.catalog.nobj
+        flux = np.empty((nobj, naper), dtype=np.float64)
+        fluxerr = np.empty((nobj, naper), dtype=np.float64)
+        flag = np.empty((nobj, naper), dtype=np.short)
+        if nobj > 0 and naper > 0:
+            flux.ravel()[:] = <double[:nobj * naper]>res.flux
+            fluxerr.ravel()[:] = <double[:nobj * naper]>res.fluxerr
+            flag.ravel()[:] = <short[:nobj * naper]>res.flag
+
+        # the Background takes ownership of the C background
+        bkg = Background.__new__(Background)
+        bkg.ptr = res.bkg
+        bkg.orig_dtype = _output_dtype(data)
+        res.bkg = NULL
+    finally:
+        sep_pipeline_free(res)
+
+    return bkg, objects, flux, fluxerr, flag
 
 # -----------------------------------------------------------------------------
 # Aperture Photometry
 
 @cython.boundscheck(False)
 @cython.wraparound(False)
-def sum_circle(np.ndarray data not None, x, y, r,
-               var=None, err=None, gain=None, np.ndarray mask=None,
+def sum_circle(data not None, x, y, r,
+               var=None, err=None, gain=None, mask=None,
                double maskthresh=0.0,
-               seg_id=None, np.ndarray segmap=None,
+               seg_id=None, segmap=None,
                bkgann=None, int subpix=5):
     """sum_circle(data, x, y, r, err=None, var=None, mask=None, maskthresh=0.0,
                   segmap=None, seg_id=None,
@@ -963,7 +2065,7 @@ def sum_circle(np.ndarray data not None, x, y, r,
     if (segmap is not None) and (seg_id is None):
         raise ValueError('`segmap` supplied but not `seg_id`.')
 
-    _parse_arrays(data, err, var, mask, segmap, &im)
+    arrays = _parse_arrays(data, err, var, mask, segmap, &im)
     im.maskthresh = maskthresh
     if gain is not None:
         im.gain = gain
@@ -1070,9 +2172,9 @@ def sum_circle(np.ndarray data not None, x, y, r,
 
 @cython.boundscheck(False)
 @cython.wraparound(False)
-def sum_circann(np.ndarray data not None, x, y, rin, rout,
-                var=None, err=None, gain=None, np.ndarray mask=None,
-                double maskthresh=0.0, seg_id=None, np.ndarray segmap=None,
+def sum_circann(data not None, x, y, rin, rout,
+                var=None, err=None, gain=None, mask=None,
+                double maskthresh=0.0, seg_id=None, segmap=None,
                 int subpix=5):
     """sum_circann(data, x, y, rin, rout, err=None, var=None, mask=None,
                    maskthresh=0.0, seg_id=None, segmap=None, gain=None,
@@ -1150,7 +2252,7 @@ def sum_circann(np.ndarray data not None, x, y, rin, rout,
     if (segmap is not None) and (seg_id is None):
         raise ValueError('`segmap` supplied but not `seg_id`.')
 
-    _parse_arrays(data, err, var, mask, segmap, &im)
+    arrays = _parse_arrays(data, err, var, mask, segmap, &im)
     im.maskthresh = maskthresh
     if gain is not None:
         im.gain = gain
@@ -1201,10 +2303,10 @@ def sum_circann(np.ndarray data not None, x, y, rin, rout,
     return sum, sumerr, flag
 
 
-def sum_ellipse(np.ndarray data not None, x, y, a, b, theta, r=1.0,
-                var=None, err=None, gain=None, np.ndarray mask=None,
+def sum_ellipse(data not None, x, y, a, b, theta, r=1.0,
+                var=None, err=None, gain=None, mask=None,
                 double maskthresh=0.0,
-                seg_id=None, np.ndarray segmap=None,
+                seg_id=None, segmap=None,
                 bkgann=None, int subpix=5):
     """sum_ellipse(data, x, y, a, b, theta, r, err=None, var=None, mask=None,
                    maskthresh=0.0, seg_id=None, segmap=None, bkgann=None,
@@ -1305,7 +2407,7 @@ def sum_ellipse(np.ndarray data not None, x, y, a, b, theta, r=1.0,
     if (segmap is not None) and (seg_id is None):
         raise ValueError('`segmap` supplied but not `seg_id`.')
 
-    _parse_arrays(data, err, var, mask, segmap, &im)
+    arrays = _parse_arrays(data, err, var, mask, segmap, &im)
     im.maskthresh = maskthresh
     if gain is not None:
         im.gain = gain
@@ -1417,10 +2519,10 @@ def sum_ellipse(np.ndarray data not None, x, y, a, b, theta, r=1.0,
 
 @cython.boundscheck(False)
 @cython.wraparound(False)
-def sum_ellipann(np.ndarray data not None, x, y, a, b, theta, rin, rout,
-                 var=None, err=None, gain=None, np.ndarray mask=None,
+def sum_ellipann(data not None, x, y, a, b, theta, rin, rout,
+                 var=None, err=None, gain=None, mask=None,
                  double maskthresh=0.0,
-                 seg_id=None, np.ndarray segmap=None,
+                 seg_id=None, segmap=None,
                  int subpix=5):
     """sum_ellipann(data, x, y, a, b, theta, rin, rout, err=None, var=None,
                     mask=None, maskthresh=0.0, gain=None, subpix=5)
@@ -1506,7 +2608,7 @@ def sum_ellipann(np.ndarray data not None, x, y, a, b, theta, rin, rout,
     if (segmap is not None) and (seg_id is None):
         raise ValueError('`segmap` supplied but not `seg_id`.')
 
-    _parse_arrays(data, err, var, mask, segmap, &im)
+    arrays = _parse_arrays(data, err, var, mask, segmap, &im)
     im.maskthresh = maskthresh
     if gain is not None:
         im.gain = gain
@@ -1559,11 +2661,145 @@ def sum_ellipann(np.ndarray data not None, x, y, a, b, theta, rin, rout,
 
     return sum, sumerr, flag
 
+
+def sum_psf(data not None, x, y, psf,
+            var=None, err=None, gain=None, mask=None,
+            double maskthresh=0.0, seg_id=None, segmap=None,
+            tilesize=None, int nshift=8):
+    """sum_psf(data, x, y, psf, err=None, var=None, mask=None, maskthresh=0.0,
+               segmap=None, seg_id=None, gain=None, tilesize=None, nshift=8)
+
+    PSF-weighted flux at fixed position(s).
+
+    For each position, the PSF is shifted to the object and normalized to
+    unit sum, and the flux is the inverse-variance weighted linear
+    estimate ``sum(w * psf * data) / sum(w * psf**2)``, with ``w = 1 /
+    var`` (or 1 without ``err`` or ``var``). Shifted PSF stamps are
+    computed once per sub-pixel bin and shared by all objects, which are
+    processed in parallel (see `set_nthreads`).
+
+    Parameters
+    ----------
+    data : `~numpy.ndarray`
+        2-d array to be measured.
+
+    x, y : array_like
+        Center coordinates of object(s), as in `sum_circle`. These inputs
+        obey numpy broadcasting rules.
+
+    psf : `~numpy.ndarray`
+        2-d PSF stamp, centered on pixel ``((h - 1) / 2, (w - 1) / 2)``.
+        If 4-d, of shape ``(ny, nx, h, w)``, a grid of stamps where
+        ``psf[j, i]`` applies to the tile ``j, i`` of the image (see
+        ``tilesize``). The normalization of the stamps is irrelevant.
+
+    err, var : float or `~numpy.ndarray`
+        Error *or* variance (specify at most one).
+
+    mask : `~numpy.ndarray`, optional
+        Mask array. If supplied, a given pixel is masked if its value
+        is greater than ``maskthresh``.
+
+    maskthresh : float, optional
+        Threshold for a pixel to be masked. Default is ``0.0``.
+
+    segmap, seg_id : optional
+        Segmentation image and ids, as in `sum_circle`.
+
+    gain : float, optional
+        Conversion factor between data array units and poisson counts,
+        used in calculating poisson noise in the flux error. If ``None``
+        (default), do not add poisson noise.
+
+    tilesize : tuple, optional
+        ``(th, tw)``, the size in pixels of the image tile covered by each
+        stamp of a 4-d ``psf``. Objects outside the grid use the nearest
+        tile.
+
+    nshift : int, optional
+        Number of sub-pixel shift bins per pixel along each axis. The
+        model PSF is placed within ``0.5 / nshift`` pixels of the
+        requested position. Default is 8.
+
+    Returns
+    -------
+    flux : `~numpy.ndarray`
+        PSF-weighted flux. NaN if no unmasked pixel overlaps the PSF.
+
+    fluxerr : `~numpy.ndarray`
+        Error on the flux.
+
+    flags : `~numpy.ndarray`
+        Integer giving flags. (0 if no flags set.)
+    """
+
+    cdef int status
+    cdef sep_image im
+    cdef sep_psf p
+    cdef double[::1] xbuf, ybuf, fbuf, ebuf
+    cdef double[:, :, :, ::1] pbuf
+    cdef int[::1] idbuf
+    cdef short[::1] flagbuf
+    cdef const int *idptr = NULL
+
+    if (segmap is not None) and (seg_id is None):
+        raise ValueError('`segmap` supplied but not `seg_id`.')
+
+    arrays = _parse_arrays(data, err, var, mask, segmap, &im)
+    im.maskthresh = maskthresh
+    if gain is not None:
+        im.gain = gain
+
+    # PSF stamp(s)
+    psf = np.asarray(psf, dtype=np.double)
+    if psf.ndim == 2:
+        psf = psf[np.newaxis, np.newaxis]
+        p.tw = p.th = 0
+    elif psf.ndim == 4:
+        if tilesize is None:
+            raise ValueError("`tilesize` required for a 4-d `psf`")
+        p.th, p.tw = tilesize
+    else:
+        raise ValueError("psf must be 2-d or 4-d")
+    if min(psf.shape) == 0:
+        raise ValueError("psf must not be empty")
+    pbuf = np.ascontiguousarray(psf)
+    p.data = <void*>&pbuf[0, 0, 0, 0]
+    p.dtype = SEP_TDOUBLE
+    p.ny, p.nx, p.h, p.w = psf.shape
+
+    dt = np.dtype(np.double)
+    x, y = np.broadcast_arrays(np.asarray(x, dtype=dt), np.asarray(y, dtype=dt))
+    shape = x.shape
+    x = np.ascontiguousarray(x, dtype=dt).ravel()
+    y = np.ascontiguousarray(y, dtype=dt).ravel()
+    if seg_id is not None:
+        seg_id = np.ascontiguousarray(
+            np.broadcast_to(np.asarray(seg_id, dtype=np.int32), shape)).ravel()
+
+    flux = np.empty(x.shape[0], dt)
+    fluxerr = np.empty(x.shape[0], dt)
+    flag = np.empty(x.shape[0], np.short)
+    if x.shape[0] > 0:
+        xbuf = x
+        ybuf = y
+        fbuf = flux
+        ebuf = fluxerr
+        flagbuf = flag
+        if seg_id is not None:
+            idbuf = seg_id
+            idptr = &idbuf[0]
+        status = sep_sum_psf(&im, &p, &xbuf[0], &ybuf[0], idptr, x.shape[0],
+                             nshift, &fbuf[0], &ebuf[0], &flagbuf[0])
+        _assert_ok(status)
+
+    return flux.reshape(shape), fluxerr.reshape(shape), flag.reshape(shape)
+
 @cython.boundscheck(False)
 @cython.wraparound(False)
-def flux_radius(np.ndarray data not None, x, y, rmax, frac, normflux=None,
-                np.ndarray mask=None, double maskthresh=0.0,
-                seg_id=None, np.ndarray segmap=None,
+def flux_radius(data not None, x, y, rmax, frac, normflux=None,
+                mask=None, double maskthresh=0.0,
+                seg_id=None, segmap=None,
                 int subpix=5):
     """flux_radius(data, x, y, rmax, frac, normflux=None, mask=None,
                    maskthresh=0.0, subpix=5)
@@ -1654,7 +2890,7 @@ def flux_radius(np.ndarray data not None, x, y, rmax, frac, normflux=None,
     if (segmap is not None) and (seg_id is None):
         raise ValueError('`segmap` supplied but not `seg_id`.')
 
-    _parse_arrays(data, None, None, mask, segmap, &im)
+    arrays = _parse_arrays(data, None, None, mask, segmap, &im)
     im.maskthresh = maskthresh
 
     # Require that inputs are float64 arrays with same shape. See note in
@@ -1810,9 +3046,9 @@ def mask_ellipse(np.ndarray arr not None, x, y, a=None, b=None, theta=None,
                          "cxx, cyy and cxy.")
 
 
-def kron_radius(np.ndarray data not None, x, y, a, b, theta, r,
-                np.ndarray mask=None, double maskthresh=0.0,
-                seg_id=None, np.ndarray segmap=None):
+def kron_radius(data not None, x, y, a, b, theta, r,
+                mask=None, double maskthresh=0.0,
+                seg_id=None, segmap=None):
     """kron_radius(data, x, y, a, b, theta, r, mask=None, maskthresh=0.0, seg_id=None, segmap=None)
 
     Calculate Kron "radius" within an ellipse.
@@ -1891,7 +3127,7 @@ def kron_radius(np.ndarray data not None, x, y, a, b, theta, r,
     if (segmap is not None) and (seg_id is None):
         raise ValueError('`segmap` supplied but not `seg_id`.')
 
-    _parse_arrays(data, None, None, mask, segmap, &im)
+    arrays = _parse_arrays(data, None, None, mask, segmap, &im)
     im.maskthresh = maskthresh
 
     # See note in apercirc on requiring specific array type
@@ -1937,11 +3173,13 @@ def kron_radius(np.ndarray data not None, x, y, a, b, theta, r,
 
     return kr, flag
 
-def winpos(np.ndarray data not None, xinit, yinit, sig,
-           np.ndarray mask=None, double maskthresh=0.0, int subpix=11,
-           double minsig=2.0/2.35*0.5):
+def winpos(data not None, xinit, yinit, sig,
+           mask=None, double maskthresh=0.0, int subpix=11,
+           double minsig=2.0/2.35*0.5, err=None, var=None, gain=None,
+           bint moments=False):
     """winpos(data, xinit, yinit, sig, mask=None, maskthresh=0.0, subpix=11,
-              minsig=2.0/2.35*0.5)
+              minsig=2.0/2.35*0.5, err=None, var=None, gain=None,
+              moments=False)
 
     Calculate more accurate object centroids using 'windowed' algorithm.
 
@@ -1989,54 +3227,89 @@ def winpos(np.ndarray data not None, xinit, yinit, sig,
         Source Extractor uses a minimum half-light radius of 0.5 pixels,
         equivalent to a sigma of 0.5 * 2.0 / 2.35.
 
+    err, var : float or `~numpy.ndarray`, optional
+        Error *or* variance (specify at most one). Only used for the
+        errors returned with ``moments``.
+
+    gain : float, optional
+        Conversion factor between data array units and poisson counts,
+        used to add source Poisson noise to the errors.
+
+    moments : bool, optional
+        If True, also return the windowed second moments, shape and
+        position errors, computed in the same pass over the pixels.
+        Default is False, which skips their computation.
+
     Returns
     -------
     x, y : np.ndarray
         New x and y position(s).
 
+    x2, y2, xy : np.ndarray
+        Windowed second moments (``X2WIN_IMAGE``, ``Y2WIN_IMAGE`` and
+        ``XYWIN_IMAGE`` in Source Extractor). Only returned if
+        ``moments`` is True.
+
+    a, b, theta : np.ndarray
+        Windowed semi-major and semi-minor axes and position angle
+        (``AWIN_IMAGE``, ``BWIN_IMAGE`` and ``THETAWIN_IMAGE``), derived
+        from the moments as in `extract`. Only returned if ``moments`` is
+        True.
+
+    errx2, erry2, errxy : np.ndarray
+        Variances and covariance of the windowed position
+        (``ERRX2WIN_IMAGE`` etc.). Only returned if ``moments`` is True.
+
     flag : np.ndarray
         Flags.
 
     """
 
     cdef int status
-    cdef double cxx, cyy, cxy, sigval
-    cdef int niter = 0  # not currently returned
+    cdef np.int64_t n
     cdef sep_image im
+    cdef const double[::1] xbuf, ybuf, sbuf
+    cdef double[::1] xout, yout, mbuf
+    cdef double *mom[9]
+    cdef short[::1] flagbuf
+    cdef int k
 
-    _parse_arrays(data, None, None, mask, None, &im)
+    arrays = _parse_arrays(data, err, var, mask, None, &im)
     im.maskthresh = maskthresh
+    if gain is not None:
+        im.gain = gain
 
-    # See note in apercirc on requiring specific array type
-    dt = np.dtype(np.double)
-    xinit = np.require(xinit, dtype=dt)
-    yinit = np.require(yinit, dtype=dt)
-    sig = np.require(sig, dtype=dt)
-
-    # allocate output arrays
+    # flat copies of the broadcast inputs; objects are measured in parallel
     shape = np.broadcast(xinit, yinit, sig).shape
-    x = np.empty(shape, np.float64)
-    y = np.empty(shape, np.float64)
-    flag = np.empty(shape, np.short)
-
-    it = np.broadcast(xinit, yinit, sig, x, y, flag)
-    while np.PyArray_MultiIter_NOTDONE(it):
-        sigval = (<double*>np.PyArray_MultiIter_DATA(it, 2))[0]
-        if sigval < minsig:
-            sigval = minsig
-        status = sep_windowed(&im,
-                              (<double*>np.PyArray_MultiIter_DATA(it, 0))[0],
-                              (<double*>np.PyArray_MultiIter_DATA(it, 1))[0],
-                              sigval,
-                              subpix, 0,
-                              <double*>np.PyArray_MultiIter_DATA(it, 3),
-                              <double*>np.PyArray_MultiIter_DATA(it, 4),
-                              &niter,
-                              <short*>np.PyArray_MultiIter_DATA(it, 5))
+    xinit = np.ascontiguousarray(np.broadcast_to(xinit, shape), dtype=np.double)
+    yinit = np.ascontiguousarray(np.broadcast_to(yinit, shape), dtype=np.double)
+    sig = np.maximum(np.broadcast_to(sig, shape).astype(np.double), minsig)
+    n = xinit.size
+
+    # x, y, then x2, y2, xy, a, b, theta, errx2, erry2, errxy if requested
+    outputs = [np.empty(n, np.float64) for _ in range(11 if moments else 2)]
+    flag = np.zeros(n, np.short)
+
+    if n > 0:
+        xbuf = xinit.ravel()
+        ybuf = yinit.ravel()
+        sbuf = np.ascontiguousarray(sig).ravel()
+        xout = outputs[0]
+        yout = outputs[1]
+        for k in range(9):
+            mom[k] = NULL
+            if moments:
+                mbuf = outputs[k + 2]
+                mom[k] = &mbuf[0]
+        flagbuf = flag
+        status = sep_windowed_moments(&im, &xbuf[0], &ybuf[0], &sbuf[0], n,
+                                      subpix, 0, &xout[0], &yout[0], mom[0],
+                                      mom[1], mom[2], mom[3], mom[4], mom[5],
+                                      mom[6], mom[7], mom[8], &flagbuf[0])
         _assert_ok(status)
-        np.PyArray_MultiIter_NEXT(it)
 
-    return x, y, flag
+    outputs = [a.reshape(shape) for a in outputs]
+    return tuple(outputs) + (flag.reshape(shape),)
 
 
 
@@ -2143,6 +3416,371 @@ def ellipse_axes(cxx, cyy, cxy):
 
     return a, b, theta
 
+# -----------------------------------------------------------------------------
+# Catalog utilities
+
+cdef class SpatialIndex:
+    """
+    SpatialIndex(x, y, cellsize=0.0)
+
+    Static spatial index over 2-d positions, such as catalog ``x`` and
+    ``y`` columns, for neighbour and cross-match queries.
+
+    Positions are bucketed into a uniform grid of square cells. Queries
+    are batched and run with the number of threads set by
+    `sep.set_nthreads`.
+
+    Parameters
+    ----------
+    x, y : array_like
+        Positions to index. Non-finite positions are never returned by
+        queries.
+    cellsize : float, optional
+        Width of grid cells. The default (0) chooses a size holding about
+        one position per cell. Cells may be enlarged to bound the grid
+        size.
+    """
+
+    cdef sep_index *ptr
+
+    def __cinit__(self, x, y, double cellsize=0.0):
+        cdef int status
+        cdef double[::1] xbuf, ybuf
+
+        dt = np.dtype(np.double)
+        x = np.ascontiguousarray(x, dtype=dt).ravel()
+        y = np.ascontiguousarray(y, dtype=dt).ravel()
+        if x.shape[0] != y.shape[0]:
+            raise ValueError("x and y must have the same length")
+        xbuf = x
+        ybuf = y
+        status = sep_index_build(&xbuf[0] if x.shape[0] else NULL,
+                                 &ybuf[0] if y.shape[0] else NULL,
+                                 x.shape[0], cellsize, &self.ptr)
+        _assert_ok(status)
+
+    def __init__(self, x, y, double cellsize=0.0):
+        """SpatialIndex(x, y, cellsize=0.0)"""
+        pass
+
+    def __len__(self):
+        return sep_index_size(self.ptr)
+
+    def query_radius(self, x, y, r):
+        """query_radius(x, y, r)
+
+        Find indexed positions within a distance of query positions.
+
+        Parameters
+        ----------
+        x, y, r : array_like
+            Query positions and search radii. Broadcast against each other;
+            the queries are the flattened result. Distances equal to ``r``
+            are included.
+
+        Returns
+        -------
+        indices : `~numpy.ndarray`
+            Indices of matching positions for all queries, concatenated.
+            Within each query, indices are in increasing order.
+        offsets : `~numpy.ndarray`
+            Array of length ``nquery + 1``. The matches of query ``i`` are
+            ``indices[offsets[i]:offsets[i+1]]``.
+        """
+
+        cdef int status
+        cdef np.int64_t n
+        cdef double[::1] xbuf, ybuf, rbuf
+        cdef np.int64_t[::1] cbuf, obuf, ibuf
+
+        dt = np.dtype(np.double)
+        x, y, r = np.broadcast_arrays(np.asarray(x, dtype=dt),
+                                      np.asarray(y, dtype=dt),
+                                      np.asarray(r, dtype=dt))
+        x = np.ascontiguousarray(x).ravel()
+        y = np.ascontiguousarray(y).ravel()
+        r = np.ascontiguousarray(r).ravel()
+        n = x.shape[0]
+
+        counts = np.empty(n, dtype=np.int64)
+        offsets = np.zeros(n + 1, dtype=np.int64)
+        if n == 0:
+            return np.empty(0, dtype=np.int64), offsets
+
+        xbuf = x
+        ybuf = y
+        rbuf = r
+        cbuf = counts
+        status = sep_index_count_radius(self.ptr, &xbuf[0], &ybuf[0],
+                                        &rbuf[0], n, &cbuf[0])
+        _assert_ok(status)
+
+        np.cumsum(counts, out=offsets[1:])
+        indices = np.empty(offsets[n] + 1, dtype=np.int64)
+        obuf = offsets
+        ibuf = indices
+        status = sep_index_query_radius(self.ptr, &xbuf[0], &ybuf[0],
+                                        &rbuf[0], n, &obuf[0], &ibuf[0])
+        _assert_ok(status)
+
+        return indices[:offsets[n]], offsets
+
+    def query_nearest(self, x, y, int k=1):
+        """query_nearest(x, y, k=1)
+
+        Find the nearest indexed positions to query positions.
+
+        Parameters
+        ----------
+        x, y : array_like
+            Query positions, broadcast against each other.
+        k : int, optional
+            Number of neighbours to return per query. Default is 1.
+
+        Returns
+        -------
+        dist : `~numpy.ndarray`
+            Distances to the neighbours, in increasing order, with shape
+            ``broadcast(x, y).shape + (k,)``. Missing neighbours (fewer
+            than ``k`` indexed positions) have infinite distance.
+        indices : `~numpy.ndarray`
+            Indices of the neighbours, with the same shape as ``dist``.
+            Missing neighbours have index -1.
+        """
+
+        cdef int status
+        cdef double[::1] xbuf, ybuf, dbuf
+        cdef np.int64_t[::1] ibuf
+
+        if k < 1:
+            raise ValueError("k must be positive")
+
+        dt = np.dtype(np.double)
+        x, y = np.broadcast_arrays(np.asarray(x, dtype=dt),
+                                   np.asarray(y, dtype=dt))
+        shape = x.shape + (k,)
+        x = np.ascontiguousarray(x).ravel()
+        y = np.ascontiguousarray(y).ravel()
+
+        dist = np.empty(shape, dtype=dt)
+        indices = np.empty(shape, dtype=np.int64)
+        if x.shape[0] == 0:
+            return dist, indices
+
+        xbuf = x
+        ybuf = y
+        dbuf = dist.ravel()
+        ibuf = indices.ravel()
+        status = sep_index_query_nearest(self.ptr, &xbuf[0], &ybuf[0],
+                                         x.shape[0], k, &ibuf[0], &dbuf[0])
+        _assert_ok(status)
+
+        return dist, indices
+
+    def __dealloc__(self):
+        if self.ptr is not NULL:
+            sep_index_free(self.ptr)
+
+def merge_tiles(catalogs, origins, cores, double match_radius=1.0):
+    """merge_tiles(catalogs, origins, cores, match_radius=1.0)
+
+    Merge catalogs extracted from overlapping tiles of a mosaic.
+
+    Each object is owned by the tile whose core region contains its
+    centroid. Duplicates (objects from different tiles closer than
+    ``match_radius``) are resolved in favour of the object lying deepest
+    within its own tile's core, so that objects whose centroids differ
+    slightly across a core boundary are neither duplicated nor lost.
+
+    Parameters
+    ----------
+    catalogs : list of `~numpy.ndarray`
+        Catalogs returned by `sep.extract` for each tile.
+    origins : array_like
+        Shape ``(ntiles, 2)``: mosaic ``x, y`` position of the first pixel
+        of each tile.
+    cores : array_like
+        Shape ``(ntiles, 4)``: core region ``xmin, xmax, ymin, ymax`` of
+        each tile in mosaic coordinates (lower bounds inclusive, upper
+        bounds exclusive). Cores of neighbouring tiles should abut without
+        overlapping.
+    match_radius : float, optional
+        Objects from different tiles within this distance are considered
+        duplicates. If <= 0, objects are kept only if they lie in their own
+        tile's core. Default is 1.0.
+
+    Returns
+    -------
+    catalog : `~numpy.ndarray`
+        Merged catalog, with positions and bounding boxes in mosaic
+        coordinates. Objects are in tile order, then in their order within
+        each tile.
+    """
+
+    cdef int status
+    cdef int i, ntiles
+    cdef sep_tile *tiles
+    cdef double[::1] xbuf, ybuf
+    cdef int[::1] tbuf
+    cdef np.uint8_t[::1] kbuf
+
+    ntiles = len(catalogs)
+    origins = np.asarray(origins, dtype=np.int64).reshape(ntiles, 2)
+    cores = np.asarray(cores, dtype=np.double).reshape(ntiles, 4)
+    if ntiles == 0:
+        raise ValueError("no catalogs to merge")
+
+    lengths = np.array([len(c) for c in catalogs], dtype=np.int64)
+    merged = np.concatenate(catalogs)
+    xoff = np.repeat(origins[:, 0], lengths)
+    yoff = np.repeat(origins[:, 1], lengths)
+    for name in ("x", "xmin", "xmax", "xcpeak", "xpeak"):
+        merged[name] += xoff
+    for name in ("y", "ymin", "ymax", "ycpeak", "ypeak"):
+        merged[name] += yoff
+
+    x = np.ascontiguousarray(merged["x"], dtype=np.double)
+    y = np.ascontiguousarray(merged["y"], dtype=np.double)
+    tile = np.repeat(np.arange(ntiles, dtype=np.intc), lengths)
+    keep = np.zeros(len(merged), dtype=np.uint8)
+    if len(merged) == 0:
+        return merged
+
+    tiles = <sep_tile *>PyMem_Malloc(ntiles * sizeof(sep_tile))
+    if tiles is NULL:
+        raise MemoryError
+    try:
+        for i in range(ntiles):
+            tiles[i].x0 = origins[i, 0]
+            tiles[i].y0 = origins[i, 1]
+            tiles[i].w = 0
+            tiles[i].h = 0
+            tiles[i].cxmin = cores[i, 0]
+            tiles[i].cxmax = cores[i, 1]
+            tiles[i].cymin = cores[i, 2]
+            tiles[i].cymax = cores[i, 3]
+
+        xbuf = x
+        ybuf = y
+        tbuf = tile
+        kbuf = keep
+        status = sep_tile_select(&xbuf[0], &ybuf[0], &tbuf[0], len(merged),
+                                 tiles, match_radius, &kbuf[0])
+        _assert_ok(status)
+    finally:
+        PyMem_Free(tiles)
+
+    return merged[keep.view(np.bool_)]
+
+cdef class CatalogWriter:
+    """
+    CatalogWriter(path, format='fits', rowgroup=0)
+
+    Stream catalogs from `extract` to a FITS binary table or an Arrow IPC
+    file.
+
+    Each call to `write` appends the rows of one catalog, e.g. from one
+    image tile. Rows are buffered by column and written out every
+    ``rowgroup`` rows, as a block of table rows for FITS or as one record
+    batch for Arrow, so memory use does not grow with the catalog size.
+    The columns are those of `extract`, without any pixel lists, in the
+    types of the C catalog: ``thresh``, ``a``, ``b``, ``theta``, ``cxx``,
+    ``cyy``, ``cxy``, ``cflux``, ``flux``, ``cpeak`` and ``peak`` are
+    written as single-precision floats. The file is only complete once the
+    writer is closed, with `close` or at the end of a ``with`` block.
+
+    Parameters
+    ----------
+    path : str or path-like
+        File to create. An existing file is overwritten.
+    format : {'fits', 'arrow'}, optional
+        File format. Default is ``'fits'``.
+    rowgroup : int, optional
+        Rows buffered per write. The default (0) is 65536.
+    """
+
+    cdef sep_catwriter *ptr
+
+    def __cinit__(self, path, format='fits', np.int64_t rowgroup=0):
+        cdef int status, fmt
+        cdef bytes bpath
+
+        if format == 'fits':
+            fmt = SEP_CATFMT_FITS
+        elif format == 'arrow':
+            fmt = SEP_CATFMT_ARROW
+        else:
+            raise ValueError("format must be 'fits' or 'arrow'")
+        if rowgroup < 0:
+            raise ValueError("rowgroup must be non-negative")
+        bpath = os.fsencode(path)
+        status = sep_catwriter_open(bpath, fmt, rowgroup, &self.ptr)
+        _assert_ok(status)
+
+    def __init__(self, path, format='fits', rowgroup=0):
+        """CatalogWriter(path, format='fits', rowgroup=0)"""
+        pass
+
+    def __len__(self):
+        return sep_catwriter_nrows(self.ptr) if self.ptr is not NULL else 0
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, exc_type, exc_value, traceback):
+        self.close()
+
+    cdef _check_open(self):
+        if self.ptr is NULL:
+            raise ValueError("catalog writer is closed")
+
+    def write(self, objects):
+        """write(objects)
+
+        Append the rows of a catalog.
+
+        Parameters
+        ----------
+        objects : `~numpy.ndarray`
+            Structured array with (at least) the fields returned by
+            `extract`. Fields are converted to the written column types if
+            needed.
+        """
+
+        cdef int status
+        cdef sep_catalog catalog
+
+        self._check_open()
+        columns = _catalog_view(objects, &catalog)
+        status = sep_catwriter_write(self.ptr, &catalog)
+        _assert_ok(status)
+
+    def flush(self):
+        """flush()
+
+        Write out any buffered rows now."""
+
+        self._check_open()
+        _assert_ok(sep_catwriter_flush(self.ptr))
+
+    def close(self):
+        """close()
+
+        Write out any buffered rows and finalize the file. Further calls
+        do nothing."""
+
+        cdef int status
+
+        if self.ptr is NULL:
+            return
+        status = sep_catwriter_close(self.ptr)
+        self.ptr = NULL
+        _assert_ok(status)
+
+    def __dealloc__(self):
+        if self.ptr is not NULL:
+            sep_catwriter_close(self.ptr)
+
 # -----------------------------------------------------------------------------
 # Utility functions
 
@@ -2199,3 +3837,128 @@ def get_sub_object_limit():
     Get the limit on the number of sub-objects when deblending in extract().
     """
     return sep_get_sub_object_limit()
+
+def set_background_subsample(int stride):
+    """set_background_subsample(stride)
+
+    Set the pixel stride used to measure the background.
+
+    With a stride n > 1, `Background` reads only one pixel in n along
+    each axis of every box, for roughly n**2 times less work at the cost
+    of roughly n times larger statistical errors (see
+    `Background.backerr`). The current value can be retrieved with
+    get_background_subsample. The initial default is 1 (all pixels).
+    """
+    sep_set_background_subsample(stride)
+
+def get_background_subsample():
+    """get_background_subsample()
+
+    Get the pixel stride used to measure the background.
+    """
+    return sep_get_background_subsample()
+
+def set_overlap_tolerance(double tol):
+    """set_overlap_tolerance(tol)
+
+    Set the accuracy of exact aperture-pixel overlap (``subpix=0``).
+
+    With ``tol > 0``, the area of each pixel inside an aperture is allowed
+    to differ from its exact value by up to ``tol``, which makes
+    ``subpix=0`` somewhat faster for circular apertures. The
+    current value can be retrieved with get_overlap_tolerance. The
+    initial default is 0 (exact).
+    """
+    sep_set_overlap_tolerance(tol)
+
+def get_overlap_tolerance():
+    """get_overlap_tolerance()
+
+    Get the accuracy of exact aperture-pixel overlap.
+    """
+    return sep_get_overlap_tolerance()
+
+_conv_plan_names = {SEP_CONV_AUTO: 'auto', SEP_CONV_DIRECT: 'direct',
+                    SEP_CONV_SEPARABLE: 'separable'}
+_conv_plan_codes = {v: k for k, v in _conv_plan_names.items()}
+
+def set_conv_plan(plan):
+    """set_conv_plan(plan)
+
+    Set how the filter kernel is applied in `extract`.
+
+    A kernel that is the outer product of a row and a column (such as the
+    default kernel) can be applied as two 1-d passes (``'separable'``)
+    instead of one 2-d pass (``'direct'``); the results agree to float
+    rounding. With ``'auto'``, both are timed the first time a kernel size
+    and image width are seen, and the faster is used from then on (see
+    `conv_plan` and `set_tune_cache`); catalogs can then differ slightly
+    from one machine or run to another. Kernels that are not separable are
+    always applied directly. The initial default is ``'direct'``, which
+    gives reproducible results.
+    """
+    if plan not in _conv_plan_codes:
+        raise ValueError("unknown plan: {!r}".format(plan))
+    sep_set_conv_plan(_conv_plan_codes[plan])
+
+def get_conv_plan():
+    """get_conv_plan()
+
+    Get how the filter kernel is applied in `extract`: ``'auto'``,
+    ``'direct'`` or ``'separable'``.
+    """
+    return _conv_plan_names.get(sep_get_conv_plan(), 'auto')
+
+def conv_plan(np.ndarray filter_kernel not None, width):
+    """conv_plan(filter_kernel, width)
+
+    Implementation that `extract` uses for ``filter_kernel`` on an image
+    ``width`` pixels wide: ``'direct'`` or ``'separable'``. With
+    ``'auto'`` (see `set_conv_plan`), this times the candidates if this
+    kernel size and width class have not been seen before.
+    """
+    cdef int status, plan
+    cdef float[:, ::1] kernelflt
+
+    if filter_kernel.ndim != 2 or filter_kernel.size == 0:
+        raise ValueError("filter_kernel must be a non-empty 2-d array")
+    kernelflt = np.ascontiguousarray(filter_kernel, dtype=np.float32)
+    status = sep_conv_plan(&kernelflt[0, 0], kernelflt.shape[1],
+                           kernelflt.shape[0], width, &plan)
+    _assert_ok(status)
+    return _conv_plan_names[plan]
+
+def set_tune_cache(path):
+    """set_tune_cache(path)
+
+    Keep the decisions of ``'auto'`` filter planning (see `set_conv_plan`)
+    in a text file, so that later processes can skip timing: decisions
+    already in the file are loaded now, and new ones are appended. The
+    file is created when needed. ``None`` stops using a file.
+    """
+    cdef bytes bpath
+    if path is None:
+        status = sep_set_tune_cache(NULL)
+    else:
+        bpath = os.fsencode(path)
+        status = sep_set_tune_cache(bpath)
+    _assert_ok(status)
+
+def set_nthreads(int nthreads):
+    """set_nthreads(nthreads)
+
+    Set the number of threads used by batched routines, such as
+    `SpatialIndex` queries and `Background.evaluate`. Values <= 0 select the number of available
+    processors.
+
+    The current value can be retrieved with get_nthreads. The initial
+    default is 1.
+    """
+    sep_set_nthreads(nthreads)
+
+def get_nthreads():
+    """get_nthreads()
+
+    Get the number of threads used by batched routines.
+    """
+    return sep_get_nthreads()
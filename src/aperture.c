@@ -36,6 +36,8 @@
 #define WINPOS_NSIG 4 /* Measurement radius */
 #define WINPOS_STEPMIN 0.0001 /* Minimum change in position for continuing */
 #define WINPOS_FAC 2.0 /* Centroid offset factor (2 for a Gaussian) */
+#define WINPOS_CHUNK 16 /* objects claimed at a time by a thread */
+#define WINPOS_NMOM 9 /* moments, shape and errors from windowed() */
 
 /*
   Adding (void *) pointers is a GNU C extension, not part of standard C.
@@ -48,6 +50,18 @@
 #define MSVC_VOID_CAST
 #endif
 
+/* maximum error in the area of each pixel with exact overlap (subpix = 0);
+ * 0 for exact */
+static _Atomic double overlap_tolerance = 0.0;
+
+void sep_set_overlap_tolerance(double tol) {
+  overlap_tolerance = tol > 0.0 ? tol : 0.0;
+}
+
+double sep_get_overlap_tolerance(void) {
+  return overlap_tolerance;
+}
+
 /****************************************************************************/
 /* conversions between ellipse representations */
 
@@ -198,7 +212,7 @@ static void oversamp_ann_ellipse(double r, double b, double * r_in2, double * r_
   oversamp_ann_circle(r, &r_in2, &r_out2)
 #define APER_BOXEXTENT \
   boxextent(x, y, r, r, im->w, im->h, &xmin, &xmax, &ymin, &ymax, flag)
-#define APER_EXACT circoverlap(dx - 0.5, dy - 0.5, dx + 0.5, dy + 0.5, r)
+#define APER_EXACT circoverlap(dx - 0.5, dy - 0.5, dx + 0.5, dy + 0.5, r, overlaptol)
 #define APER_RPIX2 dx * dx + dy * dy
 #define APER_RPIX2_SUBPIX dx1 * dx1 + dy2
 #define APER_COMPARE1 rpix2 < r_out2
@@ -223,7 +237,9 @@ static void oversamp_ann_ellipse(double r, double b, double * r_in2, double * r_
 
 #define APER_NAME sep_sum_ellipse
 #define APER_ARGS double a, double b, double theta, double r
-#define APER_DECL double cxx, cyy, cxy, r2, r_in2, r_out2
+#define APER_DECL                          \
+  double cxx, cyy, cxy, r2, r_in2, r_out2; \
+  ellipgeom eg
 #define APER_CHECKS                                                               \
   if (!(r >= 0.0 && b >= 0.0 && a >= b && theta >= -PI / 2. && theta <= PI / 2.)) \
   return ILLEGAL_APER_PARAMS
@@ -231,13 +247,12 @@ static void oversamp_ann_ellipse(double r, double b, double * r_in2, double * r_
   r2 = r * r;                                        \
   oversamp_ann_ellipse(r, b, &r_in2, &r_out2);       \
   sep_ellipse_coeffs(a, b, theta, &cxx, &cyy, &cxy); \
-  a *= r;                                            \
-  b *= r
+  ellipgeom_init(a * r, b * r, theta, &eg)
 #define APER_BOXEXTENT                                                       \
   boxextent_ellipse(                                                         \
       x, y, cxx, cyy, cxy, r, im->w, im->h, &xmin, &xmax, &ymin, &ymax, flag \
   )
-#define APER_EXACT ellipoverlap(dx - 0.5, dy - 0.5, dx + 0.5, dy + 0.5, a, b, theta)
+#define APER_EXACT ellipoverlap(dx - 0.5, dy - 0.5, dx + 0.5, dy + 0.5, &eg, overlaptol)
 #define APER_RPIX2 cxx * dx * dx + cyy * dy * dy + cxy * dx * dy
 #define APER_RPIX2_SUBPIX cxx * dx1 * dx1 + cyy * dy2 + cxy * dx1 * dy
 #define APER_COMPARE1 rpix2 < r_out2
@@ -273,9 +288,9 @@ static void oversamp_ann_ellipse(double r, double b, double * r_in2, double * r_
   oversamp_ann_circle(rout, &rout_in2, &rout_out2)
 #define APER_BOXEXTENT \
   boxextent(x, y, rout, rout, im->w, im->h, &xmin, &xmax, &ymin, &ymax, flag)
-#define APER_EXACT                                           \
-  (circoverlap(dx - 0.5, dy - 0.5, dx + 0.5, dy + 0.5, rout) \
-   - circoverlap(dx - 0.5, dy - 0.5, dx + 0.5, dy + 0.5, rin))
+#define APER_EXACT                                                             \
+  (circoverlap(dx - 0.5, dy - 0.5, dx + 0.5, dy + 0.5, rout, 0.5 * overlaptol) \
+   - circoverlap(dx - 0.5, dy - 0.5, dx + 0.5, dy + 0.5, rin, 0.5 * overlaptol))
 #define APER_RPIX2 dx * dx + dy * dy
 #define APER_RPIX2_SUBPIX dx1 * dx1 + dy2
 #define APER_COMPARE1 (rpix2 < rout_out2) && (rpix2 > rin_in2)
@@ -300,9 +315,10 @@ static void oversamp_ann_ellipse(double r, double b, double * r_in2, double * r_
 
 #define APER_NAME sep_sum_ellipann
 #define APER_ARGS double a, double b, double theta, double rin, double rout
-#define APER_DECL       \
-  double cxx, cyy, cxy; \
-  double rin2, rin_in2, rin_out2, rout2, rout_in2, rout_out2
+#define APER_DECL                                             \
+  double cxx, cyy, cxy;                                       \
+  double rin2, rin_in2, rin_out2, rout2, rout_in2, rout_out2; \
+  ellipgeom egin, egout
 #define APER_CHECKS                                                          \
   if (!(rin >= 0.0 && rout >= rin && b >= 0.0 && a >= b && theta >= -PI / 2. \
         && theta <= PI / 2.))                                                \
@@ -312,14 +328,16 @@ static void oversamp_ann_ellipse(double r, double b, double * r_in2, double * r_
   oversamp_ann_ellipse(rin, b, &rin_in2, &rin_out2);    \
   rout2 = rout * rout;                                  \
   oversamp_ann_ellipse(rout, b, &rout_in2, &rout_out2); \
-  sep_ellipse_coeffs(a, b, theta, &cxx, &cyy, &cxy)
+  sep_ellipse_coeffs(a, b, theta, &cxx, &cyy, &cxy);    \
+  ellipgeom_init(a * rin, b * rin, theta, &egin);       \
+  ellipgeom_init(a * rout, b * rout, theta, &egout)
 #define APER_BOXEXTENT                                                          \
   boxextent_ellipse(                                                            \
       x, y, cxx, cyy, cxy, rout, im->w, im->h, &xmin, &xmax, &ymin, &ymax, flag \
   )
-#define APER_EXACT                                                                 \
-  (ellipoverlap(dx - 0.5, dy - 0.5, dx + 0.5, dy + 0.5, a * rout, b * rout, theta) \
-   - ellipoverlap(dx - 0.5, dy - 0.5, dx + 0.5, dy + 0.5, a * rin, b * rin, theta))
+#define APER_EXACT                                                                \
+  (ellipoverlap(dx - 0.5, dy - 0.5, dx + 0.5, dy + 0.5, &egout, 0.5 * overlaptol) \
+   - ellipoverlap(dx - 0.5, dy - 0.5, dx + 0.5, dy + 0.5, &egin, 0.5 * overlaptol))
 #define APER_RPIX2 cxx * dx * dx + cyy * dy * dy + cxy * dx * dy
 #define APER_RPIX2_SUBPIX cxx * dx1 * dx1 + cyy * dy2 + cxy * dx1 * dy
 #define APER_COMPARE1 (rpix2 < rout_out2) && (rpix2 > rin_in2)
@@ -362,11 +380,15 @@ int sep_sum_circann_multi(
 ) {
   PIXTYPE pix, varpix;
   double dx, dy, dx1, dy2, offset, scale, scale2, tmp, rpix2;
-  int64_t ix, iy, xmin, xmax, ymin, ymax, sx, sy, size, esize, msize, ssize, pos;
+  int64_t ix, iy, xmin, xmax, ymin, ymax, sx, sy, size, esize, mrowsize, ssize, pos;
+  int64_t drow, erow, srow;
   int status;
   short errisarray, errisstd;
   const BYTE *datat, *errort, *maskt, *segt;
-  converter convert, econvert, mconvert, sconvert;
+  converter convert, econvert;
+  mask_reader mread;
+  BYTE mflag;
+  id_converter sconvert;
   double rpix, r_out, r_out2, d, prevbinmargin, nextbinmargin, step, stepdens;
   int64_t j, ismasked;
 
@@ -387,7 +409,7 @@ int sep_sum_circann_multi(
   }
 
   /* initializations */
-  size = esize = msize = ssize = 0;
+  size = esize = mrowsize = ssize = 0;
   datat = maskt = segt = NULL;
   errort = im->noise;
   *flag = 0;
@@ -412,10 +434,10 @@ int sep_sum_circann_multi(
   if ((status = get_converter(im->dtype, &convert, &size))) {
     return status;
   }
-  if (im->mask && (status = get_converter(im->mdtype, &mconvert, &msize))) {
+  if (im->mask && (status = get_mask_reader(im->mdtype, im->w, &mread, &mrowsize))) {
     return status;
   }
-  if (im->segmap && (status = get_converter(im->sdtype, &sconvert, &ssize))) {
+  if (im->segmap && (status = get_id_converter(im->sdtype, &sconvert, &ssize))) {
     return status;
   }
 
@@ -433,22 +455,28 @@ int sep_sum_circann_multi(
   }
 
 
+  /* bytes from one row to the next in each array */
+  drow = ROWSTRIDE(im->dstride, im->w * size);
+  erow = ROWSTRIDE(im->nstride, im->w * esize);
+  mrowsize = ROWSTRIDE(im->mstride, mrowsize);
+  srow = ROWSTRIDE(im->sstride, im->w * ssize);
+
   /* get extent of box */
   boxextent(x, y, r_out, r_out, im->w, im->h, &xmin, &xmax, &ymin, &ymax, flag);
 
   /* loop over rows in the box */
   for (iy = ymin; iy < ymax; iy++) {
     /* set pointers to the start of this row */
-    pos = (iy % im->h) * im->w + xmin;
-    datat = MSVC_VOID_CAST im->data + pos * size;
+    pos = iy % im->h;
+    datat = MSVC_VOID_CAST im->data + pos * drow + xmin * size;
     if (errisarray) {
-      errort = MSVC_VOID_CAST im->noise + pos * esize;
+      errort = MSVC_VOID_CAST im->noise + pos * erow + xmin * esize;
     }
     if (im->mask) {
-      maskt = MSVC_VOID_CAST im->mask + pos * msize;
+      maskt = MSVC_VOID_CAST im->mask + pos * mrowsize;
     }
     if (im->segmap) {
-      segt = MSVC_VOID_CAST im->segmap + pos * ssize;
+      segt = MSVC_VOID_CAST im->segmap + pos * srow + xmin * ssize;
     }
 
     /* loop over pixels in this row */
@@ -468,7 +496,8 @@ int sep_sum_circann_multi(
 
         ismasked = 0;
         if (im->mask) {
-          if (mconvert(maskt) > im->maskthresh) {
+          mread(maskt, ix, 1, im->maskthresh, &mflag);
+          if (mflag) {
             *flag |= SEP_APER_HASMASKED;
             ismasked = 1;
           }
@@ -485,7 +514,7 @@ int sep_sum_circann_multi(
         */
         if (im->segmap) {
           if (id > 0) {
-            if ((sconvert(segt) > 0.) && (sconvert(segt) != id)) {
+            if ((sconvert(segt) > 0) && (sconvert(segt) != id)) {
               *flag |= SEP_APER_HASMASKED;
               ismasked = 1;
             }
@@ -540,7 +569,6 @@ int sep_sum_circann_multi(
       if (errisarray) {
         errort += esize;
       }
-      maskt += msize;
       segt += ssize;
     }
   }
@@ -672,31 +700,39 @@ int sep_kron_radius(
 ) {
   float pix;
   double r1, v1, r2, area, rpix2, dx, dy;
-  int64_t ix, iy, xmin, xmax, ymin, ymax, pos, size, msize, ssize;
+  int64_t ix, iy, xmin, xmax, ymin, ymax, pos, size, mrowsize, ssize, drow, srow;
   int status;
   int ismasked;
 
   const BYTE *datat, *maskt, *segt;
-  converter convert, mconvert, sconvert;
+  converter convert;
+  mask_reader mread;
+  BYTE mflag;
+  id_converter sconvert;
 
   r2 = r * r;
   r1 = v1 = 0.0;
   area = 0.0;
   *flag = 0;
   datat = maskt = segt = NULL;
-  size = msize = ssize = 0;
+  size = mrowsize = ssize = 0;
 
   /* get data converter(s) for input array(s) */
   if ((status = get_converter(im->dtype, &convert, &size))) {
     return status;
   }
-  if (im->mask && (status = get_converter(im->mdtype, &mconvert, &msize))) {
+  if (im->mask && (status = get_mask_reader(im->mdtype, im->w, &mread, &mrowsize))) {
     return status;
   }
-  if (im->segmap && (status = get_converter(im->sdtype, &sconvert, &ssize))) {
+  if (im->segmap && (status = get_id_converter(im->sdtype, &sconvert, &ssize))) {
     return status;
   }
 
+  /* bytes from one row to the next in each array */
+  drow = ROWSTRIDE(im->dstride, im->w * size);
+  mrowsize = ROWSTRIDE(im->mstride, mrowsize);
+  srow = ROWSTRIDE(im->sstride, im->w * ssize);
+
   /* get extent of ellipse in x and y */
   boxextent_ellipse(
       x, y, cxx, cyy, cxy, r, im->w, im->h, &xmin, &xmax, &ymin, &ymax, flag
@@ -705,13 +741,13 @@ int sep_kron_radius(
   /* loop over rows in the box */
   for (iy = ymin; iy < ymax; iy++) {
     /* set pointers to the start of this row */
-    pos = (iy % im->h) * im->w + xmin;
-    datat = MSVC_VOID_CAST im->data + pos * size;
+    pos = iy % im->h;
+    datat = MSVC_VOID_CAST im->data + pos * drow + xmin * size;
     if (im->mask) {
-      maskt = MSVC_VOID_CAST im->mask + pos * msize;
+      maskt = MSVC_VOID_CAST im->mask + pos * mrowsize;
     }
     if (im->segmap) {
-      segt = MSVC_VOID_CAST im->segmap + pos * ssize;
+      segt = MSVC_VOID_CAST im->segmap + pos * srow + xmin * ssize;
     }
 
     /* loop over pixels in this row */
@@ -722,7 +758,11 @@ int sep_kron_radius(
       if (rpix2 <= r2) {
         pix = convert(datat);
         ismasked = 0;
-        if ((pix < -BIG) || (im->mask && mconvert(maskt) > im->maskthresh)) {
+        mflag = 0;
+        if (im->mask) {
+          mread(maskt, ix, 1, im->maskthresh, &mflag);
+        }
+        if ((pix < -BIG) || mflag) {
           ismasked = 1;
         }
 
@@ -737,7 +777,7 @@ int sep_kron_radius(
         */
         if (im->segmap) {
           if (id > 0) {
-            if ((sconvert(segt) > 0.) && (sconvert(segt) != id)) {
+            if ((sconvert(segt) > 0) && (sconvert(segt) != id)) {
               ismasked = 1;
             }
           } else {
@@ -758,7 +798,6 @@ int sep_kron_radius(
 
       /* increment pointers by one element */
       datat += size;
-      maskt += msize;
       segt += ssize;
     }
   }
@@ -824,7 +863,13 @@ void sep_set_ellipse(
  *
  */
 
-int sep_windowed(
+/* windowed position of one object, and if `mom` is not NULL its windowed
+ * second moments, shape and position errors: x2, y2, xy, a, b, theta,
+ * errx2, erry2, errxy. The moments are sums over the same pixels and
+ * Gaussian weights as the position, taken about the weighted mean offset
+ * of the last iteration; the errors are the variances of the last position
+ * update. Without `mom` none of this is accumulated. */
+static int windowed(
     const sep_image * im,
     double x,
     double y,
@@ -833,19 +878,25 @@ int sep_windowed(
     short inflag,
     double * xout,
     double * yout,
+    double * mom,
     int * niter,
     short * flag
 ) {
   PIXTYPE pix, varpix;
   double dx, dy, dx1, dy2, offset, scale, scale2, tmp, dxpos, dypos, weight;
   double maskarea, maskweight, maskdxpos, maskdypos;
-  double r, tv, twv, sigtv, totarea, overlap, rpix2, invtwosig2;
-  double wpix;
-  int64_t ix, iy, xmin, xmax, ymin, ymax, sx, sy, pos, size, esize, msize;
-  int i, status;
+  double r, tv, twv, sigtv, totarea, overlap, overlaptol, rpix2, invtwosig2;
+  double wpix, pvar, wvar, mdx, mdy, fac2, det;
+  double mx2, my2, mxy, maskdx2, maskdy2, maskdxy;
+  double esum, edx, edy, edx2, edy2, edxy;
+  int64_t ix, iy, xmin, xmax, ymin, ymax, sx, sy, pos, size, esize, mrowsize;
+  int64_t drow, erow;
+  int i, k, status;
   short errisarray, errisstd;
   const BYTE *datat, *errort, *maskt;
-  converter convert, econvert, mconvert;
+  converter convert, econvert;
+  mask_reader mread;
+  BYTE mflag;
   double r2, r_in2, r_out2;
 
   /* input checks */
@@ -857,7 +908,7 @@ int sep_windowed(
   }
 
   /* initializations */
-  size = esize = msize = 0;
+  size = esize = mrowsize = 0;
   tv = sigtv = 0.0;
   overlap = totarea = maskweight = 0.0;
   datat = maskt = NULL;
@@ -868,9 +919,16 @@ int sep_windowed(
   scale2 = scale * scale;
   offset = 0.5 * (scale - 1.0);
   invtwosig2 = 1.0 / (2.0 * sig * sig);
+  overlaptol = overlap_tolerance;
   errisarray = 0;
   errisstd = 0;
 
+  if (mom) {
+    for (k = 0; k < WINPOS_NMOM; k++) {
+      mom[k] = NAN;
+    }
+  }
+
   /* Integration radius */
   r = WINPOS_NSIG * sig;
 
@@ -882,7 +940,7 @@ int sep_windowed(
   if ((status = get_converter(im->dtype, &convert, &size))) {
     return status;
   }
-  if (im->mask && (status = get_converter(im->mdtype, &mconvert, &msize))) {
+  if (im->mask && (status = get_mask_reader(im->mdtype, im->w, &mread, &mrowsize))) {
     return status;
   }
 
@@ -899,30 +957,33 @@ int sep_windowed(
     }
   }
 
+  /* bytes from one row to the next in each array */
+  drow = ROWSTRIDE(im->dstride, im->w * size);
+  erow = ROWSTRIDE(im->nstride, im->w * esize);
+  mrowsize = ROWSTRIDE(im->mstride, mrowsize);
+
   /* iteration loop */
   for (i = 0; i < WINPOS_NITERMAX; i++) {
     /* get extent of box */
     boxextent(x, y, r, r, im->w, im->h, &xmin, &xmax, &ymin, &ymax, flag);
 
-    /* TODO: initialize values */
-    // mx2ph
-    // my2ph
-    //  esum, emxy, emx2, emy2, mx2, my2, mxy
     tv = twv = sigtv = 0.0;
     overlap = totarea = maskarea = maskweight = 0.0;
     dxpos = dypos = 0.0;
     maskdxpos = maskdypos = 0.0;
+    mx2 = my2 = mxy = maskdx2 = maskdy2 = maskdxy = 0.0;
+    esum = edx = edy = edx2 = edy2 = edxy = 0.0;
 
     /* loop over rows in the box */
     for (iy = ymin; iy < ymax; iy++) {
       /* set pointers to the start of this row */
-      pos = (iy % im->h) * im->w + xmin;
-      datat = MSVC_VOID_CAST im->data + pos * size;
+      pos = iy % im->h;
+      datat = MSVC_VOID_CAST im->data + pos * drow + xmin * size;
       if (errisarray) {
-        errort = MSVC_VOID_CAST im->noise + pos * esize;
+        errort = MSVC_VOID_CAST im->noise + pos * erow + xmin * esize;
       }
       if (im->mask) {
-        maskt = MSVC_VOID_CAST im->mask + pos * msize;
+        maskt = MSVC_VOID_CAST im->mask + pos * mrowsize;
       }
 
       /* loop over pixels in this row */
@@ -933,7 +994,8 @@ int sep_windowed(
         if (rpix2 < r_out2) {
           if (rpix2 > r_in2) /* might be partially in aperture */ {
             if (subpix == 0) {
-              overlap = circoverlap(dx - 0.5, dy - 0.5, dx + 0.5, dy + 0.5, r);
+              overlap =
+                  circoverlap(dx - 0.5, dy - 0.5, dx + 0.5, dy + 0.5, r, overlaptol);
             } else {
               dx += offset;
               dy += offset;
@@ -969,18 +1031,43 @@ int sep_windowed(
           /* weight by gaussian */
           weight = exp(-rpix2 * invtwosig2);
 
-          if (im->mask && (mconvert(maskt) > im->maskthresh)) {
+          mflag = 0;
+          if (im->mask) {
+            mread(maskt, ix, 1, im->maskthresh, &mflag);
+          }
+          if (mflag) {
             *flag |= SEP_APER_HASMASKED;
             maskarea += overlap;
             maskweight += overlap * weight;
             maskdxpos += overlap * weight * dx;
             maskdypos += overlap * weight * dy;
+            if (mom) {
+              maskdx2 += overlap * weight * dx * dx;
+              maskdy2 += overlap * weight * dy * dy;
+              maskdxy += overlap * weight * dx * dy;
+            }
           } else {
             tv += pix * overlap;
             wpix = pix * overlap * weight;
             twv += wpix;
             dxpos += wpix * dx;
             dypos += wpix * dy;
+            if (mom) {
+              mx2 += wpix * dx * dx;
+              my2 += wpix * dy * dy;
+              mxy += wpix * dx * dy;
+              pvar = varpix;
+              if (im->gain > 0.0 && pix > 0.0) {
+                pvar += pix / im->gain;
+              }
+              wvar = pvar * overlap * overlap * weight * weight;
+              esum += wvar;
+              edx += wvar * dx;
+              edy += wvar * dy;
+              edx2 += wvar * dx * dx;
+              edy2 += wvar * dy * dy;
+              edxy += wvar * dx * dy;
+            }
           }
 
           totarea += overlap;
@@ -992,7 +1079,6 @@ int sep_windowed(
         if (errisarray) {
           errort += esize;
         }
-        maskt += msize;
       } /* closes loop over x */
     } /* closes loop over y */
 
@@ -1018,6 +1104,43 @@ int sep_windowed(
         twv += tmp * maskweight;
         dxpos += tmp * maskdxpos;
         dypos += tmp * maskdypos;
+        mx2 += tmp * maskdx2;
+        my2 += tmp * maskdy2;
+        mxy += tmp * maskdxy;
+      }
+    }
+
+    if (mom && twv > 0.0) {
+      mdx = dxpos / twv;
+      mdy = dypos / twv;
+      mom[0] = mx2 / twv - mdx * mdx;
+      mom[1] = my2 / twv - mdy * mdy;
+      mom[2] = mxy / twv - mdx * mdy;
+      fac2 = WINPOS_FAC * WINPOS_FAC / (twv * twv);
+      mom[6] = fac2 * (edx2 - 2.0 * mdx * edx + mdx * mdx * esum);
+      mom[7] = fac2 * (edy2 - 2.0 * mdy * edy + mdy * mdy * esum);
+      mom[8] = fac2 * (edxy - mdx * edy - mdy * edx + mdx * mdy * esum);
+
+      /* handle fully correlated x/y, as in analyse() */
+      if (mom[0] * mom[1] - mom[2] * mom[2] < 0.00694) {
+        mom[0] += 0.0833333;
+        mom[1] += 0.0833333;
+        esum *= 0.08333 * fac2;
+        if (mom[6] * mom[7] - mom[8] * mom[8] < esum * esum) {
+          mom[6] += esum;
+          mom[7] += esum;
+        }
+      }
+
+      /* shape, as in analyse() */
+      tmp = mom[0] - mom[1];
+      mom[5] = fabs(tmp) > 0.0 ? atan2(2.0 * mom[2], tmp) / 2.0 : PI / 4.0;
+      det = sqrt(0.25 * tmp * tmp + mom[2] * mom[2]);
+      mom[3] = sqrt(0.5 * (mom[0] + mom[1]) + det);
+      mom[4] = sqrt(0.5 * (mom[0] + mom[1]) - det);
+    } else if (mom) {
+      for (k = 0; k < WINPOS_NMOM; k++) {
+        mom[k] = NAN;
       }
     }
 
@@ -1043,3 +1166,110 @@ int sep_windowed(
 
   return status;
 }
+
+int sep_windowed(
+    const sep_image * im,
+    double x,
+    double y,
+    double sig,
+    int subpix,
+    short inflag,
+    double * xout,
+    double * yout,
+    int * niter,
+    short * flag
+) {
+  return windowed(im, x, y, sig, subpix, inflag, xout, yout, NULL, niter, flag);
+}
+
+typedef struct {
+  const sep_image * im;
+  const double *x, *y, *sig;
+  int subpix;
+  short inflag;
+  double *xout, *yout;
+  double * mom[WINPOS_NMOM]; /* x2, y2, xy, a, b, theta, errx2, erry2, errxy */
+  int hasmom;
+  short * flag;
+} windowedjob;
+
+static int windowed_task(void * ctx, int64_t start, int64_t end, int thread) {
+  windowedjob * job = ctx;
+  double mom[WINPOS_NMOM];
+  int64_t i;
+  int k, niter, status;
+
+  (void)thread;
+  for (i = start; i < end; i++) {
+    status = windowed(
+        job->im,
+        job->x[i],
+        job->y[i],
+        job->sig[i],
+        job->subpix,
+        job->inflag,
+        job->xout + i,
+        job->yout + i,
+        job->hasmom ? mom : NULL,
+        &niter,
+        job->flag + i
+    );
+    if (status != RETURN_OK) {
+      return status;
+    }
+    for (k = 0; job->hasmom && k < WINPOS_NMOM; k++) {
+      if (job->mom[k]) {
+        job->mom[k][i] = mom[k];
+      }
+    }
+  }
+  return RETURN_OK;
+}
+
+int sep_windowed_moments(
+    const sep_image * im,
+    const double * x,
+    const double * y,
+    const double * sig,
+    int64_t n,
+    int subpix,
+    short inflag,
+    double * xout,
+    double * yout,
+    double * x2,
+    double * y2,
+    double * xy,
+    double * a,
+    double * b,
+    double * theta,
+    double * errx2,
+    double * erry2,
+    double * errxy,
+    short * flag
+) {
+  windowedjob job;
+  int k;
+
+  job.im = im;
+  job.x = x;
+  job.y = y;
+  job.sig = sig;
+  job.subpix = subpix;
+  job.inflag = inflag;
+  job.xout = xout;
+  job.yout = yout;
+  job.mom[0] = x2;
+  job.mom[1] = y2;
+  job.mom[2] = xy;
+  job.mom[3] = a;
+  job.mom[4] = b;
+  job.mom[5] = theta;
+  job.mom[6] = errx2;
+  job.mom[7] = erry2;
+  job.mom[8] = errxy;
+  for (k = job.hasmom = 0; k < WINPOS_NMOM; k++) {
+    job.hasmom |= (job.mom[k] != NULL);
+  }
+  job.flag = flag;
+  return parallel_for(n, WINPOS_CHUNK, windowed_task, &job);
+}
@@ -24,12 +24,16 @@ int APER_NAME(
 ) {
   PIXTYPE pix, varpix;
   double dx, dy, dx1, dy2, offset, scale, scale2, tmp;
-  double tv, sigtv, totarea, maskarea, overlap, rpix2;
-  int64_t ix, iy, xmin, xmax, ymin, ymax, sx, sy, pos, size, esize, msize, ssize;
+  double tv, sigtv, totarea, maskarea, overlap, overlaptol, rpix2;
+  int64_t ix, iy, xmin, xmax, ymin, ymax, sx, sy, pos, size, esize, mrowsize, ssize;
+  int64_t drow, erow, srow;
   int ismasked, status;
+  BYTE mflag;
   short errisarray, errisstd;
   const BYTE *datat, *errort, *maskt, *segt;
-  converter convert, econvert, mconvert, sconvert;
+  converter convert, econvert;
+  mask_reader mread;
+  id_converter sconvert;
   APER_DECL;
 
   /* input checks */
@@ -39,7 +43,7 @@ int APER_NAME(
   }
 
   /* initializations */
-  size = esize = msize = ssize = 0;
+  size = esize = mrowsize = ssize = 0;
   tv = sigtv = 0.0;
   overlap = totarea = maskarea = 0.0;
   datat = maskt = segt = NULL;
@@ -49,6 +53,7 @@ int APER_NAME(
   scale = 1.0 / subpix;
   scale2 = scale * scale;
   offset = 0.5 * (scale - 1.0);
+  overlaptol = overlap_tolerance;
   errisarray = 0;
   errisstd = 0;
 
@@ -58,11 +63,11 @@ int APER_NAME(
   if ((status = get_converter(im->dtype, &convert, &size))) {
     return status;
   }
-  if (im->mask && (status = get_converter(im->mdtype, &mconvert, &msize))) {
+  if (im->mask && (status = get_mask_reader(im->mdtype, im->w, &mread, &mrowsize))) {
     return status;
   }
 
-  if (im->segmap && (status = get_converter(im->sdtype, &sconvert, &ssize))) {
+  if (im->segmap && (status = get_id_converter(im->sdtype, &sconvert, &ssize))) {
     return status;
   }
 
@@ -79,22 +84,28 @@ int APER_NAME(
     }
   }
 
+  /* bytes from one row to the next in each array */
+  drow = ROWSTRIDE(im->dstride, im->w * size);
+  erow = ROWSTRIDE(im->nstride, im->w * esize);
+  mrowsize = ROWSTRIDE(im->mstride, mrowsize);
+  srow = ROWSTRIDE(im->sstride, im->w * ssize);
+
   /* get extent of box */
   APER_BOXEXTENT;
 
   /* loop over rows in the box */
   for (iy = ymin; iy < ymax; iy++) {
     /* set pointers to the start of this row */
-    pos = (iy % im->h) * im->w + xmin;
-    datat = MSVC_VOID_CAST im->data + pos * size;
+    pos = iy % im->h;
+    datat = MSVC_VOID_CAST im->data + pos * drow + xmin * size;
     if (errisarray) {
-      errort = MSVC_VOID_CAST im->noise + pos * esize;
+      errort = MSVC_VOID_CAST im->noise + pos * erow + xmin * esize;
     }
     if (im->mask) {
-      maskt = MSVC_VOID_CAST im->mask + pos * msize;
+      maskt = MSVC_VOID_CAST im->mask + pos * mrowsize;
     }
     if (im->segmap) {
-      segt = MSVC_VOID_CAST im->segmap + pos * ssize;
+      segt = MSVC_VOID_CAST im->segmap + pos * srow + xmin * ssize;
     }
 
     /* loop over pixels in this row */
@@ -136,8 +147,9 @@ int APER_NAME(
         }
 
         ismasked = 0;
-        if (im->mask && (mconvert(maskt) > im->maskthresh)) {
-          ismasked = 1;
+        if (im->mask) {
+          mread(maskt, ix, 1, im->maskthresh, &mflag);
+          ismasked = mflag;
         }
 
         /* Segmentation image:
@@ -151,7 +163,7 @@ int APER_NAME(
         */
         if (im->segmap) {
           if (id > 0) {
-            if ((sconvert(segt) > 0.) && (sconvert(segt) != id)) {
+            if ((sconvert(segt) > 0) && (sconvert(segt) != id)) {
               ismasked = 1;
             }
           } else {
@@ -178,7 +190,6 @@ int APER_NAME(
       if (errisarray) {
         errort += esize;
       }
-      maskt += msize;
       segt += ssize;
     }
   }
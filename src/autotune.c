@@ -0,0 +1,271 @@
+/*%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+ *
+ * This file is part of SEP
+ *
+ * Copyright 2014 SEP developers
+ *
+ * Distributed under an MIT license.
+ *
+ *%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%*/
+
+/* Run-time choice of the detection filter implementation.
+ *
+ * A kernel that is the outer product of a row and a column can be applied
+ * directly or as two 1-d passes. Which is faster depends on the kernel
+ * size and, through cache behaviour, on the line width. The first time a
+ * (kernel width, kernel height, line width class) is seen, both are timed
+ * on a synthetic buffer; the faster one is remembered for the rest of the
+ * process and, if a cache file is set, appended to it so that other
+ * processes can skip the measurement. */
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "extract.h"
+#include "sep.h"
+#include "sepcore.h"
+
+#if defined(_MSC_VER)
+#define TUNE_LOCK()
+#define TUNE_UNLOCK()
+#else
+#include <pthread.h>
+static pthread_mutex_t tunelock = PTHREAD_MUTEX_INITIALIZER;
+#define TUNE_LOCK() pthread_mutex_lock(&tunelock)
+#define TUNE_UNLOCK() pthread_mutex_unlock(&tunelock)
+#endif
+
+#define TUNE_MAXENTRIES 256 /* decisions remembered; oldest are replaced */
+#define TUNE_MINCLASS 6 /* smallest line width class: 2^6 pixels */
+#define TUNE_MAXCLASS 14 /* widest line timed: 2^14 pixels */
+#define TUNE_WORK 2000000 /* multiply-adds per timing */
+#define TUNE_ROUNDS 3 /* timings per candidate; the fastest counts */
+#define TUNE_MAXPATH 4096
+
+typedef struct {
+  int64_t convw, convh;
+  int wclass;
+  int plan;
+} tuneentry;
+
+static tuneentry tunetable[TUNE_MAXENTRIES];
+static int ntune = 0, tunenext = 0;
+static char tunecache[TUNE_MAXPATH] = "";
+static _Atomic int conv_plan_setting = SEP_CONV_DIRECT;
+
+void sep_set_conv_plan(int plan) {
+  conv_plan_setting = plan;
+}
+
+int sep_get_conv_plan(void) {
+  return conv_plan_setting;
+}
+
+static const char * plan_name(int plan) {
+  return plan == SEP_CONV_SEPARABLE ? "separable" : "direct";
+}
+
+/* smallest k >= TUNE_MINCLASS with 2^k >= w */
+static int width_class(int64_t w) {
+  int k;
+
+  for (k = TUNE_MINCLASS; k < 62 && ((int64_t)1 << k) < w; k++) {
+  }
+  return k;
+}
+
+static double tune_clock(void) {
+  struct timespec ts;
+
+  timespec_get(&ts, TIME_UTC);
+  return ts.tv_sec + 1.0e-9 * ts.tv_nsec;
+}
+
+/* remember a decision; the caller holds the lock */
+static void tune_store(int64_t convw, int64_t convh, int wclass, int plan) {
+  int i;
+
+  for (i = 0; i < ntune; i++) {
+    if (tunetable[i].convw == convw && tunetable[i].convh == convh
+        && tunetable[i].wclass == wclass) {
+      tunetable[i].plan = plan;
+      return;
+    }
+  }
+  i = (ntune < TUNE_MAXENTRIES) ? ntune++ : tunenext++ % TUNE_MAXENTRIES;
+  tunetable[i].convw = convw;
+  tunetable[i].convh = convh;
+  tunetable[i].wclass = wclass;
+  tunetable[i].plan = plan;
+}
+
+/* time both implementations on a synthetic buffer of width 2^wclass */
+static int tune_conv(
+    const float * conv,
+    const float * row,
+    const float * col,
+    int64_t convw,
+    int64_t convh,
+    int wclass,
+    int * plan
+) {
+  arraybuffer buf;
+  PIXTYPE *work, *out;
+  double t, tdirect, tsep;
+  int64_t i, n, reps, r;
+  int round;
+  int status = RETURN_OK;
+
+  work = out = NULL;
+  memset(&buf, 0, sizeof(buf));
+  n = (int64_t)1 << (wclass < TUNE_MAXCLASS ? wclass : TUNE_MAXCLASS);
+  buf.dw = buf.bw = n;
+  buf.dh = buf.bh = convh;
+  QMALLOC(buf.bptr, PIXTYPE, n * convh, status);
+  QMALLOC(work, PIXTYPE, n, status);
+  QMALLOC(out, PIXTYPE, n, status);
+  for (i = 0; i < n * convh; i++) {
+    buf.bptr[i] = (PIXTYPE)((i * 2654435761u) % 1000) * 0.001f;
+  }
+
+  reps = TUNE_WORK / (n * convw * convh) + 1;
+  tdirect = tsep = BIG;
+  for (round = 0; round < TUNE_ROUNDS; round++) {
+    t = tune_clock();
+    for (r = 0; r < reps; r++) {
+      convolve(&buf, convh / 2, conv, convw, convh, out);
+    }
+    t = tune_clock() - t;
+    tdirect = t < tdirect ? t : tdirect;
+
+    t = tune_clock();
+    for (r = 0; r < reps; r++) {
+      convolve_separable(&buf, convh / 2, row, col, convw, convh, work, out);
+    }
+    t = tune_clock() - t;
+    tsep = t < tsep ? t : tsep;
+  }
+  *plan = (tsep < tdirect) ? SEP_CONV_SEPARABLE : SEP_CONV_DIRECT;
+
+exit:
+  free(buf.bptr);
+  free(work);
+  free(out);
+  return status;
+}
+
+/* Choose how to apply a separable kernel (row, col) that is applied
+ * directly as conv, to lines w pixels wide. */
+int conv_choose(
+    const float * conv,
+    const float * row,
+    const float * col,
+    int64_t convw,
+    int64_t convh,
+    int64_t w,
+    int * plan
+) {
+  FILE * f;
+  int i, wclass;
+  int status = RETURN_OK;
+
+  *plan = conv_plan_setting;
+  if (*plan == SEP_CONV_DIRECT || *plan == SEP_CONV_SEPARABLE) {
+    return RETURN_OK;
+  }
+
+  wclass = width_class(w);
+  TUNE_LOCK();
+  for (i = 0; i < ntune; i++) {
+    if (tunetable[i].convw == convw && tunetable[i].convh == convh
+        && tunetable[i].wclass == wclass) {
+      *plan = tunetable[i].plan;
+      goto exit;
+    }
+  }
+
+  if ((status = tune_conv(conv, row, col, convw, convh, wclass, plan))) {
+    goto exit;
+  }
+  tune_store(convw, convh, wclass, *plan);
+
+  /* the cache file is only an optimization: failing to write it is not
+   * an error */
+  if (tunecache[0] && (f = fopen(tunecache, "a"))) {
+    fprintf(
+        f, "conv %lld %lld %d %s\n", (long long)convw, (long long)convh, wclass,
+        plan_name(*plan)
+    );
+    fclose(f);
+  }
+
+exit:
+  TUNE_UNLOCK();
+  return status;
+}
+
+int sep_set_tune_cache(const char * path) {
+  FILE * f;
+  char line[128], name[16];
+  long long convw, convh;
+  int wclass;
+  int status = RETURN_OK;
+
+  TUNE_LOCK();
+  tunecache[0] = '\0';
+  if (!path || !path[0]) {
+    goto exit;
+  }
+  if (strlen(path) >= TUNE_MAXPATH) {
+    status = FILE_IO_ERROR;
+    goto exit;
+  }
+  strcpy(tunecache, path);
+
+  /* a missing file is created on the first decision */
+  if (!(f = fopen(path, "r"))) {
+    goto exit;
+  }
+  while (fgets(line, sizeof(line), f)) {
+    if (sscanf(line, "conv %lld %lld %d %15s", &convw, &convh, &wclass, name) == 4
+        && convw > 0 && convh > 0) {
+      if (strcmp(name, "separable") == 0) {
+        tune_store(convw, convh, wclass, SEP_CONV_SEPARABLE);
+      } else if (strcmp(name, "direct") == 0) {
+        tune_store(convw, convh, wclass, SEP_CONV_DIRECT);
+      }
+    }
+  }
+  fclose(f);
+
+exit:
+  TUNE_UNLOCK();
+  return status;
+}
+
+int sep_conv_plan(
+    const float * conv, int64_t convw, int64_t convh, int64_t w, int * plan
+) {
+  float *row, *col;
+  int status = RETURN_OK;
+
+  row = col = NULL;
+  *plan = SEP_CONV_DIRECT;
+  if (convw < 1 || convh < 1) {
+    return RETURN_OK;
+  }
+  QMALLOC(row, float, convw, status);
+  QMALLOC(col, float, convh, status);
+  if (conv_separate(conv, convw, convh, row, col)) {
+    status = conv_choose(conv, row, col, convw, convh, w, plan);
+  }
+
+exit:
+  free(row);
+  free(col);
+  return status;
+}
@@ -33,6 +33,7 @@
 #define QUANTIF_NSIGMA 5 /* histogram limits */
 #define QUANTIF_NMAXLEVELS 4096 /* max nb of quantif. levels */
 #define QUANTIF_AMIN 4 /* min nb of "mode pixels" */
+#define MERGE_NMAXLEVELS 512 /* max nb of levels kept to merge meshes */
 
 /* Background info in a single mesh*/
 typedef struct {
@@ -42,103 +43,233 @@ typedef struct {
   float qzero, qscale; /* Position of histogram */
   float lcut, hcut; /* Histogram cuts */
   int64_t npix; /* Number of pixels involved */
+  int64_t ntot, nvalid; /* Nb of pixels in mesh, and before clipping */
+  double sum, sumsq; /* Moments before clipping */
 } backstruct;
 
+/* Fine mesh statistics kept to derive coarser meshes: the moments before
+ * clipping, and the histogram in cumulative form so that the number, sum
+ * and sum of squares of pixels in any range of values can be read off
+ * directly (see sep_background_multiscale()) */
+typedef struct {
+  int64_t ntot, nvalid; /* Nb of pixels in mesh, and before clipping */
+  double sum, sumsq; /* Moments before clipping */
+  int nlevels; /* Nb of histogram bins (0 if mesh was discarded) */
+  double qzero, qscale; /* Position of histogram */
+  double * cum; /* Sums of 1, i, i^2 over bins < i, 3 * (nlevels + 1) */
+} meshcum;
+
+/* Rows of fine meshes held back to derive coarser meshes */
+typedef struct {
+  int nscales;
+  int64_t nx, ny; /* number of fine meshes in x, y */
+  int64_t group; /* fine rows per row of coarsest meshes */
+  int64_t row0, nrows; /* first held row, number of held rows */
+  meshcum * rows; /* held rows, group * nx */
+  sep_bkg ** bkgs; /* maps at each scale (index 0 is unused here) */
+} bkgpyramid;
+
 /* internal helper functions */
 void backhisto(
     backstruct * backmesh,
     const PIXTYPE * buf,
-    const PIXTYPE * wbuf,
+    const BYTE * wbuf,
     int64_t bufsize,
     int64_t n,
     int64_t w,
-    int64_t bw,
-    PIXTYPE maskthresh
+    int64_t bw
 );
 void backstat(
     backstruct * backmesh,
     const PIXTYPE * buf,
-    const PIXTYPE * wbuf,
+    const BYTE * wbuf,
     int64_t bufsize,
     int64_t n,
     int64_t w,
-    int64_t bw,
-    PIXTYPE maskthresh
+    int64_t bw
 );
 int filterback(sep_bkg * bkg, int64_t fw, int64_t fh, double fthresh);
 float backguess(backstruct * bkg, float * mean, float * sigma);
+static void backquantize(backstruct * bm, double mean, double sigma);
+static int bkgpyramid_addrow(bkgpyramid * pyr, const backstruct * backmesh);
 int makebackspline(const sep_bkg * bkg, float * map, float * dmap);
+int sep_bkg_line_flt(const sep_bkg * bkg, int64_t y, float * line);
+int sep_bkg_rmsline_flt(const sep_bkg * bkg, int64_t y, float * line);
+static int bkg_exclude_strip(
+    const sep_image * image,
+    array_converter convert,
+    int64_t elsize,
+    const sep_bkg * prev,
+    double nsigma,
+    int64_t dilate,
+    int64_t y0,
+    int64_t h,
+    const BYTE * mask,
+    BYTE * out
+);
+static int64_t bkg_gather(
+    const BYTE * strip,
+    array_converter convert,
+    int64_t rowsize,
+    int64_t w,
+    int64_t h,
+    int64_t bw,
+    int64_t sub,
+    int64_t ox,
+    int64_t oy,
+    PIXTYPE * row,
+    PIXTYPE * out
+);
+static void bkg_gather_mask(
+    const BYTE * strip,
+    mask_reader read,
+    int64_t rowsize,
+    double thresh,
+    int64_t w,
+    int64_t h,
+    int64_t bw,
+    int64_t sub,
+    int64_t ox,
+    int64_t oy,
+    BYTE * row,
+    BYTE * out
+);
 
+static _Atomic int background_subsample = 1;
 
-int sep_background(
+void sep_set_background_subsample(int val) {
+  background_subsample = val > 1 ? val : 1;
+}
+
+int sep_get_background_subsample(void) {
+  return background_subsample;
+}
+
+/* allocate a background map (without contents) */
+static int bkg_alloc(int64_t w, int64_t h, int64_t bw, int64_t bh, sep_bkg ** bkg) {
+  sep_bkg * bkgout;
+  int64_t nx, ny, nb;
+  int status = RETURN_OK;
+
+  bkgout = NULL;
+
+  /* determine number of background boxes */
+  if ((nx = (w - 1) / bw + 1) < 1) {
+    nx = 1;
+  }
+  if ((ny = (h - 1) / bh + 1) < 1) {
+    ny = 1;
+  }
+  nb = nx * ny;
+
+  QMALLOC(bkgout, sep_bkg, 1, status);
+  bkgout->w = w;
+  bkgout->h = h;
+  bkgout->nx = nx;
+  bkgout->ny = ny;
+  bkgout->n = nb;
+  bkgout->bw = bw;
+  bkgout->bh = bh;
+  bkgout->back = NULL;
+  bkgout->sigma = NULL;
+  bkgout->dback = NULL;
+  bkgout->dsigma = NULL;
+  bkgout->subsample = 1;
+  bkgout->nsample = 0;
+  bkgout->backerr = NULL;
+  QMALLOC(bkgout->back, float, nb, status);
+  QMALLOC(bkgout->sigma, float, nb, status);
+  QMALLOC(bkgout->dback, float, nb, status);
+  QMALLOC(bkgout->dsigma, float, nb, status);
+  QMALLOC(bkgout->backerr, float, nb, status);
+
+  *bkg = bkgout;
+  return status;
+
+exit:
+  sep_bkg_free(bkgout);
+  *bkg = NULL;
+  return status;
+}
+
+/* filter the mesh values of a background map and compute its splines */
+static int bkg_finish(sep_bkg * bkg, int64_t fw, int64_t fh, double fthresh) {
+  int status;
+
+  /* Median-filter and check suitability of the background map */
+  if ((status = filterback(bkg, fw, fh, fthresh)) != RETURN_OK) {
+    return status;
+  }
+
+  /* Compute 2nd derivatives along the y-direction */
+  if ((status = makebackspline(bkg, bkg->back, bkg->dback)) != RETURN_OK) {
+    return status;
+  }
+  return makebackspline(bkg, bkg->sigma, bkg->dsigma);
+}
+
+/* Estimate the background. If `prev` is given, pixels near sources
+ * detected above it (see bkg_exclude_strip()) are excluded from the mesh
+ * statistics, in addition to masked pixels. If `pyr` is given, each row of
+ * meshes (with its histograms) is passed on to it. */
+static int bkg_estimate(
     const sep_image * image,
     int64_t bw,
     int64_t bh,
     int64_t fw,
     int64_t fh,
     double fthresh,
+    const sep_bkg * prev,
+    double nsigma,
+    int64_t dilate,
+    bkgpyramid * pyr,
     sep_bkg ** bkg
 ) {
   const BYTE *imt, *maskt;
   int64_t npix; /* size of image */
-  int64_t nx, ny, nb; /* number of background boxes in x, y, total */
+  int64_t nx, ny; /* number of background boxes in x, y */
   int64_t bufsize; /* size of a "row" of boxes in pixels (w*bh) */
   int64_t elsize; /* size (in bytes) of an image array element */
-  int64_t melsize; /* size (in bytes) of a mask array element */
-  PIXTYPE *buf, *mbuf;
-  const PIXTYPE *buft, *mbuft;
-  PIXTYPE maskthresh;
-  array_converter convert, mconvert;
+  int64_t drow; /* bytes from one image row to the next */
+  int64_t mrowsize; /* size (in bytes) of a mask array row */
+  PIXTYPE *buf, *sbuf, *rowbuf;
+  BYTE *mbuf, *xbuf, *swbuf, *mrowbuf;
+  const PIXTYPE * buft;
+  const BYTE *mbuft, *wbuft;
+  array_converter convert;
+  mask_reader mread, fread;
   backstruct *backmesh, *bm; /* info about each background "box" */
   sep_bkg * bkgout; /* output */
-  int64_t j, k, m;
+  int64_t j, k, m, sub, ox, oy, lim, sw, sbw, sbufsize, fsize;
+  uint64_t hash;
   int status;
 
   status = RETURN_OK;
   npix = image->w * image->h;
   bufsize = image->w * bh;
-  maskthresh = image->maskthresh;
-  if (image->mask == NULL) {
-    maskthresh = 0.0;
-  }
 
   backmesh = bm = NULL;
   bkgout = NULL;
-  buf = mbuf = NULL;
-  buft = mbuft = NULL;
-  convert = mconvert = NULL;
+  buf = sbuf = rowbuf = NULL;
+  mbuf = xbuf = swbuf = mrowbuf = NULL;
+  sub = sep_get_background_subsample();
+  buft = NULL;
+  mbuft = NULL;
+  convert = NULL;
+  mread = fread = NULL;
 
-  /* determine number of background boxes */
-  if ((nx = (image->w - 1) / bw + 1) < 1) {
-    nx = 1;
-  }
-  if ((ny = (image->h - 1) / bh + 1) < 1) {
-    ny = 1;
+  /* Allocate the returned struct */
+  if ((status = bkg_alloc(image->w, image->h, bw, bh, &bkgout)) != RETURN_OK) {
+    goto exit;
   }
-  nb = nx * ny;
+  nx = bkgout->nx;
+  ny = bkgout->ny;
+  bkgout->subsample = sub;
 
   /* Allocate temp memory & initialize */
   QCALLOC(backmesh, backstruct, nx, status);
   bm = backmesh;
 
-  /* Allocate the returned struct */
-  QMALLOC(bkgout, sep_bkg, 1, status);
-  bkgout->w = image->w;
-  bkgout->h = image->h;
-  bkgout->nx = nx;
-  bkgout->ny = ny;
-  bkgout->n = nb;
-  bkgout->bw = bw;
-  bkgout->bh = bh;
-  bkgout->back = NULL;
-  bkgout->sigma = NULL;
-  bkgout->dback = NULL;
-  bkgout->dsigma = NULL;
-  QMALLOC(bkgout->back, float, nb, status);
-  QMALLOC(bkgout->sigma, float, nb, status);
-  QMALLOC(bkgout->dback, float, nb, status);
-  QMALLOC(bkgout->dsigma, float, nb, status);
-
   /* cast input array pointers. These are used to step through the arrays. */
   imt = (const BYTE *)image->data;
   maskt = (const BYTE *)image->mask;
@@ -148,26 +279,39 @@ int sep_background(
   if (status != RETURN_OK) {
     goto exit;
   }
+  drow = ROWSTRIDE(image->dstride, image->w * elsize);
   if (image->mask) {
-    status = get_array_converter(image->mdtype, &mconvert, &melsize);
+    status = get_mask_reader(image->mdtype, image->w, &mread, &mrowsize);
     if (status != RETURN_OK) {
       goto exit;
     }
+    mrowsize = ROWSTRIDE(image->mstride, mrowsize);
   }
 
-  /* If the input array type is not PIXTYPE, allocate a buffer to hold
-     converted values */
-  if (image->dtype != PIXDTYPE) {
+  /* If the input array type is not PIXTYPE, or its rows are not
+     contiguous, allocate a buffer to hold converted values */
+  if (image->dtype != PIXDTYPE || drow != image->w * elsize) {
     QMALLOC(buf, PIXTYPE, bufsize, status);
     buft = buf;
     if (status != RETURN_OK) {
       goto exit;
     }
   }
-  if (image->mask && (image->mdtype != PIXDTYPE)) {
-    QMALLOC(mbuf, PIXTYPE, bufsize, status);
+  /* masked pixels (and pixels excluded around sources) are flagged with
+   * one byte per pixel */
+  if (image->mask) {
+    QMALLOC(mbuf, BYTE, bufsize, status);
     mbuft = mbuf;
-    if (status != RETURN_OK) {
+  }
+  if (prev) {
+    QMALLOC(xbuf, BYTE, bufsize, status);
+  }
+  if (sub > 1) {
+    QMALLOC(sbuf, PIXTYPE, bufsize, status);
+    QMALLOC(swbuf, BYTE, bufsize, status);
+    QMALLOC(rowbuf, PIXTYPE, image->w, status);
+    QMALLOC(mrowbuf, BYTE, image->w, status);
+    if ((status = get_mask_reader(SEP_TBYTE, image->w, &fread, &fsize)) != RETURN_OK) {
       goto exit;
     }
   }
@@ -185,23 +329,83 @@ int sep_background(
       bufsize = npix % bufsize;
     }
 
-    /* convert this row to PIXTYPE and store in buffer(s)*/
-    if (image->dtype != PIXDTYPE) {
-      convert(imt, bufsize, buf);
+    /* convert this row to PIXTYPE and store in buffer(s). When
+     * subsampling, only the sampled rows are converted (below). */
+    if (sub > 1) {
+      buft = NULL;
+    } else if (image->dtype != PIXDTYPE || drow != image->w * elsize) {
+      for (k = 0; k < bufsize / image->w; k++) {
+        convert(imt + k * drow, image->w, buf + k * image->w);
+      }
+      buft = buf;
     } else {
       buft = (const PIXTYPE *)imt;
     }
 
-    if (image->mask) {
-      if (image->mdtype != PIXDTYPE) {
-        mconvert(maskt, bufsize, mbuf);
-      } else {
-        mbuft = (const PIXTYPE *)maskt;
+    if (image->mask && (sub == 1 || prev)) {
+      for (k = 0; k < bufsize / image->w; k++) {
+        mread(
+            maskt + k * mrowsize, 0, image->w, image->maskthresh, mbuf + k * image->w
+        );
       }
     }
 
+    /* combine the mask with the pixels excluded around sources */
+    wbuft = mbuft;
+    if (prev) {
+      status = bkg_exclude_strip(
+          image,
+          convert,
+          elsize,
+          prev,
+          nsigma,
+          dilate,
+          j * bh,
+          bufsize / image->w,
+          image->mask ? mbuft : NULL,
+          xbuf
+      );
+      if (status != RETURN_OK) {
+        goto exit;
+      }
+      wbuft = xbuf;
+    }
+
+    /* take every sub-th pixel in x and y within each mesh, from a
+     * lattice whose offset varies between rows of meshes */
+    sw = image->w;
+    sbw = bw;
+    sbufsize = bufsize;
+    if (sub > 1) {
+      hash = (uint64_t)(j + 1) * 0x9E3779B97F4A7C15ull;
+      lim = image->w - (nx - 1) * bw; /* width of the last mesh */
+      lim = lim < sub ? lim : sub;
+      ox = (int64_t)((hash >> 32) % (uint64_t)lim);
+      lim = bufsize / image->w < sub ? bufsize / image->w : sub;
+      oy = (int64_t)((hash >> 16 & 0xffff) % (uint64_t)lim);
+
+      sw = bkg_gather(
+          imt, convert, drow, image->w, bufsize / image->w, bw, sub, ox, oy, rowbuf, sbuf
+      );
+      if (prev) {
+        bkg_gather_mask(
+            xbuf, fread, fsize, 0.0, image->w, bufsize / image->w, bw, sub, ox, oy,
+            mrowbuf, swbuf
+        );
+      } else if (image->mask) {
+        bkg_gather_mask(
+            maskt, mread, mrowsize, image->maskthresh, image->w, bufsize / image->w, bw,
+            sub, ox, oy, mrowbuf, swbuf
+        );
+      }
+      buft = sbuf;
+      wbuft = (prev || image->mask) ? swbuf : NULL;
+      sbw = (bw - ox - 1) / sub + 1;
+      sbufsize = sw * ((bufsize / image->w - oy - 1) / sub + 1);
+    }
+
     /* Get clipped mean, sigma for all boxes in the row */
-    backstat(backmesh, buft, mbuft, bufsize, nx, image->w, bw, maskthresh);
+    backstat(backmesh, buft, wbuft, sbufsize, nx, sw, sbw);
 
     /* Allocate histograms in each box in this row. */
     bm = backmesh;
@@ -212,21 +416,30 @@ int sep_background(
         QCALLOC(bm->histo, int64_t, bm->nlevels, status);
       }
     }
-    backhisto(backmesh, buft, mbuft, bufsize, nx, image->w, bw, maskthresh);
+    backhisto(backmesh, buft, wbuft, sbufsize, nx, sw, sbw);
 
     /* Compute background statistics from the histograms */
     bm = backmesh;
     for (m = 0; m < nx; m++, bm++) {
       k = m + nx * j;
       backguess(bm, bkgout->back + k, bkgout->sigma + k);
+      bkgout->nsample += bm->nvalid;
+      bkgout->backerr[k] = (bm->mean > -BIG && bm->npix > 0)
+                               ? bkgout->sigma[k] / sqrt((double)bm->npix)
+                               : NAN;
+    }
+    if (pyr && (status = bkgpyramid_addrow(pyr, backmesh)) != RETURN_OK) {
+      goto exit;
+    }
+    for (m = 0, bm = backmesh; m < nx; m++, bm++) {
       free(bm->histo);
       bm->histo = NULL;
     }
 
     /* increment array pointers to next row of background boxes */
-    imt += elsize * bufsize;
+    imt += drow * bh;
     if (image->mask) {
-      maskt += melsize * bufsize;
+      maskt += mrowsize * bh;
     }
   }
 
@@ -235,19 +448,20 @@ int sep_background(
   buf = NULL;
   free(mbuf);
   mbuf = NULL;
+  free(xbuf);
+  xbuf = NULL;
+  free(sbuf);
+  sbuf = NULL;
+  free(swbuf);
+  swbuf = NULL;
+  free(rowbuf);
+  rowbuf = NULL;
+  free(mrowbuf);
+  mrowbuf = NULL;
   free(backmesh);
   backmesh = NULL;
 
-  /* Median-filter and check suitability of the background map */
-  if ((status = filterback(bkgout, fw, fh, fthresh)) != RETURN_OK) {
-    goto exit;
-  }
-
-  /* Compute 2nd derivatives along the y-direction */
-  if ((status = makebackspline(bkgout, bkgout->back, bkgout->dback)) != RETURN_OK) {
-    goto exit;
-  }
-  if ((status = makebackspline(bkgout, bkgout->sigma, bkgout->dsigma)) != RETURN_OK) {
+  if ((status = bkg_finish(bkgout, fw, fh, fthresh)) != RETURN_OK) {
     goto exit;
   }
 
@@ -258,6 +472,11 @@ int sep_background(
 exit:
   free(buf);
   free(mbuf);
+  free(xbuf);
+  free(sbuf);
+  free(swbuf);
+  free(rowbuf);
+  free(mrowbuf);
   if (backmesh) {
     bm = backmesh;
     for (m = 0; m < nx; m++, bm++) {
@@ -270,6 +489,540 @@ exit:
   return status;
 }
 
+int sep_background(
+    const sep_image * image,
+    int64_t bw,
+    int64_t bh,
+    int64_t fw,
+    int64_t fh,
+    double fthresh,
+    sep_bkg ** bkg
+) {
+  return bkg_estimate(image, bw, bh, fw, fh, fthresh, NULL, 0.0, 0, NULL, bkg);
+}
+
+int sep_background_masked(
+    const sep_image * image,
+    int64_t bw,
+    int64_t bh,
+    int64_t fw,
+    int64_t fh,
+    double fthresh,
+    double nsigma,
+    int64_t dilate,
+    int niter,
+    sep_bkg ** bkg
+) {
+  sep_bkg *prev, *next;
+  int i, status;
+
+  status = bkg_estimate(image, bw, bh, fw, fh, fthresh, NULL, 0.0, 0, NULL, &prev);
+  for (i = 0; i < niter && status == RETURN_OK; i++) {
+    status = bkg_estimate(image, bw, bh, fw, fh, fthresh, prev, nsigma, dilate, NULL, &next);
+    sep_bkg_free(prev);
+    prev = next;
+  }
+  *bkg = prev;
+  return status;
+}
+
+/* Add the number, sum and sum of squares of the pixels in meshes [x0, x1)
+ * of held rows [y0, y1) with values (taken at bin centers) in [lo, hi]. */
+static void meshcum_range(
+    const bkgpyramid * pyr,
+    int64_t x0,
+    int64_t x1,
+    int64_t y0,
+    int64_t y1,
+    double lo,
+    double hi,
+    double * n,
+    double * s1,
+    double * s2
+) {
+  const meshcum * mc;
+  const double *c0, *c1;
+  double a, b, cnt, si, sii;
+  int64_t x, y, i0, i1, nl;
+
+  for (y = y0; y < y1; y++) {
+    for (x = x0, mc = pyr->rows + y * pyr->nx + x0; x < x1; x++, mc++) {
+      if (!mc->nlevels) {
+        continue;
+      }
+      nl = mc->nlevels;
+      a = ceil((lo - mc->qzero) / mc->qscale);
+      b = floor((hi - mc->qzero) / mc->qscale);
+      a = a > 0.0 ? a : 0.0;
+      b = b < nl - 1 ? b : nl - 1;
+      if (!(a <= b)) {
+        continue;
+      }
+      i0 = (int64_t)a;
+      i1 = (int64_t)b + 1;
+      c0 = mc->cum;
+      c1 = mc->cum + (nl + 1);
+      cnt = c0[i1] - c0[i0];
+      si = c1[i1] - c1[i0];
+      sii = c1[nl + 1 + i1] - c1[nl + 1 + i0];
+      *n += cnt;
+      *s1 += mc->qzero * cnt + mc->qscale * si;
+      *s2 += mc->qzero * mc->qzero * cnt + 2.0 * mc->qzero * mc->qscale * si
+             + mc->qscale * mc->qscale * sii;
+    }
+  }
+}
+
+/* Estimate the background of the coarse mesh made of fine meshes
+ * [x0, x0+f) of held rows [y0, y0+f), as backstat() and backguess() would
+ * on its pixels. Pixel values are taken at the centers of the fine
+ * histogram bins, which are narrower than those backguess() would use. The
+ * iterative clipping of backguess() is done on values rather than on a
+ * histogram of the coarse mesh, so that the cost does not depend on the
+ * number of pixels. */
+static void backmerge(
+    const bkgpyramid * pyr,
+    int64_t x0,
+    int64_t y0,
+    int64_t f,
+    float * mean,
+    float * sigma,
+    double * nused
+) {
+  const meshcum * mc;
+  backstruct q;
+  int64_t x, y, x1, y1, ntot, nvalid;
+  double n, s1, s2, mea, sig, sig1, med, lo, hi, lo0, hi0, a, b, m, cnt, d1, d2;
+  int it, k;
+
+  x1 = x0 + f < pyr->nx ? x0 + f : pyr->nx;
+  y1 = y0 + f < pyr->nrows ? y0 + f : pyr->nrows;
+
+  /* moments before clipping */
+  ntot = nvalid = 0;
+  s1 = s2 = 0.0;
+  for (y = y0; y < y1; y++) {
+    for (x = x0, mc = pyr->rows + y * pyr->nx + x0; x < x1; x++, mc++) {
+      ntot += mc->ntot;
+      nvalid += mc->nvalid;
+      s1 += mc->sum;
+      s2 += mc->sumsq;
+    }
+  }
+  *nused = 0.0;
+  if ((float)nvalid < (float)(ntot * BACK_MINGOODFRAC)) {
+    *mean = *sigma = -BIG;
+    return;
+  }
+  mea = s1 / nvalid;
+  sig = (sig = s2 / nvalid - mea * mea) > 0.0 ? sqrt(sig) : 0.0;
+
+  /* clipped moments, as in backstat() */
+  n = s1 = s2 = 0.0;
+  meshcum_range(
+      pyr, x0, x1, y0, y1, (PIXTYPE)(mea - 2.0 * sig), (PIXTYPE)(mea + 2.0 * sig), &n, &s1, &s2
+  );
+  if (n <= 0.0) {
+    *mean = *sigma = -BIG;
+    return;
+  }
+  mea = s1 / n;
+  sig = (sig = s2 / n - mea * mea) > 0.0 ? sqrt(sig) : 0.0;
+  q.npix = (int64_t)n;
+  *nused = n;
+  backquantize(&q, mea, sig);
+
+  /* iterative clipping around the median, as in backguess() */
+  lo = lo0 = q.qzero - 0.5 * q.qscale;
+  hi = hi0 = q.qzero + (q.nlevels - 0.5) * q.qscale;
+  sig = 10.0 * (q.nlevels - 1) * q.qscale;
+  sig1 = q.qscale;
+  for (it = 100; it-- && (sig >= 0.1 * q.qscale) && (fabs(sig / sig1 - 1.0) > 1e-4);) {
+    sig1 = sig;
+    n = s1 = s2 = 0.0;
+    meshcum_range(pyr, x0, x1, y0, y1, lo, hi, &n, &s1, &s2);
+    *nused = n;
+    if (n <= 0.0) {
+      mea = q.qzero;
+      sig = 0.0;
+      break;
+    }
+    mea = s1 / n;
+    sig = (sig = s2 / n - mea * mea) > 0.0 ? sqrt(sig) : 0.0;
+
+    /* median, by bisection */
+    a = lo;
+    b = hi;
+    for (k = 0; k < 64 && b - a > 1e-3 * q.qscale; k++) {
+      m = 0.5 * (a + b);
+      cnt = d1 = d2 = 0.0;
+      meshcum_range(pyr, x0, x1, y0, y1, lo, m, &cnt, &d1, &d2);
+      if (cnt < 0.5 * n) {
+        a = m;
+      } else {
+        b = m;
+      }
+    }
+    med = 0.5 * (a + b);
+
+    lo = med - 3.0 * sig > lo0 ? med - 3.0 * sig : lo0;
+    hi = med + 3.0 * sig < hi0 ? med + 3.0 * sig : hi0;
+  }
+
+  *mean = mea;
+  *sigma = sig;
+}
+
+/* compute the coarse meshes covering the held rows, then release them */
+static void bkgpyramid_flush(bkgpyramid * pyr) {
+  const meshcum * mc;
+  sep_bkg * bkg;
+  double nused;
+  int64_t f, cx, cy, k;
+  int sc;
+
+  for (sc = 1; sc < pyr->nscales; sc++) {
+    bkg = pyr->bkgs[sc];
+    f = (int64_t)1 << sc;
+    for (cy = pyr->row0 / f; cy * f < pyr->row0 + pyr->nrows; cy++) {
+      for (cx = 0; cx < bkg->nx; cx++) {
+        k = cx + cy * bkg->nx;
+        backmerge(pyr, cx * f, cy * f - pyr->row0, f, bkg->back + k, bkg->sigma + k, &nused);
+        bkg->backerr[k] = nused > 0.0 ? bkg->sigma[k] / sqrt(nused) : NAN;
+      }
+    }
+    for (k = 0, mc = pyr->rows; k < pyr->nrows * pyr->nx; k++, mc++) {
+      bkg->nsample += mc->nvalid;
+    }
+  }
+
+  for (k = 0; k < pyr->nrows * pyr->nx; k++) {
+    free(pyr->rows[k].cum);
+    pyr->rows[k].cum = NULL;
+  }
+  pyr->row0 += pyr->nrows;
+  pyr->nrows = 0;
+}
+
+/* keep the statistics of a row of fine meshes */
+static int bkgpyramid_addrow(bkgpyramid * pyr, const backstruct * backmesh) {
+  const backstruct * bm;
+  meshcum * mc;
+  double *c0, *c1, *c2;
+  int64_t m, i, j, g, nl, cnt;
+  int status = RETURN_OK;
+
+  for (m = 0; m < pyr->nx; m++) {
+    bm = backmesh + m;
+    mc = pyr->rows + pyr->nrows * pyr->nx + m;
+    mc->ntot = bm->ntot;
+    mc->nvalid = bm->nvalid;
+    mc->sum = bm->sum;
+    mc->sumsq = bm->sumsq;
+    mc->nlevels = 0;
+    mc->cum = NULL;
+    if (!bm->histo) {
+      continue;
+    }
+
+    /* group bins by g, so that at most MERGE_NMAXLEVELS are kept */
+    g = (bm->nlevels - 1) / MERGE_NMAXLEVELS + 1;
+    nl = (bm->nlevels - 1) / g + 1;
+    mc->nlevels = (int)nl;
+    mc->qzero = bm->qzero + 0.5 * (g - 1) * bm->qscale;
+    mc->qscale = bm->qscale * g;
+    QMALLOC(mc->cum, double, 3 * (nl + 1), status);
+    c0 = mc->cum;
+    c1 = c0 + nl + 1;
+    c2 = c1 + nl + 1;
+    c0[0] = c1[0] = c2[0] = 0.0;
+    for (i = 0; i < nl; i++) {
+      cnt = 0;
+      for (j = i * g; j < (i + 1) * g && j < bm->nlevels; j++) {
+        cnt += bm->histo[j];
+      }
+      c0[i + 1] = c0[i] + cnt;
+      c1[i + 1] = c1[i] + (double)cnt * i;
+      c2[i + 1] = c2[i] + (double)cnt * i * i;
+    }
+  }
+  pyr->nrows++;
+  if (pyr->nrows == pyr->group || pyr->row0 + pyr->nrows == pyr->ny) {
+    bkgpyramid_flush(pyr);
+  }
+
+exit:
+  return status;
+}
+
+int sep_background_multiscale(
+    const sep_image * image,
+    int64_t bw,
+    int64_t bh,
+    int64_t fw,
+    int64_t fh,
+    double fthresh,
+    int nscales,
+    sep_bkg ** bkgs
+) {
+  bkgpyramid pyr;
+  int64_t k, nrows;
+  int sc, status = RETURN_OK;
+
+  pyr.rows = NULL;
+  nrows = 0;
+  for (sc = 0; sc < nscales; sc++) {
+    bkgs[sc] = NULL;
+  }
+  if (nscales < 1) {
+    return status;
+  }
+
+  /* scale 0 is allocated by bkg_estimate(), which calls back into
+   * bkgpyramid_addrow() for every row of meshes */
+  for (sc = 1; sc < nscales; sc++) {
+    status = bkg_alloc(image->w, image->h, bw << sc, bh << sc, bkgs + sc);
+    if (status != RETURN_OK) {
+      goto exit;
+    }
+  }
+  pyr.nscales = nscales;
+  pyr.bkgs = bkgs;
+  pyr.nx = (image->w - 1) / bw + 1 > 1 ? (image->w - 1) / bw + 1 : 1;
+  pyr.group = (int64_t)1 << (nscales - 1);
+  pyr.row0 = pyr.nrows = 0;
+  for (sc = 1; sc < nscales; sc++) {
+    bkgs[sc]->subsample = sep_get_background_subsample();
+  }
+  pyr.ny = (image->h - 1) / bh + 1 > 1 ? (image->h - 1) / bh + 1 : 1;
+  nrows = pyr.group < pyr.ny ? pyr.group : pyr.ny;
+  QCALLOC(pyr.rows, meshcum, nrows * pyr.nx, status);
+
+  status = bkg_estimate(
+      image, bw, bh, fw, fh, fthresh, NULL, 0.0, 0, nscales > 1 ? &pyr : NULL, bkgs
+  );
+  if (status != RETURN_OK) {
+    goto exit;
+  }
+  for (sc = 1; sc < nscales; sc++) {
+    if ((status = bkg_finish(bkgs[sc], fw, fh, fthresh)) != RETURN_OK) {
+      goto exit;
+    }
+  }
+
+exit:
+  for (k = 0; pyr.rows && k < nrows * pyr.nx; k++) {
+    free(pyr.rows[k].cum);
+  }
+  free(pyr.rows);
+  if (status != RETURN_OK) {
+    for (sc = 0; sc < nscales; sc++) {
+      sep_bkg_free(bkgs[sc]);
+      bkgs[sc] = NULL;
+    }
+  }
+  return status;
+}
+
+/******************************** bkg_gather ********************************/
+/*
+Gather the pixels of rows oy, oy+sub, ... of a strip of h rows of width w,
+taking columns ox, ox+sub, ... within each mesh of width bw, and converting
+them to PIXTYPE. The result is a compact strip in which each mesh has
+(bw-ox-1)/sub+1 columns (fewer for a narrower last mesh), as expected by
+backstat() and backhisto(). Returns the width of the compact strip.
+*/
+static int64_t bkg_gather(
+    const BYTE * strip,
+    array_converter convert,
+    int64_t rowsize,
+    int64_t w,
+    int64_t h,
+    int64_t bw,
+    int64_t sub,
+    int64_t ox,
+    int64_t oy,
+    PIXTYPE * row,
+    PIXTYPE * out
+) {
+  int64_t x, y, x0, x1, sw;
+
+  sw = 0;
+  for (y = oy; y < h; y += sub) {
+    convert(strip + y * rowsize, w, row);
+    sw = 0;
+    for (x0 = 0; x0 < w; x0 += bw) {
+      x1 = x0 + bw < w ? x0 + bw : w;
+      for (x = x0 + ox; x < x1; x += sub, sw++) {
+        *(out++) = row[x];
+      }
+    }
+  }
+  return sw;
+}
+
+/* as bkg_gather(), for mask flags (value > thresh) read with `read` */
+static void bkg_gather_mask(
+    const BYTE * strip,
+    mask_reader read,
+    int64_t rowsize,
+    double thresh,
+    int64_t w,
+    int64_t h,
+    int64_t bw,
+    int64_t sub,
+    int64_t ox,
+    int64_t oy,
+    BYTE * row,
+    BYTE * out
+) {
+  int64_t x, y, x0, x1;
+
+  for (y = oy; y < h; y += sub) {
+    read(strip + y * rowsize, 0, w, thresh, row);
+    for (x0 = 0; x0 < w; x0 += bw) {
+      x1 = x0 + bw < w ? x0 + bw : w;
+      for (x = x0 + ox; x < x1; x += sub) {
+        *(out++) = row[x];
+      }
+    }
+  }
+}
+
+/****************************** bkg_exclude_strip ****************************/
+/*
+Mark the pixels of image rows [y0, y0+h) to exclude from the background
+statistics, writing 1 (excluded) or 0 to `out`. A pixel is excluded if it is
+masked, or within `dilate` pixels (in x and y) of a detection. A pixel is
+detected if the significance of the 3x3 sum around it, measured against the
+background and RMS of `prev`, exceeds `nsigma`. Only the rows needed for the
+strip are read from the image.
+*/
+static int bkg_exclude_strip(
+    const sep_image * image,
+    array_converter convert,
+    int64_t elsize,
+    const sep_bkg * prev,
+    double nsigma,
+    int64_t dilate,
+    int64_t y0,
+    int64_t h,
+    const BYTE * mask,
+    BYTE * out
+) {
+  const BYTE * imt;
+  PIXTYPE *sig, *back, *rms, *row;
+  BYTE *seed, *hdil, *acc;
+  int64_t w, drow, sa, sb, ya, yb, x, y, yy, dx, dy, cnt, last;
+  double sum;
+  int status = RETURN_OK;
+
+  sig = back = rms = NULL;
+  seed = hdil = acc = NULL;
+  w = image->w;
+  if (dilate < 0) {
+    dilate = 0;
+  }
+
+  /* detections are needed within `dilate` rows of the strip (sa to sb), and
+   * each detection needs the rows either side of it (ya to yb) */
+  sa = y0 - dilate > 0 ? y0 - dilate : 0;
+  sb = y0 + h + dilate < image->h ? y0 + h + dilate : image->h;
+  ya = sa > 0 ? sa - 1 : 0;
+  yb = sb < image->h ? sb + 1 : image->h;
+
+  QMALLOC(sig, PIXTYPE, (yb - ya) * w, status);
+  QMALLOC(back, PIXTYPE, w, status);
+  QMALLOC(rms, PIXTYPE, w, status);
+  QCALLOC(seed, BYTE, (sb - sa) * w, status);
+  QCALLOC(hdil, BYTE, (sb - sa) * w, status);
+  QMALLOC(acc, BYTE, w, status);
+
+  /* significance of each pixel above the previous background */
+  drow = ROWSTRIDE(image->dstride, w * elsize);
+  imt = (const BYTE *)image->data + ya * drow;
+  for (y = ya; y < yb; y++, imt += drow) {
+    row = sig + (y - ya) * w;
+    convert(imt, w, row);
+    if ((status = sep_bkg_line_flt(prev, y, back)) != RETURN_OK
+        || (status = sep_bkg_rmsline_flt(prev, y, rms)) != RETURN_OK) {
+      goto exit;
+    }
+    for (x = 0; x < w; x++) {
+      row[x] = rms[x] > 0.0 ? (row[x] - back[x]) / rms[x] : 0.0;
+    }
+  }
+
+  /* detections: 3x3 sums (of cnt pixels) above nsigma * sqrt(cnt) */
+  for (y = sa; y < sb; y++) {
+    for (x = 0; x < w; x++) {
+      sum = 0.0;
+      cnt = 0;
+      for (dy = -1; dy <= 1; dy++) {
+        if (y + dy < ya || y + dy >= yb) {
+          continue;
+        }
+        row = sig + (y + dy - ya) * w;
+        for (dx = -1; dx <= 1; dx++) {
+          if (x + dx >= 0 && x + dx < w) {
+            sum += row[x + dx];
+            cnt++;
+          }
+        }
+      }
+      seed[(y - sa) * w + x] = sum > nsigma * sqrt((double)cnt);
+    }
+  }
+
+  /* dilate along x, using the distance to the nearest detection on
+   * either side */
+  for (y = 0; y < sb - sa; y++) {
+    last = -dilate - 1;
+    for (x = 0; x < w; x++) {
+      if (seed[y * w + x]) {
+        last = x;
+      }
+      hdil[y * w + x] = x - last <= dilate;
+    }
+    last = w + dilate;
+    for (x = w - 1; x >= 0; x--) {
+      if (seed[y * w + x]) {
+        last = x;
+      }
+      hdil[y * w + x] |= last - x <= dilate;
+    }
+  }
+
+  /* dilate along y and combine with the mask */
+  for (y = y0; y < y0 + h; y++) {
+    memset(acc, 0, (size_t)w);
+    for (yy = y - dilate; yy <= y + dilate; yy++) {
+      if (yy < sa || yy >= sb) {
+        continue;
+      }
+      for (x = 0; x < w; x++) {
+        acc[x] |= hdil[(yy - sa) * w + x];
+      }
+    }
+    for (x = 0; x < w; x++) {
+      out[x] = acc[x] | (mask ? mask[x] : 0);
+    }
+    out += w;
+    if (mask) {
+      mask += w;
+    }
+  }
+
+exit:
+  free(sig);
+  free(back);
+  free(rms);
+  free(seed);
+  free(hdil);
+  free(acc);
+  return status;
+}
+
 /******************************** backstat **********************************/
 /*
 Compute robust statistical estimators in a row of meshes.
@@ -277,23 +1030,22 @@ Compute robust statistical estimators in a row of meshes.
 void backstat(
     backstruct * backmesh,
     const PIXTYPE * buf,
-    const PIXTYPE * wbuf,
+    const BYTE * wbuf,
     int64_t bufsize,
     int64_t n,
     int64_t w,
-    int64_t bw,
-    PIXTYPE maskthresh
+    int64_t bw
 ) {
   backstruct * bm;
-  double pix, wpix, sig, mean, sigma, step;
-  const PIXTYPE *buft, *wbuft;
+  double pix, sig, mean, sigma;
+  const PIXTYPE * buft;
+  const BYTE * wbuft;
   PIXTYPE lcut, hcut;
   int64_t m, h, x, y, npix, wnpix, offset, lastbite;
 
   h = bufsize / w; /* height of background boxes in this row */
   bm = backmesh;
   offset = w - bw;
-  step = sqrt(2 / PI) * QUANTIF_NSIGMA / QUANTIF_AMIN;
 
   for (m = n; m--; bm++, buf += bw) {
     if (!m && (lastbite = w % bw)) {
@@ -311,7 +1063,7 @@ void backstat(
       for (y = h; y--; buft += offset, wbuft += offset) {
         for (x = bw; x--;) {
           pix = *(buft++);
-          if ((wpix = *(wbuft++)) <= maskthresh && pix > -BIG) {
+          if (!*(wbuft++) && pix > -BIG) {
             mean += pix;
             sigma += pix * pix;
             npix++;
@@ -330,6 +1082,11 @@ void backstat(
       }
     }
 
+    bm->ntot = bw * h;
+    bm->nvalid = npix;
+    bm->sum = mean;
+    bm->sumsq = sigma;
+
     /*-- If not enough valid pixels, discard this mesh */
     if ((float)npix < (float)(bw * h * BACK_MINGOODFRAC)) {
       bm->mean = bm->sigma = -BIG;
@@ -353,7 +1110,7 @@ void backstat(
       for (y = h; y--; buft += offset, wbuft += offset) {
         for (x = bw; x--;) {
           pix = *(buft++);
-          if ((wpix = *(wbuft++)) <= maskthresh && pix <= hcut && pix >= lcut) {
+          if (!*(wbuft++) && pix <= hcut && pix >= lcut) {
             mean += pix;
             sigma += pix * pix;
             npix++;
@@ -379,11 +1136,7 @@ void backstat(
     sigma = sig > 0.0 ? sqrt(sig) : 0.0;
     bm->mean = mean;
     bm->sigma = sigma;
-    if ((bm->nlevels = (int)(step * npix + 1)) > QUANTIF_NMAXLEVELS) {
-      bm->nlevels = QUANTIF_NMAXLEVELS;
-    }
-    bm->qscale = sigma > 0.0 ? 2 * QUANTIF_NSIGMA * sigma / bm->nlevels : 1.0;
-    bm->qzero = mean - QUANTIF_NSIGMA * sigma;
+    backquantize(bm, mean, sigma);
 
     if (wbuf) {
       wbuf += bw;
@@ -391,6 +1144,18 @@ void backstat(
   }
 }
 
+/* set the histogram position and binning of a mesh from its (clipped)
+ * npix, mean and sigma */
+static void backquantize(backstruct * bm, double mean, double sigma) {
+  double step = sqrt(2 / PI) * QUANTIF_NSIGMA / QUANTIF_AMIN;
+
+  if ((bm->nlevels = (int)(step * bm->npix + 1)) > QUANTIF_NMAXLEVELS) {
+    bm->nlevels = QUANTIF_NMAXLEVELS;
+  }
+  bm->qscale = sigma > 0.0 ? 2 * QUANTIF_NSIGMA * sigma / bm->nlevels : 1.0;
+  bm->qzero = mean - QUANTIF_NSIGMA * sigma;
+}
+
 /******************************** backhisto *********************************/
 /*
 Fill histograms in a row of meshes.
@@ -398,16 +1163,16 @@ Fill histograms in a row of meshes.
 void backhisto(
     backstruct * backmesh,
     const PIXTYPE * buf,
-    const PIXTYPE * wbuf,
+    const BYTE * wbuf,
     int64_t bufsize,
     int64_t n,
     int64_t w,
-    int64_t bw,
-    PIXTYPE maskthresh
+    int64_t bw
 ) {
   backstruct * bm;
-  const PIXTYPE *buft, *wbuft;
-  float qscale, cste, wpix;
+  const PIXTYPE * buft;
+  const BYTE * wbuft;
+  float qscale, cste;
   int64_t * histo;
   int64_t h, m, x, y, nlevels, lastbite, offset, bin;
 
@@ -439,7 +1204,7 @@ void backhisto(
       for (y = h; y--; buft += offset, wbuft += offset) {
         for (x = bw; x--;) {
           bin = (int64_t)(*(buft++) / qscale + cste);
-          if ((wpix = *(wbuft++)) <= maskthresh && bin < nlevels && bin >= 0) {
+          if (!*(wbuft++) && bin < nlevels && bin >= 0) {
             (*(histo + bin))++;
           }
         }
@@ -532,6 +1297,12 @@ float backguess(backstruct * bkg, float * mean, float * sigma)
   //                           : bkg->qzero + med * bkg->qscale))
   //             : bkg->qzero + mea * bkg->qscale;
 
+  /* Source Extractor's mode estimate, reported by sep_stats_box() and
+   * sep_stats_circann() */
+  bkg->mode = fabs(sig) > 0.0 && fabs((mea - med) / sig) < 0.3
+                  ? bkg->qzero + (2.5 * med - 1.5 * mea) * bkg->qscale
+                  : bkg->qzero + med * bkg->qscale;
+
   *sigma = sig * bkg->qscale;
 
   return *mean;
@@ -1135,6 +1906,675 @@ exit:
   return status;
 }
 
+/*****************************************************************************/
+/* Evaluation at arbitrary positions.
+ *
+ * bkg_line_flt_internal() first interpolates the nodes along y, then fits a
+ * natural spline along x through the interpolated nodes. Both steps are
+ * linear in the node values, so the x-spline second derivatives at any y
+ * are the same y-interpolation of the x-spline second derivatives of each
+ * row of the maps. These are precomputed once (bkg_xspline()), after which
+ * each position costs a fixed number of operations. */
+
+typedef struct {
+  const sep_bkg * bkg;
+  const float *map, *dmap; /* node values and y 2nd derivatives */
+  float *xmap, *xdmap; /* x 2nd derivatives of each row of map, dmap */
+} bkgspline;
+
+/* natural spline 2nd derivatives along x for each row of map */
+static int bkg_xspline_rows(const sep_bkg * bkg, const float * map, float * out) {
+  int64_t x, y, nbx;
+  double *u, *d, temp;
+  int status = RETURN_OK;
+
+  nbx = bkg->nx;
+  u = d = NULL;
+  QMALLOC(u, double, nbx, status);
+  QMALLOC(d, double, nbx, status);
+  for (y = 0; y < bkg->ny; y++, map += nbx, out += nbx) {
+    if (nbx < 3) {
+      for (x = 0; x < nbx; x++) {
+        out[x] = 0.0;
+      }
+      continue;
+    }
+    d[0] = u[0] = 0.0; /* "natural" lower boundary condition */
+    for (x = 1; x < nbx - 1; x++) {
+      temp = -1.0 / (d[x - 1] + 4);
+      d[x] = temp;
+      u[x] = temp * (u[x - 1] - 6 * (map[x + 1] + map[x - 1] - 2 * map[x]));
+    }
+    d[nbx - 1] = 0.0; /* "natural" upper boundary condition */
+    for (x = nbx - 2; x > 0; x--) {
+      d[x] = (d[x] * d[x + 1] + u[x]) / 6.0;
+    }
+    for (x = 0; x < nbx; x++) {
+      out[x] = (float)d[x];
+    }
+  }
+
+exit:
+  free(u);
+  free(d);
+  return status;
+}
+
+static int bkg_xspline(
+    const sep_bkg * bkg, const float * map, const float * dmap, bkgspline * s
+) {
+  int status = RETURN_OK;
+
+  s->bkg = bkg;
+  s->map = map;
+  s->dmap = dmap;
+  s->xmap = s->xdmap = NULL;
+  QMALLOC(s->xmap, float, bkg->n, status);
+  QMALLOC(s->xdmap, float, bkg->n, status);
+  if ((status = bkg_xspline_rows(bkg, map, s->xmap)) != RETURN_OK) {
+    goto exit;
+  }
+  status = bkg_xspline_rows(bkg, dmap, s->xdmap);
+
+exit:
+  return status;
+}
+
+static void bkg_xspline_free(bkgspline * s) {
+  free(s->xmap);
+  free(s->xdmap);
+  s->xmap = s->xdmap = NULL;
+}
+
+/* node column segment containing pixel column x, and offset within it,
+ * using the same pixel coordinate convention as bkg_line_flt_internal() */
+static int64_t bkg_xsegment(const sep_bkg * bkg, double x, double * dx) {
+  int64_t xl;
+
+  if (bkg->nx < 2) {
+    *dx = 0.0;
+    return 0;
+  }
+  *dx = (x + 0.5) / bkg->bw - 0.5;
+  xl = (int64_t)floor(*dx);
+  xl = xl < 0 ? 0 : (xl > bkg->nx - 2 ? bkg->nx - 2 : xl);
+  *dx -= xl;
+  return xl;
+}
+
+/* interpolate node columns [c0, c1] (and their x 2nd derivatives) along y
+ * to pixel row y */
+static void bkg_spline_row(
+    const bkgspline * s, double y, int64_t c0, int64_t c1, double * node, double * dnode
+) {
+  const sep_bkg * bkg = s->bkg;
+  int64_t c, yl, i0, i1;
+  double dy, cdy, dy3, cdy3;
+
+  if (bkg->ny < 2) {
+    /* as in bkg_line_flt_internal(), the y 2nd derivatives (zero) are
+     * used in place of x 2nd derivatives */
+    for (c = c0; c <= c1; c++) {
+      node[c - c0] = s->map[c];
+      dnode[c - c0] = s->dmap[c];
+    }
+    return;
+  }
+
+  dy = y / bkg->bh - 0.5;
+  yl = (int64_t)floor(dy);
+  yl = yl < 0 ? 0 : (yl > bkg->ny - 2 ? bkg->ny - 2 : yl);
+  dy -= yl;
+  cdy = 1 - dy;
+  dy3 = dy * dy * dy - dy;
+  cdy3 = cdy * cdy * cdy - cdy;
+
+  for (c = c0; c <= c1; c++) {
+    i0 = yl * bkg->nx + c;
+    i1 = i0 + bkg->nx;
+    node[c - c0] = cdy * s->map[i0] + dy * s->map[i1] + cdy3 * s->dmap[i0]
+                   + dy3 * s->dmap[i1];
+    dnode[c - c0] = cdy * s->xmap[i0] + dy * s->xmap[i1] + cdy3 * s->xdmap[i0]
+                    + dy3 * s->xdmap[i1];
+  }
+}
+
+/* spline value at pixel column x, given the row interpolated by
+ * bkg_spline_row() starting at node column c0 */
+static double bkg_spline_xeval(
+    const sep_bkg * bkg, const double * node, const double * dnode, int64_t c0, double x
+) {
+  int64_t xl;
+  double dx, cdx;
+
+  xl = bkg_xsegment(bkg, x, &dx) - c0;
+  if (bkg->nx < 2) {
+    return node[0];
+  }
+  cdx = 1 - dx;
+  return cdx * (node[xl] + (cdx * cdx - 1) * dnode[xl])
+         + dx * (node[xl + 1] + (dx * dx - 1) * dnode[xl + 1]);
+}
+
+/* spline value at (x, y) */
+static double bkg_spline_eval(const bkgspline * s, double x, double y) {
+  double node[2], dnode[2], dx;
+  int64_t xl;
+
+  xl = bkg_xsegment(s->bkg, x, &dx);
+  bkg_spline_row(s, y, xl, s->bkg->nx > 1 ? xl + 1 : xl, node, dnode);
+  return bkg_spline_xeval(s->bkg, node, dnode, xl, x);
+}
+
+/* pixel coordinate v moved into [0, n - 1]: the cubic is not extrapolated
+ * beyond the image */
+static int64_t bkg_clamp(int64_t v, int64_t n) {
+  return v < 0 ? 0 : (v > n - 1 ? n - 1 : v);
+}
+
+typedef struct {
+  const bkgspline *back, *rms;
+  const double *x, *y;
+  double *backout, *rmsout;
+} bkgevaljob;
+
+static int bkg_eval_task(void * ctx, int64_t start, int64_t end, int thread) {
+  bkgevaljob * job = ctx;
+  const sep_bkg * bkg = job->back ? job->back->bkg : job->rms->bkg;
+  double x, y;
+  int64_t i;
+
+  (void)thread;
+  for (i = start; i < end; i++) {
+    x = job->x[i];
+    y = job->y[i];
+    if (!(isfinite(x) && isfinite(y))) {
+      if (job->backout) {
+        job->backout[i] = NAN;
+      }
+      if (job->rmsout) {
+        job->rmsout[i] = NAN;
+      }
+      continue;
+    }
+
+    /* the cubic is not extrapolated beyond the image */
+    x = x < 0.0 ? 0.0 : (x > bkg->w - 1 ? bkg->w - 1 : x);
+    y = y < 0.0 ? 0.0 : (y > bkg->h - 1 ? bkg->h - 1 : y);
+    if (job->backout) {
+      job->backout[i] = bkg_spline_eval(job->back, x, y);
+    }
+    if (job->rmsout) {
+      job->rmsout[i] = bkg_spline_eval(job->rms, x, y);
+    }
+  }
+  return RETURN_OK;
+}
+
+int sep_bkg_eval(
+    const sep_bkg * bkg,
+    const double * x,
+    const double * y,
+    int64_t n,
+    double * back,
+    double * rms
+) {
+  bkgspline sback, srms;
+  bkgevaljob job;
+  int status = RETURN_OK;
+
+  sback.xmap = sback.xdmap = srms.xmap = srms.xdmap = NULL;
+  if (!back && !rms) {
+    return status;
+  }
+  if (back && (status = bkg_xspline(bkg, bkg->back, bkg->dback, &sback)) != RETURN_OK) {
+    goto exit;
+  }
+  if (rms && (status = bkg_xspline(bkg, bkg->sigma, bkg->dsigma, &srms)) != RETURN_OK) {
+    goto exit;
+  }
+
+  job.back = back ? &sback : NULL;
+  job.rms = rms ? &srms : NULL;
+  job.x = x;
+  job.y = y;
+  job.backout = back;
+  job.rmsout = rms;
+  status = parallel_for(n, 4096, bkg_eval_task, &job);
+
+exit:
+  bkg_xspline_free(&sback);
+  bkg_xspline_free(&srms);
+  return status;
+}
+
+/* Rendering of a rectangular region. Only the node columns spanned by the
+ * region are interpolated along y for each row, so the cost is
+ * proportional to the region size rather than the image size. */
+
+typedef struct {
+  bkgspline spline;
+  int64_t x0, y0, w;
+  int64_t c0, c1; /* node columns spanned by the region */
+  array_writer write; /* NULL for float output */
+  int64_t size;
+  BYTE * out;
+} bkgtilejob;
+
+static int bkg_tile_task(void * ctx, int64_t start, int64_t end, int thread) {
+  bkgtilejob * job = ctx;
+  const sep_bkg * bkg = job->spline.bkg;
+  int64_t x, y;
+  double *node, *dnode;
+  PIXTYPE *line, *buf;
+  int status = RETURN_OK;
+
+  (void)thread;
+  node = dnode = NULL;
+  line = NULL;
+  QMALLOC(node, double, job->c1 - job->c0 + 1, status);
+  QMALLOC(dnode, double, job->c1 - job->c0 + 1, status);
+  if (job->write) {
+    QMALLOC(line, PIXTYPE, job->w, status);
+  }
+
+  for (y = start; y < end; y++) {
+    /* float output is written directly */
+    buf = job->write ? line : (PIXTYPE *)(job->out + y * job->w * job->size);
+    bkg_spline_row(
+        &job->spline, (double)bkg_clamp(job->y0 + y, bkg->h), job->c0, job->c1, node,
+        dnode
+    );
+    for (x = 0; x < job->w; x++) {
+      buf[x] = (PIXTYPE)bkg_spline_xeval(
+          bkg, node, dnode, job->c0, (double)bkg_clamp(job->x0 + x, bkg->w)
+      );
+    }
+    if (job->write) {
+      job->write(line, job->w, job->out + y * job->w * job->size);
+    }
+  }
+
+exit:
+  free(node);
+  free(dnode);
+  free(line);
+  return status;
+}
+
+static int bkg_tile_internal(
+    const sep_bkg * bkg,
+    const float * map,
+    const float * dmap,
+    int64_t x0,
+    int64_t y0,
+    int64_t w,
+    int64_t h,
+    void * out,
+    int dtype,
+    int subtract
+) {
+  bkgtilejob job;
+  double dx;
+  int status = RETURN_OK;
+
+  job.spline.xmap = job.spline.xdmap = NULL;
+  if (subtract) {
+    status = get_array_subtractor(dtype, &job.write, &job.size);
+  } else if (dtype == SEP_TFLOAT) {
+    job.write = NULL;
+    job.size = sizeof(PIXTYPE);
+  } else {
+    status = get_array_writer(dtype, &job.write, &job.size);
+  }
+  if (status != RETURN_OK || w <= 0 || h <= 0) {
+    goto exit;
+  }
+  if ((status = bkg_xspline(bkg, map, dmap, &job.spline)) != RETURN_OK) {
+    goto exit;
+  }
+
+  job.x0 = x0;
+  job.y0 = y0;
+  job.w = w;
+  job.c0 = bkg_xsegment(bkg, (double)bkg_clamp(x0, bkg->w), &dx);
+  job.c1 = bkg_xsegment(bkg, (double)bkg_clamp(x0 + w - 1, bkg->w), &dx);
+  if (bkg->nx > 1) {
+    job.c1++;
+  }
+  job.out = (BYTE *)out;
+  status = parallel_for(h, 16, bkg_tile_task, &job);
+
+exit:
+  bkg_xspline_free(&job.spline);
+  return status;
+}
+
+int sep_bkg_tile(
+    const sep_bkg * bkg, int64_t x0, int64_t y0, int64_t w, int64_t h, void * out, int dtype
+) {
+  return bkg_tile_internal(bkg, bkg->back, bkg->dback, x0, y0, w, h, out, dtype, 0);
+}
+
+int sep_bkg_rmstile(
+    const sep_bkg * bkg, int64_t x0, int64_t y0, int64_t w, int64_t h, void * out, int dtype
+) {
+  return bkg_tile_internal(bkg, bkg->sigma, bkg->dsigma, x0, y0, w, h, out, dtype, 0);
+}
+
+int sep_bkg_subtile(
+    const sep_bkg * bkg, int64_t x0, int64_t y0, int64_t w, int64_t h, void * arr, int dtype
+) {
+  return bkg_tile_internal(bkg, bkg->back, bkg->dback, x0, y0, w, h, arr, dtype, 1);
+}
+
+/* Rendering of many small regions, such as the surroundings of each
+ * object in sep_pipeline(): the splines are set up once and each region
+ * is rendered serially, so that callers can work on regions in parallel. */
+
+typedef struct bkgrender {
+  bkgspline back, rms;
+} bkgrender;
+
+void bkgrender_free(bkgrender * r) {
+  if (r) {
+    bkg_xspline_free(&r->back);
+    bkg_xspline_free(&r->rms);
+  }
+  free(r);
+}
+
+int bkgrender_init(const sep_bkg * bkg, bkgrender ** r) {
+  int status = RETURN_OK;
+
+  *r = NULL;
+  QCALLOC(*r, bkgrender, 1, status);
+  if ((status = bkg_xspline(bkg, bkg->back, bkg->dback, &(*r)->back)) != RETURN_OK) {
+    goto exit;
+  }
+  status = bkg_xspline(bkg, bkg->sigma, bkg->dsigma, &(*r)->rms);
+
+exit:
+  if (status != RETURN_OK) {
+    bkgrender_free(*r);
+    *r = NULL;
+  }
+  return status;
+}
+
+/* background (or, with rms, its rms) in the w x h region whose first
+ * pixel is (x0, y0): written to out, or subtracted from it with subtract */
+int bkgrender_tile(
+    const bkgrender * r,
+    int rms,
+    int64_t x0,
+    int64_t y0,
+    int64_t w,
+    int64_t h,
+    PIXTYPE * out,
+    int subtract
+) {
+  const bkgspline * s = rms ? &r->rms : &r->back;
+  double *node, *dnode, dx, val;
+  int64_t x, y, c0, c1;
+  int status = RETURN_OK;
+
+  node = dnode = NULL;
+  if (w <= 0 || h <= 0) {
+    return RETURN_OK;
+  }
+  c0 = bkg_xsegment(s->bkg, (double)bkg_clamp(x0, s->bkg->w), &dx);
+  c1 = bkg_xsegment(s->bkg, (double)bkg_clamp(x0 + w - 1, s->bkg->w), &dx);
+  if (s->bkg->nx > 1) {
+    c1++;
+  }
+  QMALLOC(node, double, c1 - c0 + 1, status);
+  QMALLOC(dnode, double, c1 - c0 + 1, status);
+
+  for (y = 0; y < h; y++, out += w) {
+    bkg_spline_row(s, (double)bkg_clamp(y0 + y, s->bkg->h), c0, c1, node, dnode);
+    for (x = 0; x < w; x++) {
+      val = bkg_spline_xeval(
+          s->bkg, node, dnode, c0, (double)bkg_clamp(x0 + x, s->bkg->w)
+      );
+      out[x] = subtract ? out[x] - (PIXTYPE)val : (PIXTYPE)val;
+    }
+  }
+
+exit:
+  free(node);
+  free(dnode);
+  return status;
+}
+
+/*****************************************************************************/
+/* Clipped statistics in many regions of an image, with the estimator used
+ * for background meshes: the valid pixels of each region are gathered
+ * into a buffer, which is passed to backstat(), backhisto() and
+ * backguess() as a single mesh. Each thread reuses its own buffer and
+ * histogram from one region to the next. */
+
+#define STATS_CHUNK 8 /* regions claimed at a time by a thread */
+
+typedef struct {
+  PIXTYPE * buf; /* gathered pixel values */
+  int64_t size; /* allocated size of buf */
+  int64_t * histo; /* QUANTIF_NMAXLEVELS bins */
+} statscratch;
+
+typedef struct {
+  const sep_image * image;
+  converter convert;
+  mask_reader mread;
+  int64_t size, drow, mrowsize;
+  const int64_t *xmin, *xmax, *ymin, *ymax; /* boxes (NULL for annuli) */
+  const double *x, *y, *rin, *rout; /* annuli */
+  double *mean, *mode, *sigma;
+  int64_t * npix;
+  short * flag;
+  statscratch * scratch; /* one per thread */
+} statsjob;
+
+static int stats_task(void * ctx, int64_t start, int64_t end, int thread) {
+  statsjob * job = ctx;
+  const sep_image * im = job->image;
+  statscratch * s = job->scratch + thread;
+  const BYTE *data, *mask;
+  BYTE masked;
+  backstruct bm;
+  PIXTYPE pix;
+  double dx, dy, r2, rin2, rout2;
+  float mean, sigma;
+  int64_t i, x, y, xmin, xmax, ymin, ymax, n;
+  short flag;
+  int status = RETURN_OK;
+
+  data = im->data;
+  mask = im->mask;
+  masked = 0;
+  rin2 = rout2 = 0.0;
+  for (i = start; i < end; i++) {
+    if (job->xmin) {
+      xmin = job->xmin[i];
+      xmax = job->xmax[i];
+      ymin = job->ymin[i];
+      ymax = job->ymax[i];
+    } else if (isfinite(job->x[i]) && isfinite(job->y[i]) && isfinite(job->rout[i])) {
+      xmin = (int64_t)ceil(job->x[i] - job->rout[i]);
+      xmax = (int64_t)floor(job->x[i] + job->rout[i]);
+      ymin = (int64_t)ceil(job->y[i] - job->rout[i]);
+      ymax = (int64_t)floor(job->y[i] + job->rout[i]);
+      rin2 = job->rin[i] > 0.0 ? job->rin[i] * job->rin[i] : 0.0;
+      rout2 = job->rout[i] * job->rout[i];
+    } else {
+      xmin = ymin = 0;
+      xmax = ymax = -1;
+    }
+
+    flag = 0;
+    if (xmin <= xmax && ymin <= ymax
+        && (xmin < 0 || xmax >= im->w || ymin < 0 || ymax >= im->h)) {
+      flag |= SEP_APER_TRUNC;
+    }
+    xmin = xmin < 0 ? 0 : xmin;
+    xmax = xmax >= im->w ? im->w - 1 : xmax;
+    ymin = ymin < 0 ? 0 : ymin;
+    ymax = ymax >= im->h ? im->h - 1 : ymax;
+
+    /* grow this thread's buffer to the bounding box if needed */
+    n = (xmin <= xmax && ymin <= ymax) ? (xmax - xmin + 1) * (ymax - ymin + 1) : 0;
+    if (n > s->size) {
+      free(s->buf);
+      s->size = 0;
+      QMALLOC(s->buf, PIXTYPE, n, status);
+      s->size = n;
+    }
+
+    /* gather valid pixels */
+    n = 0;
+    for (y = ymin; y <= ymax; y++) {
+      dy = job->xmin ? 0.0 : y - job->y[i];
+      for (x = xmin; x <= xmax; x++) {
+        if (!job->xmin) {
+          dx = x - job->x[i];
+          r2 = dx * dx + dy * dy;
+          if (r2 < rin2 || r2 >= rout2) {
+            continue;
+          }
+        }
+        pix = job->convert(data + y * job->drow + x * job->size);
+        if (mask) {
+          job->mread(mask + y * job->mrowsize, x, 1, im->maskthresh, &masked);
+        }
+        if (!(pix > -BIG) || masked) {
+          flag |= SEP_APER_HASMASKED;
+          continue;
+        }
+        s->buf[n++] = pix;
+      }
+    }
+
+    job->mean[i] = job->mode[i] = job->sigma[i] = NAN;
+    job->npix[i] = n;
+    if (n == 0) {
+      if (flag & SEP_APER_HASMASKED) {
+        flag |= SEP_APER_ALLMASKED;
+      }
+    } else {
+      bm.histo = s->histo;
+      backstat(&bm, s->buf, NULL, n, 1, n, n);
+      if (bm.npix > 0) {
+        memset(s->histo, 0, (size_t)bm.nlevels * sizeof(int64_t));
+        backhisto(&bm, s->buf, NULL, n, 1, n, n);
+        backguess(&bm, &mean, &sigma);
+        job->mean[i] = mean;
+        job->mode[i] = bm.mode;
+        job->sigma[i] = sigma;
+      }
+    }
+    job->flag[i] = flag;
+  }
+
+exit:
+  return status;
+}
+
+static int stats_run(statsjob * job, int64_t n) {
+  statscratch * scratch;
+  int t, nt;
+  int status = RETURN_OK;
+
+  scratch = NULL;
+  nt = parallel_nthreads(n, STATS_CHUNK);
+
+  if ((status = get_converter(job->image->dtype, &job->convert, &job->size))) {
+    goto exit;
+  }
+  if (job->image->mask
+      && (status = get_mask_reader(
+              job->image->mdtype, job->image->w, &job->mread, &job->mrowsize
+          ))) {
+    goto exit;
+  }
+  job->drow = ROWSTRIDE(job->image->dstride, job->image->w * job->size);
+  job->mrowsize = ROWSTRIDE(job->image->mstride, job->mrowsize);
+
+  QCALLOC(scratch, statscratch, nt, status);
+  for (t = 0; t < nt; t++) {
+    QMALLOC(scratch[t].histo, int64_t, QUANTIF_NMAXLEVELS, status);
+  }
+  job->scratch = scratch;
+  status = parallel_for_n(n, STATS_CHUNK, nt, stats_task, job);
+
+exit:
+  if (scratch) {
+    for (t = 0; t < nt; t++) {
+      free(scratch[t].buf);
+      free(scratch[t].histo);
+    }
+  }
+  free(scratch);
+  return status;
+}
+
+int sep_stats_box(
+    const sep_image * image,
+    const int64_t * xmin,
+    const int64_t * xmax,
+    const int64_t * ymin,
+    const int64_t * ymax,
+    int64_t n,
+    double * mean,
+    double * mode,
+    double * sigma,
+    int64_t * npix,
+    short * flag
+) {
+  statsjob job;
+
+  memset(&job, 0, sizeof(job));
+  job.image = image;
+  job.xmin = xmin;
+  job.xmax = xmax;
+  job.ymin = ymin;
+  job.ymax = ymax;
+  job.mean = mean;
+  job.mode = mode;
+  job.sigma = sigma;
+  job.npix = npix;
+  job.flag = flag;
+  return stats_run(&job, n);
+}
+
+int sep_stats_circann(
+    const sep_image * image,
+    const double * x,
+    const double * y,
+    const double * rin,
+    const double * rout,
+    int64_t n,
+    double * mean,
+    double * mode,
+    double * sigma,
+    int64_t * npix,
+    short * flag
+) {
+  statsjob job;
+
+  memset(&job, 0, sizeof(job));
+  job.image = image;
+  job.x = x;
+  job.y = y;
+  job.rin = rin;
+  job.rout = rout;
+  job.mean = mean;
+  job.mode = mode;
+  job.sigma = sigma;
+  job.npix = npix;
+  job.flag = flag;
+  return stats_run(&job, n);
+}
+
 /*****************************************************************************/
 
 void sep_bkg_free(sep_bkg * bkg) {
@@ -1143,6 +2583,7 @@ void sep_bkg_free(sep_bkg * bkg) {
     free(bkg->dback);
     free(bkg->sigma);
     free(bkg->dsigma);
+    free(bkg->backerr);
   }
   free(bkg);
 }
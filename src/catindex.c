@@ -0,0 +1,408 @@
+/*%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+ *
+ * This file is part of SEP
+ *
+ * Copyright 2014 SEP developers
+ *
+ * Distributed under an MIT license.
+ *
+ *%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%*/
+
+/* Static spatial index over 2-d positions (e.g., catalog x, y).
+ *
+ * Points are bucketed into a uniform grid of square cells and stored
+ * cell by cell (compressed sparse row layout), so that the positions in
+ * one cell are contiguous in memory. Radius queries scan the cells
+ * overlapping the search circle; nearest-neighbour queries scan rings of
+ * cells around the query until no closer point can remain. The index is
+ * read-only once built, so queries run in parallel. */
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sep.h"
+#include "sepcore.h"
+
+#define INDEX_CHUNK 256 /* queries per parallel work item */
+#define INDEX_MAXCELLS_PER_POINT 4 /* grid size limit relative to npoints */
+
+struct sep_index {
+  int64_t n; /* number of input points */
+  int64_t nx, ny; /* grid size in cells */
+  double x0, y0; /* position of the grid corner */
+  double cellsize; /* width of (square) cells */
+  int64_t * cellstart; /* first entry of each cell; length nx*ny+1 */
+  int64_t * id; /* input index of each entry, ordered by cell */
+  double *x, *y; /* positions, ordered by cell */
+};
+
+
+int sep_index_build(
+    const double * x,
+    const double * y,
+    int64_t n,
+    double cellsize,
+    sep_index ** index
+) {
+  sep_index * idx;
+  int64_t i, j, ix, iy, c, ngood, *cell, *fill;
+  double xmin, xmax, ymin, ymax, w, h;
+  int status;
+
+  status = RETURN_OK;
+  cell = fill = NULL;
+  QCALLOC(idx, sep_index, 1, status);
+
+  /* bounding box of finite positions; others are never returned */
+  xmin = ymin = BIG;
+  xmax = ymax = -BIG;
+  ngood = 0;
+  for (i = 0; i < n; i++) {
+    if (isfinite(x[i]) && isfinite(y[i])) {
+      xmin = x[i] < xmin ? x[i] : xmin;
+      xmax = x[i] > xmax ? x[i] : xmax;
+      ymin = y[i] < ymin ? y[i] : ymin;
+      ymax = y[i] > ymax ? y[i] : ymax;
+      ngood++;
+    }
+  }
+  if (ngood == 0) {
+    xmin = xmax = ymin = ymax = 0.0;
+  }
+  w = xmax - xmin;
+  h = ymax - ymin;
+
+  /* default: about one point per cell */
+  if (!(cellsize > 0.0)) {
+    cellsize = ngood > 0 ? sqrt(w * h / ngood) : 1.0;
+    if (!(cellsize > 0.0)) {
+      cellsize = (w > h ? w : h) / (ngood > 0 ? ngood : 1);
+    }
+    if (!(cellsize > 0.0)) {
+      cellsize = 1.0;
+    }
+  }
+  /* limit memory used by empty cells */
+  while (
+      (w / cellsize + 1.0) * (h / cellsize + 1.0)
+      > (double)(INDEX_MAXCELLS_PER_POINT * ngood + 16)
+  ) {
+    cellsize *= 2.0;
+  }
+
+  idx->n = n;
+  idx->x0 = xmin;
+  idx->y0 = ymin;
+  idx->cellsize = cellsize;
+  idx->nx = (int64_t)(w / cellsize) + 1;
+  idx->ny = (int64_t)(h / cellsize) + 1;
+
+  QCALLOC(idx->cellstart, int64_t, idx->nx * idx->ny + 1, status);
+  QMALLOC(idx->id, int64_t, ngood, status);
+  QMALLOC(idx->x, double, ngood, status);
+  QMALLOC(idx->y, double, ngood, status);
+  QMALLOC(cell, int64_t, n, status);
+
+  /* count points per cell, then scatter them (stable, so that entries in
+   * each cell are in input order) */
+  for (i = 0; i < n; i++) {
+    if (isfinite(x[i]) && isfinite(y[i])) {
+      ix = (int64_t)((x[i] - xmin) / cellsize);
+      iy = (int64_t)((y[i] - ymin) / cellsize);
+      ix = ix < idx->nx ? ix : idx->nx - 1;
+      iy = iy < idx->ny ? iy : idx->ny - 1;
+      cell[i] = iy * idx->nx + ix;
+      idx->cellstart[cell[i] + 1]++;
+    } else {
+      cell[i] = -1;
+    }
+  }
+  for (c = 0; c < idx->nx * idx->ny; c++) {
+    idx->cellstart[c + 1] += idx->cellstart[c];
+  }
+
+  QMALLOC(fill, int64_t, idx->nx * idx->ny, status);
+  memcpy(fill, idx->cellstart, (size_t)(idx->nx * idx->ny) * sizeof(int64_t));
+  for (i = 0; i < n; i++) {
+    if (cell[i] >= 0) {
+      j = fill[cell[i]]++;
+      idx->id[j] = i;
+      idx->x[j] = x[i];
+      idx->y[j] = y[i];
+    }
+  }
+
+exit:
+  free(cell);
+  free(fill);
+  if (status != RETURN_OK) {
+    sep_index_free(idx);
+    idx = NULL;
+  }
+  *index = idx;
+  return status;
+}
+
+void sep_index_free(sep_index * index) {
+  if (index != NULL) {
+    free(index->cellstart);
+    free(index->id);
+    free(index->x);
+    free(index->y);
+  }
+  free(index);
+}
+
+int64_t sep_index_size(const sep_index * index) {
+  return index->n;
+}
+
+/* range of cell indices [*i0, *i1] overlapping [lo, hi] along one axis;
+ * returns 0 if there is none */
+static int cellrange(double lo, double hi, double x0, double cs, int64_t nc, int64_t * i0, int64_t * i1) {
+  double a = (lo - x0) / cs, b = (hi - x0) / cs;
+
+  if (!(b >= 0.0) || !(a < (double)nc)) {
+    return 0;
+  }
+  *i0 = a > 0.0 ? (int64_t)a : 0;
+  *i1 = b < (double)(nc - 1) ? (int64_t)b : nc - 1;
+  return 1;
+}
+
+static int cmp_int64(const void * a, const void * b) {
+  int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+  return (x > y) - (x < y);
+}
+
+/*****************************************************************************/
+/* radius queries */
+
+typedef struct {
+  const sep_index * index;
+  const double *x, *y, *r;
+  int64_t * counts; /* count pass output, or NULL */
+  const int64_t * offsets; /* fill pass input */
+  int64_t * indices; /* fill pass output */
+} radiusquery;
+
+static int radius_task(void * ctx, int64_t start, int64_t end, int thread) {
+  radiusquery * q = ctx;
+  const sep_index * idx = q->index;
+  int64_t i, iy, ix0, ix1, iy0, iy1, j, jend, nfound, *out;
+  double qx, qy, r, r2, dx, dy;
+
+  (void)thread;
+  for (i = start; i < end; i++) {
+    qx = q->x[i];
+    qy = q->y[i];
+    r = q->r[i];
+    r2 = r * r;
+    nfound = 0;
+    out = q->counts ? NULL : q->indices + q->offsets[i];
+
+    if (r >= 0.0
+        && cellrange(qx - r, qx + r, idx->x0, idx->cellsize, idx->nx, &ix0, &ix1)
+        && cellrange(qy - r, qy + r, idx->y0, idx->cellsize, idx->ny, &iy0, &iy1))
+    {
+      for (iy = iy0; iy <= iy1; iy++) {
+        /* cells of one grid row are contiguous */
+        j = idx->cellstart[iy * idx->nx + ix0];
+        jend = idx->cellstart[iy * idx->nx + ix1 + 1];
+        for (; j < jend; j++) {
+          dx = idx->x[j] - qx;
+          dy = idx->y[j] - qy;
+          if (dx * dx + dy * dy <= r2) {
+            if (out) {
+              out[nfound] = idx->id[j];
+            }
+            nfound++;
+          }
+        }
+      }
+    }
+
+    if (out) {
+      qsort(out, (size_t)nfound, sizeof(int64_t), cmp_int64);
+    } else {
+      q->counts[i] = nfound;
+    }
+  }
+  return RETURN_OK;
+}
+
+int sep_index_count_radius(
+    const sep_index * index,
+    const double * x,
+    const double * y,
+    const double * r,
+    int64_t n,
+    int64_t * counts
+) {
+  radiusquery q = {index, x, y, r, counts, NULL, NULL};
+  return parallel_for(n, INDEX_CHUNK, radius_task, &q);
+}
+
+int sep_index_query_radius(
+    const sep_index * index,
+    const double * x,
+    const double * y,
+    const double * r,
+    int64_t n,
+    const int64_t * offsets,
+    int64_t * indices
+) {
+  radiusquery q = {index, x, y, r, NULL, offsets, indices};
+  return parallel_for(n, INDEX_CHUNK, radius_task, &q);
+}
+
+/*****************************************************************************/
+/* nearest-neighbour queries */
+
+typedef struct {
+  const sep_index * index;
+  const double *x, *y;
+  int64_t k;
+  int64_t * indices;
+  double * dist;
+} nearestquery;
+
+/* insert a candidate into the sorted list of the k best so far */
+static void knn_insert(int64_t * ids, double * d2, int64_t k, int64_t * nfound, int64_t id, double dd) {
+  int64_t m;
+
+  if (*nfound == k && (dd > d2[k - 1] || (dd == d2[k - 1] && id > ids[k - 1]))) {
+    return;
+  }
+  m = *nfound < k ? (*nfound)++ : k - 1;
+  while (m > 0 && (d2[m - 1] > dd || (d2[m - 1] == dd && ids[m - 1] > id))) {
+    d2[m] = d2[m - 1];
+    ids[m] = ids[m - 1];
+    m--;
+  }
+  d2[m] = dd;
+  ids[m] = id;
+}
+
+/* scan all entries of cell (ix, iy), if it exists */
+static void knn_scancell(
+    const sep_index * idx,
+    int64_t ix,
+    int64_t iy,
+    double qx,
+    double qy,
+    int64_t * ids,
+    double * d2,
+    int64_t k,
+    int64_t * nfound
+) {
+  int64_t j, jend;
+  double dx, dy;
+
+  if (ix < 0 || ix >= idx->nx || iy < 0 || iy >= idx->ny) {
+    return;
+  }
+  j = idx->cellstart[iy * idx->nx + ix];
+  jend = idx->cellstart[iy * idx->nx + ix + 1];
+  for (; j < jend; j++) {
+    dx = idx->x[j] - qx;
+    dy = idx->y[j] - qy;
+    knn_insert(ids, d2, k, nfound, idx->id[j], dx * dx + dy * dy);
+  }
+}
+
+static int nearest_task(void * ctx, int64_t start, int64_t end, int thread) {
+  nearestquery * q = ctx;
+  const sep_index * idx = q->index;
+  int64_t i, m, t, cx, cy, nfound, k, *ids;
+  double qx, qy, cs, bound, gap, *d2;
+
+  (void)thread;
+  k = q->k;
+  cs = idx->cellsize;
+  for (i = start; i < end; i++) {
+    qx = q->x[i];
+    qy = q->y[i];
+    ids = q->indices + i * k;
+    d2 = q->dist + i * k;
+    nfound = 0;
+
+    if (isfinite(qx) && isfinite(qy)) {
+      /* nearest cell to the query */
+      cx = (int64_t)floor((qx - idx->x0) / cs);
+      cy = (int64_t)floor((qy - idx->y0) / cs);
+      cx = cx < 0 ? 0 : (cx >= idx->nx ? idx->nx - 1 : cx);
+      cy = cy < 0 ? 0 : (cy >= idx->ny ? idx->ny - 1 : cy);
+
+      for (m = 0;; m++) {
+        /* rings 0 to m-1 have been scanned: points not yet seen are at
+         * least as far as the edge of the box of cells [cx-m+1, cx+m-1]
+         * x [cy-m+1, cy+m-1] (no bound if the query is outside it). */
+        if (nfound == k) {
+          gap = qx - (idx->x0 + (cx - m + 1) * cs);
+          bound = gap;
+          gap = idx->x0 + (cx + m) * cs - qx;
+          bound = gap < bound ? gap : bound;
+          gap = qy - (idx->y0 + (cy - m + 1) * cs);
+          bound = gap < bound ? gap : bound;
+          gap = idx->y0 + (cy + m) * cs - qy;
+          bound = gap < bound ? gap : bound;
+          if (m > 0 && bound > 0.0 && bound * bound >= d2[k - 1]) {
+            break;
+          }
+        }
+
+        /* scan ring m */
+        if (m == 0) {
+          knn_scancell(idx, cx, cy, qx, qy, ids, d2, k, &nfound);
+        } else {
+          for (t = -m; t <= m; t++) {
+            knn_scancell(idx, cx + t, cy - m, qx, qy, ids, d2, k, &nfound);
+            knn_scancell(idx, cx + t, cy + m, qx, qy, ids, d2, k, &nfound);
+          }
+          for (t = -m + 1; t <= m - 1; t++) {
+            knn_scancell(idx, cx - m, cy + t, qx, qy, ids, d2, k, &nfound);
+            knn_scancell(idx, cx + m, cy + t, qx, qy, ids, d2, k, &nfound);
+          }
+        }
+
+        /* the whole grid has been scanned */
+        if (cx - m <= 0 && cy - m <= 0 && cx + m >= idx->nx - 1
+            && cy + m >= idx->ny - 1)
+        {
+          break;
+        }
+      }
+    }
+
+    for (t = 0; t < nfound; t++) {
+      d2[t] = sqrt(d2[t]);
+    }
+    for (; t < k; t++) {
+      ids[t] = -1;
+      d2[t] = INFINITY;
+    }
+  }
+  return RETURN_OK;
+}
+
+int sep_index_query_nearest(
+    const sep_index * index,
+    const double * x,
+    const double * y,
+    int64_t n,
+    int64_t k,
+    int64_t * indices,
+    double * dist
+) {
+  nearestquery q = {index, x, y, k, indices, dist};
+
+  if (k <= 0) {
+    put_errdetail("number of neighbours must be positive");
+    return ILLEGAL_APER_PARAMS;
+  }
+  return parallel_for(n, INDEX_CHUNK, nearest_task, &q);
+}
@@ -0,0 +1,361 @@
+/*%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+ *
+ * This file is part of SEP
+ *
+ * Copyright 2014 SEP developers
+ *
+ * Distributed under an MIT license.
+ *
+ *%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%*/
+
+/* Merging of catalogs extracted from overlapping tiles of a mosaic.
+ *
+ * Each object is scored by how deep its centroid lies inside the core
+ * region of the tile it was detected in (negative if outside). Objects
+ * are then accepted in order of decreasing depth, unless an object from
+ * another tile has already been accepted within the match radius. A
+ * spatial hash of accepted objects keeps this close to linear time. */
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sep.h"
+#include "sepcore.h"
+
+int alloc_catalog_fields(sep_catalog * cat, int nobj);
+void free_catalog_fields(sep_catalog * catalog);
+
+typedef struct {
+  double depth;
+  int64_t i;
+} mergeorder;
+
+typedef struct {
+  int64_t ix, iy; /* cell coordinates */
+  int64_t head; /* first accepted object in cell, or -1 if slot is empty */
+} hashslot;
+
+static int cmp_mergeorder(const void * a, const void * b) {
+  const mergeorder *p = a, *q = b;
+  if (p->depth != q->depth) {
+    return p->depth < q->depth ? 1 : -1; /* decreasing depth */
+  }
+  return (p->i > q->i) - (p->i < q->i);
+}
+
+/* find the slot of cell (ix, iy), or the empty slot where it would go */
+static hashslot * hash_lookup(hashslot * table, uint64_t mask, int64_t ix, int64_t iy) {
+  uint64_t h;
+
+  h = ((uint64_t)ix * 0x9E3779B97F4A7C15ull) ^ ((uint64_t)iy * 0xC2B2AE3D27D4EB4Full);
+  h ^= h >> 29;
+  for (h &= mask;; h = (h + 1) & mask) {
+    if (table[h].head < 0 || (table[h].ix == ix && table[h].iy == iy)) {
+      return table + h;
+    }
+  }
+}
+
+int sep_tile_select(
+    const double * x,
+    const double * y,
+    const int * tile,
+    int64_t n,
+    const sep_tile * tiles,
+    double matchrad,
+    unsigned char * keep
+) {
+  mergeorder * order;
+  hashslot *table, *slot;
+  int64_t i, j, k, ix, iy, dx, dy, *next;
+  uint64_t tsize;
+  double d, gap, ddx, ddy, r2;
+  const sep_tile * t;
+  int status, found;
+
+  status = RETURN_OK;
+  order = NULL;
+  table = NULL;
+  next = NULL;
+
+  /* depth of each centroid inside its tile's core region */
+  QMALLOC(order, mergeorder, n, status);
+  for (i = 0; i < n; i++) {
+    t = tiles + tile[i];
+    d = x[i] - t->cxmin;
+    gap = t->cxmax - x[i];
+    d = gap < d ? gap : d;
+    gap = y[i] - t->cymin;
+    d = gap < d ? gap : d;
+    gap = t->cymax - y[i];
+    d = gap < d ? gap : d;
+    order[i].depth = isnan(d) ? -INFINITY : d;
+    order[i].i = i;
+  }
+
+  /* without a match radius, fall back to core ownership alone */
+  if (!(matchrad > 0.0)) {
+    for (i = 0; i < n; i++) {
+      t = tiles + tile[i];
+      keep[i] = x[i] >= t->cxmin && x[i] < t->cxmax && y[i] >= t->cymin
+                && y[i] < t->cymax;
+    }
+    goto exit;
+  }
+
+  qsort(order, (size_t)n, sizeof(mergeorder), cmp_mergeorder);
+
+  /* hash table of cells of width matchrad, at most half full */
+  tsize = 16;
+  while (tsize < 2 * (uint64_t)n) {
+    tsize *= 2;
+  }
+  QMALLOC(table, hashslot, tsize, status);
+  for (j = 0; j < (int64_t)tsize; j++) {
+    table[j].head = -1;
+  }
+  QMALLOC(next, int64_t, n, status);
+
+  r2 = matchrad * matchrad;
+  for (k = 0; k < n; k++) {
+    i = order[k].i;
+    keep[i] = 1;
+    if (!isfinite(x[i]) || !isfinite(y[i])) {
+      continue;
+    }
+    ix = (int64_t)floor(x[i] / matchrad);
+    iy = (int64_t)floor(y[i] / matchrad);
+
+    /* look for an accepted object from another tile within matchrad */
+    found = 0;
+    for (dy = -1; dy <= 1 && !found; dy++) {
+      for (dx = -1; dx <= 1 && !found; dx++) {
+        slot = hash_lookup(table, tsize - 1, ix + dx, iy + dy);
+        for (j = slot->head; j >= 0; j = next[j]) {
+          ddx = x[j] - x[i];
+          ddy = y[j] - y[i];
+          if (tile[j] != tile[i] && ddx * ddx + ddy * ddy <= r2) {
+            found = 1;
+            break;
+          }
+        }
+      }
+    }
+    if (found) {
+      keep[i] = 0;
+      continue;
+    }
+
+    slot = hash_lookup(table, tsize - 1, ix, iy);
+    if (slot->head < 0) {
+      slot->ix = ix;
+      slot->iy = iy;
+    }
+    next[i] = slot->head;
+    slot->head = i;
+  }
+
+exit:
+  free(order);
+  free(table);
+  free(next);
+  return status;
+}
+
+/* copy object i of src, detected in an image whose pixel (0, 0) is pixel
+ * (x0, y0) of the output, to object j of dst (pixel lists excepted) */
+void catalog_copy_object(
+    sep_catalog * dst,
+    int64_t j,
+    const sep_catalog * src,
+    int64_t i,
+    int64_t x0,
+    int64_t y0
+) {
+  dst->thresh[j] = src->thresh[i];
+  dst->npix[j] = src->npix[i];
+  dst->tnpix[j] = src->tnpix[i];
+  dst->xmin[j] = src->xmin[i] + x0;
+  dst->xmax[j] = src->xmax[i] + x0;
+  dst->ymin[j] = src->ymin[i] + y0;
+  dst->ymax[j] = src->ymax[i] + y0;
+  dst->x[j] = src->x[i] + x0;
+  dst->y[j] = src->y[i] + y0;
+  dst->x2[j] = src->x2[i];
+  dst->y2[j] = src->y2[i];
+  dst->xy[j] = src->xy[i];
+  dst->errx2[j] = src->errx2[i];
+  dst->erry2[j] = src->erry2[i];
+  dst->errxy[j] = src->errxy[i];
+  dst->a[j] = src->a[i];
+  dst->b[j] = src->b[i];
+  dst->theta[j] = src->theta[i];
+  dst->cxx[j] = src->cxx[i];
+  dst->cyy[j] = src->cyy[i];
+  dst->cxy[j] = src->cxy[i];
+  dst->cflux[j] = src->cflux[i];
+  dst->flux[j] = src->flux[i];
+  dst->cpeak[j] = src->cpeak[i];
+  dst->peak[j] = src->peak[i];
+  dst->xcpeak[j] = src->xcpeak[i] + x0;
+  dst->ycpeak[j] = src->ycpeak[i] + y0;
+  dst->xpeak[j] = src->xpeak[i] + x0;
+  dst->ypeak[j] = src->ypeak[i] + y0;
+  dst->flag[j] = src->flag[i];
+}
+
+/* allocate pixel lists of `totnpix` pixels for the `nobj` objects of cat,
+ * with pixel values if `values` and variances if `var` */
+int alloc_catalog_pixels(
+    sep_catalog * cat, int64_t nobj, int64_t totnpix, int values, int var
+) {
+  int status = RETURN_OK;
+
+  QMALLOC(cat->objectspix, int64_t, totnpix, status);
+  QMALLOC(cat->pix, int64_t *, nobj, status);
+  if (values) {
+    QMALLOC(cat->objectsvalue, float, totnpix, status);
+    QMALLOC(cat->objectscdvalue, float, totnpix, status);
+  }
+  if (values && var) {
+    QMALLOC(cat->objectsvar, float, totnpix, status);
+  }
+
+exit:
+  return status;
+}
+
+/* copy the pixel values of object i of src to position p of dst's pixel
+ * lists, as far as dst has them */
+void catalog_copy_pixvalues(
+    sep_catalog * dst, int64_t p, const sep_catalog * src, int64_t i
+) {
+  int64_t off = src->pix[i] - src->objectspix;
+  size_t size = src->npix[i] * sizeof(float);
+
+  if (dst->objectsvalue) {
+    memcpy(dst->objectsvalue + p, src->objectsvalue + off, size);
+    memcpy(dst->objectscdvalue + p, src->objectscdvalue + off, size);
+  }
+  if (dst->objectsvar) {
+    memcpy(dst->objectsvar + p, src->objectsvar + off, size);
+  }
+}
+
+int sep_merge_tiles(
+    const sep_catalog * catalogs,
+    const sep_tile * tiles,
+    int ntiles,
+    int64_t mosaicw,
+    double matchrad,
+    sep_catalog ** merged
+) {
+  sep_catalog * cat;
+  const sep_catalog * c;
+  const sep_tile * t;
+  double *x, *y;
+  unsigned char * keep;
+  int * tile;
+  int64_t i, j, k, m, n, nkeep, totnpix, p;
+  int ti, haspix, hasvalue, hasvar, status;
+
+  status = RETURN_OK;
+  cat = NULL;
+  x = y = NULL;
+  keep = NULL;
+  tile = NULL;
+
+  /* positions in mosaic coordinates */
+  n = 0;
+  haspix = mosaicw > 0;
+  hasvalue = hasvar = 1;
+  for (ti = 0; ti < ntiles; ti++) {
+    n += catalogs[ti].nobj;
+    if (catalogs[ti].nobj > 0) {
+      haspix = haspix && catalogs[ti].pix != NULL;
+      hasvalue = hasvalue && catalogs[ti].objectsvalue != NULL;
+      hasvar = hasvar && catalogs[ti].objectsvar != NULL;
+    }
+  }
+  QCALLOC(x, double, n, status);
+  QCALLOC(y, double, n, status);
+  QCALLOC(tile, int, n, status);
+  QMALLOC(keep, unsigned char, n, status);
+  k = 0;
+  for (ti = 0; ti < ntiles; ti++) {
+    for (i = 0; i < catalogs[ti].nobj; i++, k++) {
+      x[k] = catalogs[ti].x[i] + tiles[ti].x0;
+      y[k] = catalogs[ti].y[i] + tiles[ti].y0;
+      tile[k] = ti;
+    }
+  }
+
+  status = sep_tile_select(x, y, tile, n, tiles, matchrad, keep);
+  if (status != RETURN_OK) {
+    goto exit;
+  }
+
+  nkeep = 0;
+  totnpix = 0;
+  k = 0;
+  for (ti = 0; ti < ntiles; ti++) {
+    for (i = 0; i < catalogs[ti].nobj; i++, k++) {
+      if (keep[k]) {
+        nkeep++;
+        totnpix += catalogs[ti].npix[i];
+      }
+    }
+  }
+
+  /* build the merged catalog, in tile order */
+  QCALLOC(cat, sep_catalog, 1, status);
+  if ((status = alloc_catalog_fields(cat, (int)nkeep)) != RETURN_OK) {
+    goto exit;
+  }
+  if (haspix) {
+    status = alloc_catalog_pixels(cat, nkeep, totnpix, hasvalue, hasvar);
+    if (status != RETURN_OK) {
+      goto exit;
+    }
+  }
+
+  j = 0; /* output object */
+  k = 0; /* input object, over all tiles */
+  p = 0; /* position in objectspix */
+  for (ti = 0; ti < ntiles; ti++) {
+    c = catalogs + ti;
+    t = tiles + ti;
+    for (i = 0; i < c->nobj; i++, k++) {
+      if (!keep[k]) {
+        continue;
+      }
+      catalog_copy_object(cat, j, c, i, t->x0, t->y0);
+
+      /* linear pixel indices: tile -> mosaic */
+      if (haspix) {
+        cat->pix[j] = cat->objectspix + p;
+        catalog_copy_pixvalues(cat, p, c, i);
+        for (m = 0; m < c->npix[i]; m++, p++) {
+          cat->objectspix[p] = (c->pix[i][m] % t->w + t->x0)
+                               + (c->pix[i][m] / t->w + t->y0) * mosaicw;
+        }
+      }
+      j++;
+    }
+  }
+
+exit:
+  free(x);
+  free(y);
+  free(tile);
+  free(keep);
+  if (status != RETURN_OK) {
+    sep_catalog_free(cat);
+    cat = NULL;
+  }
+  *merged = cat;
+  return status;
+}
@@ -0,0 +1,917 @@
+/*%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+ *
+ * This file is part of SEP
+ *
+ * Copyright 2014 SEP developers
+ *
+ * Distributed under an MIT license.
+ *
+ *%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%*/
+
+/* Streaming catalog writers: FITS binary tables and Arrow IPC files.
+ *
+ * Rows are accumulated column by column in fixed-size buffers and written
+ * out every `rowgroup` rows (a block of table rows for FITS, one record
+ * batch for Arrow), so memory use does not grow with the catalog size.
+ */
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sep.h"
+#include "sepcore.h"
+
+#define CATWRITE_ROWGROUP 65536 /* default rows buffered per flush */
+#define FITS_BLOCK 2880 /* FITS record size in bytes */
+#define FITS_CARD 80 /* FITS header card size in bytes */
+
+/* column element types */
+#define COL_FLOAT 0 /* float32 (FITS 'E') */
+#define COL_DOUBLE 1 /* float64 (FITS 'D') */
+#define COL_INT64 2 /* int64   (FITS 'K') */
+#define COL_SHORT 3 /* int16   (FITS 'I') */
+
+typedef struct {
+  const char * name;
+  int type;
+  size_t offset; /* offset of the array pointer within sep_catalog */
+} catcolumn;
+
+#define CATCOL(name, type) {#name, type, offsetof(sep_catalog, name)}
+
+/* same names and order as the columns returned by the Python extract() */
+static const catcolumn catcolumns[] = {
+    CATCOL(thresh, COL_FLOAT), CATCOL(npix, COL_INT64),   CATCOL(tnpix, COL_INT64),
+    CATCOL(xmin, COL_INT64),   CATCOL(xmax, COL_INT64),   CATCOL(ymin, COL_INT64),
+    CATCOL(ymax, COL_INT64),   CATCOL(x, COL_DOUBLE),     CATCOL(y, COL_DOUBLE),
+    CATCOL(x2, COL_DOUBLE),    CATCOL(y2, COL_DOUBLE),    CATCOL(xy, COL_DOUBLE),
+    CATCOL(errx2, COL_DOUBLE), CATCOL(erry2, COL_DOUBLE), CATCOL(errxy, COL_DOUBLE),
+    CATCOL(a, COL_FLOAT),      CATCOL(b, COL_FLOAT),      CATCOL(theta, COL_FLOAT),
+    CATCOL(cxx, COL_FLOAT),    CATCOL(cyy, COL_FLOAT),    CATCOL(cxy, COL_FLOAT),
+    CATCOL(cflux, COL_FLOAT),  CATCOL(flux, COL_FLOAT),   CATCOL(cpeak, COL_FLOAT),
+    CATCOL(peak, COL_FLOAT),   CATCOL(xcpeak, COL_INT64), CATCOL(ycpeak, COL_INT64),
+    CATCOL(xpeak, COL_INT64),  CATCOL(ypeak, COL_INT64),  CATCOL(flag, COL_SHORT),
+};
+
+#define NCATCOLS ((int)(sizeof(catcolumns) / sizeof(catcolumn)))
+
+static const int64_t coltypesize[] = {4, 8, 8, 2};
+static const char coltypefits[] = {'E', 'D', 'K', 'I'};
+
+struct sep_catwriter {
+  FILE * f;
+  int format;
+  int64_t rowgroup; /* rows per flush */
+  int64_t nbuf; /* rows currently buffered */
+  int64_t nrows; /* rows written to file so far */
+  int64_t pos; /* current file offset */
+  BYTE * cols[NCATCOLS]; /* column buffers, native byte order */
+  BYTE * scratch; /* output staging buffer */
+
+  /* FITS */
+  long naxis2pos; /* file offset of the NAXIS2 card */
+
+  /* Arrow */
+  int64_t nblocks, blockcap;
+  int64_t * blockoff; /* file offset of each record batch message */
+  int64_t * blockmeta; /* metadata length of each record batch */
+  int64_t * blockbody; /* body length of each record batch */
+};
+
+
+/*****************************************************************************/
+/* byte order helpers */
+
+/* store an n-byte value in little- or big-endian order */
+static void store_le(BYTE * dst, uint64_t v, int n) {
+  int i;
+  for (i = 0; i < n; i++) {
+    dst[i] = (BYTE)(v >> (8 * i));
+  }
+}
+
+static void store_be(BYTE * dst, uint64_t v, int n) {
+  int i;
+  for (i = 0; i < n; i++) {
+    dst[n - 1 - i] = (BYTE)(v >> (8 * i));
+  }
+}
+
+/* read an n-byte native-order value as an unsigned integer */
+static uint64_t load_native(const BYTE * src, int n) {
+  uint16_t v16;
+  uint32_t v32;
+  uint64_t v64;
+
+  switch (n) {
+  case 2:
+    memcpy(&v16, src, 2);
+    return v16;
+  case 4:
+    memcpy(&v32, src, 4);
+    return v32;
+  default:
+    memcpy(&v64, src, 8);
+    return v64;
+  }
+}
+
+static int write_bytes(sep_catwriter * w, const void * buf, size_t n) {
+  if (n && fwrite(buf, 1, n, w->f) != n) {
+    put_errdetail("error writing catalog file");
+    return FILE_IO_ERROR;
+  }
+  w->pos += (int64_t)n;
+  return RETURN_OK;
+}
+
+static int write_zeros(sep_catwriter * w, size_t n) {
+  static const BYTE zeros[64] = {0};
+  size_t m;
+  int status = RETURN_OK;
+
+  while (n && status == RETURN_OK) {
+    m = n < sizeof(zeros) ? n : sizeof(zeros);
+    status = write_bytes(w, zeros, m);
+    n -= m;
+  }
+  return status;
+}
+
+
+/*****************************************************************************/
+/* FITS binary table */
+
+/* format one 80-character header card */
+static void fits_card(char * card, const char * key, const char * value, int isstr) {
+  char tmp[FITS_CARD + 1];
+
+  if (value == NULL) {
+    snprintf(tmp, sizeof(tmp), "%-8s", key);
+  } else if (isstr) {
+    snprintf(tmp, sizeof(tmp), "%-8s= '%-8s'", key, value);
+  } else {
+    snprintf(tmp, sizeof(tmp), "%-8s= %20s", key, value);
+  }
+  memset(card, ' ', FITS_CARD);
+  memcpy(card, tmp, strlen(tmp));
+}
+
+static int fits_write_header(sep_catwriter * w) {
+  char *hdr, value[32];
+  int64_t ncards, nbytes, rowbytes;
+  int i, status;
+
+  status = RETURN_OK;
+  ncards = 9 + 2 * NCATCOLS; /* generous upper bound on card count */
+  nbytes = ((ncards * FITS_CARD + FITS_BLOCK - 1) / FITS_BLOCK) * FITS_BLOCK;
+  QMALLOC(hdr, char, nbytes, status);
+
+  /* empty primary HDU */
+  memset(hdr, ' ', FITS_BLOCK);
+  fits_card(hdr, "SIMPLE", "T", 0);
+  fits_card(hdr + FITS_CARD, "BITPIX", "8", 0);
+  fits_card(hdr + 2 * FITS_CARD, "NAXIS", "0", 0);
+  fits_card(hdr + 3 * FITS_CARD, "EXTEND", "T", 0);
+  fits_card(hdr + 4 * FITS_CARD, "END", NULL, 0);
+  status = write_bytes(w, hdr, FITS_BLOCK);
+  if (status != RETURN_OK) {
+    goto exit;
+  }
+
+  /* binary table extension; NAXIS2 is rewritten at close */
+  rowbytes = 0;
+  for (i = 0; i < NCATCOLS; i++) {
+    rowbytes += coltypesize[catcolumns[i].type];
+  }
+
+  memset(hdr, ' ', nbytes);
+  ncards = 0;
+  fits_card(hdr + FITS_CARD * ncards++, "XTENSION", "BINTABLE", 1);
+  fits_card(hdr + FITS_CARD * ncards++, "BITPIX", "8", 0);
+  fits_card(hdr + FITS_CARD * ncards++, "NAXIS", "2", 0);
+  sprintf(value, "%lld", (long long)rowbytes);
+  fits_card(hdr + FITS_CARD * ncards++, "NAXIS1", value, 0);
+  w->naxis2pos = (long)(w->pos + FITS_CARD * ncards);
+  fits_card(hdr + FITS_CARD * ncards++, "NAXIS2", "0", 0);
+  fits_card(hdr + FITS_CARD * ncards++, "PCOUNT", "0", 0);
+  fits_card(hdr + FITS_CARD * ncards++, "GCOUNT", "1", 0);
+  sprintf(value, "%d", NCATCOLS);
+  fits_card(hdr + FITS_CARD * ncards++, "TFIELDS", value, 0);
+  for (i = 0; i < NCATCOLS; i++) {
+    char key[9];
+    sprintf(key, "TTYPE%d", i + 1);
+    fits_card(hdr + FITS_CARD * ncards++, key, catcolumns[i].name, 1);
+    sprintf(key, "TFORM%d", i + 1);
+    sprintf(value, "%c", coltypefits[catcolumns[i].type]);
+    fits_card(hdr + FITS_CARD * ncards++, key, value, 1);
+  }
+  fits_card(hdr + FITS_CARD * ncards++, "END", NULL, 0);
+  nbytes = ((ncards * FITS_CARD + FITS_BLOCK - 1) / FITS_BLOCK) * FITS_BLOCK;
+  status = write_bytes(w, hdr, nbytes);
+
+exit:
+  free(hdr);
+  return status;
+}
+
+/* transpose buffered columns into big-endian rows and write them */
+static int fits_flush(sep_catwriter * w) {
+  BYTE * row;
+  int64_t i, size;
+  int j;
+
+  row = w->scratch;
+  for (i = 0; i < w->nbuf; i++) {
+    for (j = 0; j < NCATCOLS; j++) {
+      size = coltypesize[catcolumns[j].type];
+      store_be(row, load_native(w->cols[j] + i * size, (int)size), (int)size);
+      row += size;
+    }
+  }
+  return write_bytes(w, w->scratch, (size_t)(row - w->scratch));
+}
+
+static int fits_close(sep_catwriter * w) {
+  char card[FITS_CARD], value[32];
+  int64_t datasize;
+  int status;
+
+  /* pad data to a whole number of FITS records */
+  datasize = w->pos % FITS_BLOCK;
+  status = write_zeros(w, datasize ? FITS_BLOCK - datasize : 0);
+  if (status != RETURN_OK) {
+    return status;
+  }
+
+  sprintf(value, "%lld", (long long)w->nrows);
+  fits_card(card, "NAXIS2", value, 0);
+  if (fseek(w->f, w->naxis2pos, SEEK_SET) != 0
+      || fwrite(card, 1, FITS_CARD, w->f) != FITS_CARD)
+  {
+    put_errdetail("error updating NAXIS2 in catalog file");
+    return FILE_IO_ERROR;
+  }
+  return RETURN_OK;
+}
+
+
+/*****************************************************************************/
+/* Minimal FlatBuffers builder, enough to encode Arrow IPC metadata.
+ *
+ * As in the reference implementation, the buffer is filled from the end
+ * towards the start, so that children are always created before the
+ * tables that refer to them. Objects are referred to by their distance
+ * from the end of the buffer. */
+
+#define FB_MAXSLOTS 8
+
+typedef struct {
+  BYTE * buf;
+  int64_t cap; /* allocated size */
+  int64_t head; /* data occupies buf[head, cap) */
+  int64_t minalign;
+  int64_t tstart; /* size when the current table was started */
+  int64_t slots[FB_MAXSLOTS]; /* size when each field was added (0: absent) */
+  int nslots;
+} fbbuilder;
+
+static int64_t fb_size(const fbbuilder * b) {
+  return b->cap - b->head;
+}
+
+static int fb_reserve(fbbuilder * b, int64_t n) {
+  int64_t newcap, size;
+  BYTE * newbuf;
+
+  if (b->head >= n) {
+    return RETURN_OK;
+  }
+  size = fb_size(b);
+  newcap = b->cap ? b->cap : 256;
+  while (newcap - size < n) {
+    newcap *= 2;
+  }
+  if (!(newbuf = malloc((size_t)newcap))) {
+    return MEMORY_ALLOC_ERROR;
+  }
+  if (size) {
+    memcpy(newbuf + newcap - size, b->buf + b->head, (size_t)size);
+  }
+  free(b->buf);
+  b->buf = newbuf;
+  b->cap = newcap;
+  b->head = newcap - size;
+  return RETURN_OK;
+}
+
+/* pad so that, once `additional` bytes are added, the size is a multiple
+ * of `align` */
+static int fb_align(fbbuilder * b, int64_t align, int64_t additional) {
+  int64_t pad;
+  int status;
+
+  if (align > b->minalign) {
+    b->minalign = align;
+  }
+  pad = (-(fb_size(b) + additional)) & (align - 1);
+  if ((status = fb_reserve(b, pad + additional)) != RETURN_OK) {
+    return status;
+  }
+  b->head -= pad;
+  memset(b->buf + b->head, 0, (size_t)pad);
+  return RETURN_OK;
+}
+
+static int fb_push(fbbuilder * b, uint64_t v, int n) {
+  int status;
+  if ((status = fb_align(b, n, n)) != RETURN_OK) {
+    return status;
+  }
+  b->head -= n;
+  store_le(b->buf + b->head, v, n);
+  return RETURN_OK;
+}
+
+/* push a reference to an earlier object, relative to its own position */
+static int fb_push_ref(fbbuilder * b, int64_t ref) {
+  int status;
+  if ((status = fb_align(b, 4, 4)) != RETURN_OK) {
+    return status;
+  }
+  return fb_push(b, (uint64_t)(fb_size(b) + 4 - ref), 4);
+}
+
+static int fb_string(fbbuilder * b, const char * s, int64_t * ref) {
+  int64_t len = (int64_t)strlen(s);
+  int status;
+
+  if ((status = fb_align(b, 4, len + 1)) != RETURN_OK) {
+    return status;
+  }
+  b->head -= len + 1;
+  memcpy(b->buf + b->head, s, (size_t)len + 1);
+  if ((status = fb_push(b, (uint64_t)len, 4)) != RETURN_OK) {
+    return status;
+  }
+  *ref = fb_size(b);
+  return RETURN_OK;
+}
+
+/* vector of references to earlier objects */
+static int fb_refvector(fbbuilder * b, const int64_t * refs, int64_t n, int64_t * ref) {
+  int64_t i;
+  int status;
+
+  if ((status = fb_align(b, 4, 4 * n)) != RETURN_OK) {
+    return status;
+  }
+  for (i = n - 1; i >= 0; i--) {
+    if ((status = fb_push_ref(b, refs[i])) != RETURN_OK) {
+      return status;
+    }
+  }
+  if ((status = fb_push(b, (uint64_t)n, 4)) != RETURN_OK) {
+    return status;
+  }
+  *ref = fb_size(b);
+  return RETURN_OK;
+}
+
+/* vector of structs made of `nfields` 8-byte little-endian fields each */
+static int fb_structvector(
+    fbbuilder * b,
+    const int64_t * values,
+    int64_t n,
+    int nfields,
+    int64_t * ref
+) {
+  int64_t i;
+  int status;
+
+  if ((status = fb_align(b, 4, 8 * n * nfields)) != RETURN_OK
+      || (status = fb_align(b, 8, 8 * n * nfields)) != RETURN_OK)
+  {
+    return status;
+  }
+  for (i = n * nfields - 1; i >= 0; i--) {
+    if ((status = fb_push(b, (uint64_t)values[i], 8)) != RETURN_OK) {
+      return status;
+    }
+  }
+  if ((status = fb_push(b, (uint64_t)n, 4)) != RETURN_OK) {
+    return status;
+  }
+  *ref = fb_size(b);
+  return RETURN_OK;
+}
+
+static void fb_start_table(fbbuilder * b) {
+  memset(b->slots, 0, sizeof(b->slots));
+  b->nslots = 0;
+  b->tstart = fb_size(b);
+}
+
+static int fb_add_scalar(fbbuilder * b, int slot, uint64_t v, int n) {
+  int status;
+  if ((status = fb_push(b, v, n)) != RETURN_OK) {
+    return status;
+  }
+  b->slots[slot] = fb_size(b);
+  if (slot >= b->nslots) {
+    b->nslots = slot + 1;
+  }
+  return RETURN_OK;
+}
+
+static int fb_add_ref(fbbuilder * b, int slot, int64_t ref) {
+  int status;
+  if ((status = fb_push_ref(b, ref)) != RETURN_OK) {
+    return status;
+  }
+  b->slots[slot] = fb_size(b);
+  if (slot >= b->nslots) {
+    b->nslots = slot + 1;
+  }
+  return RETURN_OK;
+}
+
+static int fb_end_table(fbbuilder * b, int64_t * ref) {
+  int64_t tableref, vtableref;
+  int i, status;
+
+  /* placeholder for the offset to the vtable */
+  if ((status = fb_push(b, 0, 4)) != RETURN_OK) {
+    return status;
+  }
+  tableref = fb_size(b);
+
+  /* vtable: size of vtable, size of table, then one entry per field */
+  for (i = b->nslots - 1; i >= 0; i--) {
+    status = fb_push(b, b->slots[i] ? (uint64_t)(tableref - b->slots[i]) : 0, 2);
+    if (status != RETURN_OK) {
+      return status;
+    }
+  }
+  if ((status = fb_push(b, (uint64_t)(tableref - b->tstart), 2)) != RETURN_OK
+      || (status = fb_push(b, (uint64_t)(4 + 2 * b->nslots), 2)) != RETURN_OK)
+  {
+    return status;
+  }
+  vtableref = fb_size(b);
+
+  /* the table records where its vtable is (vtable = table - offset) */
+  store_le(b->buf + b->cap - tableref, (uint64_t)(vtableref - tableref), 4);
+  *ref = tableref;
+  return RETURN_OK;
+}
+
+static int fb_finish(fbbuilder * b, int64_t root) {
+  int status;
+  if ((status = fb_align(b, b->minalign, 4)) != RETURN_OK) {
+    return status;
+  }
+  return fb_push_ref(b, root);
+}
+
+static void fb_reset(fbbuilder * b) {
+  b->head = b->cap;
+  b->minalign = 1;
+}
+
+
+/*****************************************************************************/
+/* Arrow IPC file */
+
+/* Arrow flatbuffer enum values (Schema.fbs, Message.fbs) */
+#define ARROW_V5 4
+#define ARROW_HEADER_SCHEMA 1
+#define ARROW_HEADER_RECORDBATCH 3
+#define ARROW_TYPE_INT 2
+#define ARROW_TYPE_FLOAT 3
+#define ARROW_PRECISION_SINGLE 1
+#define ARROW_PRECISION_DOUBLE 2
+
+static const BYTE arrow_magic[8] = {'A', 'R', 'R', 'O', 'W', '1', 0, 0};
+
+/* add a Schema table describing the catalog columns */
+static int arrow_schema(fbbuilder * b, int64_t * ref) {
+  int64_t fields[NCATCOLS], name, type, children;
+  int i, t, status;
+
+  for (i = 0; i < NCATCOLS; i++) {
+    t = catcolumns[i].type;
+    if ((status = fb_string(b, catcolumns[i].name, &name)) != RETURN_OK) {
+      return status;
+    }
+
+    fb_start_table(b);
+    if (t == COL_FLOAT || t == COL_DOUBLE) {
+      status = fb_add_scalar(
+          b, 0, t == COL_FLOAT ? ARROW_PRECISION_SINGLE : ARROW_PRECISION_DOUBLE, 2
+      );
+    } else {
+      status = fb_add_scalar(b, 0, (uint64_t)(8 * coltypesize[t]), 4);
+      if (status == RETURN_OK) {
+        status = fb_add_scalar(b, 1, 1, 1); /* is_signed */
+      }
+    }
+    if (status != RETURN_OK || (status = fb_end_table(b, &type)) != RETURN_OK) {
+      return status;
+    }
+
+    if ((status = fb_refvector(b, NULL, 0, &children)) != RETURN_OK) {
+      return status;
+    }
+
+    fb_start_table(b);
+    if ((status = fb_add_ref(b, 0, name)) != RETURN_OK
+        || (status = fb_add_ref(b, 3, type)) != RETURN_OK
+        || (status = fb_add_ref(b, 5, children)) != RETURN_OK
+        || (status = fb_add_scalar(
+                b,
+                2,
+                (t == COL_FLOAT || t == COL_DOUBLE) ? ARROW_TYPE_FLOAT : ARROW_TYPE_INT,
+                1
+            ))
+               != RETURN_OK
+        || (status = fb_end_table(b, &fields[i])) != RETURN_OK)
+    {
+      return status;
+    }
+  }
+
+  if ((status = fb_refvector(b, fields, NCATCOLS, &children)) != RETURN_OK) {
+    return status;
+  }
+  fb_start_table(b);
+  if ((status = fb_add_ref(b, 1, children)) != RETURN_OK) {
+    return status;
+  }
+  return fb_end_table(b, ref);
+}
+
+/* write an encapsulated message: continuation marker, metadata length,
+ * flatbuffer padded to 8 bytes. Returns the total metadata length. */
+static int arrow_write_message(sep_catwriter * w, fbbuilder * b, int64_t * metalen) {
+  BYTE prefix[8];
+  int64_t size, pad;
+  int status;
+
+  size = fb_size(b);
+  pad = (-(size + 8)) & 7;
+  store_le(prefix, 0xFFFFFFFFu, 4);
+  store_le(prefix + 4, (uint64_t)(size + pad), 4);
+  if ((status = write_bytes(w, prefix, 8)) != RETURN_OK
+      || (status = write_bytes(w, b->buf + b->head, (size_t)size)) != RETURN_OK
+      || (status = write_zeros(w, (size_t)pad)) != RETURN_OK)
+  {
+    return status;
+  }
+  *metalen = 8 + size + pad;
+  return RETURN_OK;
+}
+
+static int arrow_message(
+    fbbuilder * b,
+    int headertype,
+    int64_t header,
+    int64_t bodylen
+) {
+  int64_t msg;
+  int status;
+
+  fb_start_table(b);
+  if ((status = fb_add_scalar(b, 3, (uint64_t)bodylen, 8)) != RETURN_OK
+      || (status = fb_add_ref(b, 2, header)) != RETURN_OK
+      || (status = fb_add_scalar(b, 0, ARROW_V5, 2)) != RETURN_OK
+      || (status = fb_add_scalar(b, 1, (uint64_t)headertype, 1)) != RETURN_OK
+      || (status = fb_end_table(b, &msg)) != RETURN_OK)
+  {
+    return status;
+  }
+  return fb_finish(b, msg);
+}
+
+static int arrow_write_header(sep_catwriter * w) {
+  fbbuilder b;
+  int64_t schema, metalen;
+  int status;
+
+  memset(&b, 0, sizeof(fbbuilder));
+  fb_reset(&b);
+
+  if ((status = write_bytes(w, arrow_magic, 8)) != RETURN_OK
+      || (status = arrow_schema(&b, &schema)) != RETURN_OK
+      || (status = arrow_message(&b, ARROW_HEADER_SCHEMA, schema, 0)) != RETURN_OK)
+  {
+    goto exit;
+  }
+  status = arrow_write_message(w, &b, &metalen);
+
+exit:
+  free(b.buf);
+  return status;
+}
+
+/* write buffered rows as one record batch */
+static int arrow_flush(sep_catwriter * w) {
+  fbbuilder b;
+  int64_t nodes[2 * NCATCOLS], buffers[4 * NCATCOLS];
+  int64_t bodylen, len, nodesref, buffersref, batch, metalen, offset;
+  int64_t *tmp;
+  int j, status;
+
+  memset(&b, 0, sizeof(fbbuilder));
+  fb_reset(&b);
+
+  /* body layout: for each column, an empty validity buffer followed by the
+   * values, padded to 8 bytes */
+  bodylen = 0;
+  for (j = 0; j < NCATCOLS; j++) {
+    len = w->nbuf * coltypesize[catcolumns[j].type];
+    nodes[2 * j] = w->nbuf;
+    nodes[2 * j + 1] = 0;
+    buffers[4 * j] = bodylen;
+    buffers[4 * j + 1] = 0;
+    buffers[4 * j + 2] = bodylen;
+    buffers[4 * j + 3] = len;
+    bodylen += (len + 7) & ~(int64_t)7;
+  }
+
+  if ((status = fb_structvector(&b, buffers, 2 * NCATCOLS, 2, &buffersref))
+          != RETURN_OK
+      || (status = fb_structvector(&b, nodes, NCATCOLS, 2, &nodesref)) != RETURN_OK)
+  {
+    goto exit;
+  }
+  fb_start_table(&b);
+  if ((status = fb_add_scalar(&b, 0, (uint64_t)w->nbuf, 8)) != RETURN_OK
+      || (status = fb_add_ref(&b, 1, nodesref)) != RETURN_OK
+      || (status = fb_add_ref(&b, 2, buffersref)) != RETURN_OK
+      || (status = fb_end_table(&b, &batch)) != RETURN_OK
+      || (status = arrow_message(&b, ARROW_HEADER_RECORDBATCH, batch, bodylen))
+             != RETURN_OK)
+  {
+    goto exit;
+  }
+
+  /* remember where this batch is, for the footer */
+  if (w->nblocks == w->blockcap) {
+    w->blockcap = w->blockcap ? 2 * w->blockcap : 16;
+    if (!(tmp = realloc(w->blockoff, w->blockcap * sizeof(int64_t)))) {
+      status = MEMORY_ALLOC_ERROR;
+      goto exit;
+    }
+    w->blockoff = tmp;
+    if (!(tmp = realloc(w->blockmeta, w->blockcap * sizeof(int64_t)))) {
+      status = MEMORY_ALLOC_ERROR;
+      goto exit;
+    }
+    w->blockmeta = tmp;
+    if (!(tmp = realloc(w->blockbody, w->blockcap * sizeof(int64_t)))) {
+      status = MEMORY_ALLOC_ERROR;
+      goto exit;
+    }
+    w->blockbody = tmp;
+  }
+  offset = w->pos;
+  if ((status = arrow_write_message(w, &b, &metalen)) != RETURN_OK) {
+    goto exit;
+  }
+  w->blockoff[w->nblocks] = offset;
+  w->blockmeta[w->nblocks] = metalen;
+  w->blockbody[w->nblocks] = bodylen;
+  w->nblocks++;
+
+  /* body: little-endian column values */
+  for (j = 0; j < NCATCOLS; j++) {
+    int size = (int)coltypesize[catcolumns[j].type];
+    int64_t i;
+    len = w->nbuf * size;
+    for (i = 0; i < w->nbuf; i++) {
+      store_le(w->scratch + i * size, load_native(w->cols[j] + i * size, size), size);
+    }
+    if ((status = write_bytes(w, w->scratch, (size_t)len)) != RETURN_OK
+        || (status = write_zeros(w, (size_t)(((len + 7) & ~(int64_t)7) - len)))
+               != RETURN_OK)
+    {
+      goto exit;
+    }
+  }
+
+exit:
+  free(b.buf);
+  return status;
+}
+
+static int arrow_close(sep_catwriter * w) {
+  fbbuilder b;
+  BYTE eos[8], tail[4];
+  int64_t *blocks, schema, blocksref, dictref, footer, size;
+  int64_t i;
+  int status;
+
+  memset(&b, 0, sizeof(fbbuilder));
+  fb_reset(&b);
+  blocks = NULL;
+  status = RETURN_OK;
+
+  /* end-of-stream marker */
+  store_le(eos, 0xFFFFFFFFu, 4);
+  store_le(eos + 4, 0, 4);
+  if ((status = write_bytes(w, eos, 8)) != RETURN_OK) {
+    goto exit;
+  }
+
+  /* footer: Block structs are {offset, metaDataLength (+ padding), bodyLength} */
+  QMALLOC(blocks, int64_t, 3 * w->nblocks + 1, status);
+  for (i = 0; i < w->nblocks; i++) {
+    blocks[3 * i] = w->blockoff[i];
+    blocks[3 * i + 1] = w->blockmeta[i];
+    blocks[3 * i + 2] = w->blockbody[i];
+  }
+  if ((status = fb_structvector(&b, blocks, w->nblocks, 3, &blocksref)) != RETURN_OK
+      || (status = fb_structvector(&b, NULL, 0, 3, &dictref)) != RETURN_OK
+      || (status = arrow_schema(&b, &schema)) != RETURN_OK)
+  {
+    goto exit;
+  }
+  fb_start_table(&b);
+  if ((status = fb_add_ref(&b, 1, schema)) != RETURN_OK
+      || (status = fb_add_ref(&b, 2, dictref)) != RETURN_OK
+      || (status = fb_add_ref(&b, 3, blocksref)) != RETURN_OK
+      || (status = fb_add_scalar(&b, 0, ARROW_V5, 2)) != RETURN_OK
+      || (status = fb_end_table(&b, &footer)) != RETURN_OK
+      || (status = fb_finish(&b, footer)) != RETURN_OK)
+  {
+    goto exit;
+  }
+
+  size = fb_size(&b);
+  store_le(tail, (uint64_t)size, 4);
+  if ((status = write_bytes(w, b.buf + b.head, (size_t)size)) != RETURN_OK
+      || (status = write_bytes(w, tail, 4)) != RETURN_OK)
+  {
+    goto exit;
+  }
+  status = write_bytes(w, arrow_magic, 6);
+
+exit:
+  free(blocks);
+  free(b.buf);
+  return status;
+}
+
+
+/*****************************************************************************/
+/* public interface */
+
+static void catwriter_free(sep_catwriter * w) {
+  int j;
+
+  if (w == NULL) {
+    return;
+  }
+  if (w->f) {
+    fclose(w->f);
+  }
+  for (j = 0; j < NCATCOLS; j++) {
+    free(w->cols[j]);
+  }
+  free(w->scratch);
+  free(w->blockoff);
+  free(w->blockmeta);
+  free(w->blockbody);
+  free(w);
+}
+
+int sep_catwriter_open(
+    const char * path,
+    int format,
+    int64_t rowgroup,
+    sep_catwriter ** writer
+) {
+  sep_catwriter * w;
+  char errtext[512];
+  int j, status;
+
+  status = RETURN_OK;
+  w = NULL;
+
+  if (format != SEP_CATFMT_FITS && format != SEP_CATFMT_ARROW) {
+    status = FILE_IO_ERROR;
+    put_errdetail("unknown catalog format");
+    goto exit;
+  }
+
+  QCALLOC(w, sep_catwriter, 1, status);
+  w->format = format;
+  w->rowgroup = rowgroup > 0 ? rowgroup : CATWRITE_ROWGROUP;
+
+  for (j = 0; j < NCATCOLS; j++) {
+    QMALLOC(w->cols[j], BYTE, w->rowgroup * coltypesize[catcolumns[j].type], status);
+  }
+  /* big enough for one full row group in FITS, or one column in Arrow */
+  QMALLOC(w->scratch, BYTE, w->rowgroup * 8 * NCATCOLS, status);
+
+  if (!(w->f = fopen(path, "wb"))) {
+    snprintf(errtext, sizeof(errtext), "%s: %s", path, strerror(errno));
+    put_errdetail(errtext);
+    status = FILE_IO_ERROR;
+    goto exit;
+  }
+
+  if (format == SEP_CATFMT_FITS) {
+    status = fits_write_header(w);
+  } else {
+    status = arrow_write_header(w);
+  }
+
+exit:
+  if (status != RETURN_OK) {
+    catwriter_free(w);
+    w = NULL;
+  }
+  *writer = w;
+  return status;
+}
+
+int sep_catwriter_flush(sep_catwriter * writer) {
+  int status;
+
+  if (writer->nbuf == 0) {
+    return RETURN_OK;
+  }
+  if (writer->format == SEP_CATFMT_FITS) {
+    status = fits_flush(writer);
+  } else {
+    status = arrow_flush(writer);
+  }
+  if (status == RETURN_OK) {
+    writer->nrows += writer->nbuf;
+    writer->nbuf = 0;
+  }
+  return status;
+}
+
+int sep_catwriter_write(sep_catwriter * writer, const sep_catalog * catalog) {
+  const BYTE * src;
+  int64_t i, n, size;
+  int j, status;
+
+  status = RETURN_OK;
+  i = 0;
+  while (i < catalog->nobj) {
+    /* copy as many rows as fit in the current row group */
+    n = writer->rowgroup - writer->nbuf;
+    if (n > catalog->nobj - i) {
+      n = catalog->nobj - i;
+    }
+    for (j = 0; j < NCATCOLS; j++) {
+      size = coltypesize[catcolumns[j].type];
+      memcpy(&src, (const BYTE *)catalog + catcolumns[j].offset, sizeof(src));
+      memcpy(writer->cols[j] + writer->nbuf * size, src + i * size, (size_t)(n * size));
+    }
+    writer->nbuf += n;
+    i += n;
+
+    if (writer->nbuf == writer->rowgroup) {
+      if ((status = sep_catwriter_flush(writer)) != RETURN_OK) {
+        return status;
+      }
+    }
+  }
+  return status;
+}
+
+int64_t sep_catwriter_nrows(const sep_catwriter * writer) {
+  return writer->nrows + writer->nbuf;
+}
+
+int sep_catwriter_close(sep_catwriter * writer) {
+  int status;
+
+  if (writer == NULL) {
+    return RETURN_OK;
+  }
+  status = sep_catwriter_flush(writer);
+  if (status == RETURN_OK) {
+    if (writer->format == SEP_CATFMT_FITS) {
+      status = fits_close(writer);
+    } else {
+      status = arrow_close(writer);
+    }
+  }
+  if (status == RETURN_OK && fclose(writer->f) != 0) {
+    put_errdetail("error closing catalog file");
+    status = FILE_IO_ERROR;
+  }
+  writer->f = NULL;
+  catwriter_free(writer);
+  return status;
+}
@@ -102,6 +102,127 @@ int convolve(
 }
 
 
+/* Split a kernel into a row and a column whose outer product it is.
+ *
+ * Returns 1 and fills row (convw elements) and col (convh elements) if
+ * every element agrees with the product to single precision, 0 otherwise.
+ */
+int conv_separate(
+    const float * conv, int64_t convw, int64_t convh, float * row, float * col
+) {
+  int64_t i, imax, cx, cy;
+  double amax, pivot;
+
+  /* the largest element fixes the scale of the row and column */
+  imax = 0;
+  amax = 0.0;
+  for (i = 0; i < convw * convh; i++) {
+    if (fabs(conv[i]) > amax) {
+      amax = fabs(conv[i]);
+      imax = i;
+    }
+  }
+  if (amax == 0.0) {
+    return 0;
+  }
+
+  pivot = conv[imax];
+  for (cx = 0; cx < convw; cx++) {
+    row[cx] = conv[(imax / convw) * convw + cx];
+  }
+  for (cy = 0; cy < convh; cy++) {
+    col[cy] = conv[cy * convw + imax % convw] / pivot;
+  }
+  for (i = 0; i < convw * convh; i++) {
+    if (fabs(conv[i] - (double)col[i / convw] * row[i % convw]) > 1.0e-6 * amax) {
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+
+/* Convolve one line of an image with a separable kernel.
+ *
+ * As convolve(), for the kernel whose element (cx, cy) is
+ * row[cx] * col[cy]: the buffer lines are first combined with the column
+ * weights, then the result is convolved with the row. This takes
+ * convw + convh rather than convw * convh operations per pixel.
+ *
+ * work : work buffer (buf->dw elements long)
+ */
+int convolve_separable(
+    arraybuffer * buf,
+    int64_t y,
+    const float * row,
+    const float * col,
+    int64_t convw,
+    int64_t convh,
+    PIXTYPE * work,
+    PIXTYPE * out
+) {
+  int64_t convw2, cx, cy, dcx, y0;
+  PIXTYPE * line; /* current line in input buffer */
+  PIXTYPE * outend; /* end of output buffer */
+  PIXTYPE *src, *dst, *dstend;
+  PIXTYPE c;
+
+  outend = out + buf->dw;
+  convw2 = convw / 2;
+  y0 = y - convh / 2; /* start line in image */
+
+  /* Cut off top of kernel if it extends beyond image */
+  if (y0 + convh > buf->dh) {
+    convh = buf->dh - y0;
+  }
+
+  /* cut off bottom of kernel if it extends beyond image */
+  if (y0 < 0) {
+    convh = convh + y0;
+    col += (-y0);
+    y0 = 0;
+  }
+
+  /* check that buffer has needed lines */
+  if ((y0 < buf->yoff) || (y0 + convh > buf->yoff + buf->bh)) {
+    return LINE_NOT_IN_BUF;
+  }
+
+  /* combine lines with the column weights */
+  memset(work, 0, buf->dw * sizeof(PIXTYPE));
+  for (cy = 0; cy < convh; cy++) {
+    line = buf->bptr + buf->bw * (y0 - buf->yoff + cy);
+    c = col[cy];
+    for (dst = work, dstend = work + buf->dw; dst < dstend;) {
+      *(dst++) += c * *(line++);
+    }
+  }
+
+  /* convolve the result with the row */
+  memset(out, 0, buf->dw * sizeof(PIXTYPE));
+  for (cx = 0; cx < convw; cx++) {
+    dcx = cx - convw2;
+    if (dcx >= 0) {
+      src = work + dcx;
+      dst = out;
+      dstend = outend - dcx;
+    } else {
+      src = work;
+      dst = out - dcx;
+      dstend = outend;
+    }
+
+    c = row[cx];
+    while (dst < dstend) {
+      *(dst++) += c * *(src++);
+    }
+  }
+
+  return RETURN_OK;
+}
+
+
 /* Apply a matched filter to one line of an image with a given kernel.
  *
  * Calculates
@@ -34,6 +34,8 @@
 #define RAND_MAX 2147483647
 #endif
 #define NBRANCH 16 /* starting number per branch */
+#define SUBMAP_SMALL 65536 /* boxes (pixels) always given a dense submap */
+#define SUBMAP_MINFILL 8 /* else dense if at least 1 pixel in this many */
 
 static _Atomic int nsonmax = 1024; /* max. number sub-objects per level */
 
@@ -48,9 +50,10 @@ int sep_get_sub_object_limit() {
 
 
 int belong(int, objliststruct *, int, objliststruct *);
-int64_t *
-createsubmap(objliststruct *, int64_t, int64_t *, int64_t *, int64_t *, int64_t *);
-int gatherup(objliststruct *, objliststruct *);
+int createsubmap(objliststruct *, int64_t, submapstruct *);
+void freesubmap(submapstruct *);
+int64_t submapslot(const submapstruct *, int64_t, int64_t);
+int gatherup(objliststruct *, objliststruct *, const submapstruct *);
 
 /******************************** deblend ************************************/
 /*
@@ -71,11 +74,11 @@ int deblend(
   objstruct * obj;
   objliststruct debobjlist, debobjlist2;
   double thresh, thresh0, value0;
-  int64_t h, i, j, k, l, m, subx, suby, subh, subw, xn, nbm = NBRANCH;
-  int64_t * submap;
+  int64_t h, i, j, k, l, m, xn, nbm = NBRANCH;
+  submapstruct submap;
   int status;
 
-  submap = NULL;
+  memset(&submap, 0, sizeof(submapstruct));
   status = RETURN_OK;
   xn = deblend_nthresh;
   l = 0;
@@ -94,9 +97,7 @@ int deblend(
    * The submap is used in lutz(). We create it here because we may call
    * lutz multiple times below, and we only want to create it once.
    */
-  submap = createsubmap(objlistin, l, &subx, &suby, &subw, &subh);
-  if (!submap) {
-    status = MEMORY_ALLOC_ERROR;
+  if ((status = createsubmap(objlistin, l, &submap)) != RETURN_OK) {
     goto exit;
   }
 
@@ -130,10 +131,7 @@ int deblend(
       for (i = 0; i < objlist[k - 1].nobj; i++) {
         status = lutz(
             objlistin->plist,
-            submap,
-            subx,
-            suby,
-            subw,
+            &submap,
             &objlist[k - 1].obj[i],
             &debobjlist,
             minarea,
@@ -201,7 +199,7 @@ int deblend(
     if (ctx->ok[0]) {
       status = addobjdeep(0, &debobjlist2, objlistout);
     } else {
-      status = gatherup(&debobjlist2, objlistout);
+      status = gatherup(&debobjlist2, objlistout, &submap);
     }
   }
 
@@ -214,8 +212,7 @@ exit:
     );
   }
 
-  free(submap);
-  submap = NULL;
+  freesubmap(&submap);
   free(debobjlist2.obj);
   free(debobjlist2.plist);
 
@@ -266,19 +263,59 @@ void freedeblend(deblendctx * ctx) {
   ctx->objlist = NULL;
 }
 
+/******************************* shapeseed *********************************/
+/*
+Seed for the random draws of gatherup(), from the pixel count, bounding box
+size and first pixel of the parent object relative to its box. It does not
+depend on where the object is or on which objects were deblended before, so
+an object deblends the same way in a full extraction and in a region
+extracted by sep_extract_update().
+*/
+static unsigned int shapeseed(const objliststruct * objlist) {
+  pliststruct *pixel = objlist->plist, *pixt;
+  int64_t n, x, y, xmin, xmax, ymin, ymax, x0, y0;
+  uint64_t h;
+
+  pixt = pixel + objlist->obj->firstpix;
+  x0 = xmin = xmax = PLIST(pixt, x);
+  y0 = ymin = ymax = PLIST(pixt, y);
+  for (n = 0; pixt >= pixel; pixt = pixel + PLIST(pixt, nextpix), n++) {
+    x = PLIST(pixt, x);
+    y = PLIST(pixt, y);
+    xmin = x < xmin ? x : xmin;
+    xmax = x > xmax ? x : xmax;
+    ymin = y < ymin ? y : ymin;
+    ymax = y > ymax ? y : ymax;
+  }
+
+  /* FNV-1a over the five values */
+  h = 14695981039346656037ULL;
+  h = (h ^ (uint64_t)n) * 1099511628211ULL;
+  h = (h ^ (uint64_t)(xmax - xmin)) * 1099511628211ULL;
+  h = (h ^ (uint64_t)(ymax - ymin)) * 1099511628211ULL;
+  h = (h ^ (uint64_t)(x0 - xmin)) * 1099511628211ULL;
+  h = (h ^ (uint64_t)(y0 - ymin)) * 1099511628211ULL;
+  return (unsigned int)(h ^ (h >> 32));
+}
+
 /********************************* gatherup **********************************/
 /*
 Collect faint remaining pixels and allocate them to their most probable
-progenitor.
+progenitor. Pixels already allocated are flagged by their slot in the submap
+of the parent object. Contested pixels are drawn at random, with a seed
+taken from the shape of the parent (see shapeseed()).
 */
-int gatherup(objliststruct * objlistin, objliststruct * objlistout) {
+int gatherup(
+    objliststruct * objlistin, objliststruct * objlistout, const submapstruct * submap
+) {
   char * bmp;
   float *amp, *p, dx, dy, drand, dist, distmin;
   objstruct *objin = objlistin->obj, *objout, *objt;
 
   pliststruct *pixelin = objlistin->plist, *pixelout, *pixt, *pixt2;
 
-  int64_t i, k, l, *n, iclst, npix, bmwidth, nobj = objlistin->nobj, xs, ys, x, y;
+  int64_t i, k, l, *n, iclst, nslot, slot, nobj = objlistin->nobj, x, y;
+  unsigned int seed;
   int status;
 
   bmp = NULL;
@@ -287,6 +324,7 @@ int gatherup(objliststruct * objlistin, objliststruct * objlistout) {
   status = RETURN_OK;
 
   objlistout->thresh = objlistin->thresh;
+  seed = shapeseed(objlistin);
 
   QMALLOC(amp, float, nobj, status);
   QMALLOC(p, float, nobj, status);
@@ -297,9 +335,8 @@ int gatherup(objliststruct * objlistin, objliststruct * objlistout) {
   }
 
   p[0] = 0.0;
-  bmwidth = objin->xmax - (xs = objin->xmin) + 1;
-  npix = bmwidth * (objin->ymax - (ys = objin->ymin) + 1);
-  if (!(bmp = (char *)calloc(1, npix * sizeof(char)))) {
+  nslot = submap->map ? submap->subw * submap->subh : submap->npix;
+  if (!(bmp = (char *)calloc(1, nslot * sizeof(char)))) {
     bmp = NULL;
     status = MEMORY_ALLOC_ERROR;
     goto exit;
@@ -313,7 +350,9 @@ int gatherup(objliststruct * objlistin, objliststruct * objlistout) {
     for (pixt = pixelin + objin[i].firstpix; pixt >= pixelin;
          pixt = pixelin + PLIST(pixt, nextpix))
     {
-      bmp[(PLIST(pixt, x) - xs) + (PLIST(pixt, y) - ys) * bmwidth] = '\1';
+      if ((slot = submapslot(submap, PLIST(pixt, x), PLIST(pixt, y))) >= 0) {
+        bmp[slot] = '\1';
+      }
     }
 
     status = addobjdeep(i, objlistin, objlistout);
@@ -333,7 +372,9 @@ int gatherup(objliststruct * objlistin, objliststruct * objlistout) {
 
   objout = objlistout->obj; /* DO NOT MOVE !!! */
 
-  if (!(pixelout = realloc(objlistout->plist, (objlistout->npix + npix) * plistsize))) {
+  if (!(pixelout =
+            realloc(objlistout->plist, (objlistout->npix + submap->npix) * plistsize)))
+  {
     status = MEMORY_ALLOC_ERROR;
     goto exit;
   }
@@ -346,7 +387,7 @@ int gatherup(objliststruct * objlistin, objliststruct * objlistout) {
   {
     x = PLIST(pixt, x);
     y = PLIST(pixt, y);
-    if (!bmp[(x - xs) + (y - ys) * bmwidth]) {
+    if ((slot = submapslot(submap, x, y)) < 0 || !bmp[slot]) {
       pixt2 = pixelout + (l = (k++ * plistsize));
       memcpy(pixt2, pixt, (size_t)plistsize);
       PLIST(pixt2, nextpix) = -1;
@@ -363,7 +404,7 @@ int gatherup(objliststruct * objlistin, objliststruct * objlistout) {
         }
       }
       if (p[nobj - 1] > 1.0e-31) {
-        drand = p[nobj - 1] * rand_r(&randseed) / (float)RAND_MAX;
+        drand = p[nobj - 1] * rand_r(&seed) / (float)RAND_MAX;
         for (i = 1; i < nobj && p[i] < drand; i++)
           ;
         if (i == nobj) {
@@ -414,43 +455,159 @@ int belong(
 }
 
 
+/* order (x, index) pairs along x */
+static int cmp_runpix(const void * a, const void * b) {
+  const int64_t *p = a, *q = b;
+  return (p[0] > q[0]) - (p[0] < q[0]);
+}
+
 /******************************** createsubmap *******************************/
 /*
-Create pixel-index submap for deblending.
+Create pixel-index submap for deblending. Objects that fill a fair part of
+their bounding box get a dense map; others (streaks, rings, haloes) are
+stored as runs of pixels along each row, so that memory and time follow the
+number of pixels rather than the box.
 */
-int64_t * createsubmap(
-    objliststruct * objlistin,
-    int64_t no,
-    int64_t * subx,
-    int64_t * suby,
-    int64_t * subw,
-    int64_t * subh
-) {
+int createsubmap(objliststruct * objlistin, int64_t no, submapstruct * submap) {
   objstruct * obj;
   pliststruct *pixel, *pixt;
-  int64_t i, n, xmin, ymin, w, *pix, *pt, *submap;
+  int64_t i, j, k, r, n, nrun, xmin, ymin, w, h, *pix, *pt, *start, *key;
+  int status;
+
+  status = RETURN_OK;
+  start = key = NULL;
+  memset(submap, 0, sizeof(submapstruct));
 
   obj = objlistin->obj + no;
   pixel = objlistin->plist;
 
-  *subx = xmin = obj->xmin;
-  *suby = ymin = obj->ymin;
-  *subw = w = obj->xmax - xmin + 1;
-  *subh = obj->ymax - ymin + 1;
-
-  n = w * *subh;
-  if (!(submap = pix = malloc(n * sizeof(int64_t)))) {
-    return NULL;
+  submap->subx = xmin = obj->xmin;
+  submap->suby = ymin = obj->ymin;
+  submap->subw = w = obj->xmax - xmin + 1;
+  submap->subh = h = obj->ymax - ymin + 1;
+  for (i = obj->firstpix; i != -1; i = PLIST(pixel + i, nextpix)) {
+    submap->npix++;
   }
-  pt = pix;
-  for (i = n; i--;) {
-    *(pt++) = -1;
+
+  n = w * h;
+  if (n <= SUBMAP_SMALL || submap->npix * SUBMAP_MINFILL >= n) {
+    QMALLOC(submap->map, int64_t, n, status);
+    pix = pt = submap->map;
+    for (i = n; i--;) {
+      *(pt++) = -1;
+    }
+
+    for (i = obj->firstpix; i != -1; i = PLIST(pixt, nextpix)) {
+      pixt = pixel + i;
+      *(pix + (PLIST(pixt, x) - xmin) + (PLIST(pixt, y) - ymin) * w) = i;
+    }
+    return status;
   }
 
+  /* bucket (x, index) pairs by row, then sort each row along x */
+  QCALLOC(start, int64_t, h + 1, status);
+  QMALLOC(key, int64_t, 2 * submap->npix, status);
+  for (i = obj->firstpix; i != -1; i = PLIST(pixel + i, nextpix)) {
+    start[PLIST(pixel + i, y) - ymin + 1]++;
+  }
+  for (r = 0; r < h; r++) {
+    start[r + 1] += start[r];
+  }
   for (i = obj->firstpix; i != -1; i = PLIST(pixt, nextpix)) {
     pixt = pixel + i;
-    *(pix + (PLIST(pixt, x) - xmin) + (PLIST(pixt, y) - ymin) * w) = i;
+    k = start[PLIST(pixt, y) - ymin]++;
+    key[2 * k] = PLIST(pixt, x);
+    key[2 * k + 1] = i;
+  }
+  for (r = h; r > 0; r--) {
+    start[r] = start[r - 1];
+  }
+  start[0] = 0;
+
+  /* count the runs of consecutive pixels */
+  nrun = 0;
+  for (r = 0; r < h; r++) {
+    n = start[r + 1] - start[r];
+    pt = key + 2 * start[r];
+    for (j = 1; j < n && pt[2 * j] > pt[2 * j - 2]; j++)
+      ;
+    if (j < n) {
+      qsort(pt, (size_t)n, 2 * sizeof(int64_t), cmp_runpix);
+    }
+    for (j = 0; j < n; j++) {
+      nrun += (j == 0 || pt[2 * j] != pt[2 * j - 2] + 1);
+    }
   }
 
-  return submap;
+  QMALLOC(submap->rows, int64_t, h + 1, status);
+  QMALLOC(submap->runs, int64_t, 3 * nrun, status);
+  QMALLOC(submap->index, int64_t, submap->npix, status);
+  pt = submap->runs - 3;
+  for (r = k = 0; r < h; r++) {
+    submap->rows[r] = (pt + 3 - submap->runs) / 3;
+    for (j = start[r]; j < start[r + 1]; j++) {
+      if (j == start[r] || key[2 * j] != key[2 * j - 2] + 1) {
+        pt += 3;
+        pt[0] = key[2 * j];
+        pt[2] = j;
+      }
+      pt[1] = key[2 * j] + 1;
+      submap->index[j] = key[2 * j + 1];
+    }
+  }
+  submap->rows[h] = nrun;
+
+exit:
+  free(start);
+  free(key);
+  if (status != RETURN_OK) {
+    freesubmap(submap);
+  }
+  return status;
+}
+
+/********************************* freesubmap ********************************/
+void freesubmap(submapstruct * submap) {
+  free(submap->map);
+  free(submap->rows);
+  free(submap->runs);
+  free(submap->index);
+  memset(submap, 0, sizeof(submapstruct));
+}
+
+/********************************* submapslot ********************************/
+/*
+Slot of pixel (x, y) in a submap, or -1 if it is not part of the object.
+*/
+int64_t submapslot(const submapstruct * submap, int64_t x, int64_t y) {
+  const int64_t * run;
+  int64_t lo, hi, mid, slot;
+
+  x -= submap->subx;
+  y -= submap->suby;
+  if (x < 0 || y < 0 || x >= submap->subw || y >= submap->subh) {
+    return -1;
+  }
+  if (submap->map) {
+    slot = x + y * submap->subw;
+    return submap->map[slot] < 0 ? -1 : slot;
+  }
+
+  /* last run of the row starting at or before x */
+  x += submap->subx;
+  lo = submap->rows[y];
+  hi = submap->rows[y + 1];
+  while (hi - lo > 1) {
+    mid = (lo + hi) / 2;
+    if (submap->runs[3 * mid] <= x) {
+      lo = mid;
+    } else {
+      hi = mid;
+    }
+  }
+  if (lo == hi) {
+    return -1;
+  }
+  run = submap->runs + 3 * lo;
+  return (run[0] <= x && x < run[1]) ? run[2] + x - run[0] : -1;
 }
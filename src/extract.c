@@ -36,14 +36,15 @@
 #define DETECT_MAXAREA 0 /* replaces prefs.ext_maxarea */
 #define WTHRESH_CONVFAC 1e-4 /* Factor to apply to weights when */
 /* thresholding filtered weight-maps */
+#define SEGSORT_CHUNK 64 /* segmentation map objects per parallel task */
 
 /* globals */
 _Thread_local int64_t plistexist_cdvalue, plistexist_thresh, plistexist_var;
 _Thread_local int64_t plistoff_value, plistoff_cdvalue, plistoff_thresh, plistoff_var;
 _Thread_local int64_t plistsize;
-_Thread_local unsigned int randseed;
 static _Atomic size_t extract_pixstack = 300000;
 static _Atomic size_t extract_object_limit = 5000;
+static _Thread_local int extract_pixvalues = 0; /* per calling thread */
 
 /* get and set pixstack */
 void sep_set_extract_pixstack(size_t val) {
@@ -63,6 +64,43 @@ size_t sep_get_extract_object_limit() {
   return extract_object_limit;
 }
 
+/* get and set export of pixel values */
+void sep_set_extract_pixvalues(int val) {
+  extract_pixvalues = val;
+}
+
+int sep_get_extract_pixvalues() {
+  return extract_pixvalues;
+}
+
+/* an id of a segmentation map and its index in image->segids */
+typedef struct {
+  int64_t id, index;
+} segentry;
+
+static int segentry_cmp(const void * a, const void * b) {
+  const segentry *ea = a, *eb = b;
+  if (ea->id != eb->id) {
+    return ea->id < eb->id ? -1 : 1;
+  }
+  return ea->index < eb->index ? -1 : ea->index > eb->index;
+}
+
+/* index of the first occurrence of `id` in image->segids, or -1 */
+static int64_t segentry_find(const segentry * tab, int64_t n, int64_t id) {
+  int64_t lo = 0, hi = n, mid;
+
+  while (lo < hi) {
+    mid = lo + (hi - lo) / 2;
+    if (tab[mid].id < id) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return (lo < n && tab[lo].id == id) ? tab[lo].index : -1;
+}
+
 int sortit(
     infostruct * info,
     objliststruct * objlist,
@@ -73,12 +111,7 @@ int sortit(
     double gain,
     deblendctx * deblendctx
 );
-int segsortit(
-    infostruct * info,
-    objliststruct * objlist,
-    objliststruct * finalobjlist,
-    double gain
-);
+int segsort(infostruct * idinfo, int64_t nobj, objliststruct * objlist, double gain);
 void plistinit(int hasconv, int hasvar);
 void clean(objliststruct * objlist, double clean_param, int * survives);
 PIXTYPE get_mean_thresh(infostruct * info, pliststruct * pixel);
@@ -89,6 +122,25 @@ int convert_to_catalog(
     int64_t w,
     int include_pixels
 );
+int extract_with_bkg(
+    const sep_image * image,
+    const sep_bkg * bkg,
+    int bkgnoise,
+    float thresh,
+    int thresh_type,
+    int minarea,
+    const float * conv,
+    int64_t convw,
+    int64_t convh,
+    int filter_type,
+    int deblend_nthresh,
+    double deblend_cont,
+    int clean_flag,
+    double clean_param,
+    sep_catalog ** catalog
+);
+int sep_bkg_line_flt(const sep_bkg * bkg, int64_t y, float * line);
+int sep_bkg_rmsline_flt(const sep_bkg * bkg, int64_t y, float * line);
 
 int arraybuffer_init(
     arraybuffer * buf,
@@ -99,7 +151,31 @@ int arraybuffer_init(
     int64_t bufw,
     int64_t bufh
 );
-void arraybuffer_readline(arraybuffer * buf);
+int arraybuffer_init_combined(
+    arraybuffer * buf,
+    const void * arr,
+    int dtype,
+    int64_t stride,
+    PIXTYPE val,
+    const void * tarr,
+    int tdtype,
+    int64_t tstride,
+    PIXTYPE tval,
+    PIXTYPE tscale,
+    int tmode,
+    const sep_bkg * bkg,
+    int bmode,
+    const void * mask,
+    int mdtype,
+    int64_t mstride,
+    double mthresh,
+    PIXTYPE mval,
+    int64_t w,
+    int64_t h,
+    int64_t bufw,
+    int64_t bufh
+);
+int arraybuffer_readline(arraybuffer * buf);
 void arraybuffer_free(arraybuffer * buf);
 
 /********************* array buffer functions ********************************/
@@ -114,6 +190,42 @@ int arraybuffer_init(
     int64_t h,
     int64_t bufw,
     int64_t bufh
+) {
+  return arraybuffer_init_combined(
+      buf, arr, dtype, 0, 0.0, NULL, 0, 0, 0.0, 0.0, ARRAYBUF_NONE, NULL, 0, NULL, 0, 0,
+      0.0, 0.0, w, h, bufw, bufh
+  );
+}
+
+/* initialize a buffer whose lines combine two arrays (see ARRAYBUF_*).
+ * If `arr` (`tarr`) is NULL, the constant `val` (`tval`) is used in its
+ * place. If `bkg` is not NULL, the background or its rms is then
+ * applied as set by `bmode`. Finally, if `mask` is not NULL, pixels whose
+ * mask value is above `mthresh` are set to `mval`. Each array has a row
+ * stride in bytes, or 0 if its rows are contiguous. */
+int arraybuffer_init_combined(
+    arraybuffer * buf,
+    const void * arr,
+    int dtype,
+    int64_t stride,
+    PIXTYPE val,
+    const void * tarr,
+    int tdtype,
+    int64_t tstride,
+    PIXTYPE tval,
+    PIXTYPE tscale,
+    int tmode,
+    const sep_bkg * bkg,
+    int bmode,
+    const void * mask,
+    int mdtype,
+    int64_t mstride,
+    double mthresh,
+    PIXTYPE mval,
+    int64_t w,
+    int64_t h,
+    int64_t bufw,
+    int64_t bufh
 ) {
   int status;
   int64_t yl;
@@ -121,9 +233,28 @@ int arraybuffer_init(
 
   /* data info */
   buf->dptr = arr;
+  buf->dval = val;
   buf->dw = w;
   buf->dh = h;
 
+  /* second array info */
+  buf->tmode = tmode;
+  buf->tptr = tarr;
+  buf->tval = tval;
+  buf->tscale = tscale;
+  buf->tline = NULL;
+
+  /* background info */
+  buf->bkg = bkg;
+  buf->bmode = bkg ? bmode : 0;
+  buf->bline = NULL;
+
+  /* mask info */
+  buf->mptr = mask;
+  buf->mthresh = mthresh;
+  buf->mval = mval;
+  buf->mline = NULL;
+
   /* buffer array info */
   buf->bptr = NULL;
   QMALLOC(buf->bptr, PIXTYPE, bufw * bufh, status);
@@ -134,9 +265,31 @@ int arraybuffer_init(
   buf->midline = buf->bptr + bufw * (bufh / 2); /* ptr to middle buffer line */
   buf->lastline = buf->bptr + bufw * (bufh - 1); /* ptr to last buffer line */
 
-  status = get_array_converter(dtype, &(buf->readline), &(buf->elsize));
-  if (status != RETURN_OK) {
-    goto exit;
+  if (arr) {
+    status = get_array_converter(dtype, &(buf->readline), &(buf->elsize));
+    if (status != RETURN_OK) {
+      goto exit;
+    }
+    buf->drow = ROWSTRIDE(stride, w * buf->elsize);
+  }
+  if (tmode != ARRAYBUF_NONE && tarr) {
+    status = get_array_converter(tdtype, &(buf->treadline), &(buf->telsize));
+    if (status != RETURN_OK) {
+      goto exit;
+    }
+    buf->trow = ROWSTRIDE(tstride, w * buf->telsize);
+    QMALLOC(buf->tline, PIXTYPE, w, status);
+  }
+  if (buf->bmode == ARRAYBUF_BKGSUB) {
+    QMALLOC(buf->bline, PIXTYPE, w, status);
+  }
+  if (mask) {
+    status = get_mask_reader(mdtype, w, &(buf->mreadline), &(buf->mrowsize));
+    if (status != RETURN_OK) {
+      goto exit;
+    }
+    buf->mrowsize = ROWSTRIDE(mstride, buf->mrowsize);
+    QMALLOC(buf->mline, BYTE, w, status);
   }
 
   /* initialize yoff */
@@ -144,21 +297,23 @@ int arraybuffer_init(
 
   /* read in lines until the first data line is one line above midline */
   for (yl = 0; yl < bufh - bufh / 2 - 1; yl++) {
-    arraybuffer_readline(buf);
+    if ((status = arraybuffer_readline(buf)) != RETURN_OK) {
+      goto exit;
+    }
   }
 
   return status;
 
 exit:
-  free(buf->bptr);
-  buf->bptr = NULL;
+  arraybuffer_free(buf);
   return status;
 }
 
 /* read a line into the buffer at the top, shifting all lines down one */
-void arraybuffer_readline(arraybuffer * buf) {
-  PIXTYPE * line;
-  int64_t y;
+int arraybuffer_readline(arraybuffer * buf) {
+  PIXTYPE *line, *tline, tval, tscale;
+  int64_t i, y;
+  int status;
 
   /* shift all lines down one */
   for (line = buf->bptr; line < buf->lastline; line += buf->bw) {
@@ -169,17 +324,85 @@ void arraybuffer_readline(arraybuffer * buf) {
   buf->yoff++;
   y = buf->yoff + buf->bh - 1;
 
-  if (y < buf->dh) {
-    buf->readline(buf->dptr + buf->elsize * buf->dw * y, buf->dw, buf->lastline);
+  if (y >= buf->dh) {
+    return RETURN_OK;
+  }
+
+  line = buf->lastline;
+  if (buf->bmode == ARRAYBUF_BKGRMS) {
+    if ((status = sep_bkg_rmsline_flt(buf->bkg, y, line)) != RETURN_OK) {
+      return status;
+    }
+  } else if (buf->dptr) {
+    buf->readline(buf->dptr + buf->drow * y, buf->dw, line);
+  } else {
+    for (i = 0; i < buf->dw; i++) {
+      line[i] = buf->dval;
+    }
+  }
+
+  /* combine with the second array, reading it into scratch space if it
+   * is not constant. */
+  tline = NULL;
+  tval = buf->tval;
+  tscale = buf->tscale;
+  if (buf->tptr) {
+    tline = buf->tline;
+    buf->treadline(buf->tptr + buf->trow * y, buf->dw, tline);
+  }
+
+  switch (buf->tmode) {
+  case ARRAYBUF_SUB:
+    for (i = 0; i < buf->dw; i++) {
+      line[i] -= tscale * (tline ? tline[i] : tval);
+    }
+    break;
+  case ARRAYBUF_QUADSTD:
+    for (i = 0; i < buf->dw; i++) {
+      tval = tscale * (tline ? tline[i] : buf->tval);
+      line[i] = sqrt(line[i] * line[i] + tval * tval);
+    }
+    break;
+  case ARRAYBUF_QUADVAR:
+    tscale *= tscale;
+    for (i = 0; i < buf->dw; i++) {
+      line[i] += tscale * (tline ? tline[i] : tval);
+    }
+    break;
+  }
+
+  if (buf->bmode == ARRAYBUF_BKGSUB) {
+    if ((status = sep_bkg_line_flt(buf->bkg, y, buf->bline)) != RETURN_OK) {
+      return status;
+    }
+    for (i = 0; i < buf->dw; i++) {
+      line[i] -= buf->bline[i];
+    }
+  }
+
+  if (buf->mptr) {
+    buf->mreadline(buf->mptr + buf->mrowsize * y, 0, buf->dw, buf->mthresh, buf->mline);
+    for (i = 0; i < buf->dw; i++) {
+      line[i] = buf->mline[i] ? buf->mval : line[i];
+    }
   }
+
+  return RETURN_OK;
 }
 
 void arraybuffer_free(arraybuffer * buf) {
   free(buf->bptr);
   buf->bptr = NULL;
+  free(buf->tline);
+  buf->tline = NULL;
+  free(buf->bline);
+  buf->bline = NULL;
+  free(buf->mline);
+  buf->mline = NULL;
 }
 
-/* apply_mask_line: Apply the mask to the image and noise buffers.
+/* Masking: masked pixels are set as lines are read into the image and
+ * noise buffers (see arraybuffer_init_combined()).
  *
  * If convolution is off, masked values should simply be not
  * detected. For this, would be sufficient to either set data to zero or
@@ -194,21 +417,9 @@ void arraybuffer_free(arraybuffer * buf) {
  *
  * For the purpose of the full matched filter, we should set noise = infinity.
  *
- * So, this routine sets masked pixels to zero in the image buffer and
- * infinity in the noise buffer (if present). It affects the first
+ * So, masked pixels are zero in the image buffer and infinity in the noise
+ * buffer (if present).
  */
-void apply_mask_line(arraybuffer * mbuf, arraybuffer * imbuf, arraybuffer * nbuf) {
-  int64_t i;
-
-  for (i = 0; i < mbuf->bw; i++) {
-    if (mbuf->lastline[i] > 0.0) {
-      imbuf->lastline[i] = 0.0;
-      if (nbuf) {
-        nbuf->lastline[i] = BIG;
-      }
-    }
-  }
-}
 
 /****************************** extract **************************************/
 int sep_extract(
@@ -226,7 +437,48 @@ int sep_extract(
     double clean_param,
     sep_catalog ** catalog
 ) {
-  arraybuffer dbuf, nbuf, mbuf, sbuf;
+  return extract_with_bkg(
+      image,
+      NULL,
+      0,
+      thresh,
+      thresh_type,
+      minarea,
+      conv,
+      convw,
+      convh,
+      filter_type,
+      deblend_nthresh,
+      deblend_cont,
+      clean_flag,
+      clean_param,
+      catalog
+  );
+}
+
+/* As sep_extract(), with the background model `bkg` (if not NULL)
+ * subtracted from the image line by line as it is read. With `bkgnoise`,
+ * the background rms is also used as the per-pixel noise of an image
+ * without a noise array (image->noise_type must then be
+ * SEP_NOISE_STDDEV). */
+int extract_with_bkg(
+    const sep_image * image,
+    const sep_bkg * bkg,
+    int bkgnoise,
+    float thresh,
+    int thresh_type,
+    int minarea,
+    const float * conv,
+    int64_t convw,
+    int64_t convh,
+    int filter_type,
+    int deblend_nthresh,
+    double deblend_cont,
+    int clean_flag,
+    double clean_param,
+    sep_catalog ** catalog
+) {
+  arraybuffer dbuf, nbuf;
   infostruct curpixinfo, initinfo, freeinfo;
   objliststruct objlist;
   char newmarker;
@@ -237,7 +489,7 @@ int sep_extract(
   int64_t ididx, numids, totnpix;
   int64_t prevpix, bufh;
   int64_t stacksize, convn;
-  int status, isvarthresh, isvarnoise, luflag;
+  int status, isvarthresh, isvarnoise, luflag, convplan;
   short trunflag;
   PIXTYPE relthresh, cdnewsymbol, pixvar, pixsig;
   float sum;
@@ -247,10 +499,14 @@ int sep_extract(
   objliststruct * finalobjlist;
   pliststruct *pixel, *pixt;
   char * marker;
-  PIXTYPE *scan, *cdscan, *wscan, *dummyscan, *sscan;
+  PIXTYPE *scan, *cdscan, *wscan, *dummyscan;
   PIXTYPE *sigscan, *workscan;
-  float * convnorm;
-  int64_t *start, *end, *cumcounts;
+  float *convnorm, *convrow, *convcol;
+  PIXTYPE * convwork;
+  int64_t *start, *end, *cumcounts, *sscan;
+  id_reader sreadline;
+  int64_t selsize, srow, lastid;
+  segentry * segtab;
   int * survives;
   pixstatus * psstack;
   char errtext[512];
@@ -259,8 +515,15 @@ int sep_extract(
 
   status = RETURN_OK;
   pixel = NULL;
-  convnorm = NULL;
-  scan = wscan = cdscan = dummyscan = sscan = NULL;
+  convnorm = convrow = convcol = NULL;
+  convwork = NULL;
+  convplan = SEP_CONV_DIRECT;
+  scan = wscan = cdscan = dummyscan = NULL;
+  sscan = NULL;
+  segtab = NULL;
+  srow = 0;
+  totnpix = 0;
+  lastid = ididx = -1;
   sigscan = workscan = NULL;
   info = NULL;
   store = NULL;
@@ -286,6 +549,9 @@ int sep_extract(
   isvarnoise = 0;
   memset(&deblendctx, 0, sizeof(deblendctx));
 
+  memset(&dbuf, 0, sizeof(arraybuffer));
+  memset(&nbuf, 0, sizeof(arraybuffer));
+
   mem_pixstack = sep_get_extract_pixstack();
   object_limit = sep_get_extract_object_limit();
 
@@ -300,23 +566,35 @@ int sep_extract(
     if ((size_t)totnpix > mem_pixstack) {
       goto exit;
     }
-  }
 
-  /* seed the random number generator consistently on each call to get
-   * consistent results. rand_r() is used in deblending. */
-  randseed = 1;
+    /* ids sorted, to find the object of each pixel by bisection */
+    QMALLOC(segtab, segentry, numids, status);
+    for (i = 0; i < numids; i++) {
+      segtab[i].id = image->segids[i];
+      segtab[i].index = i;
+    }
+    qsort(segtab, numids, sizeof(segentry), segentry_cmp);
+  }
 
   /* Noise characteristics of the image: None, scalar or variable? */
   if (image->noise_type == SEP_NOISE_NONE) {
   } /* nothing to do */
-  else if (image->noise == NULL)
+  else if (image->noise == NULL && !(image->ref && image->refnoise) && !bkgnoise)
   {
     /* noise is constant; we can set pixel noise now. */
     if (image->noise_type == SEP_NOISE_STDDEV) {
       pixsig = image->noiseval;
       pixvar = pixsig * pixsig;
+      if (image->ref) {
+        pixvar += image->refscale * image->refscale * image->refnoiseval
+                  * image->refnoiseval;
+        pixsig = sqrt(pixvar);
+      }
     } else if (image->noise_type == SEP_NOISE_VAR) {
       pixvar = image->noiseval;
+      if (image->ref) {
+        pixvar += image->refscale * image->refscale * image->refnoiseval;
+      }
       pixsig = sqrt(pixvar);
     } else {
       return UNKNOWN_NOISE_TYPE;
@@ -367,29 +645,75 @@ int sep_extract(
    * the buffer height equals the height of the convolution kernel.
    */
   bufh = conv ? convh : 1;
-  status = arraybuffer_init(&dbuf, image->data, image->dtype, w, h, stacksize, bufh);
+  /* data, or difference image data - refscale * ref; background
+   * subtracted on the fly if given */
+  status = arraybuffer_init_combined(
+      &dbuf,
+      image->data,
+      image->dtype,
+      image->dstride,
+      0.0,
+      image->ref,
+      image->rdtype,
+      image->rstride,
+      0.0,
+      image->refscale,
+      (image->ref ? ARRAYBUF_SUB : ARRAYBUF_NONE),
+      bkg,
+      ARRAYBUF_BKGSUB,
+      image->mask,
+      image->mdtype,
+      image->mstride,
+      image->maskthresh,
+      0.0,
+      w,
+      h,
+      stacksize,
+      bufh
+  );
   if (status != RETURN_OK) {
     goto exit;
   }
   if (isvarnoise) {
-    status =
-        arraybuffer_init(&nbuf, image->noise, image->ndtype, w, h, stacksize, bufh);
-    if (status != RETURN_OK) {
-      goto exit;
-    }
-  }
-  if (image->mask) {
-    status = arraybuffer_init(&mbuf, image->mask, image->mdtype, w, h, stacksize, bufh);
+    /* image noise (or background rms) and reference noise added in
+     * quadrature; either one may be a scalar. */
+    status = arraybuffer_init_combined(
+        &nbuf,
+        image->noise,
+        image->ndtype,
+        image->nstride,
+        image->noiseval,
+        image->ref ? image->refnoise : NULL,
+        image->rndtype,
+        image->rnstride,
+        image->refnoiseval,
+        image->refscale,
+        (!image->ref                           ? ARRAYBUF_NONE
+         : image->noise_type == SEP_NOISE_VAR ? ARRAYBUF_QUADVAR
+                                               : ARRAYBUF_QUADSTD),
+        (bkgnoise && !image->noise) ? bkg : NULL,
+        ARRAYBUF_BKGRMS,
+        image->mask,
+        image->mdtype,
+        image->mstride,
+        image->maskthresh,
+        BIG,
+        w,
+        h,
+        stacksize,
+        bufh
+    );
     if (status != RETURN_OK) {
       goto exit;
     }
   }
+  /* segmentation map: the ids of the current line, read as integers */
   if (image->segmap) {
-    status =
-        arraybuffer_init(&sbuf, image->segmap, image->sdtype, w, h, stacksize, bufh);
-    if (status != RETURN_OK) {
+    if ((status = get_id_reader(image->sdtype, &sreadline, &selsize)) != RETURN_OK) {
       goto exit;
     }
+    srow = ROWSTRIDE(image->sstride, w * selsize);
+    QCALLOC(sscan, int64_t, stacksize, status);
   }
 
   /* `scan` (or `wscan`) is always a pointer to the current line being
@@ -406,7 +730,6 @@ int sep_extract(
   initinfo.firstpix = initinfo.lastpix = -1;
 
   if (image->segmap) {
-    sscan = sbuf.midline;
     for (i = 0; i < numids; i++) {
       idinfo[i].pixnb = 0;
       idinfo[i].flag = 0;
@@ -474,6 +797,19 @@ int sep_extract(
     for (i = 0; i < convn; i++) {
       convnorm[i] = conv[i] / sum;
     }
+
+    /* apply it as a row and a column pass if possible and faster */
+    QMALLOC(convrow, float, convw, status);
+    QMALLOC(convcol, float, convh, status);
+    if (conv_separate(convnorm, convw, convh, convrow, convcol)) {
+      status = conv_choose(convnorm, convrow, convcol, convw, convh, w, &convplan);
+      if (status != RETURN_OK) {
+        goto exit;
+      }
+    }
+    if (convplan == SEP_CONV_SEPARABLE) {
+      QMALLOC(convwork, PIXTYPE, stacksize, status);
+    }
   }
 
   /*----- MAIN LOOP ------ */
@@ -493,21 +829,25 @@ int sep_extract(
       }
       cdscan = dummyscan;
     } else {
-      arraybuffer_readline(&dbuf);
-      if (isvarnoise) {
-        arraybuffer_readline(&nbuf);
+      if ((status = arraybuffer_readline(&dbuf)) != RETURN_OK) {
+        goto exit;
       }
-      if (image->mask) {
-        arraybuffer_readline(&mbuf);
-        apply_mask_line(&mbuf, &dbuf, (isvarnoise ? &nbuf : NULL));
+      if (isvarnoise && (status = arraybuffer_readline(&nbuf)) != RETURN_OK) {
+        goto exit;
       }
       if (image->segmap) {
-        arraybuffer_readline(&sbuf);
+        sreadline((const BYTE *)image->segmap + srow * yl, w, sscan);
       }
 
       /* filter the lines */
       if (conv) {
-        status = convolve(&dbuf, yl, convnorm, convw, convh, cdscan);
+        if (convplan == SEP_CONV_SEPARABLE) {
+          status = convolve_separable(
+              &dbuf, yl, convrow, convcol, convw, convh, convwork, cdscan
+          );
+        } else {
+          status = convolve(&dbuf, yl, convnorm, convw, convh, cdscan);
+        }
         if (status != RETURN_OK) {
           goto exit;
         }
@@ -576,36 +916,34 @@ int sep_extract(
             curpixinfo.flag |= SEP_OBJ_TRUNC;
           }
 
-          for (ididx = 0; ididx < numids; ididx++) {
-            if (image->segids[ididx] == (int64_t)sscan[xl]) {
-              pixt = pixel + prevpix * plistsize;
-              prevpix = cumcounts[ididx] + idinfo[ididx].pixnb;
-              pixt = pixel + prevpix * plistsize;
-
-              PLIST(pixt, x) = xl;
-              PLIST(pixt, y) = yl;
-              PLIST(pixt, value) = scan[xl];
-              if (PLISTEXIST(cdvalue)) {
-                PLISTPIX(pixt, cdvalue) = cdnewsymbol;
-              };
-              if (PLISTEXIST(var)) {
-                PLISTPIX(pixt, var) = pixvar;
-              };
-              if (PLISTEXIST(thresh)) {
-                PLISTPIX(pixt, thresh) = thresh;
-              };
-
-              if (idinfo[ididx].pixnb == 0) {
-                idinfo[ididx].firstpix = prevpix * plistsize;
-                idinfo[ididx].pixnb = 1;
-              } else if (idinfo[ididx].pixnb == image->idcounts[ididx] - 1) {
-                idinfo[ididx].pixnb++;
-                idinfo[ididx].lastpix = prevpix * plistsize;
-                PLIST(pixt, nextpix) = -1;
-              } else {
-                idinfo[ididx].pixnb++;
-              };
-              break;
+          /* neighbouring pixels mostly belong to the same object */
+          if (sscan[xl] != lastid) {
+            lastid = sscan[xl];
+            ididx = segentry_find(segtab, numids, lastid);
+          }
+          if (ididx >= 0) {
+            prevpix = cumcounts[ididx] + idinfo[ididx].pixnb;
+            pixt = pixel + prevpix * plistsize;
+
+            PLIST(pixt, x) = xl;
+            PLIST(pixt, y) = yl;
+            PLIST(pixt, value) = scan[xl];
+            if (PLISTEXIST(cdvalue)) {
+              PLISTPIX(pixt, cdvalue) = cdnewsymbol;
+            };
+            if (PLISTEXIST(var)) {
+              PLISTPIX(pixt, var) = pixvar;
+            };
+            if (PLISTEXIST(thresh)) {
+              PLISTPIX(pixt, thresh) = thresh;
+            };
+
+            if (idinfo[ididx].pixnb == 0) {
+              idinfo[ididx].firstpix = prevpix * plistsize;
+            }
+            if (++idinfo[ididx].pixnb == image->idcounts[ididx]) {
+              idinfo[ididx].lastpix = prevpix * plistsize;
+              PLIST(pixt, nextpix) = -1;
             }
           }
         }
@@ -810,9 +1148,18 @@ int sep_extract(
   } /*---------------- End of the loop over the y's -----------------------*/
 
   if (image->segmap) {
-    for (i = 0; i < numids; i++) {
-      status = segsortit(&idinfo[i], &objlist, finalobjlist, image->gain);
+    /* the objects are analysed in place: each one's pixels are a slice of
+     * `pixel`, which becomes the pixel list of `finalobjlist` */
+    status = segsort(idinfo, numids, &objlist, image->gain);
+    if (status != RETURN_OK) {
+      goto exit;
     }
+    finalobjlist->obj = objlist.obj;
+    finalobjlist->nobj = numids;
+    finalobjlist->plist = pixel;
+    finalobjlist->npix = totnpix;
+    objlist.obj = NULL;
+    pixel = NULL;
   } else {
     /* convert `finalobjlist` to an array of `sepobj` structs */
     /* if cleaning, see which objects "survive" cleaning. */
@@ -842,10 +1189,12 @@ exit:
     free(finalobjlist->plist);
     free(finalobjlist);
   }
+  free(sscan);
   if (image->segmap) {
-    arraybuffer_free(&sbuf);
     free(idinfo);
     free(cumcounts);
+    free(segtab);
+    free(objlist.obj);
   }
   freedeblend(&deblendctx);
   free(pixel);
@@ -858,14 +1207,12 @@ exit:
   free(end);
   free(survives);
   arraybuffer_free(&dbuf);
-  if (image->noise) {
-    arraybuffer_free(&nbuf);
-  }
-  if (image->mask) {
-    arraybuffer_free(&mbuf);
-  }
+  arraybuffer_free(&nbuf);
   if (conv) {
     free(convnorm);
+    free(convrow);
+    free(convcol);
+    free(convwork);
   }
   if (filter_type == SEP_FILTER_MATCHED) {
     free(sigscan);
@@ -887,40 +1234,47 @@ exit:
   return status;
 }
 
-int segsortit(
-    infostruct * info,
-    objliststruct * objlist,
-    objliststruct * finalobjlist,
-    double gain
-) {
-  objstruct obj;
-  int status;
-
-  status = RETURN_OK;
-
-  /*----- Allocate memory to store object data */
-  objlist->obj = &obj;
-  objlist->nobj = 1;
+typedef struct {
+  infostruct * idinfo;
+  objliststruct * objlist;
+  double gain;
+  int hasconv, hasvar;
+} segsortjob;
 
-  memset(&obj, 0, (size_t)sizeof(objstruct));
-  objlist->npix = info->pixnb;
-  obj.firstpix = info->firstpix;
-  obj.lastpix = info->lastpix;
-  obj.flag = info->flag;
-
-  obj.thresh =
-      plistexist_thresh ? get_mean_thresh(info, objlist->plist) : objlist->thresh;
-
-  analyse(0, objlist, 1, gain);
-
-  status = addobjdeep(0, objlist, finalobjlist);
+static int segsort_task(void * ctx, int64_t start, int64_t end, int thread) {
+  segsortjob * job = ctx;
+  objstruct * obj;
+  infostruct * info;
+  int64_t i;
 
-  if (status != RETURN_OK) {
-    goto exit;
+  (void)thread;
+  /* the pixel list layout is thread-local */
+  plistinit(job->hasconv, job->hasvar);
+  for (i = start; i < end; i++) {
+    obj = job->objlist->obj + i;
+    info = job->idinfo + i;
+    memset(obj, 0, sizeof(objstruct));
+    obj->firstpix = info->firstpix;
+    obj->lastpix = info->lastpix;
+    obj->flag = info->flag;
+    obj->thresh = plistexist_thresh ? get_mean_thresh(info, job->objlist->plist)
+                                    : job->objlist->thresh;
+    analyse((int)i, job->objlist, 1, job->gain);
   }
+  return RETURN_OK;
+}
 
-exit:
-  return status;
+/* analyse the `nobj` objects of a segmentation map in parallel:
+ * objlist->obj[i] is made from the pixels of idinfo[i] */
+int segsort(infostruct * idinfo, int64_t nobj, objliststruct * objlist, double gain) {
+  segsortjob job;
+
+  job.idinfo = idinfo;
+  job.objlist = objlist;
+  job.gain = gain;
+  job.hasconv = plistexist_cdvalue;
+  job.hasvar = plistexist_var;
+  return parallel_for(nobj, SEGSORT_CHUNK, segsort_task, &job);
 }
 
 /********************************* sortit ************************************/
@@ -1232,11 +1586,62 @@ void free_catalog_fields(sep_catalog * catalog) {
 
   free(catalog->pix);
   free(catalog->objectspix);
+  free(catalog->objectsvalue);
+  free(catalog->objectscdvalue);
+  free(catalog->objectsvar);
 
   memset(catalog, 0, sizeof(sep_catalog));
 }
 
 
+/* alloc_catalog_fields()
+ *
+ * Allocate the per-object arrays of a zeroed catalog (not `pix` or
+ * `objectspix`). On failure, anything allocated is freed again.
+ */
+int alloc_catalog_fields(sep_catalog * cat, int nobj) {
+  int status = RETURN_OK;
+
+  cat->nobj = nobj;
+  QMALLOC(cat->thresh, float, nobj, status);
+  QMALLOC(cat->npix, int64_t, nobj, status);
+  QMALLOC(cat->tnpix, int64_t, nobj, status);
+  QMALLOC(cat->xmin, int64_t, nobj, status);
+  QMALLOC(cat->xmax, int64_t, nobj, status);
+  QMALLOC(cat->ymin, int64_t, nobj, status);
+  QMALLOC(cat->ymax, int64_t, nobj, status);
+  QMALLOC(cat->x, double, nobj, status);
+  QMALLOC(cat->y, double, nobj, status);
+  QMALLOC(cat->x2, double, nobj, status);
+  QMALLOC(cat->y2, double, nobj, status);
+  QMALLOC(cat->xy, double, nobj, status);
+  QMALLOC(cat->errx2, double, nobj, status);
+  QMALLOC(cat->erry2, double, nobj, status);
+  QMALLOC(cat->errxy, double, nobj, status);
+  QMALLOC(cat->a, float, nobj, status);
+  QMALLOC(cat->b, float, nobj, status);
+  QMALLOC(cat->theta, float, nobj, status);
+  QMALLOC(cat->cxx, float, nobj, status);
+  QMALLOC(cat->cyy, float, nobj, status);
+  QMALLOC(cat->cxy, float, nobj, status);
+  QMALLOC(cat->cflux, float, nobj, status);
+  QMALLOC(cat->flux, float, nobj, status);
+  QMALLOC(cat->cpeak, float, nobj, status);
+  QMALLOC(cat->peak, float, nobj, status);
+  QMALLOC(cat->xcpeak, int64_t, nobj, status);
+  QMALLOC(cat->ycpeak, int64_t, nobj, status);
+  QMALLOC(cat->xpeak, int64_t, nobj, status);
+  QMALLOC(cat->ypeak, int64_t, nobj, status);
+  QMALLOC(cat->flag, short, nobj, status);
+
+exit:
+  if (status != RETURN_OK) {
+    free_catalog_fields(cat);
+  }
+  return status;
+}
+
+
 /* convert_to_catalog()
  *
  * Convert the final object list to an output catalog.
@@ -1276,39 +1681,10 @@ int convert_to_catalog(
   }
 
   /* allocate catalog fields */
-  cat->nobj = nobj;
-  QMALLOC(cat->thresh, float, nobj, status);
-  QMALLOC(cat->npix, int64_t, nobj, status);
-  QMALLOC(cat->tnpix, int64_t, nobj, status);
-  QMALLOC(cat->xmin, int64_t, nobj, status);
-  QMALLOC(cat->xmax, int64_t, nobj, status);
-  QMALLOC(cat->ymin, int64_t, nobj, status);
-  QMALLOC(cat->ymax, int64_t, nobj, status);
-  QMALLOC(cat->x, double, nobj, status);
-  QMALLOC(cat->y, double, nobj, status);
-  QMALLOC(cat->x2, double, nobj, status);
-  QMALLOC(cat->y2, double, nobj, status);
-  QMALLOC(cat->xy, double, nobj, status);
-  QMALLOC(cat->errx2, double, nobj, status);
-  QMALLOC(cat->erry2, double, nobj, status);
-  QMALLOC(cat->errxy, double, nobj, status);
-  QMALLOC(cat->a, float, nobj, status);
-  QMALLOC(cat->b, float, nobj, status);
-  QMALLOC(cat->theta, float, nobj, status);
-  QMALLOC(cat->cxx, float, nobj, status);
-  QMALLOC(cat->cyy, float, nobj, status);
-  QMALLOC(cat->cxy, float, nobj, status);
-  QMALLOC(cat->cflux, float, nobj, status);
-  QMALLOC(cat->flux, float, nobj, status);
-  QMALLOC(cat->cpeak, float, nobj, status);
-  QMALLOC(cat->peak, float, nobj, status);
-  QMALLOC(cat->xcpeak, int64_t, nobj, status);
-  QMALLOC(cat->ycpeak, int64_t, nobj, status);
-  QMALLOC(cat->xpeak, int64_t, nobj, status);
-  QMALLOC(cat->ypeak, int64_t, nobj, status);
-  QMALLOC(cat->cflux, float, nobj, status);
-  QMALLOC(cat->flux, float, nobj, status);
-  QMALLOC(cat->flag, short, nobj, status);
+  status = alloc_catalog_fields(cat, nobj);
+  if (status != RETURN_OK) {
+    goto exit;
+  }
 
   /* fill output arrays */
   j = 0; /* running index in output array */
@@ -1368,6 +1744,14 @@ int convert_to_catalog(
     /* allocate array of pointers into the above buffer */
     QMALLOC(cat->pix, int64_t *, nobj, status);
 
+    if (sep_get_extract_pixvalues()) {
+      QMALLOC(cat->objectsvalue, float, totnpix, status);
+      QMALLOC(cat->objectscdvalue, float, totnpix, status);
+      if (PLISTEXIST(var)) {
+        QMALLOC(cat->objectsvar, float, totnpix, status);
+      }
+    }
+
     pixel = objlist->plist;
 
     /* for each object, fill buffer and direct object's to it */
@@ -1384,6 +1768,13 @@ int convert_to_catalog(
              pixt = pixel + PLIST(pixt, nextpix), k++)
         {
           cat->objectspix[k] = PLIST(pixt, x) + w * PLIST(pixt, y);
+          if (cat->objectsvalue) {
+            cat->objectsvalue[k] = PLIST(pixt, value);
+            cat->objectscdvalue[k] = PLISTPIX(pixt, cdvalue);
+          }
+          if (cat->objectsvar) {
+            cat->objectsvar[k] = PLISTPIX(pixt, var);
+          }
         }
         j++;
       }
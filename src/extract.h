@@ -74,16 +74,51 @@ typedef struct {
   PIXTYPE * lastline; /* last line in buffer */
   array_converter readline; /* function to read a data line into buffer */
   int64_t elsize; /* size in bytes of one element in original data */
+  int64_t drow; /* bytes from one data row to the next */
   int64_t yoff; /* line index in original data corresponding to bufptr */
+  PIXTYPE dval; /* constant used for every line if dptr is NULL */
+
+  /* optional second array, combined into each line as it is read */
+  int tmode; /* how lines are combined (ARRAYBUF_* below) */
+  const BYTE * tptr; /* pointer to second array (NULL: use tval) */
+  array_converter treadline; /* function to read a second array line */
+  int64_t telsize; /* size in bytes of one element of second array */
+  int64_t trow; /* bytes from one row of second array to the next */
+  PIXTYPE tval; /* constant used in place of second array */
+  PIXTYPE tscale; /* scale applied to second array values */
+  PIXTYPE * tline; /* scratch line for second array (self-managed) */
+
+  /* optional background model, evaluated for each line (see ARRAYBUF_BKG*) */
+  const void * bkg; /* sep_bkg (sep.h is not included here) */
+  int bmode;
+  PIXTYPE * bline; /* scratch line for background (self-managed) */
+
+  /* optional mask: masked pixels are set to mval as each line is read */
+  const BYTE * mptr; /* pointer to mask (NULL: no mask) */
+  mask_reader mreadline; /* function to read a mask line */
+  int64_t mrowsize; /* bytes from one mask row to the next */
+  double mthresh; /* pixels with mask > mthresh are masked */
+  PIXTYPE mval; /* value of masked pixels */
+  BYTE * mline; /* scratch line for mask (self-managed) */
 } arraybuffer;
 
+/* arraybuffer combination modes: d = data line, t = second array line,
+ * s = tscale */
+#define ARRAYBUF_NONE 0 /* d                      */
+#define ARRAYBUF_SUB 1 /* d - s*t                */
+#define ARRAYBUF_QUADSTD 2 /* sqrt(d^2 + (s*t)^2)    */
+#define ARRAYBUF_QUADVAR 3 /* d + s^2*t              */
+
+/* background modes: applied after the combination above */
+#define ARRAYBUF_BKGSUB 1 /* subtract background     */
+#define ARRAYBUF_BKGRMS 2 /* background rms replaces d */
+
 
 /* globals */
 extern _Thread_local int64_t plistexist_cdvalue, plistexist_thresh, plistexist_var;
 extern _Thread_local int64_t plistoff_value, plistoff_cdvalue, plistoff_thresh,
     plistoff_var;
 extern _Thread_local int64_t plistsize;
-extern _Thread_local unsigned int randseed;
 
 typedef struct {
   /* thresholds */
@@ -143,18 +178,29 @@ typedef struct {
   infostruct *info, *store;
   char * marker;
   pixstatus * psstack;
-  int64_t *start, *end, *discan;
+  int64_t *start, *end, *range;
   int64_t xmin, ymin, xmax, ymax;
 } lutzbuffers;
 
+/* Pixel-list index of each pixel of an object, by position. Objects that
+ * fill their bounding box get a dense map; sparse ones keep runs of pixels
+ * along each row, so that memory follows the number of pixels. A "slot"
+ * numbers the pixels of the map: (x-subx)+(y-suby)*subw if dense, the
+ * position in index[] otherwise. */
+typedef struct {
+  int64_t subx, suby, subw, subh; /* bounding box */
+  int64_t npix; /* number of pixels of the object */
+  int64_t * map; /* dense map (-1 outside the object), or NULL if sparse */
+  int64_t * rows; /* sparse: first run of each row (subh+1 entries) */
+  int64_t * runs; /* sparse: (xstart, xend, slot of xstart) of each run */
+  int64_t * index; /* sparse: pixel-list index of each slot */
+} submapstruct;
+
 int lutzalloc(int64_t, int64_t, lutzbuffers *);
 void lutzfree(lutzbuffers *);
 int lutz(
     pliststruct * plistin,
-    int64_t * objrootsubmap,
-    int64_t subx,
-    int64_t suby,
-    int64_t subw,
+    const submapstruct * objrootsubmap,
     objstruct * objparent,
     objliststruct * objlist,
     int minarea,
@@ -187,6 +233,28 @@ int convolve(
     int64_t convh,
     PIXTYPE * out
 );
+int conv_separate(
+    const float * conv, int64_t convw, int64_t convh, float * row, float * col
+);
+int convolve_separable(
+    arraybuffer * buf,
+    int64_t y,
+    const float * row,
+    const float * col,
+    int64_t convw,
+    int64_t convh,
+    PIXTYPE * work,
+    PIXTYPE * out
+);
+int conv_choose(
+    const float * conv,
+    const float * row,
+    const float * col,
+    int64_t convw,
+    int64_t convh,
+    int64_t w,
+    int * plan
+);
 int matched_filter(
     arraybuffer * imbuf,
     arraybuffer * nbuf,
@@ -40,8 +40,7 @@ void lutzsort(infostruct *, objliststruct *);
 Allocate once for all memory space for buffers used by lutz().
 */
 int lutzalloc(int64_t width, int64_t height, lutzbuffers * buffers) {
-  int64_t * discant;
-  int64_t stacksize, i;
+  int64_t stacksize;
   int status = RETURN_OK;
 
   memset(buffers, 0, sizeof(lutzbuffers));
@@ -56,11 +55,7 @@ int lutzalloc(int64_t width, int64_t height, lutzbuffers * buffers) {
   QMALLOC(buffers->psstack, pixstatus, stacksize, status);
   QMALLOC(buffers->start, int64_t, stacksize, status);
   QMALLOC(buffers->end, int64_t, stacksize, status);
-  QMALLOC(buffers->discan, int64_t, stacksize, status);
-  discant = buffers->discan;
-  for (i = stacksize; i--;) {
-    *(discant++) = -1;
-  }
+  QMALLOC(buffers->range, int64_t, 2 * stacksize + 2, status);
 
   return status;
 
@@ -75,8 +70,8 @@ exit:
 Free once for all memory space for buffers used by lutz().
 */
 void lutzfree(lutzbuffers * buffers) {
-  free(buffers->discan);
-  buffers->discan = NULL;
+  free(buffers->range);
+  buffers->range = NULL;
   free(buffers->info);
   buffers->info = NULL;
   free(buffers->store);
@@ -93,6 +88,66 @@ void lutzfree(lutzbuffers * buffers) {
 
 static const infostruct initinfo = {.firstpix = -1, .lastpix = -1};
 
+/******************************** lutzranges *********************************/
+/*
+Columns of row y that lutz() has to visit in a sparse submap: those of the
+runs of row y and of row y-1 (where markers were left), clipped to
+[stx, enx) and extended by one column, where segments end. Other columns
+are outside the object on both rows and would leave the state unchanged.
+Writes (first, last) pairs to range and returns their number.
+*/
+static int64_t lutzranges(
+    const submapstruct * submap,
+    int64_t y,
+    int64_t stx,
+    int64_t sty,
+    int64_t enx,
+    int64_t eny,
+    int64_t * range
+) {
+  const int64_t *pa, *pae, *pb, *pbe, *p;
+  int64_t a, b, r, n;
+
+  pa = pae = pb = pbe = NULL;
+  if (y > sty) {
+    r = y - 1 - submap->suby;
+    pa = submap->runs + 3 * submap->rows[r];
+    pae = submap->runs + 3 * submap->rows[r + 1];
+  }
+  if (y < eny) {
+    r = y - submap->suby;
+    pb = submap->runs + 3 * submap->rows[r];
+    pbe = submap->runs + 3 * submap->rows[r + 1];
+  }
+
+  n = 0;
+  while (pa < pae || pb < pbe) {
+    if (pb >= pbe || (pa < pae && pa[0] <= pb[0])) {
+      p = pa;
+      pa += 3;
+    } else {
+      p = pb;
+      pb += 3;
+    }
+    a = p[0] > stx ? p[0] : stx;
+    b = p[1] < enx ? p[1] : enx;
+    if (a >= b) {
+      continue;
+    }
+    if (n && a <= range[2 * n - 1] + 1) {
+      if (b > range[2 * n - 1]) {
+        range[2 * n - 1] = b;
+      }
+    } else {
+      range[2 * n] = a;
+      range[2 * n + 1] = b;
+      n++;
+    }
+  }
+
+  return n;
+}
+
 /********************************** lutz *************************************/
 /*
 C implementation of R.K LUTZ' algorithm for the extraction of 8-connected pi-
@@ -100,10 +155,7 @@ xels in an image
 */
 int lutz(
     pliststruct * plistin,
-    int64_t * objrootsubmap,
-    int64_t subx,
-    int64_t suby,
-    int64_t subw,
+    const submapstruct * objrootsubmap,
     objstruct * objparent,
     objliststruct * objlist,
     int minarea,
@@ -114,8 +166,9 @@ int lutz(
   pliststruct *plist, *pixel, *plistint;
 
   char newmarker;
+  const int64_t *rowmap, *run, *runend;
   int64_t cn, co, luflag, pstop, xl, xl2, yl, out, deb_maxarea, stx, sty, enx, eny,
-      step, nobjm = NOBJ, inewsymbol, *iscan;
+      npixm, nrange, r, nobjm = NOBJ, inewsymbol, *range;
   short trunflag;
   PIXTYPE thresh;
   pixstatus cs, ps;
@@ -130,11 +183,11 @@ int lutz(
   eny = objparent->ymax;
   thresh = objlist->thresh;
   cn = 0;
+  range = buffers->range;
+  rowmap = run = runend = NULL;
 
-  iscan = objrootsubmap + (sty - suby) * subw + (stx - subx);
-
-  /* As we only analyse a fraction of the map, a step occurs between lines */
-  step = subw - (++enx - stx);
+  /* one column and one row past the object end all segments */
+  enx++;
   eny++;
 
   /*------Allocate memory to store object data */
@@ -148,7 +201,11 @@ int lutz(
 
   /*------Allocate memory for the pixel list */
   free(objlist->plist);
-  if (!(objlist->plist = malloc((eny - sty) * (enx - stx) * plistsize))) {
+  npixm = (eny - sty) * (enx - stx);
+  if (npixm > objrootsubmap->npix) {
+    npixm = objrootsubmap->npix;
+  }
+  if (!(objlist->plist = malloc((npixm > 0 ? npixm : 1) * plistsize))) {
     out = MEMORY_ALLOC_ERROR;
     plist = NULL; /* To avoid gcc -Wall warnings */
     goto exit_lutz;
@@ -166,18 +223,49 @@ int lutz(
   curpixinfo.pixnb = 1;
   curpixinfo.flag = curpixinfo.firstpix = curpixinfo.lastpix = 0;
 
-  for (yl = sty; yl <= eny; yl++, iscan += step) {
+  for (yl = sty; yl <= eny; yl++) {
     ps = COMPLETE;
     cs = NONOBJECT;
     trunflag = (yl == 0 || yl == buffers->ymax) ? SEP_OBJ_TRUNC : 0;
-    if (yl == eny) {
-      iscan = buffers->discan;
+    if (objrootsubmap->map) {
+      if (yl < eny) {
+        rowmap = objrootsubmap->map + (yl - objrootsubmap->suby) * objrootsubmap->subw;
+      }
+      range[0] = stx;
+      range[1] = enx;
+      nrange = 1;
+    } else {
+      if (yl < eny) {
+        r = yl - objrootsubmap->suby;
+        run = objrootsubmap->runs + 3 * objrootsubmap->rows[r];
+        runend = objrootsubmap->runs + 3 * objrootsubmap->rows[r + 1];
+      }
+      nrange = lutzranges(objrootsubmap, yl, stx, sty, enx, eny, range);
     }
 
-    for (xl = stx; xl <= enx; xl++) {
+    /* visit the columns of each range in turn */
+    for (r = 0, xl = nrange ? range[0] : enx + 1; xl <= enx; xl++) {
+      if (xl > range[2 * r + 1]) {
+        if (++r == nrange) {
+          break;
+        }
+        xl = range[2 * r];
+      }
       newmarker = buffers->marker[xl];
       buffers->marker[xl] = 0;
-      if ((inewsymbol = (xl != enx) ? *(iscan++) : -1) < 0) {
+      if (xl == enx || yl == eny) {
+        inewsymbol = -1;
+      } else if (rowmap) {
+        inewsymbol = rowmap[xl - objrootsubmap->subx];
+      } else {
+        while (run < runend && run[1] <= xl) {
+          run += 3;
+        }
+        inewsymbol = (run < runend && run[0] <= xl)
+                         ? objrootsubmap->index[run[2] + xl - run[0]]
+                         : -1;
+      }
+      if (inewsymbol < 0) {
         luflag = 0;
       } else {
         curpixinfo.flag = trunflag;
@@ -15,12 +15,28 @@
 #endif
 
 /* Return area of a circle arc between (x1, y1) and (x2, y2) with radius r */
-/* reference: http://mathworld.wolfram.com/CircularSegment.html */
-static INLINE double area_arc(double x1, double y1, double x2, double y2, double r) {
-  double a, theta;
-
-  a = sqrt((x2 - x1) * (x2 - x1) + (y2 - y1) * (y2 - y1));
-  theta = 2. * asin(0.5 * a / r);
+/* reference: http://mathworld.wolfram.com/CircularSegment.html
+ * With c = a / 2r for chord length a, the area is r^2 (asin(c) - c sqrt(1 -
+ * c^2)) = r^2 (2/3 c^3 + 1/5 c^5 + 3/28 c^7 + 5/72 c^9 + ...). The
+ * coefficients decrease and are below 1/20 after c^9, so truncating there
+ * costs less than r^2 c^11 / (20 (1 - c^2)). If tol > 0, the truncated
+ * series is used whenever that bound is within tol. */
+static INLINE double area_arc(
+    double x1, double y1, double x2, double y2, double r, double tol
+) {
+  double a2, c, c2, theta;
+
+  a2 = (x2 - x1) * (x2 - x1) + (y2 - y1) * (y2 - y1);
+  if (tol > 0.0) {
+    c2 = 0.25 * a2 / (r * r);
+    c = sqrt(c2);
+    if (c2 < 0.5 && r * r * c * c2 * c2 * c2 * c2 * c2 < 20.0 * tol * (1.0 - c2)) {
+      return r * r * c * c2
+             * (2. / 3. + c2 * (1. / 5. + c2 * (3. / 28. + c2 * (5. / 72.))));
+    }
+  }
+  c = 0.5 * sqrt(a2) / r;
+  theta = 2. * asin(c < 1. ? c : 1.);
   return 0.5 * r * r * (theta - sin(theta));
 }
 
@@ -36,7 +52,7 @@ static INLINE double area_triangle(
  * (can always modify input to conform to this).
  */
 static INLINE double circoverlap_core(
-    double xmin, double ymin, double xmax, double ymax, double r
+    double xmin, double ymin, double xmax, double ymax, double r, double tol
 ) {
   double a, b, x1, x2, y1, y2, r2, xmin2, ymin2, xmax2, ymax2;
 
@@ -63,7 +79,7 @@ static INLINE double circoverlap_core(
     y2 = sqrt(r2 - xmax2);
     return (
         (xmax - xmin) * (ymax - ymin) - area_triangle(x1, y1, x2, y2, xmax, ymax)
-        + area_arc(x1, y1, x2, y2, r)
+        + area_arc(x1, y1, x2, y2, r, tol)
     );
   }
 
@@ -73,7 +89,7 @@ static INLINE double circoverlap_core(
     x2 = xmax;
     y2 = sqrt(r2 - xmax2);
     return (
-        area_arc(x1, y1, x2, y2, r) + area_triangle(x1, y1, x1, ymin, xmax, ymin)
+        area_arc(x1, y1, x2, y2, r, tol) + area_triangle(x1, y1, x1, ymin, xmax, ymin)
         + area_triangle(x1, y1, x2, ymin, x2, y2)
     );
   }
@@ -84,7 +100,7 @@ static INLINE double circoverlap_core(
     x2 = sqrt(r2 - ymax2);
     y2 = ymax;
     return (
-        area_arc(x1, y1, x2, y2, r) + area_triangle(x1, y1, xmin, y1, xmin, ymax)
+        area_arc(x1, y1, x2, y2, r, tol) + area_triangle(x1, y1, xmin, y1, xmin, ymax)
         + area_triangle(x1, y1, xmin, y2, x2, y2)
     );
   }
@@ -94,13 +110,14 @@ static INLINE double circoverlap_core(
   y1 = ymin;
   x2 = xmin;
   y2 = sqrt(r2 - xmin2);
-  return (area_arc(x1, y1, x2, y2, r) + area_triangle(x1, y1, x2, y2, xmin, ymin));
+  return (area_arc(x1, y1, x2, y2, r, tol) + area_triangle(x1, y1, x2, y2, xmin, ymin));
 }
 
 
-/* Area of overlap of a rectangle and a circle */
+/* Area of overlap of a rectangle and a circle, to within tol if tol > 0 (see
+ * area_arc()) */
 static double circoverlap(
-    double xmin, double ymin, double xmax, double ymax, double r
+    double xmin, double ymin, double xmax, double ymax, double r, double tol
 ) {
   /* some subroutines demand that r > 0 */
   if (r <= 0.) {
@@ -109,38 +126,44 @@ static double circoverlap(
 
   if (0. <= xmin) {
     if (0. <= ymin) {
-      return circoverlap_core(xmin, ymin, xmax, ymax, r);
+      return circoverlap_core(xmin, ymin, xmax, ymax, r, tol);
     } else if (0. >= ymax) {
-      return circoverlap_core(-ymax, xmin, -ymin, xmax, r);
+      return circoverlap_core(-ymax, xmin, -ymin, xmax, r, tol);
     } else {
       return (
-          circoverlap(xmin, ymin, xmax, 0., r) + circoverlap(xmin, 0., xmax, ymax, r)
+          circoverlap(xmin, ymin, xmax, 0., r, 0.5 * tol)
+          + circoverlap(xmin, 0., xmax, ymax, r, 0.5 * tol)
       );
     }
   } else if (0. >= xmax) {
     if (0. <= ymin) {
-      return circoverlap_core(-xmax, ymin, -xmin, ymax, r);
+      return circoverlap_core(-xmax, ymin, -xmin, ymax, r, tol);
     } else if (0. >= ymax) {
-      return circoverlap_core(-xmax, -ymax, -xmin, -ymin, r);
+      return circoverlap_core(-xmax, -ymax, -xmin, -ymin, r, tol);
     } else {
       return (
-          circoverlap(xmin, ymin, xmax, 0., r) + circoverlap(xmin, 0., xmax, ymax, r)
+          circoverlap(xmin, ymin, xmax, 0., r, 0.5 * tol)
+          + circoverlap(xmin, 0., xmax, ymax, r, 0.5 * tol)
       );
     }
   } else {
     if (0. <= ymin) {
       return (
-          circoverlap(xmin, ymin, 0., ymax, r) + circoverlap(0., ymin, xmax, ymax, r)
+          circoverlap(xmin, ymin, 0., ymax, r, 0.5 * tol)
+          + circoverlap(0., ymin, xmax, ymax, r, 0.5 * tol)
       );
     }
     if (0. >= ymax) {
       return (
-          circoverlap(xmin, ymin, 0., ymax, r) + circoverlap(0., ymin, xmax, ymax, r)
+          circoverlap(xmin, ymin, 0., ymax, r, 0.5 * tol)
+          + circoverlap(0., ymin, xmax, ymax, r, 0.5 * tol)
       );
     } else {
       return (
-          circoverlap(xmin, ymin, 0., 0., r) + circoverlap(0., ymin, xmax, 0., r)
-          + circoverlap(xmin, 0., 0., ymax, r) + circoverlap(0., 0., xmax, ymax, r)
+          circoverlap(xmin, ymin, 0., 0., r, 0.25 * tol)
+          + circoverlap(0., ymin, xmax, 0., r, 0.25 * tol)
+          + circoverlap(xmin, 0., 0., ymax, r, 0.25 * tol)
+          + circoverlap(0., 0., xmax, ymax, r, 0.25 * tol)
       );
     }
   }
@@ -181,364 +204,127 @@ double circoverlap_new(double dx, double dy, double r)
 /*****************************************************************************/
 /* ellipse overlap functions */
 
+/* An ellipse centered on the origin, cxx x^2 + cyy y^2 + cxy x y <= 1. Its
+ * boundary is y = m x +/- k sqrt(X^2 - x^2) for |x| <= X, and it spans
+ * |y| <= Y. */
 typedef struct {
-  double x, y;
-} point;
-
-
-typedef struct {
-  point p1, p2;
-} intersections;
-
-static INLINE void swap(double * a, double * b) {
-  double temp;
-  temp = *a;
-  *a = *b;
-  *b = temp;
-}
-
-static INLINE void swap_point(point * a, point * b) {
-  point temp;
-  temp = *a;
-  *a = *b;
-  *b = temp;
-}
-
-/* rotate values to the left: a=b, b=c, c=a */
-static INLINE void rotate(double * a, double * b, double * c) {
-  double temp;
-  temp = *a;
-  *a = *b;
-  *b = *c;
-  *c = temp;
-}
-
-/* Check if a point (x,y) is inside a triangle */
-static int in_triangle(
-    double x, double y, double x1, double y1, double x2, double y2, double x3, double y3
-) {
-  int c;
-
-  c = 0;
-  c += ((y1 > y) != (y2 > y)) && (x < (x2 - x1) * (y - y1) / (y2 - y1) + x1);
-  c += ((y2 > y) != (y3 > y)) && (x < (x3 - x2) * (y - y2) / (y3 - y2) + x2);
-  c += ((y3 > y) != (y1 > y)) && (x < (x1 - x3) * (y - y3) / (y1 - y3) + x3);
-
-  return c % 2 == 1;
-}
-
-
-/* Intersection of a line defined by two points with a unit circle */
-static intersections circle_line(double x1, double y1, double x2, double y2) {
-  double a, b, delta, dx, dy;
-  double tol = 1.e-10;
-  intersections inter;
-
-  dx = x2 - x1;
-  dy = y2 - y1;
-
-  if (fabs(dx) < tol && fabs(dy) < tol) {
-    inter.p1.x = 2.;
-    inter.p1.y = 2.;
-    inter.p2.x = 2.;
-    inter.p2.y = 2.;
-  } else if (fabs(dx) > fabs(dy)) {
-    /* Find the slope and intercept of the line */
-    a = dy / dx;
-    b = y1 - a * x1;
-
-    /* Find the determinant of the quadratic equation */
-    delta = 1. + a * a - b * b;
-    if (delta > 0.) /* solutions exist */ {
-      delta = sqrt(delta);
-
-      inter.p1.x = (-a * b - delta) / (1. + a * a);
-      inter.p1.y = a * inter.p1.x + b;
-      inter.p2.x = (-a * b + delta) / (1. + a * a);
-      inter.p2.y = a * inter.p2.x + b;
-    } else /* no solution, return values > 1 */ {
-      inter.p1.x = 2.;
-      inter.p1.y = 2.;
-      inter.p2.x = 2.;
-      inter.p2.y = 2.;
-    }
-  } else {
-    /* Find the slope and intercept of the line */
-    a = dx / dy;
-    b = x1 - a * y1;
-
-    /* Find the determinant of the quadratic equation */
-    delta = 1. + a * a - b * b;
-    if (delta > 0.) /* solutions exist */ {
-      delta = sqrt(delta);
-      inter.p1.y = (-a * b - delta) / (1. + a * a);
-      inter.p1.x = a * inter.p1.y + b;
-      inter.p2.y = (-a * b + delta) / (1. + a * a);
-      inter.p2.x = a * inter.p2.y + b;
-    } else /* no solution, return values > 1 */ {
-      inter.p1.x = 2.;
-      inter.p1.y = 2.;
-      inter.p2.x = 2.;
-      inter.p2.y = 2.;
-    }
+  double cxx, cyy, cxy;
+  double xext, yext; /* X, Y */
+  double m, k;
+} ellipgeom;
+
+/* ellipse with semi-major and semi-minor axes a and b, and position
+   angle theta */
+static void ellipgeom_init(double a, double b, double theta, ellipgeom * g) {
+  double c, s, ia2, ib2;
+
+  if (!(a > 0. && b > 0.)) {
+    g->cxx = g->cyy = g->cxy = g->m = g->k = 0.;
+    g->xext = g->yext = 0.;
+    return;
   }
-
-  return inter;
+  c = cos(theta);
+  s = sin(theta);
+  ia2 = 1. / (a * a);
+  ib2 = 1. / (b * b);
+  g->cxx = c * c * ia2 + s * s * ib2;
+  g->cyy = s * s * ia2 + c * c * ib2;
+  g->cxy = 2. * c * s * (ia2 - ib2);
+  g->xext = a * b * sqrt(g->cyy);
+  g->yext = a * b * sqrt(g->cxx);
+  g->m = -g->cxy / (2. * g->cyy);
+  g->k = 1. / (a * b * g->cyy);
 }
 
-/* The intersection of a line with the unit circle. The intersection the
- * closest to (x2, y2) is chosen. */
-static point circle_segment_single2(double x1, double y1, double x2, double y2) {
-  double dx1, dy1, dx2, dy2;
-  intersections inter;
-  point pt1, pt2, pt;
-
-  inter = circle_line(x1, y1, x2, y2);
-  pt1 = inter.p1;
-  pt2 = inter.p2;
-
-  /*Can be optimized, but just checking for correctness right now */
-  dx1 = fabs(pt1.x - x2);
-  dy1 = fabs(pt1.y - y2);
-  dx2 = fabs(pt2.x - x2);
-  dy2 = fabs(pt2.y - y2);
-
-  if (dx1 > dy1) /* compare based on x-axis */ {
-    pt = (dx1 > dx2) ? pt2 : pt1;
-  } else {
-    pt = (dy1 > dy2) ? pt2 : pt1;
-  }
-
-  return pt;
+static INLINE int in_ellipse(double x, double y, const ellipgeom * g) {
+  return g->cxx * x * x + g->cyy * y * y + g->cxy * x * y <= 1.;
 }
 
-/* Intersection(s) of a segment with the unit circle. Discard any
-   solution not on the segment. */
-static inline intersections circle_segment(double x1, double y1, double x2, double y2) {
-  intersections inter, inter_new;
-  point pt1, pt2;
-
-  inter = circle_line(x1, y1, x2, y2);
-  pt1 = inter.p1;
-  pt2 = inter.p2;
+/* exact overlap between a rectangle defined by (xmin, ymin, xmax,
+   ymax) and an ellipse, to within tol if tol > 0.
+
+   Rectangles outside the bounding box of the ellipse or with all corners
+   inside it are classified directly. Otherwise the height of the
+   intersection is integrated over x: between the values of x where the
+   boundary crosses y = ymin or y = ymax, the top and bottom of the
+   intersection are each either a side of the rectangle or a branch of the
+   boundary, so the integral is a polynomial plus k times the area under
+   the circle of radius X, which is a trapezoid and a segment
+   (area_arc()). */
+static double ellipoverlap(
+    double xmin, double ymin, double xmax, double ymax, const ellipgeom * g, double tol
+) {
+  double xs[6], ss[6], bound[2];
+  double xext2, a, c, d, t, dx, xm, ym, hw, lin, sint, area;
+  int i, j, n, top, bot;
 
-  if ((pt1.x > x1 && pt1.x > x2) || (pt1.x < x1 && pt1.x < x2)
-      || (pt1.y > y1 && pt1.y > y2) || (pt1.y < y1 && pt1.y < y2))
+  if (g->xext <= 0. || xmin >= g->xext || xmax <= -g->xext || ymin >= g->yext
+      || ymax <= -g->yext)
   {
-    pt1.x = 2.;
-    pt1.y = 2.;
+    return 0.;
   }
-  if ((pt2.x > x1 && pt2.x > x2) || (pt2.x < x1 && pt2.x < x2)
-      || (pt2.y > y1 && pt2.y > y2) || (pt2.y < y1 && pt2.y < y2))
+  if (in_ellipse(xmin, ymin, g) && in_ellipse(xmax, ymin, g) && in_ellipse(xmin, ymax, g)
+      && in_ellipse(xmax, ymax, g))
   {
-    pt2.x = 2.;
-    pt2.y = 2.;
-  }
-
-  if (pt1.x > 1. && pt2.x < 2.) {
-    inter_new.p1 = pt1;
-    inter_new.p2 = pt2;
-  } else {
-    inter_new.p1 = pt2;
-    inter_new.p2 = pt1;
+    return (xmax - xmin) * (ymax - ymin);
   }
-  return inter_new;
-}
-
 
-/* Given a triangle defined by three points (x1, y1), (x2, y2), and
-   (x3, y3), find the area of overlap with the unit circle. */
-static double triangle_unitcircle_overlap(
-    double x1, double y1, double x2, double y2, double x3, double y3
-) {
-  double d1, d2, d3, area, xp, yp;
-  int in1, in2, in3, on1, on2, on3;
-  int intersect13, intersect23;
-  intersections inter;
-  point pt1, pt2, pt3, pt4, pt5, pt6;
-
-  /* Find distance of all vertices to circle center */
-  d1 = x1 * x1 + y1 * y1;
-  d2 = x2 * x2 + y2 * y2;
-  d3 = x3 * x3 + y3 * y3;
-
-  /* Order vertices by distance from origin */
-  if (d1 < d2) {
-    if (d2 < d3) {
-    } else if (d1 < d3) {
-      swap(&x2, &x3);
-      swap(&y2, &y3);
-      swap(&d2, &d3);
-    } else {
-      rotate(&x1, &x3, &x2);
-      rotate(&y1, &y3, &y2);
-      rotate(&d1, &d3, &d2);
+  /* interval boundaries: ends, and where the boundary crosses ymin, ymax */
+  xext2 = g->xext * g->xext;
+  n = 0;
+  xs[n++] = xmin > -g->xext ? xmin : -g->xext;
+  a = g->k * g->k + g->m * g->m;
+  bound[0] = ymin;
+  bound[1] = ymax;
+  for (i = 0; i < 2; i++) {
+    c = bound[i];
+    if ((d = a * xext2 - c * c) > 0.) {
+      d = g->k * sqrt(d);
+      t = (g->m * c - d) / a;
+      if (t > xs[0] && t < xmax && t < g->xext) {
+        xs[n++] = t;
+      }
+      t = (g->m * c + d) / a;
+      if (t > xs[0] && t < xmax && t < g->xext) {
+        xs[n++] = t;
+      }
     }
-  } else {
-    if (d1 < d3) {
-      swap(&x1, &x2);
-      swap(&y1, &y2);
-      swap(&d1, &d2);
-    } else if (d2 < d3) {
-      rotate(&x1, &x2, &x3);
-      rotate(&y1, &y2, &y3);
-      rotate(&d1, &d2, &d3);
-    } else {
-      swap(&x1, &x3);
-      swap(&y1, &y3);
-      swap(&d1, &d3);
+  }
+  xs[n++] = xmax < g->xext ? xmax : g->xext;
+  for (i = 2; i < n - 1; i++) {
+    for (j = i; j > 1 && xs[j] < xs[j - 1]; j--) {
+      t = xs[j];
+      xs[j] = xs[j - 1];
+      xs[j - 1] = t;
     }
   }
-
-  /* Determine number of vertices inside circle */
-  in1 = d1 < 1.;
-  in2 = d2 < 1.;
-  in3 = d3 < 1.;
-
-  /* Determine which vertices are on the circle */
-  on1 = fabs(d1 - 1.) < 1.e-10;
-  on2 = fabs(d2 - 1.) < 1.e-10;
-  on3 = fabs(d3 - 1.) < 1.e-10;
-
-  if (on3 || in3) /* triangle completely within circle */ {
-    area = area_triangle(x1, y1, x2, y2, x3, y3);
+  for (i = 0; i < n; i++) {
+    ss[i] = (t = xext2 - xs[i] * xs[i]) > 0. ? sqrt(t) : 0.;
   }
 
-  else if (in2 || on2)
-  {
-    /* If vertex 1 or 2 are on the edge of the circle, then we use
-     * the dot product to vertex 3 to determine whether an
-     * intersection takes place. */
-    intersect13 = !on1 || (x1 * (x3 - x1) + y1 * (y3 - y1) < 0.);
-    intersect23 = !on2 || (x2 * (x3 - x2) + y2 * (y3 - y2) < 0.);
-    if (intersect13 && intersect23) {
-      pt1 = circle_segment_single2(x1, y1, x3, y3);
-      pt2 = circle_segment_single2(x2, y2, x3, y3);
-      area =
-          (area_triangle(x1, y1, x2, y2, pt1.x, pt1.y)
-           + area_triangle(x2, y2, pt1.x, pt1.y, pt2.x, pt2.y)
-           + area_arc(pt1.x, pt1.y, pt2.x, pt2.y, 1.));
-    } else if (intersect13) {
-      pt1 = circle_segment_single2(x1, y1, x3, y3);
-      area =
-          (area_triangle(x1, y1, x2, y2, pt1.x, pt1.y)
-           + area_arc(x2, y2, pt1.x, pt1.y, 1.));
-    } else if (intersect23) {
-      pt2 = circle_segment_single2(x2, y2, x3, y3);
-      area =
-          (area_triangle(x1, y1, x2, y2, pt2.x, pt2.y)
-           + area_arc(x1, y1, pt2.x, pt2.y, 1.));
-    } else {
-      area = area_arc(x1, y1, x2, y2, 1.);
+  /* at most n - 1 <= 5 segments, each counted with weight k twice */
+  tol = 0.1 * tol / g->k;
+  area = 0.;
+  for (i = 0; i < n - 1; i++) {
+    if ((dx = xs[i + 1] - xs[i]) <= 0.) {
+      continue;
     }
-  } else if (in1) {
-    /* Check for intersections of far side with circle */
-    inter = circle_segment(x2, y2, x3, y3);
-    pt1 = inter.p1;
-    pt2 = inter.p2;
-    pt3 = circle_segment_single2(x1, y1, x2, y2);
-    pt4 = circle_segment_single2(x1, y1, x3, y3);
-
-    if (pt1.x > 1.) /* indicates no intersection */ {
-      /* check if the pixel vertex (x1, y2) and the origin are on
-       * different sides of the circle segment. If they are, the
-       * circle segment spans more than pi radians.
-       * We use the formula (y-y1) * (x2-x1) > (y2-y1) * (x-x1)
-       * to determine if (x, y) is on the left of the directed
-       * line segment from (x1, y1) to (x2, y2) */
-      if (((0. - pt3.y) * (pt4.x - pt3.x) > (pt4.y - pt3.y) * (0. - pt3.x))
-          != ((y1 - pt3.y) * (pt4.x - pt3.x) > (pt4.y - pt3.y) * (x1 - pt3.x)))
-      {
-        area =
-            (area_triangle(x1, y1, pt3.x, pt3.y, pt4.x, pt4.y) + PI
-             - area_arc(pt3.x, pt3.y, pt4.x, pt4.y, 1.));
-      } else {
-        area =
-            (area_triangle(x1, y1, pt3.x, pt3.y, pt4.x, pt4.y)
-             + area_arc(pt3.x, pt3.y, pt4.x, pt4.y, 1.));
-      }
-    } else {
-      /* ensure that pt1 is the point closest to (x2, y2) */
-      if (((pt2.x - x2) * (pt2.x - x2) + (pt2.y - y2) * (pt2.y - y2))
-          < ((pt1.x - x2) * (pt1.x - x2) + (pt1.y - y2) * (pt1.y - y2)))
-      {
-        swap_point(&pt1, &pt2);
-      }
-
-      area =
-          (area_triangle(x1, y1, pt3.x, pt3.y, pt1.x, pt1.y)
-           + area_triangle(x1, y1, pt1.x, pt1.y, pt2.x, pt2.y)
-           + area_triangle(x1, y1, pt2.x, pt2.y, pt4.x, pt4.y)
-           + area_arc(pt1.x, pt1.y, pt3.x, pt3.y, 1.)
-           + area_arc(pt2.x, pt2.y, pt4.x, pt4.y, 1.));
+    xm = 0.5 * (xs[i] + xs[i + 1]);
+    ym = g->m * xm;
+    hw = (t = xext2 - xm * xm) > 0. ? g->k * sqrt(t) : 0.;
+    top = ym + hw < ymax;
+    bot = ym - hw > ymin;
+    if ((top ? ym + hw : ymax) <= (bot ? ym - hw : ymin)) {
+      continue;
     }
-  } else {
-    inter = circle_segment(x1, y1, x2, y2);
-    pt1 = inter.p1;
-    pt2 = inter.p2;
-    inter = circle_segment(x2, y2, x3, y3);
-    pt3 = inter.p1;
-    pt4 = inter.p2;
-    inter = circle_segment(x3, y3, x1, y1);
-    pt5 = inter.p1;
-    pt6 = inter.p2;
-    if (pt1.x <= 1.) {
-      xp = 0.5 * (pt1.x + pt2.x);
-      yp = 0.5 * (pt1.y + pt2.y);
-      area =
-          (triangle_unitcircle_overlap(x1, y1, x3, y3, xp, yp)
-           + triangle_unitcircle_overlap(x2, y2, x3, y3, xp, yp));
-    } else if (pt3.x <= 1.) {
-      xp = 0.5 * (pt3.x + pt4.x);
-      yp = 0.5 * (pt3.y + pt4.y);
-      area =
-          (triangle_unitcircle_overlap(x3, y3, x1, y1, xp, yp)
-           + triangle_unitcircle_overlap(x2, y2, x1, y1, xp, yp));
-    } else if (pt5.x <= 1.) {
-      xp = 0.5 * (pt5.x + pt6.x);
-      yp = 0.5 * (pt5.y + pt6.y);
-      area =
-          (triangle_unitcircle_overlap(x1, y1, x2, y2, xp, yp)
-           + triangle_unitcircle_overlap(x3, y3, x2, y2, xp, yp));
-    } else /* no intersections */ {
-      if (in_triangle(0., 0., x1, y1, x2, y2, x3, y3)) {
-        return PI;
-      } else {
-        return 0.;
-      }
+    lin = g->m * xm * dx;
+    sint = 0.;
+    if (top || bot) {
+      sint = 0.5 * dx * (ss[i] + ss[i + 1])
+             + area_arc(xs[i], ss[i], xs[i + 1], ss[i + 1], g->xext, tol);
     }
+    area += top ? lin + g->k * sint : ymax * dx;
+    area -= bot ? lin - g->k * sint : ymin * dx;
   }
   return area;
 }
-
-/* exact overlap between a rectangle defined by (xmin, ymin, xmax,
-   ymax) and an ellipse with major and minor axes rx and ry
-   respectively and position angle theta. */
-static double ellipoverlap(
-    double xmin, double ymin, double xmax, double ymax, double a, double b, double theta
-) {
-  double cos_m_theta, sin_m_theta, scale;
-  double x1, y1, x2, y2, x3, y3, x4, y4;
-
-  cos_m_theta = cos(-theta);
-  sin_m_theta = sin(-theta);
-
-  /* scale by which the areas will be shrunk */
-  scale = a * b;
-
-  /* Reproject rectangle to a frame in which ellipse is a unit circle */
-  x1 = (xmin * cos_m_theta - ymin * sin_m_theta) / a;
-  y1 = (xmin * sin_m_theta + ymin * cos_m_theta) / b;
-  x2 = (xmax * cos_m_theta - ymin * sin_m_theta) / a;
-  y2 = (xmax * sin_m_theta + ymin * cos_m_theta) / b;
-  x3 = (xmax * cos_m_theta - ymax * sin_m_theta) / a;
-  y3 = (xmax * sin_m_theta + ymax * cos_m_theta) / b;
-  x4 = (xmin * cos_m_theta - ymax * sin_m_theta) / a;
-  y4 = (xmin * sin_m_theta + ymax * cos_m_theta) / b;
-
-  /* Divide resulting quadrilateral into two triangles and find
-     intersection with unit circle */
-  return scale
-         * (triangle_unitcircle_overlap(x1, y1, x2, y2, x3, y3)
-            + triangle_unitcircle_overlap(x1, y1, x4, y4, x3, y3));
-}
@@ -0,0 +1,163 @@
+/*%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+ *
+ * This file is part of SEP
+ *
+ * Copyright 2014 SEP developers
+ *
+ * Distributed under an MIT license.
+ *
+ *%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%*/
+
+/* Minimal data-parallel loop used by batched routines.
+ *
+ * Work items [0, n) are handed out in chunks from a shared counter, so
+ * threads that finish early pick up more work. The calling thread takes
+ * part in the loop. Threads are created per call: batched routines are
+ * expected to do enough work per call for this not to matter. */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "sep.h"
+#include "sepcore.h"
+
+#if defined(_MSC_VER)
+#define SEP_NO_THREADS
+#endif
+
+#ifndef SEP_NO_THREADS
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#endif
+
+#define MAXTHREADS 256
+
+static _Atomic int nthreads = 1;
+
+void sep_set_nthreads(int val) {
+  if (val <= 0) {
+#if !defined(SEP_NO_THREADS) && defined(_SC_NPROCESSORS_ONLN)
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    val = ncpu > 0 ? (int)ncpu : 1;
+#else
+    val = 1;
+#endif
+  }
+  nthreads = val > MAXTHREADS ? MAXTHREADS : val;
+}
+
+int sep_get_nthreads(void) {
+  return nthreads;
+}
+
+int parallel_nthreads(int64_t n, int64_t chunk) {
+  int64_t nchunks;
+  int nt;
+
+#ifdef SEP_NO_THREADS
+  return 1;
+#endif
+  nt = nthreads;
+  nchunks = chunk > 0 ? (n + chunk - 1) / chunk : 1;
+  if (nchunks < nt) {
+    nt = nchunks > 1 ? (int)nchunks : 1;
+  }
+  return nt;
+}
+
+#ifndef SEP_NO_THREADS
+
+typedef struct {
+  parallel_task task;
+  void * ctx;
+  int64_t n, chunk;
+  atomic_llong next; /* start of next unclaimed chunk */
+  atomic_int status; /* first nonzero status returned by a task */
+} parallel_job;
+
+typedef struct {
+  parallel_job * job;
+  int thread;
+} parallel_worker;
+
+static void * parallel_run(void * arg) {
+  parallel_worker * worker = arg;
+  parallel_job * job = worker->job;
+  int64_t start, end;
+  int status;
+
+  while (atomic_load(&job->status) == RETURN_OK) {
+    start = atomic_fetch_add(&job->next, job->chunk);
+    if (start >= job->n) {
+      break;
+    }
+    end = start + job->chunk < job->n ? start + job->chunk : job->n;
+    status = job->task(job->ctx, start, end, worker->thread);
+    if (status != RETURN_OK) {
+      int expected = RETURN_OK;
+      atomic_compare_exchange_strong(&job->status, &expected, status);
+    }
+  }
+  return NULL;
+}
+
+#endif
+
+int parallel_for(int64_t n, int64_t chunk, parallel_task task, void * ctx) {
+  return parallel_for_n(n, chunk, parallel_nthreads(n, chunk), task, ctx);
+}
+
+int parallel_for_n(int64_t n, int64_t chunk, int nt, parallel_task task, void * ctx) {
+  if (n <= 0) {
+    return RETURN_OK;
+  }
+  if (chunk <= 0) {
+    chunk = 1;
+  }
+  if (nt > MAXTHREADS) {
+    nt = MAXTHREADS;
+  }
+  if (nt <= 1) {
+    return task(ctx, 0, n, 0);
+  }
+
+#ifdef SEP_NO_THREADS
+  return task(ctx, 0, n, 0);
+#else
+  {
+    pthread_t threads[MAXTHREADS];
+    parallel_worker workers[MAXTHREADS];
+    parallel_job job;
+    int i, nstarted;
+
+    job.task = task;
+    job.ctx = ctx;
+    job.n = n;
+    job.chunk = chunk;
+    atomic_init(&job.next, 0);
+    atomic_init(&job.status, RETURN_OK);
+
+    /* if a thread cannot be started, the remaining threads (including
+     * this one) simply do more of the work */
+    nstarted = 0;
+    for (i = 1; i < nt; i++) {
+      workers[i].job = &job;
+      workers[i].thread = nstarted + 1;
+      if (pthread_create(&threads[nstarted], NULL, parallel_run, &workers[i]) != 0) {
+        break;
+      }
+      nstarted++;
+    }
+    workers[0].job = &job;
+    workers[0].thread = 0;
+    parallel_run(&workers[0]);
+
+    for (i = 0; i < nstarted; i++) {
+      pthread_join(threads[i], NULL);
+    }
+    return atomic_load(&job.status);
+  }
+#endif
+}
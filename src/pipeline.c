@@ -0,0 +1,469 @@
+/*%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+ *
+ * This file is part of SEP
+ *
+ * Copyright 2014 SEP developers
+ *
+ * Distributed under an MIT license.
+ *
+ *%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%*/
+
+/* Background, detection and aperture photometry of a frame in one call.
+ *
+ * The background-subtracted image is never formed in full. Detection
+ * subtracts the background (and, optionally, takes its rms as the noise)
+ * line by line as it reads the image. Photometry then works on small
+ * cutouts around each object: the background is rendered into the cutout
+ * only, and each thread reuses its own cutout buffers from one object to
+ * the next. */
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sep.h"
+#include "sepcore.h"
+
+#if defined(_MSC_VER)
+#define MSVC_VOID_CAST (char *)
+#else
+#define MSVC_VOID_CAST
+#endif
+
+#define PIPE_CHUNK 8 /* objects claimed at a time by a thread */
+#define PIPE_MARGIN 2 /* pixels around the largest aperture in a cutout */
+
+/* defined in extract.c and background.c */
+int extract_with_bkg(
+    const sep_image * image,
+    const sep_bkg * bkg,
+    int bkgnoise,
+    float thresh,
+    int thresh_type,
+    int minarea,
+    const float * conv,
+    int64_t convw,
+    int64_t convh,
+    int filter_type,
+    int deblend_nthresh,
+    double deblend_cont,
+    int clean_flag,
+    double clean_param,
+    sep_catalog ** catalog
+);
+typedef struct bkgrender bkgrender;
+int bkgrender_init(const sep_bkg * bkg, bkgrender ** r);
+void bkgrender_free(bkgrender * r);
+int bkgrender_tile(
+    const bkgrender * r,
+    int rms,
+    int64_t x0,
+    int64_t y0,
+    int64_t w,
+    int64_t h,
+    PIXTYPE * out,
+    int subtract
+);
+
+/* cutout buffers of one thread */
+typedef struct {
+  PIXTYPE *data, *var, *line;
+  BYTE * mask; /* 1: masked */
+  int64_t size, linesize;
+} pipescratch;
+
+typedef struct {
+  const sep_image * im;
+  const sep_pipeline_config * cfg;
+  const sep_catalog * cat;
+  const bkgrender * render;
+  array_converter convert, nconvert, rconvert, rnconvert;
+  mask_reader mread;
+  int64_t size, nsize, mrowsize, rsize, rnsize;
+  int64_t drow, nrow, rrow, rnrow; /* bytes from one row to the next */
+  int varisarray, bkgvar; /* per-pixel variance; taken from the rms map */
+  double varval; /* scalar variance when !varisarray */
+  pipescratch * scratch;
+  sep_pipeline_result * res;
+} pipejob;
+
+void sep_pipeline_free(sep_pipeline_result * res) {
+  if (res) {
+    sep_bkg_free(res->bkg);
+    sep_catalog_free(res->catalog);
+    free(res->flux);
+    free(res->fluxerr);
+    free(res->flag);
+  }
+  free(res);
+}
+
+/* half extents in x and y of the apertures of object i */
+static void pipe_extent(
+    const sep_pipeline_config * cfg,
+    const sep_catalog * cat,
+    int64_t i,
+    double * rx,
+    double * ry
+) {
+  const sep_pipeline_aper * ap;
+  double cxx, cyy, cxy, dx, dy;
+  int k;
+
+  *rx = *ry = 0.0;
+  for (k = 0; k < cfg->naper; k++) {
+    ap = cfg->apers + k;
+    if (ap->type == SEP_PIPE_ELLIPSE) {
+      sep_ellipse_coeffs(cat->a[i], cat->b[i], cat->theta[i], &cxx, &cyy, &cxy);
+      dx = cxx - cxy * cxy / (4.0 * cyy);
+      dx = dx > 0.0 ? ap->r / sqrt(dx) : 0.0;
+      dy = cyy - cxy * cxy / (4.0 * cxx);
+      dy = dy > 0.0 ? ap->r / sqrt(dy) : 0.0;
+    } else {
+      dx = dy = ap->r;
+    }
+    /* degenerate ellipses are rejected by sep_sum_ellipse() */
+    if (isfinite(dx) && dx > *rx) {
+      *rx = dx;
+    }
+    if (isfinite(dy) && dy > *ry) {
+      *ry = dy;
+    }
+  }
+}
+
+/* make room for a w x h cutout */
+static int pipe_reserve(pipescratch * s, int64_t w, int64_t h) {
+  int status = RETURN_OK;
+
+  if (w * h > s->size) {
+    free(s->data);
+    free(s->var);
+    free(s->mask);
+    s->data = s->var = NULL;
+    s->mask = NULL;
+    s->size = 0;
+    QMALLOC(s->data, PIXTYPE, w * h, status);
+    QMALLOC(s->var, PIXTYPE, w * h, status);
+    QMALLOC(s->mask, BYTE, w * h, status);
+    s->size = w * h;
+  }
+  if (w > s->linesize) {
+    free(s->line);
+    s->line = NULL;
+    s->linesize = 0;
+    QMALLOC(s->line, PIXTYPE, w, status);
+    s->linesize = w;
+  }
+
+exit:
+  return status;
+}
+
+/* Fill the cutout [x0, x0 + w) x [y0, y0 + h) of the background-subtracted
+ * image, its variance and its mask. */
+static int pipe_cutout(
+    const pipejob * job,
+    pipescratch * s,
+    int64_t x0,
+    int64_t y0,
+    int64_t w,
+    int64_t h
+) {
+  const sep_image * im = job->im;
+  PIXTYPE *data, *var, rs2, rnv;
+  BYTE * mask;
+  int64_t x, y, pos;
+  int status = RETURN_OK;
+
+  if ((status = bkgrender_tile(job->render, 0, x0, y0, w, h, s->data, 0))) {
+    return status;
+  }
+  if (job->bkgvar
+      && (status = bkgrender_tile(job->render, 1, x0, y0, w, h, s->var, 0))) {
+    return status;
+  }
+  rs2 = (PIXTYPE)(im->refscale * im->refscale);
+  rnv = (PIXTYPE)(im->noise_type == SEP_NOISE_VAR ? im->refnoiseval
+                                                  : im->refnoiseval * im->refnoiseval);
+
+  for (y = 0; y < h; y++) {
+    pos = y0 + y;
+    data = s->data + y * w;
+    var = s->var + y * w;
+    mask = s->mask + y * w;
+
+    /* data - background - refscale * ref */
+    job->convert(MSVC_VOID_CAST im->data + pos * job->drow + x0 * job->size, w, s->line);
+    for (x = 0; x < w; x++) {
+      data[x] = s->line[x] - data[x];
+    }
+    if (im->ref) {
+      job->rconvert(MSVC_VOID_CAST im->ref + pos * job->rrow + x0 * job->rsize, w, s->line);
+      for (x = 0; x < w; x++) {
+        data[x] -= (PIXTYPE)im->refscale * s->line[x];
+      }
+    }
+
+    if (job->varisarray) {
+      if (job->bkgvar) {
+        for (x = 0; x < w; x++) {
+          var[x] *= var[x];
+        }
+      } else if (im->noise) {
+        job->nconvert(MSVC_VOID_CAST im->noise + pos * job->nrow + x0 * job->nsize, w, var);
+        if (im->noise_type == SEP_NOISE_STDDEV) {
+          for (x = 0; x < w; x++) {
+            var[x] *= var[x];
+          }
+        }
+      } else {
+        for (x = 0; x < w; x++) {
+          var[x] = (PIXTYPE)job->varval;
+        }
+      }
+      /* reference noise in quadrature */
+      if (im->ref && im->refnoise) {
+        job->rnconvert(
+            MSVC_VOID_CAST im->refnoise + pos * job->rnrow + x0 * job->rnsize, w, s->line
+        );
+        for (x = 0; x < w; x++) {
+          var[x] += rs2
+                    * (im->noise_type == SEP_NOISE_VAR ? s->line[x]
+                                                       : s->line[x] * s->line[x]);
+        }
+      } else if (im->ref) {
+        for (x = 0; x < w; x++) {
+          var[x] += rs2 * rnv;
+        }
+      }
+    }
+
+    if (im->mask) {
+      job->mread(MSVC_VOID_CAST im->mask + pos * job->mrowsize, x0, w, im->maskthresh, mask);
+    }
+  }
+
+  return status;
+}
+
+static int pipe_task(void * ctx, int64_t start, int64_t end, int thread) {
+  pipejob * job = ctx;
+  const sep_image * im = job->im;
+  const sep_pipeline_config * cfg = job->cfg;
+  const sep_catalog * cat = job->cat;
+  const sep_pipeline_aper * ap;
+  pipescratch * s = job->scratch + thread;
+  sep_image cut;
+  double rx, ry, x, y, area, *flux, *fluxerr;
+  int64_t i, x0, x1, y0, y1;
+  short *flag;
+  int k, status = RETURN_OK;
+
+  for (i = start; i < end; i++) {
+    flux = job->res->flux + i * cfg->naper;
+    fluxerr = job->res->fluxerr + i * cfg->naper;
+    flag = job->res->flag + i * cfg->naper;
+
+    /* cutout covering all apertures, with a margin so that it truncates
+     * an aperture only where the image does */
+    pipe_extent(cfg, cat, i, &rx, &ry);
+    x0 = (int64_t)floor(cat->x[i] - rx) - PIPE_MARGIN;
+    x1 = (int64_t)floor(cat->x[i] + rx) + PIPE_MARGIN + 1;
+    y0 = (int64_t)floor(cat->y[i] - ry) - PIPE_MARGIN;
+    y1 = (int64_t)floor(cat->y[i] + ry) + PIPE_MARGIN + 1;
+    x0 = x0 < 0 ? 0 : x0;
+    y0 = y0 < 0 ? 0 : y0;
+    x1 = x1 > im->w ? im->w : x1;
+    y1 = y1 > im->h ? im->h : y1;
+
+    if ((status = pipe_reserve(s, x1 - x0, y1 - y0))
+        || (status = pipe_cutout(job, s, x0, y0, x1 - x0, y1 - y0))) {
+      return status;
+    }
+
+    memset(&cut, 0, sizeof(cut));
+    cut.data = s->data;
+    cut.dtype = SEP_TFLOAT;
+    cut.noise = job->varisarray ? s->var : NULL;
+    cut.ndtype = SEP_TFLOAT;
+    cut.noise_type = SEP_NOISE_VAR;
+    cut.noiseval = job->varval;
+    cut.mask = im->mask ? s->mask : NULL;
+    cut.mdtype = SEP_TBYTE;
+    cut.maskthresh = 0.0;
+    cut.gain = im->gain;
+    cut.w = x1 - x0;
+    cut.h = y1 - y0;
+    x = cat->x[i] - x0;
+    y = cat->y[i] - y0;
+
+    for (k = 0; k < cfg->naper; k++) {
+      ap = cfg->apers + k;
+      flag[k] = 0;
+      if (ap->type == SEP_PIPE_ELLIPSE) {
+        status = sep_sum_ellipse(
+            &cut, x, y, cat->a[i], cat->b[i], cat->theta[i], ap->r, 0, ap->subpix,
+            0, flux + k, fluxerr + k, &area, flag + k
+        );
+      } else {
+        status = sep_sum_circle(
+            &cut, x, y, ap->r, 0, ap->subpix, 0, flux + k, fluxerr + k, &area,
+            flag + k
+        );
+      }
+      /* an object whose shape does not make a valid aperture is not
+       * measured, rather than failing the frame */
+      if (status == ILLEGAL_APER_PARAMS) {
+        flux[k] = fluxerr[k] = NAN;
+        status = RETURN_OK;
+      } else if (status) {
+        return status;
+      }
+    }
+  }
+
+  return RETURN_OK;
+}
+
+int sep_pipeline(
+    const sep_image * image,
+    const sep_pipeline_config * cfg,
+    sep_pipeline_result ** result
+) {
+  sep_pipeline_result * res;
+  sep_image dim;
+  pipejob job;
+  bkgrender * render;
+  pipescratch * scratch;
+  int64_t n;
+  int i, k, nthreads;
+  int status = RETURN_OK;
+
+  *result = NULL;
+  res = NULL;
+  render = NULL;
+  scratch = NULL;
+  nthreads = 0;
+  memset(&job, 0, sizeof(job));
+
+  for (k = 0; k < cfg->naper; k++) {
+    if ((cfg->apers[k].type != SEP_PIPE_CIRCLE && cfg->apers[k].type != SEP_PIPE_ELLIPSE)
+        || !(cfg->apers[k].r >= 0.0)) {
+      return ILLEGAL_APER_PARAMS;
+    }
+  }
+  if ((status = get_array_converter(image->dtype, &job.convert, &job.size))) {
+    return status;
+  }
+  if (image->noise_type != SEP_NOISE_NONE && image->noise
+      && (status = get_array_converter(image->ndtype, &job.nconvert, &job.nsize))) {
+    return status;
+  }
+  if (image->mask
+      && (status = get_mask_reader(image->mdtype, image->w, &job.mread, &job.mrowsize))) {
+    return status;
+  }
+  if (image->ref
+      && (status = get_array_converter(image->rdtype, &job.rconvert, &job.rsize))) {
+    return status;
+  }
+  if (image->ref && image->refnoise
+      && (status = get_array_converter(image->rndtype, &job.rnconvert, &job.rnsize))) {
+    return status;
+  }
+  job.drow = ROWSTRIDE(image->dstride, image->w * job.size);
+  job.nrow = ROWSTRIDE(image->nstride, image->w * job.nsize);
+  job.mrowsize = ROWSTRIDE(image->mstride, job.mrowsize);
+  job.rrow = ROWSTRIDE(image->rstride, image->w * job.rsize);
+  job.rnrow = ROWSTRIDE(image->rnstride, image->w * job.rnsize);
+
+  QCALLOC(res, sep_pipeline_result, 1, status);
+  res->naper = cfg->naper;
+
+  /* background */
+  if ((status = sep_background(
+           image, cfg->bw, cfg->bh, cfg->fw, cfg->fh, cfg->fthresh, &res->bkg
+       ))) {
+    goto exit;
+  }
+
+  /* detection: the background is subtracted as lines are read. An image
+   * without noise takes the noise of the background. */
+  dim = *image;
+  if (dim.noise_type == SEP_NOISE_NONE) {
+    dim.noise = NULL;
+    dim.noise_type = SEP_NOISE_STDDEV;
+    dim.noiseval = res->bkg->globalrms;
+  }
+  if ((status = extract_with_bkg(
+           &dim, res->bkg, image->noise_type == SEP_NOISE_NONE && cfg->rmsmap,
+           cfg->thresh, SEP_THRESH_REL, cfg->minarea, cfg->conv, cfg->convw, cfg->convh,
+           cfg->filter_type, cfg->deblend_nthresh, cfg->deblend_cont, cfg->clean_flag,
+           cfg->clean_param, &res->catalog
+       ))) {
+    goto exit;
+  }
+
+  /* photometry */
+  n = res->catalog->nobj;
+  QMALLOC(res->flux, double, n * cfg->naper + 1, status);
+  QMALLOC(res->fluxerr, double, n * cfg->naper + 1, status);
+  QMALLOC(res->flag, short, n * cfg->naper + 1, status);
+  if (n == 0 || cfg->naper == 0) {
+    goto exit;
+  }
+
+  if ((status = bkgrender_init(res->bkg, &render))) {
+    goto exit;
+  }
+  job.im = image;
+  job.cfg = cfg;
+  job.cat = res->catalog;
+  job.render = render;
+  job.res = res;
+  if (image->noise_type == SEP_NOISE_NONE) {
+    job.bkgvar = job.varisarray = cfg->rmsmap;
+    job.varval = (double)res->bkg->globalrms * res->bkg->globalrms;
+  } else {
+    job.varisarray = (image->noise != NULL);
+    job.varval = (image->noise_type == SEP_NOISE_STDDEV)
+                     ? image->noiseval * image->noiseval
+                     : image->noiseval;
+  }
+  if (image->ref) {
+    if (image->refnoise) {
+      job.varisarray = 1;
+    } else if (!job.varisarray) {
+      job.varval += image->refscale * image->refscale
+                    * (image->noise_type == SEP_NOISE_VAR
+                           ? image->refnoiseval
+                           : image->refnoiseval * image->refnoiseval);
+    }
+  }
+
+  nthreads = parallel_nthreads(n, PIPE_CHUNK);
+  QCALLOC(scratch, pipescratch, nthreads, status);
+  job.scratch = scratch;
+  status = parallel_for_n(n, PIPE_CHUNK, nthreads, pipe_task, &job);
+
+exit:
+  if (scratch) {
+    for (i = 0; i < nthreads; i++) {
+      free(scratch[i].data);
+      free(scratch[i].var);
+      free(scratch[i].mask);
+      free(scratch[i].line);
+    }
+  }
+  free(scratch);
+  bkgrender_free(render);
+  if (status != RETURN_OK) {
+    sep_pipeline_free(res);
+  } else {
+    *result = res;
+  }
+  return status;
+}
@@ -0,0 +1,418 @@
+/*%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+ *
+ * This file is part of SEP
+ *
+ * Copyright 2014 SEP developers
+ *
+ * Distributed under an MIT license.
+ *
+ *%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%*/
+
+/* Linear PSF-weighted photometry at fixed positions.
+ *
+ * The sub-pixel offset of each position from the pixel grid is quantized
+ * into nshift x nshift bins. For every (tile, bin) pair that some object
+ * falls in, the PSF stamp of the tile is shifted by the center of the bin
+ * by band-limited (sinc) interpolation and normalized to unit sum.
+ * These stamps are built once, in parallel, and shared by all objects.
+ * Each object then needs a single pass over the pixels under its stamp to
+ * accumulate the inverse-variance weighted sums of the linear estimator. */
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sep.h"
+#include "sepcore.h"
+
+#if defined(_MSC_VER)
+#define MSVC_VOID_CAST (char *)
+#else
+#define MSVC_VOID_CAST
+#endif
+
+#define PSF_CHUNK 16 /* objects claimed at a time by a thread */
+
+typedef struct {
+  const sep_psf * psf;
+  converter pconvert;
+  int64_t psize;
+  int nshift;
+  int64_t * keys; /* (tile, bin) pairs to build */
+  double ** stamps; /* indexed by tile * nshift^2 + bin */
+} stampjob;
+
+typedef struct {
+  const sep_image * im;
+  const sep_psf * psf;
+  const double *x, *y;
+  const int * id;
+  int nshift;
+  double ** stamps;
+  converter convert, econvert;
+  mask_reader mread;
+  id_converter sconvert;
+  int64_t size, esize, mrowsize, ssize;
+  int64_t drow, erow, srow; /* bytes from one row to the next */
+  double *flux, *fluxerr;
+  short * flag;
+} psfjob;
+
+/* matrix m (n x n) that shifts a band-limited sequence of length n by s:
+ * (m x)[i] interpolates x at i - s, by the periodic sinc (Dirichlet)
+ * kernel. This is exact for a well-sampled PSF that vanishes at the
+ * edges of its stamp. */
+static void shift_matrix(int64_t n, double s, double * m) {
+  double u;
+  int64_t i, k;
+
+  for (i = 0; i < n; i++) {
+    for (k = 0; k < n; k++) {
+      u = PI * (i - k - s);
+      if (fabs(u) < 1.0e-12) {
+        m[i * n + k] = 1.0;
+      } else if (n % 2) {
+        m[i * n + k] = sin(u) / (n * sin(u / n));
+      } else {
+        m[i * n + k] = sin(u) / (n * tan(u / n));
+      }
+    }
+  }
+}
+
+/* center of quantization bin k, as an offset in [-0.5, 0.5) */
+static double bin_center(int k, int nshift) {
+  return (k + 0.5) / nshift - 0.5;
+}
+
+/* locate the stamp and the first image pixel it covers for an object at
+ * (x, y); returns the index into the stamp cache */
+static int64_t psf_locate(
+    const sep_psf * psf, int nshift, double x, double y, int64_t * x0, int64_t * y0
+) {
+  double sx, sy;
+  int64_t tx, ty, kx, ky;
+
+  tx = (psf->nx > 1 && psf->tw > 0) ? (int64_t)floor(x / psf->tw) : 0;
+  ty = (psf->ny > 1 && psf->th > 0) ? (int64_t)floor(y / psf->th) : 0;
+  tx = tx < 0 ? 0 : (tx >= psf->nx ? psf->nx - 1 : tx);
+  ty = ty < 0 ? 0 : (ty >= psf->ny ? psf->ny - 1 : ty);
+
+  /* stamp pixel i lands on image pixel x0 + i; sx is what remains of the
+   * offset between the object and the stamp center */
+  sx = x - 0.5 * (psf->w - 1);
+  sy = y - 0.5 * (psf->h - 1);
+  *x0 = (int64_t)floor(sx + 0.5);
+  *y0 = (int64_t)floor(sy + 0.5);
+  kx = (int64_t)floor((sx - *x0 + 0.5) * nshift);
+  ky = (int64_t)floor((sy - *y0 + 0.5) * nshift);
+  kx = kx < 0 ? 0 : (kx >= nshift ? nshift - 1 : kx);
+  ky = ky < 0 ? 0 : (ky >= nshift ? nshift - 1 : ky);
+
+  return ((ty * psf->nx + tx) * nshift + ky) * nshift + kx;
+}
+
+/* build the stamp of cache index key: the tile PSF shifted by the center
+ * (sx, sy) of the bin, normalized. buf holds 2 w h + w^2 + h^2 doubles. */
+static int stamp_build(const stampjob * job, int64_t key, double * out, double * buf) {
+  const sep_psf * psf = job->psf;
+  const BYTE * src;
+  double *pix, *tmp, *mx, *my, sum;
+  int64_t i, j, k, w, h;
+  int nshift = job->nshift;
+
+  w = psf->w;
+  h = psf->h;
+  pix = buf;
+  tmp = pix + w * h;
+  mx = tmp + w * h;
+  my = mx + w * w;
+  src = MSVC_VOID_CAST psf->data + key / ((int64_t)nshift * nshift) * w * h * job->psize;
+  for (i = 0; i < w * h; i++) {
+    pix[i] = job->pconvert(src + i * job->psize);
+  }
+  shift_matrix(w, bin_center((int)(key % nshift), nshift), mx);
+  shift_matrix(h, bin_center((int)(key / nshift % nshift), nshift), my);
+
+  /* shift rows */
+  for (j = 0; j < h; j++) {
+    for (i = 0; i < w; i++) {
+      sum = 0.0;
+      for (k = 0; k < w; k++) {
+        sum += mx[i * w + k] * pix[j * w + k];
+      }
+      tmp[j * w + i] = sum;
+    }
+  }
+
+  /* shift columns */
+  memset(out, 0, (size_t)(w * h) * sizeof(double));
+  for (j = 0; j < h; j++) {
+    for (k = 0; k < h; k++) {
+      for (i = 0; i < w; i++) {
+        out[j * w + i] += my[j * h + k] * tmp[k * w + i];
+      }
+    }
+  }
+
+  sum = 0.0;
+  for (i = 0; i < w * h; i++) {
+    sum += out[i];
+  }
+  if (sum == 0.0) {
+    return ILLEGAL_APER_PARAMS;
+  }
+  for (i = 0; i < w * h; i++) {
+    out[i] /= sum;
+  }
+
+  return RETURN_OK;
+}
+
+static int stamp_task(void * ctx, int64_t start, int64_t end, int thread) {
+  stampjob * job = ctx;
+  double * buf;
+  int64_t i, key, w, h;
+  int status = RETURN_OK;
+
+  (void)thread;
+  buf = NULL;
+  w = job->psf->w;
+  h = job->psf->h;
+  QMALLOC(buf, double, 2 * w * h + w * w + h * h, status);
+  for (i = start; i < end; i++) {
+    key = job->keys[i];
+    if ((status = stamp_build(job, key, job->stamps[key], buf))) {
+      goto exit;
+    }
+  }
+
+exit:
+  free(buf);
+  return status;
+}
+
+static int psf_task(void * ctx, int64_t start, int64_t end, int thread) {
+  psfjob * job = ctx;
+  const sep_image * im = job->im;
+  const sep_psf * psf = job->psf;
+  const BYTE *datat, *errort, *maskt, *segt;
+  const double * stamp;
+  PIXTYPE pix, varpix;
+  int64_t seg;
+  double p, v, wt, swpp, swpd, swwppv;
+  int64_t i, ix, iy, x0, y0, xmin, xmax, ymin, ymax, sp;
+  int ismasked, id, errisarray, errisstd;
+  short flag;
+  BYTE mflag;
+
+  (void)thread;
+  errisarray = (im->noise_type != SEP_NOISE_NONE && im->noise);
+  errisstd = (im->noise_type == SEP_NOISE_STDDEV);
+  varpix = (errisstd) ? im->noiseval * im->noiseval : im->noiseval;
+  datat = errort = maskt = segt = NULL;
+
+  for (i = start; i < end; i++) {
+    flag = 0;
+    swpp = swpd = swwppv = 0.0;
+    id = job->id ? job->id[i] : 0;
+
+    if (!(isfinite(job->x[i]) && isfinite(job->y[i]))) {
+      job->flux[i] = job->fluxerr[i] = NAN;
+      job->flag[i] = 0;
+      continue;
+    }
+    stamp = job->stamps[psf_locate(psf, job->nshift, job->x[i], job->y[i], &x0, &y0)];
+
+    /* part of the stamp that lies on the image */
+    xmin = x0 < 0 ? 0 : x0;
+    ymin = y0 < 0 ? 0 : y0;
+    xmax = x0 + psf->w > im->w ? im->w : x0 + psf->w;
+    ymax = y0 + psf->h > im->h ? im->h : y0 + psf->h;
+    if (xmin != x0 || ymin != y0 || xmax != x0 + psf->w || ymax != y0 + psf->h) {
+      flag |= SEP_APER_TRUNC;
+    }
+
+    for (iy = ymin; iy < ymax; iy++) {
+      datat = MSVC_VOID_CAST im->data + iy * job->drow + xmin * job->size;
+      if (errisarray) {
+        errort = MSVC_VOID_CAST im->noise + iy * job->erow + xmin * job->esize;
+      }
+      if (im->mask) {
+        maskt = MSVC_VOID_CAST im->mask + iy * job->mrowsize;
+      }
+      if (im->segmap) {
+        segt = MSVC_VOID_CAST im->segmap + iy * job->srow + xmin * job->ssize;
+      }
+      sp = (iy - y0) * psf->w + (xmin - x0);
+
+      for (ix = xmin; ix < xmax; ix++, sp++) {
+        p = stamp[sp];
+        if (p != 0.0) {
+          mflag = 0;
+          if (im->mask) {
+            job->mread(maskt, ix, 1, im->maskthresh, &mflag);
+          }
+          ismasked = mflag;
+          /* segmentation map: as in the aperture functions */
+          if (im->segmap) {
+            seg = job->sconvert(segt);
+            if (id > 0 ? (seg > 0 && seg != id) : (seg != -1 * id)) {
+              ismasked = 1;
+            }
+          }
+
+          if (ismasked) {
+            flag |= SEP_APER_HASMASKED;
+          } else {
+            pix = job->convert(datat);
+            if (errisarray) {
+              varpix = job->econvert(errort);
+              if (errisstd) {
+                varpix *= varpix;
+              }
+            }
+            wt = (im->noise_type != SEP_NOISE_NONE) ? 1.0 / varpix : 1.0;
+            if (isfinite(wt) && wt > 0.0) {
+              /* variance of the pixel, including source Poisson noise */
+              v = (im->noise_type != SEP_NOISE_NONE) ? varpix : 0.0;
+              if (im->gain > 0.0 && pix > 0.0) {
+                v += pix / im->gain;
+              }
+              swpp += wt * p * p;
+              swpd += wt * p * pix;
+              swwppv += wt * wt * p * p * v;
+            }
+          }
+        }
+
+        datat += job->size;
+        if (errisarray) {
+          errort += job->esize;
+        }
+        if (im->segmap) {
+          segt += job->ssize;
+        }
+      }
+    }
+
+    if (swpp > 0.0) {
+      job->flux[i] = swpd / swpp;
+      job->fluxerr[i] = sqrt(swwppv) / swpp;
+    } else {
+      job->flux[i] = job->fluxerr[i] = NAN;
+      if (flag & SEP_APER_HASMASKED) {
+        flag |= SEP_APER_ALLMASKED;
+      }
+    }
+    job->flag[i] = flag;
+  }
+
+  return RETURN_OK;
+}
+
+int sep_sum_psf(
+    const sep_image * im,
+    const sep_psf * psf,
+    const double * x,
+    const double * y,
+    const int * id,
+    int64_t n,
+    int nshift,
+    double * flux,
+    double * fluxerr,
+    short * flag
+) {
+  stampjob sjob;
+  psfjob job;
+  double ** stamps;
+  int64_t * keys;
+  int64_t i, x0, y0, key, ncache, nkeys, npix;
+  int status = RETURN_OK;
+
+  stamps = NULL;
+  keys = NULL;
+  ncache = nkeys = 0;
+
+  /* input checks */
+  if (psf->w < 1 || psf->h < 1 || psf->nx < 1 || psf->ny < 1 || nshift < 1
+      || (psf->nx > 1 && psf->tw < 1) || (psf->ny > 1 && psf->th < 1)) {
+    return ILLEGAL_APER_PARAMS;
+  }
+  if (n == 0) {
+    return RETURN_OK;
+  }
+
+  memset(&job, 0, sizeof(job));
+  memset(&sjob, 0, sizeof(sjob));
+  if ((status = get_converter(psf->dtype, &sjob.pconvert, &sjob.psize))) {
+    goto exit;
+  }
+  if ((status = get_converter(im->dtype, &job.convert, &job.size))) {
+    goto exit;
+  }
+  if (im->noise_type != SEP_NOISE_NONE && im->noise
+      && (status = get_converter(im->ndtype, &job.econvert, &job.esize))) {
+    goto exit;
+  }
+  if (im->mask
+      && (status = get_mask_reader(im->mdtype, im->w, &job.mread, &job.mrowsize))) {
+    goto exit;
+  }
+  if (im->segmap && (status = get_id_converter(im->sdtype, &job.sconvert, &job.ssize))) {
+    goto exit;
+  }
+  job.drow = ROWSTRIDE(im->dstride, im->w * job.size);
+  job.erow = ROWSTRIDE(im->nstride, im->w * job.esize);
+  job.mrowsize = ROWSTRIDE(im->mstride, job.mrowsize);
+  job.srow = ROWSTRIDE(im->sstride, im->w * job.ssize);
+
+  /* collect the (tile, bin) pairs used by some object */
+  ncache = psf->nx * psf->ny * nshift * nshift;
+  npix = psf->w * psf->h;
+  QCALLOC(stamps, double *, ncache, status);
+  QMALLOC(keys, int64_t, n < ncache ? n : ncache, status);
+  for (i = 0; i < n; i++) {
+    if (isfinite(x[i]) && isfinite(y[i])) {
+      key = psf_locate(psf, nshift, x[i], y[i], &x0, &y0);
+      if (!stamps[key]) {
+        QMALLOC(stamps[key], double, npix, status);
+        keys[nkeys++] = key;
+      }
+    }
+  }
+
+  /* build them */
+  sjob.psf = psf;
+  sjob.nshift = nshift;
+  sjob.keys = keys;
+  sjob.stamps = stamps;
+  if ((status = parallel_for(nkeys, 1, stamp_task, &sjob))) {
+    goto exit;
+  }
+
+  /* measure objects */
+  job.im = im;
+  job.psf = psf;
+  job.x = x;
+  job.y = y;
+  job.id = id;
+  job.nshift = nshift;
+  job.stamps = stamps;
+  job.flux = flux;
+  job.fluxerr = fluxerr;
+  job.flag = flag;
+  status = parallel_for(n, PSF_CHUNK, psf_task, &job);
+
+exit:
+  if (stamps) {
+    for (i = 0; i < nkeys; i++) {
+      free(stamps[keys[i]]);
+    }
+  }
+  free(stamps);
+  free(keys);
+  return status;
+}
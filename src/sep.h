@@ -29,11 +29,20 @@
 #define SEP_API __attribute__((visibility("default")))
 #endif
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 /* datatype codes */
 #define SEP_TBYTE 11 /* 8-bit unsigned byte */
+#define SEP_TUSHORT 20 /* 16-bit unsigned integer */
+#define SEP_TSHORT 21 /* 16-bit signed integer */
 #define SEP_TINT 31 /* native int type */
 #define SEP_TFLOAT 42
 #define SEP_TDOUBLE 82
+#define SEP_TBIT 1 /* packed bits, for masks only (see sep_image) */
+#define SEP_TSWAP 0x100 /* or'd with the type of an input array whose
+                         * elements are in non-native byte order */
 
 /* object & aperture flags */
 #define SEP_OBJ_MERGED 0x0001 /* object is result of deblending */
@@ -61,12 +70,34 @@
 #define SEP_FILTER_CONV 0
 #define SEP_FILTER_MATCHED 1
 
+/* implementations of the detection filter (see sep_set_conv_plan()) */
+#define SEP_CONV_AUTO 0 /* time the candidates on first use */
+#define SEP_CONV_DIRECT 1 /* 2-d kernel */
+#define SEP_CONV_SEPARABLE 2 /* row and column passes, if possible */
+
 /* structs ------------------------------------------------------------------*/
 
 /* sep_image
  *
  * Represents an image, including data, noise and mask arrays, and
  * gain.
+ *
+ * An optional reference (template) image can be attached for difference
+ * imaging. When `ref` is set, sep_extract() detects on
+ * `data - refscale * ref`, formed one line at a time. If the image has
+ * noise, the reference noise (`refnoise` or `refnoiseval`, interpreted
+ * according to `noise_type`) is scaled by `refscale` and added in
+ * quadrature. Leave `ref` NULL to disable.
+ *
+ * A mask may be given as packed bits (mdtype SEP_TBIT): one bit per pixel,
+ * most significant bit first, with each row padded to a whole number of
+ * bytes, as produced by numpy.packbits(mask, axis=1). A set bit counts as
+ * a mask value of 1 and a clear bit as 0.
+ *
+ * The rows of each input array need not be adjacent: a nonzero stride
+ * (`dstride` for `data`, and so on) is the distance in bytes from the
+ * start of one row to the next, and may be negative. Zero means the rows
+ * are contiguous. The elements within a row must be adjacent.
  */
 typedef struct {
   const void * data; /* data array                */
@@ -86,6 +117,18 @@ typedef struct {
   short noise_type; /* interpretation of noise value                  */
   double gain; /* (poisson counts / data unit)                   */
   double maskthresh; /* pixel considered masked if mask > maskthresh   */
+  const void * ref; /* reference (template) image (can be NULL)       */
+  const void * refnoise; /* reference noise array (can be NULL)          */
+  int rdtype; /* element type of reference image              */
+  int rndtype; /* element type of reference noise              */
+  double refscale; /* reference is scaled by this before subtraction */
+  double refnoiseval; /* scalar ref noise; used only if refnoise == NULL */
+  int64_t dstride; /* bytes between rows of data (0: contiguous)    */
+  int64_t nstride; /* bytes between rows of noise                   */
+  int64_t mstride; /* bytes between rows of mask                    */
+  int64_t sstride; /* bytes between rows of segmap                  */
+  int64_t rstride; /* bytes between rows of ref                     */
+  int64_t rnstride; /* bytes between rows of refnoise                */
 } sep_image;
 
 /* sep_bkg
@@ -104,6 +147,10 @@ typedef struct {
   float * dback;
   float * sigma;
   float * dsigma;
+  int64_t subsample; /* pixel stride used for the tile statistics */
+  int64_t nsample; /* number of valid pixels used for the statistics */
+  float * backerr; /* statistical error of each tile background (NaN if
+                      the tile had too few valid pixels) */
 } sep_bkg;
 
 /* sep_catalog
@@ -134,6 +181,11 @@ typedef struct {
   /* image (linearly indexed). Length is `npix`.  */
   /* (pointer to within the `objectspix` buffer)  */
   int64_t * objectspix; /* buffer holding pixel indicies for all objects */
+  /* optional (see sep_set_extract_pixvalues()): value, filtered value and */
+  /* variance of each pixel in `objectspix`, in the same order. */
+  float * objectsvalue;
+  float * objectscdvalue;
+  float * objectsvar; /* NULL if the image has no noise */
 } sep_catalog;
 
 
@@ -166,6 +218,66 @@ SEP_API int sep_background(
 ); /* OUTPUT                           */
 
 
+/* sep_background_masked()
+ *
+ * As sep_background(), but iteratively excludes pixels around sources from
+ * the background statistics. After an initial estimate, each of `niter`
+ * iterations detects pixels whose 3x3 sum is more than `nsigma` standard
+ * deviations above the current background, excludes all pixels within
+ * `dilate` pixels of them (in addition to masked pixels), and re-estimates
+ * the background. The image is processed one row of tiles at a time; no
+ * full-size intermediate arrays are allocated. With `niter` = 0, this is
+ * identical to sep_background().
+ */
+SEP_API int sep_background_masked(
+    const sep_image * image,
+    int64_t bw,
+    int64_t bh,
+    int64_t fw,
+    int64_t fh,
+    double fthresh,
+    double nsigma, /* detection threshold in standard deviations */
+    int64_t dilate, /* exclusion radius around detections (pixels) */
+    int niter, /* number of masked re-estimations */
+    sep_bkg ** bkg
+);
+
+
+/* sep_background_multiscale()
+ *
+ * Estimate the background at `nscales` mesh sizes in a single pass over
+ * the image. bkgs[i] (an array of nscales pointers, filled on output) uses
+ * tiles of size (bw << i, bh << i). bkgs[0] is identical to the result of
+ * sep_background(); coarser meshes are derived by merging the histograms
+ * and moments of the finest meshes, and agree with sep_background() at
+ * that tile size to within a small fraction of the noise. Each map must
+ * be freed with sep_bkg_free().
+ */
+SEP_API int sep_background_multiscale(
+    const sep_image * image,
+    int64_t bw,
+    int64_t bh,
+    int64_t fw,
+    int64_t fh,
+    double fthresh,
+    int nscales,
+    sep_bkg ** bkgs
+);
+
+
+/* sep_[set,get]_background_subsample()
+ *
+ * Set and get the pixel stride used by the background estimation routines
+ * (default 1). With a stride n > 1, only one pixel in n along x and y of
+ * each tile is read, on a lattice whose offset varies from one row of
+ * tiles to the next, for roughly n^2 times less work. The statistical
+ * error of the result grows by about n (see `backerr` and `nsample` in
+ * sep_bkg).
+ */
+SEP_API void sep_set_background_subsample(int val);
+SEP_API int sep_get_background_subsample(void);
+
+
 /* sep_bkg_global[rms]()
  *
  * Get the estimate of the global background "median" or standard deviation.
@@ -205,6 +317,92 @@ SEP_API int sep_bkg_array(const sep_bkg * bkg, void * arr, int dtype);
 SEP_API int sep_bkg_subarray(const sep_bkg * bkg, void * arr, int dtype);
 SEP_API int sep_bkg_rmsarray(const sep_bkg * bkg, void * arr, int dtype);
 
+
+/* sep_bkg_eval()
+ *
+ * Evaluate the background and/or RMS at n arbitrary positions (x[i], y[i]).
+ * Uses the same bicubic spline as sep_bkg_line(), so that at integer
+ * positions the results agree with sep_bkg_array() to float precision.
+ * Either `back` or `rms` (arrays of length n) may be NULL. Positions
+ * outside the image are moved to the nearest pixel of the image, as the
+ * spline is not meant to be extrapolated; non-finite positions give NaN.
+ * Positions are evaluated in parallel (see sep_set_nthreads()).
+ */
+SEP_API int sep_bkg_eval(
+    const sep_bkg * bkg,
+    const double * x,
+    const double * y,
+    int64_t n,
+    double * back,
+    double * rms
+);
+
+/* sep_bkg_[sub,rms]tile()
+ *
+ * Evaluate the background or RMS in the w x h region whose first pixel is
+ * (x0, y0), without rendering the rest of the image. Results agree with
+ * the corresponding region of sep_bkg_array() to float precision. `out`
+ * must be a contiguous w x h array; the second function subtracts the
+ * background from it instead. Pixels outside the image take the value of
+ * the nearest edge pixel, as in sep_bkg_eval(). Rows are evaluated in
+ * parallel (see sep_set_nthreads()).
+ */
+SEP_API int sep_bkg_tile(
+    const sep_bkg * bkg, int64_t x0, int64_t y0, int64_t w, int64_t h, void * out, int dtype
+);
+SEP_API int sep_bkg_subtile(
+    const sep_bkg * bkg, int64_t x0, int64_t y0, int64_t w, int64_t h, void * arr, int dtype
+);
+SEP_API int sep_bkg_rmstile(
+    const sep_bkg * bkg, int64_t x0, int64_t y0, int64_t w, int64_t h, void * out, int dtype
+);
+
+/* sep_stats_[box,circann]()
+ *
+ * Clipped statistics of n regions of an image, using the estimator that
+ * sep_background() applies to each mesh. Regions are the boxes
+ * [xmin, xmax] x [ymin, ymax] (inclusive) or the pixels whose centers lie
+ * in the annulus rin <= r < rout around (x, y). Pixels that are masked
+ * (image->mask > image->maskthresh) or not finite are excluded. For each
+ * region, outputs are:
+ *
+ * mean, sigma: clipped mean and standard deviation (as the background and
+ *              RMS of a mesh)
+ * mode: Source Extractor's mode estimate, 2.5 * median - 1.5 * mean,
+ *       or the median when the two differ by more than 0.3 sigma
+ * npix: number of valid pixels in the region
+ * flag: SEP_APER_TRUNC, SEP_APER_HASMASKED, SEP_APER_ALLMASKED
+ *
+ * Statistics are NaN for regions without valid pixels. Regions are
+ * processed in parallel (see sep_set_nthreads()).
+ */
+SEP_API int sep_stats_box(
+    const sep_image * image,
+    const int64_t * xmin,
+    const int64_t * xmax,
+    const int64_t * ymin,
+    const int64_t * ymax,
+    int64_t n,
+    double * mean,
+    double * mode,
+    double * sigma,
+    int64_t * npix,
+    short * flag
+);
+SEP_API int sep_stats_circann(
+    const sep_image * image,
+    const double * x,
+    const double * y,
+    const double * rin,
+    const double * rout,
+    int64_t n,
+    double * mean,
+    double * mode,
+    double * sigma,
+    int64_t * npix,
+    short * flag
+);
+
 /* sep_bkg_free()
  *
  * Free memory associated with bkg.
@@ -258,9 +456,93 @@ SEP_API size_t sep_get_extract_object_limit();
 SEP_API void sep_set_sub_object_limit(int val);
 SEP_API int sep_get_sub_object_limit(void);
 
+/* set and get whether extract() exports the values of object pixels
+ *
+ * If nonzero, catalogs from sep_extract() also hold the value (as used
+ * for measurement: masked pixels are 0, and any reference image is
+ * subtracted), filtered value and variance of every pixel listed in
+ * `objectspix`, in `objectsvalue`, `objectscdvalue` and `objectsvar`.
+ * The values of object i start at index pix[i] - objectspix. Without a
+ * filter the filtered value is the value; without noise `objectsvar` is
+ * NULL. Default is 0.
+ *
+ * Unlike the other settings, this one is kept per thread: it applies to
+ * the extractions started from the thread that set it, so that threads
+ * extracting at the same time can choose independently.
+ */
+SEP_API void sep_set_extract_pixvalues(int val);
+SEP_API int sep_get_extract_pixvalues(void);
+
+/* set and get how the detection filter is applied in extract()
+ *
+ * A kernel that is the outer product of a row and a column can be
+ * applied as two 1-d passes instead of one 2-d pass; the results agree
+ * to float rounding. With SEP_CONV_AUTO, both are timed the first time a
+ * (kernel size, image width) class is seen, and the faster is used from
+ * then on, so that catalogs may differ slightly between machines. Other
+ * kernels are always applied directly. Default is SEP_CONV_DIRECT.
+ */
+SEP_API void sep_set_conv_plan(int plan);
+SEP_API int sep_get_conv_plan(void);
+
+/* sep_conv_plan()
+ *
+ * The implementation (SEP_CONV_DIRECT or SEP_CONV_SEPARABLE) that
+ * extract() uses for kernel conv on an image w pixels wide, timing the
+ * candidates now if needed.
+ */
+SEP_API int sep_conv_plan(
+    const float * conv, int64_t convw, int64_t convh, int64_t w, int * plan
+);
+
+/* set the file that keeps the decisions of SEP_CONV_AUTO across
+ * processes: decisions in it are loaded now, and new ones are appended.
+ * A file that does not exist yet is created when needed. NULL or an empty
+ * path stops using a file. */
+SEP_API int sep_set_tune_cache(const char * path);
+
 /* free memory associated with a catalog */
 SEP_API void sep_catalog_free(sep_catalog * catalog);
 
+/*---------------------------- catalog output -------------------------------*/
+
+#define SEP_CATFMT_FITS 0 /* FITS binary table */
+#define SEP_CATFMT_ARROW 1 /* Arrow IPC file format */
+
+typedef struct sep_catwriter sep_catwriter;
+
+/* sep_catwriter_open()
+ *
+ * Open a catalog file for streaming output. Rows passed to
+ * sep_catwriter_write() are buffered by column and written out every
+ * `rowgroup` rows (0 for the default of 65536): as a block of table rows
+ * for FITS, or as one record batch for Arrow. Catalogs from successive
+ * calls to sep_extract() (e.g., one per image tile) can be appended to the
+ * same file without holding them all in memory.
+ *
+ * Columns have the same names and order as those returned by the Python
+ * extract(). The file is only complete once sep_catwriter_close() has
+ * been called.
+ */
+SEP_API int sep_catwriter_open(
+    const char * path,
+    int format, /* SEP_CATFMT_FITS or SEP_CATFMT_ARROW */
+    int64_t rowgroup, /* rows buffered per write (0: default) */
+    sep_catwriter ** writer
+); /* OUTPUT writer */
+
+/* append all objects in a catalog */
+SEP_API int sep_catwriter_write(sep_catwriter * writer, const sep_catalog * catalog);
+
+/* write out any buffered rows now */
+SEP_API int sep_catwriter_flush(sep_catwriter * writer);
+
+/* number of rows written or buffered so far */
+SEP_API int64_t sep_catwriter_nrows(const sep_catwriter * writer);
+
+/* flush, finalize the file and free the writer (also on error) */
+SEP_API int sep_catwriter_close(sep_catwriter * writer);
+
 /*-------------------------- aperture photometry ----------------------------*/
 
 
@@ -461,6 +743,102 @@ SEP_API int sep_windowed(
     short * flag
 );
 
+/* sep_windowed_moments()
+ *
+ * Windowed positions of n objects, as in sep_windowed(), with their
+ * windowed second moments, shape and position errors (SExtractor's
+ * X2WIN_IMAGE, Y2WIN_IMAGE, XYWIN_IMAGE, AWIN_IMAGE, BWIN_IMAGE,
+ * THETAWIN_IMAGE, ERRX2WIN_IMAGE, ERRY2WIN_IMAGE and ERRXYWIN_IMAGE).
+ * The moments are taken over the same pixels and Gaussian weights as the
+ * position, in the same pass, about the windowed centroid; a, b and theta
+ * are derived from them as in sep_extract(). The errors are the variances
+ * and covariance of the position, from the image noise (0 without noise),
+ * plus source Poisson noise if im->gain > 0. These outputs are NaN if the
+ * window holds no positive weighted flux. Any of x2 ... errxy may be NULL;
+ * if all are, only positions are measured, at the cost of sep_windowed().
+ * Objects are processed in parallel (see sep_set_nthreads()).
+ */
+SEP_API int sep_windowed_moments(
+    const sep_image * im,
+    const double * x,
+    const double * y,
+    const double * sig,
+    int64_t n,
+    int subpix,
+    short inflag,
+    double * xout,
+    double * yout,
+    double * x2,
+    double * y2,
+    double * xy,
+    double * a,
+    double * b,
+    double * theta,
+    double * errx2,
+    double * erry2,
+    double * errxy,
+    short * flag
+);
+
+/* set and get the accuracy of exact overlap (subpix = 0)
+ *
+ * With tol > 0, the area of the circular segments that make up the overlap
+ * of an aperture with a boundary pixel is evaluated from a truncated
+ * series wherever that is guaranteed to be within tolerance, avoiding
+ * the inverse trigonometric functions. The overlap of each
+ * pixel with the aperture is then within tol of its exact value. The
+ * default, 0, always uses the exact expression. */
+SEP_API void sep_set_overlap_tolerance(double tol);
+SEP_API double sep_get_overlap_tolerance(void);
+
+/* sep_psf
+ *
+ * A point-spread function model: one stamp, or a grid of stamps each
+ * applying to a tile of the image. Stamp (i, j) of the grid is the w x h
+ * array starting at element (j * nx + i) * w * h of data. The PSF is
+ * centered at ((w - 1) / 2, (h - 1) / 2) in stamp pixel coordinates.
+ */
+typedef struct {
+  const void * data; /* stamp array(s) */
+  int dtype; /* element type of data */
+  int64_t w, h; /* stamp width, height */
+  int64_t nx, ny; /* number of tiles in x, y (1, 1 for a single PSF) */
+  int64_t tw, th; /* tile width, height in image pixels */
+} sep_psf;
+
+/* sep_sum_psf()
+ *
+ * Linear PSF-weighted flux of n objects at fixed positions (x, y). With
+ * P the PSF shifted to the object and normalized to unit sum, w = 1 / var
+ * the inverse variance of each pixel (1 without noise), the flux is
+ *
+ *   flux = sum(w P data) / sum(w P^2)
+ *
+ * and fluxerr its standard deviation, including source Poisson noise if
+ * im->gain > 0. The PSF of an object is that of the tile containing it.
+ * Sub-pixel shifts are quantized into nshift x nshift bins per pixel, so
+ * the position error of the model is at most 0.5 / nshift pixels; each
+ * shifted stamp is computed once (by sinc interpolation) and reused.
+ * Masked pixels are excluded; the segmentation map is applied as in
+ * sep_sum_circle() with id[i] (id may be NULL for all zero).
+ *
+ * flag: SEP_APER_TRUNC, SEP_APER_HASMASKED, SEP_APER_ALLMASKED. Flux and
+ * fluxerr are NaN when no valid pixel overlaps the PSF. Objects are
+ * processed in parallel (see sep_set_nthreads()).
+ */
+SEP_API int sep_sum_psf(
+    const sep_image * im,
+    const sep_psf * psf,
+    const double * x,
+    const double * y,
+    const int * id,
+    int64_t n,
+    int nshift,
+    double * flux,
+    double * fluxerr,
+    short * flag
+);
+
 
 /* sep_set_ellipse()
  *
@@ -501,6 +879,269 @@ SEP_API void sep_ellipse_coeffs(
     double a, double b, double theta, double * cxx, double * cyy, double * cxy
 );
 
+/*---------------------------- spatial index --------------------------------*/
+
+typedef struct sep_index sep_index;
+
+/* sep_index_build()
+ *
+ * Build a static spatial index over n positions, for instance the `x` and
+ * `y` arrays of a sep_catalog. Positions are bucketed into a uniform grid
+ * of square cells of width `cellsize` (if <= 0, chosen to hold about one
+ * position per cell; it may be enlarged to bound the grid size). Positions
+ * that are not finite are never returned by queries. The index does not
+ * keep references to x and y.
+ */
+SEP_API int sep_index_build(
+    const double * x,
+    const double * y,
+    int64_t n,
+    double cellsize,
+    sep_index ** index
+); /* OUTPUT index */
+
+SEP_API void sep_index_free(sep_index * index);
+
+/* number of positions the index was built from */
+SEP_API int64_t sep_index_size(const sep_index * index);
+
+/* sep_index_count_radius() / sep_index_query_radius()
+ *
+ * Find the indexed positions within distance r[i] (inclusive) of each of
+ * the n query positions (x[i], y[i]). Results are returned in compressed
+ * form in two passes: first count the matches of each query into
+ * `counts`, then (with offsets[i] the cumulative sum of counts[0..i-1])
+ * write the indices of the matches of query i, in increasing order, to
+ * indices[offsets[i]] ... indices[offsets[i] + counts[i] - 1].
+ */
+SEP_API int sep_index_count_radius(
+    const sep_index * index,
+    const double * x,
+    const double * y,
+    const double * r,
+    int64_t n,
+    int64_t * counts
+);
+
+SEP_API int sep_index_query_radius(
+    const sep_index * index,
+    const double * x,
+    const double * y,
+    const double * r,
+    int64_t n,
+    const int64_t * offsets,
+    int64_t * indices
+);
+
+/* sep_index_query_nearest()
+ *
+ * Find the k nearest indexed positions to each of the n query positions.
+ * `indices` and `dist` are arrays of n*k elements holding, for query i,
+ * the indices and distances of its neighbours in increasing order of
+ * distance (ties broken by index). If fewer than k positions are
+ * available, the remaining entries are set to -1 and infinity.
+ */
+SEP_API int sep_index_query_nearest(
+    const sep_index * index,
+    const double * x,
+    const double * y,
+    int64_t n,
+    int64_t k,
+    int64_t * indices,
+    double * dist
+);
+
+/*------------------------ merging tiled catalogs ---------------------------*/
+
+/* sep_tile
+ *
+ * Placement of one tile of a mosaic. Tile pixel (0, 0) is mosaic pixel
+ * (x0, y0). The core region [cxmin, cxmax) x [cymin, cymax), in mosaic
+ * coordinates, is the part of the tile that owns the objects whose
+ * centroids fall in it. Cores of neighbouring tiles should abut without
+ * overlapping, e.g., by splitting each overlap zone down the middle, and
+ * extend to the tile edge along the mosaic border.
+ */
+typedef struct {
+  int64_t x0, y0; /* position of tile in mosaic */
+  int64_t w, h; /* tile width, height */
+  double cxmin, cxmax; /* core region (mosaic coordinates) */
+  double cymin, cymax;
+} sep_tile;
+
+/* sep_tile_select()
+ *
+ * Decide which of n objects, detected in overlapping tiles, to keep.
+ * (x[i], y[i]) is the centroid of object i in mosaic coordinates and
+ * tile[i] the index in `tiles` of the tile it was detected in.
+ *
+ * Objects are considered in order of how deep their centroid lies within
+ * their own tile's core region (objects outside it come last), and kept
+ * unless an object from a different tile has already been kept within
+ * `matchrad`. Duplicates near core boundaries whose centroids scatter
+ * across the boundary are resolved this way, and objects seen only
+ * outside any core (e.g., in the overlap of a tile whose neighbour
+ * deblended differently) are not lost. If matchrad <= 0, only objects
+ * inside their own tile's core are kept. Objects with non-finite
+ * positions are always kept.
+ *
+ * On output, keep[i] is 1 if object i should be kept and 0 otherwise.
+ */
+SEP_API int sep_tile_select(
+    const double * x,
+    const double * y,
+    const int * tile,
+    int64_t n,
+    const sep_tile * tiles,
+    double matchrad,
+    unsigned char * keep
+);
+
+/* sep_merge_tiles()
+ *
+ * Merge the catalogs extracted from `ntiles` tiles of a mosaic into a
+ * single catalog, removing duplicates with sep_tile_select(). Positions
+ * and bounding boxes are converted to mosaic coordinates. If every input
+ * catalog has pixel lists and `mosaicw` (the mosaic width) is positive,
+ * pixel indices are converted to linear indices in the mosaic; otherwise
+ * the output has no pixel lists. Objects are output in tile order, then
+ * in their order within each tile.
+ *
+ * The returned catalog must be freed with sep_catalog_free().
+ */
+SEP_API int sep_merge_tiles(
+    const sep_catalog * catalogs, /* one catalog per tile */
+    const sep_tile * tiles,
+    int ntiles,
+    int64_t mosaicw,
+    double matchrad,
+    sep_catalog ** merged
+); /* OUTPUT catalog */
+
+/* sep_extract_update()
+ *
+ * Update `prev`, the catalog of an earlier sep_extract() of the same frame,
+ * after the pixels in `ndirty` boxes ([xmin, xmax] x [ymin, ymax],
+ * inclusive) have changed. Every pixel whose data, noise or mask differs
+ * must lie in a box. The other arguments are as in sep_extract() and
+ * should be the ones `prev` was made with.
+ *
+ * Only the neighbourhood of the boxes is extracted again: each box is
+ * grown by the reach of the filter kernel, then to cover any previous or
+ * new object that touches it, and boxes that meet are merged. Objects of
+ * `prev` outside every grown box are copied unchanged; the others are
+ * replaced by the objects found in the boxes. Without cleaning, the
+ * result matches a full extraction of the new frame, deblended objects
+ * included, except for the order of the objects (kept objects first,
+ * then new objects box by box). Cleaning only sees the objects within
+ * each grown box: a faint object near the edge of a box can survive
+ * where a full extraction would merge it into a brighter neighbour
+ * outside the box, or the reverse.
+ *
+ * The output has pixel lists if `prev` has them or no object is kept.
+ * If the image has a segmentation map, this is sep_extract().
+ *
+ * The returned catalog must be freed with sep_catalog_free().
+ */
+SEP_API int sep_extract_update(
+    const sep_image * image,
+    const sep_catalog * prev,
+    const int64_t * xmin,
+    const int64_t * xmax,
+    const int64_t * ymin,
+    const int64_t * ymax,
+    int64_t ndirty,
+    float thresh,
+    int thresh_type,
+    int minarea,
+    const float * conv,
+    int64_t convw,
+    int64_t convh,
+    int filter_type,
+    int deblend_nthresh,
+    double deblend_cont,
+    int clean_flag,
+    double clean_param,
+    sep_catalog ** catalog
+); /* OUTPUT catalog */
+
+/*----------------------------- frame pipeline ------------------------------*/
+
+#define SEP_PIPE_CIRCLE 0 /* circle of radius r */
+#define SEP_PIPE_ELLIPSE 1 /* object ellipse (a, b, theta) scaled by r */
+
+/* one aperture measured on every object by sep_pipeline() */
+typedef struct {
+  int type; /* SEP_PIPE_CIRCLE or SEP_PIPE_ELLIPSE */
+  double r; /* radius, or scale of the object ellipse */
+  int subpix; /* subpixel sampling, as in sep_sum_circle() */
+} sep_pipeline_aper;
+
+typedef struct {
+  /* background: as in sep_background() */
+  int64_t bw, bh, fw, fh;
+  double fthresh;
+
+  /* detection: as in sep_extract(); thresh is in units of the noise */
+  float thresh;
+  int minarea;
+  const float * conv;
+  int64_t convw, convh;
+  int filter_type;
+  int deblend_nthresh;
+  double deblend_cont;
+  int clean_flag;
+  double clean_param;
+  int rmsmap; /* image without noise: use the background rms map (1) or
+                 the global rms (0) as its noise */
+
+  /* photometry */
+  const sep_pipeline_aper * apers;
+  int naper;
+} sep_pipeline_config;
+
+typedef struct {
+  sep_bkg * bkg;
+  sep_catalog * catalog;
+  int naper;
+  double * flux; /* catalog->nobj x naper, by object */
+  double * fluxerr;
+  short * flag;
+} sep_pipeline_result;
+
+/* sep_pipeline()
+ *
+ * Background estimation, background subtraction, detection and aperture
+ * photometry of a frame in one call. The result is equivalent to calling
+ * sep_background(), subtracting the background from a copy of the image,
+ * then sep_extract() and the sep_sum_*() function of each aperture at the
+ * object positions (without segmentation map), but no full-size copy of
+ * the image is made: the background is subtracted line by line during
+ * detection and per object during photometry. The background is estimated
+ * and objects are measured in parallel (see sep_set_nthreads()).
+ *
+ * If the image has no noise, its noise is the background rms (see
+ * config->rmsmap). A reference image is subtracted as in sep_extract().
+ * Flux and fluxerr are NaN for an ellipse aperture that an object's shape
+ * does not define. The result must be freed with sep_pipeline_free().
+ */
+SEP_API int sep_pipeline(
+    const sep_image * image,
+    const sep_pipeline_config * config,
+    sep_pipeline_result ** result
+);
+
+SEP_API void sep_pipeline_free(sep_pipeline_result * result);
+
+/*---------------------------- multithreading -------------------------------*/
+
+/* Set and get the number of threads used by batched routines (spatial
+ * index queries, background evaluation). The default is 1. Values <= 0 select the number of
+ * available processors. Each call to a batched routine starts its own
+ * threads, so independent calls from different threads are safe. */
+SEP_API void sep_set_nthreads(int val);
+SEP_API int sep_get_nthreads(void);
+
 /*----------------------- info & error messaging ----------------------------*/
 
 /* sep_version_string : library version (e.g., "0.2.0") */
@@ -521,3 +1162,7 @@ SEP_API void sep_get_errmsg(int status, char * errtext);
  * The message may be up to 512 characters.
  */
 SEP_API void sep_get_errdetail(char * errtext);
+
+#ifdef __cplusplus
+}
+#endif
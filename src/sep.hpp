@@ -0,0 +1,476 @@
+/*%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+ *
+ * This file is part of SEP
+ *
+ * Copyright 2014 SEP developers
+ *
+ * Distributed under an MIT license.
+ *
+ *%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%*/
+
+/* sep.hpp: header-only C++17 interface to the C library.
+ *
+ * Wraps sep.h without adding to the compiled library:
+ *
+ * - ImageView<T> describes a 2-d array of T with an optional row stride.
+ *   The SEP dtype code is derived from T at compile time, so a type that
+ *   SEP cannot read is a compile error rather than ILLEGAL_DTYPE.
+ * - Image gathers the data, noise, mask and segmap views into a sep_image.
+ * - Background and Catalog own the results of sep_background() and
+ *   sep_extract(); they are movable but not copyable, and free their
+ *   C counterparts when destroyed.
+ * - Failures throw sep::error, which carries the status code and the
+ *   messages of sep_get_errmsg() and sep_get_errdetail().
+ *
+ * The C structs remain available through get() for anything not wrapped
+ * here. As for the C library, outputs use the image conventions of SEP:
+ * pixel (0, 0) is the centre of the first pixel of the first row.
+ */
+
+#ifndef SEP_HPP
+#define SEP_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "sep.h"
+
+namespace sep {
+
+/*------------------------------- errors ----------------------------------*/
+
+class error : public std::runtime_error {
+public:
+  error(int status, const std::string & msg) :
+      std::runtime_error(msg), status_(status) {}
+  int status() const noexcept { return status_; }
+
+private:
+  int status_;
+};
+
+inline void check(int status) {
+  char errmsg[61], errdetail[512];
+
+  if (status == 0) {
+    return;
+  }
+  sep_get_errmsg(status, errmsg);
+  sep_get_errdetail(errdetail);
+  std::string msg(errmsg);
+  if (errdetail[0]) {
+    msg += ": ";
+    msg += errdetail;
+  }
+  throw error(status, msg);
+}
+
+/*------------------------------ dtype codes ------------------------------*/
+
+/* dtype<T>::value is the SEP dtype code of pixels of type T */
+template <class T>
+struct dtype {
+  static_assert(sizeof(T) == 0, "pixel type not supported by SEP");
+};
+
+template <>
+struct dtype<std::uint8_t> : std::integral_constant<int, SEP_TBYTE> {};
+template <>
+struct dtype<std::uint16_t> : std::integral_constant<int, SEP_TUSHORT> {};
+template <>
+struct dtype<std::int16_t> : std::integral_constant<int, SEP_TSHORT> {};
+template <>
+struct dtype<int> : std::integral_constant<int, SEP_TINT> {};
+template <>
+struct dtype<float> : std::integral_constant<int, SEP_TFLOAT> {};
+template <>
+struct dtype<double> : std::integral_constant<int, SEP_TDOUBLE> {};
+
+template <class T>
+inline constexpr int dtype_v = dtype<std::remove_cv_t<T>>::value;
+
+/* types that the background writers accept as output */
+template <class T>
+inline constexpr bool is_output_v =
+    std::is_same_v<T, int> || std::is_same_v<T, float> || std::is_same_v<T, double>;
+
+/*------------------------------- views -----------------------------------*/
+
+/* a contiguous run of elements, as std::span in C++20 */
+template <class T>
+class Span {
+public:
+  constexpr Span() noexcept : ptr_(nullptr), n_(0) {}
+  constexpr Span(T * ptr, std::size_t n) noexcept : ptr_(ptr), n_(n) {}
+
+  constexpr T * data() const noexcept { return ptr_; }
+  constexpr std::size_t size() const noexcept { return n_; }
+  constexpr bool empty() const noexcept { return n_ == 0; }
+  constexpr T & operator[](std::size_t i) const noexcept { return ptr_[i]; }
+  constexpr T * begin() const noexcept { return ptr_; }
+  constexpr T * end() const noexcept { return ptr_ + n_; }
+
+private:
+  T * ptr_;
+  std::size_t n_;
+};
+
+/* A w x h image of T. `stride` is the distance in bytes between the
+ * starts of consecutive rows (0: rows are contiguous) and may be negative,
+ * e.g. to read the rows bottom-up. Pixels within a row are adjacent. The
+ * view does not own the pixels. */
+template <class T>
+class ImageView {
+public:
+  using value_type = std::remove_cv_t<T>;
+  static constexpr int dtype = dtype_v<value_type>;
+
+  ImageView(T * data, std::int64_t w, std::int64_t h, std::int64_t stride = 0) :
+      data_(data), w_(w), h_(h), stride_(stride) {}
+
+  T * data() const noexcept { return data_; }
+  std::int64_t width() const noexcept { return w_; }
+  std::int64_t height() const noexcept { return h_; }
+  std::int64_t stride() const noexcept { return stride_; }
+  std::int64_t row_bytes() const noexcept {
+    return stride_ ? stride_ : w_ * (std::int64_t)sizeof(T);
+  }
+
+  Span<T> row(std::int64_t y) const noexcept {
+    using byte = std::conditional_t<std::is_const_v<T>, const char, char>;
+    return Span<T>(
+        reinterpret_cast<T *>(reinterpret_cast<byte *>(data_) + y * row_bytes()),
+        (std::size_t)w_
+    );
+  }
+  T & operator()(std::int64_t x, std::int64_t y) const noexcept { return row(y)[x]; }
+
+  /* the w x h region whose first pixel is (x0, y0), sharing the pixels */
+  ImageView sub(std::int64_t x0, std::int64_t y0, std::int64_t w, std::int64_t h)
+      const noexcept {
+    return ImageView(row(y0).data() + x0, w, h, row_bytes());
+  }
+
+private:
+  T * data_;
+  std::int64_t w_, h_, stride_;
+};
+
+/*------------------------------- image -----------------------------------*/
+
+/* The arrays and scalars of one image (see sep_image in sep.h). All views
+ * must have the dimensions of the data and outlive the Image. */
+class Image {
+public:
+  template <class T>
+  explicit Image(ImageView<T> data) : im_() {
+    im_.data = data.data();
+    im_.dtype = ImageView<T>::dtype;
+    im_.dstride = data.stride();
+    im_.w = data.width();
+    im_.h = data.height();
+  }
+
+  template <class T>
+  Image & noise(ImageView<T> noise, short noise_type = SEP_NOISE_STDDEV) {
+    check_shape(noise);
+    im_.noise = noise.data();
+    im_.ndtype = ImageView<T>::dtype;
+    im_.nstride = noise.stride();
+    im_.noise_type = noise_type;
+    return *this;
+  }
+
+  Image & noise(double noiseval, short noise_type = SEP_NOISE_STDDEV) {
+    im_.noise = nullptr;
+    im_.noiseval = noiseval;
+    im_.noise_type = noise_type;
+    return *this;
+  }
+
+  template <class T>
+  Image & mask(ImageView<T> mask, double maskthresh = 0.0) {
+    check_shape(mask);
+    im_.mask = mask.data();
+    im_.mdtype = ImageView<T>::dtype;
+    im_.mstride = mask.stride();
+    im_.maskthresh = maskthresh;
+    return *this;
+  }
+
+  template <class T>
+  Image & segmap(ImageView<T> segmap) {
+    check_shape(segmap);
+    im_.segmap = segmap.data();
+    im_.sdtype = ImageView<T>::dtype;
+    im_.sstride = segmap.stride();
+    return *this;
+  }
+
+  Image & gain(double gain) {
+    im_.gain = gain;
+    return *this;
+  }
+
+  const sep_image & get() const noexcept { return im_; }
+  std::int64_t width() const noexcept { return im_.w; }
+  std::int64_t height() const noexcept { return im_.h; }
+
+private:
+  template <class T>
+  void check_shape(const ImageView<T> & v) const {
+    if (v.width() != im_.w || v.height() != im_.h) {
+      throw std::invalid_argument("array dimensions do not match the data");
+    }
+  }
+
+  sep_image im_;
+};
+
+/*----------------------------- background --------------------------------*/
+
+struct BackgroundParams {
+  std::int64_t bw = 64, bh = 64; /* tile size */
+  std::int64_t fw = 3, fh = 3; /* filter size in tiles */
+  double fthresh = 0.0; /* filter threshold */
+};
+
+class Background {
+public:
+  explicit Background(const Image & image, const BackgroundParams & p = {}) {
+    sep_bkg * bkg = nullptr;
+    check(sep_background(&image.get(), p.bw, p.bh, p.fw, p.fh, p.fthresh, &bkg));
+    bkg_.reset(bkg);
+  }
+
+  float global() const noexcept { return sep_bkg_global(bkg_.get()); }
+  float globalrms() const noexcept { return sep_bkg_globalrms(bkg_.get()); }
+  float pix(std::int64_t x, std::int64_t y) const noexcept {
+    return sep_bkg_pix(bkg_.get(), x, y);
+  }
+  std::int64_t width() const noexcept { return bkg_->w; }
+  std::int64_t height() const noexcept { return bkg_->h; }
+
+  /* write the background or rms of the whole image to a contiguous array */
+  template <class T>
+  void back(T * out) const {
+    static_assert(is_output_v<T>, "background output must be int, float or double");
+    check(sep_bkg_array(bkg_.get(), out, dtype_v<T>));
+  }
+  template <class T>
+  void rms(T * out) const {
+    static_assert(is_output_v<T>, "background output must be int, float or double");
+    check(sep_bkg_rmsarray(bkg_.get(), out, dtype_v<T>));
+  }
+
+  template <class T = float>
+  std::vector<T> back() const {
+    std::vector<T> out((std::size_t)(width() * height()));
+    back(out.data());
+    return out;
+  }
+  template <class T = float>
+  std::vector<T> rms() const {
+    std::vector<T> out((std::size_t)(width() * height()));
+    rms(out.data());
+    return out;
+  }
+
+  /* subtract the background from an image, in place, one row at a time */
+  template <class T>
+  void subtract_from(ImageView<T> arr) const {
+    static_assert(!std::is_const_v<T>, "cannot subtract from a const view");
+    static_assert(is_output_v<T>, "can only subtract from int, float or double");
+    if (arr.width() != width() || arr.height() != height()) {
+      throw std::invalid_argument("array dimensions do not match the background");
+    }
+    for (std::int64_t y = 0; y < arr.height(); y++) {
+      check(sep_bkg_subline(bkg_.get(), y, arr.row(y).data(), dtype_v<T>));
+    }
+  }
+
+  const sep_bkg * get() const noexcept { return bkg_.get(); }
+
+private:
+  struct deleter {
+    void operator()(sep_bkg * p) const noexcept { sep_bkg_free(p); }
+  };
+  std::unique_ptr<sep_bkg, deleter> bkg_;
+};
+
+/*------------------------------ extraction -------------------------------*/
+
+/* Source Extractor defaults, as in sep_extract() */
+struct ExtractParams {
+  int thresh_type = SEP_THRESH_REL;
+  int minarea = 5;
+  std::vector<float> conv = {1, 2, 1, 2, 4, 2, 1, 2, 1};
+  std::int64_t convw = 3, convh = 3; /* empty conv: no filtering */
+  int filter_type = SEP_FILTER_CONV;
+  int deblend_nthresh = 32;
+  double deblend_cont = 0.005;
+  bool clean = true;
+  double clean_param = 1.0;
+};
+
+class Catalog {
+public:
+  Catalog() = default;
+  explicit Catalog(sep_catalog * cat) noexcept : cat_(cat) {}
+
+  std::size_t size() const noexcept { return cat_ ? (std::size_t)cat_->nobj : 0; }
+  bool empty() const noexcept { return size() == 0; }
+
+  /* linear indices (y * w + x) of the pixels of object i */
+  Span<const std::int64_t> pixels(std::size_t i) const noexcept {
+    return Span<const std::int64_t>(cat_->pix[i], (std::size_t)cat_->npix[i]);
+  }
+
+  /* values, filtered values and variances of the pixels of object i, in
+   * the order of pixels(i); empty unless sep_set_extract_pixvalues() was
+   * on (variances: and the image has noise) */
+  Span<const float> values(std::size_t i) const noexcept {
+    return pixvalues(cat_->objectsvalue, i);
+  }
+  Span<const float> cdvalues(std::size_t i) const noexcept {
+    return pixvalues(cat_->objectscdvalue, i);
+  }
+  Span<const float> variances(std::size_t i) const noexcept {
+    return pixvalues(cat_->objectsvar, i);
+  }
+
+  const sep_catalog * get() const noexcept { return cat_.get(); }
+  const sep_catalog * operator->() const noexcept { return cat_.get(); }
+
+private:
+  Span<const float> pixvalues(const float * buf, std::size_t i) const noexcept {
+    if (!buf) {
+      return Span<const float>();
+    }
+    return Span<const float>(
+        buf + (cat_->pix[i] - cat_->objectspix), (std::size_t)cat_->npix[i]
+    );
+  }
+
+  struct deleter {
+    void operator()(sep_catalog * p) const noexcept { sep_catalog_free(p); }
+  };
+  std::unique_ptr<sep_catalog, deleter> cat_;
+};
+
+inline Catalog
+extract(const Image & image, float thresh, const ExtractParams & p = {}) {
+  sep_catalog * cat = nullptr;
+
+  if (!p.conv.empty() && (std::int64_t)p.conv.size() != p.convw * p.convh) {
+    throw std::invalid_argument("conv must have convw * convh elements");
+  }
+  check(sep_extract(
+      &image.get(), thresh, p.thresh_type, p.minarea,
+      p.conv.empty() ? nullptr : p.conv.data(), p.conv.empty() ? 0 : p.convw,
+      p.conv.empty() ? 0 : p.convh, p.filter_type, p.deblend_nthresh,
+      p.deblend_cont, p.clean ? 1 : 0, p.clean_param, &cat
+  ));
+  return Catalog(cat);
+}
+
+template <class T>
+Catalog extract(ImageView<T> data, float thresh, const ExtractParams & p = {}) {
+  return extract(Image(data), thresh, p);
+}
+
+/*-------------------------- aperture photometry --------------------------*/
+
+struct ApertureParams {
+  int id = 0; /* object id to test against the segmap */
+  int subpix = 5; /* subpixel sampling (0: exact) */
+  short inflags = 0; /* e.g. SEP_MASK_IGNORE */
+};
+
+struct ApertureSum {
+  double sum = 0.0, sumerr = 0.0, area = 0.0;
+  short flag = 0;
+};
+
+inline ApertureSum sum_circle(
+    const Image & image, double x, double y, double r, const ApertureParams & p = {}
+) {
+  ApertureSum s;
+  check(sep_sum_circle(
+      &image.get(), x, y, r, p.id, p.subpix, p.inflags, &s.sum, &s.sumerr, &s.area,
+      &s.flag
+  ));
+  return s;
+}
+
+inline ApertureSum sum_circann(
+    const Image & image,
+    double x,
+    double y,
+    double rin,
+    double rout,
+    const ApertureParams & p = {}
+) {
+  ApertureSum s;
+  check(sep_sum_circann(
+      &image.get(), x, y, rin, rout, p.id, p.subpix, p.inflags, &s.sum, &s.sumerr,
+      &s.area, &s.flag
+  ));
+  return s;
+}
+
+inline ApertureSum sum_ellipse(
+    const Image & image,
+    double x,
+    double y,
+    double a,
+    double b,
+    double theta,
+    double r,
+    const ApertureParams & p = {}
+) {
+  ApertureSum s;
+  check(sep_sum_ellipse(
+      &image.get(), x, y, a, b, theta, r, p.id, p.subpix, p.inflags, &s.sum,
+      &s.sumerr, &s.area, &s.flag
+  ));
+  return s;
+}
+
+/* one aperture of radius r at each (x[i], y[i]); the result is reused
+ * from call to call if passed back in. This is one sep_sum_circle() per
+ * object: the C library has no batched entry point, and the sep_image is
+ * built once and passed by reference, so the loop adds no work per pixel. */
+inline void sum_circle(
+    const Image & image,
+    Span<const double> x,
+    Span<const double> y,
+    double r,
+    std::vector<ApertureSum> & out,
+    const ApertureParams & p = {}
+) {
+  if (x.size() != y.size()) {
+    throw std::invalid_argument("x and y must have the same length");
+  }
+  out.resize(x.size());
+  for (std::size_t i = 0; i < x.size(); i++) {
+    out[i] = sum_circle(image, x[i], y[i], r, p);
+  }
+}
+
+template <class T>
+ApertureSum sum_circle(
+    ImageView<T> data, double x, double y, double r, const ApertureParams & p = {}
+) {
+  return sum_circle(Image(data), x, y, r, p);
+}
+
+} // namespace sep
+
+#endif /* SEP_HPP */
@@ -33,6 +33,7 @@
 #define LINE_NOT_IN_BUF 8
 #define RELTHRESH_NO_NOISE 9
 #define UNKNOWN_NOISE_TYPE 10
+#define FILE_IO_ERROR 11
 
 #define BIG 1e+30 /* a huge number (< biggest value a float can store) */
 #define PI M_PI
@@ -47,10 +48,19 @@ typedef float PIXTYPE; /* type used inside of functions */
 #define PIXDTYPE SEP_TFLOAT /* dtype code corresponding to PIXTYPE */
 
 
+/* bytes from one row of an input array to the next, given its stride
+ * (0: contiguous) and the size of a contiguous row */
+#define ROWSTRIDE(stride, rowsize) ((stride) ? (stride) : (rowsize))
+
 /* signature of converters */
 typedef PIXTYPE (*converter)(const void * ptr);
 typedef void (*array_converter)(const void * ptr, int64_t n, PIXTYPE * target);
 typedef void (*array_writer)(const float * ptr, int64_t n, void * target);
+typedef void (*mask_reader)(
+    const void * row, int64_t x, int64_t n, double thresh, BYTE * target
+);
+typedef int64_t (*id_converter)(const void * ptr);
+typedef void (*id_reader)(const void * ptr, int64_t n, int64_t * target);
 
 #define QCALLOC(ptr, typ, nel, status)                        \
   {                                                           \
@@ -95,6 +105,20 @@ int get_converter(int dtype, converter * f, int64_t * size);
 int get_array_converter(int dtype, array_converter * f, int64_t * size);
 int get_array_writer(int dtype, array_writer * f, int64_t * size);
 int get_array_subtractor(int dtype, array_writer * f, int64_t * size);
+int get_mask_reader(int dtype, int64_t w, mask_reader * f, int64_t * rowsize);
+int get_id_converter(int dtype, id_converter * f, int64_t * size);
+int get_id_reader(int dtype, id_reader * f, int64_t * size);
+
+/* Run task(ctx, start, end, thread) over chunks of [0, n), using up to
+ * sep_get_nthreads() threads. Returns the first nonzero status returned by
+ * a task. parallel_for_n() uses at most nt threads, so that `thread` is in
+ * [0, nt): tasks with per-thread scratch space should read nt once with
+ * parallel_nthreads(), size the scratch with it and pass it here, as
+ * sep_set_nthreads() may be called in between. */
+typedef int (*parallel_task)(void * ctx, int64_t start, int64_t end, int thread);
+int parallel_for(int64_t n, int64_t chunk, parallel_task task, void * ctx);
+int parallel_for_n(int64_t n, int64_t chunk, int nt, parallel_task task, void * ctx);
+int parallel_nthreads(int64_t n, int64_t chunk);
 
 #if defined(_MSC_VER)
 #define _Thread_local __declspec(thread)
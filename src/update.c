@@ -0,0 +1,385 @@
+/*%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+ *
+ * This file is part of SEP
+ *
+ * Copyright 2014 SEP developers
+ *
+ * Distributed under an MIT license.
+ *
+ *%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%*/
+
+/* Incremental extraction of a frame that differs from the previous one
+ * only in a few places.
+ *
+ * Changed boxes are grown into regions until no object straddles a region
+ * edge: first by the reach of the filter kernel, then to cover every
+ * previous object they touch, then (after extracting each region) to cover
+ * every object found near an edge that is not the image border. Regions
+ * that meet are merged. Objects of the previous catalog outside all
+ * regions are kept as they are; the rest are replaced by the objects
+ * extracted from the regions. Each region is extracted in place, as a
+ * strided view of the image arrays. */
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sep.h"
+#include "sepcore.h"
+
+int alloc_catalog_fields(sep_catalog * cat, int nobj);
+int alloc_catalog_pixels(
+    sep_catalog * cat, int64_t nobj, int64_t totnpix, int values, int var
+);
+void catalog_copy_pixvalues(
+    sep_catalog * dst, int64_t p, const sep_catalog * src, int64_t i
+);
+void catalog_copy_object(
+    sep_catalog * dst,
+    int64_t j,
+    const sep_catalog * src,
+    int64_t i,
+    int64_t x0,
+    int64_t y0
+);
+
+typedef struct {
+  int64_t xmin, xmax, ymin, ymax; /* inclusive */
+} region;
+
+/* whether boxes a and b overlap or are within `gap` pixels of each other */
+static int region_near(const region * a, const region * b, int64_t gap) {
+  return a->xmin <= b->xmax + gap && b->xmin <= a->xmax + gap
+         && a->ymin <= b->ymax + gap && b->ymin <= a->ymax + gap;
+}
+
+/* grow r to cover the box b expanded by margin, within a w x h image.
+ * xmin is kept a multiple of xalign (for bit-packed masks). Returns 1 if
+ * r changed. */
+static int region_cover(
+    region * r, const region * b, int64_t margin, int64_t w, int64_t h, int64_t xalign
+) {
+  region g;
+
+  g.xmin = b->xmin - margin > 0 ? b->xmin - margin : 0;
+  g.xmax = b->xmax + margin < w - 1 ? b->xmax + margin : w - 1;
+  g.ymin = b->ymin - margin > 0 ? b->ymin - margin : 0;
+  g.ymax = b->ymax + margin < h - 1 ? b->ymax + margin : h - 1;
+  g.xmin -= g.xmin % xalign;
+  if (g.xmin >= r->xmin && g.xmax <= r->xmax && g.ymin >= r->ymin
+      && g.ymax <= r->ymax) {
+    return 0;
+  }
+  r->xmin = g.xmin < r->xmin ? g.xmin : r->xmin;
+  r->xmax = g.xmax > r->xmax ? g.xmax : r->xmax;
+  r->ymin = g.ymin < r->ymin ? g.ymin : r->ymin;
+  r->ymax = g.ymax > r->ymax ? g.ymax : r->ymax;
+  return 1;
+}
+
+static void object_box(const sep_catalog * cat, int64_t i, region * b) {
+  b->xmin = cat->xmin[i];
+  b->xmax = cat->xmax[i];
+  b->ymin = cat->ymin[i];
+  b->ymax = cat->ymax[i];
+}
+
+/* the w x h view of array `arr` starting at (x0, y0); `rowsize` is the
+ * size of a contiguous row and `elsize` of an element (0: bits) */
+static const void * view_origin(
+    const void * arr,
+    int64_t stride,
+    int64_t rowsize,
+    int64_t elsize,
+    int64_t x0,
+    int64_t y0
+) {
+  const BYTE * p = arr;
+  int64_t xoff = elsize ? x0 * elsize : x0 / 8;
+  return p + y0 * ROWSTRIDE(stride, rowsize) + xoff;
+}
+
+/* sep_image for region r of image: the same arrays, offset and strided */
+static int region_image(const sep_image * image, const region * r, sep_image * sub) {
+  array_converter f;
+  mask_reader mf;
+  int64_t size, rowsize;
+  int status = RETURN_OK;
+
+  *sub = *image;
+  sub->w = r->xmax - r->xmin + 1;
+  sub->h = r->ymax - r->ymin + 1;
+
+  if ((status = get_array_converter(image->dtype, &f, &size)) != RETURN_OK) {
+    return status;
+  }
+  sub->data = view_origin(
+      image->data, image->dstride, image->w * size, size, r->xmin, r->ymin
+  );
+  sub->dstride = ROWSTRIDE(image->dstride, image->w * size);
+  if (image->noise) {
+    if ((status = get_array_converter(image->ndtype, &f, &size)) != RETURN_OK) {
+      return status;
+    }
+    sub->noise = view_origin(
+        image->noise, image->nstride, image->w * size, size, r->xmin, r->ymin
+    );
+    sub->nstride = ROWSTRIDE(image->nstride, image->w * size);
+  }
+  if (image->mask) {
+    if ((status = get_mask_reader(image->mdtype, image->w, &mf, &rowsize))
+        != RETURN_OK) {
+      return status;
+    }
+    size = image->mdtype == SEP_TBIT ? 0 : rowsize / (image->w ? image->w : 1);
+    sub->mask =
+        view_origin(image->mask, image->mstride, rowsize, size, r->xmin, r->ymin);
+    sub->mstride = ROWSTRIDE(image->mstride, rowsize);
+  }
+  if (image->ref) {
+    if ((status = get_array_converter(image->rdtype, &f, &size)) != RETURN_OK) {
+      return status;
+    }
+    sub->ref = view_origin(
+        image->ref, image->rstride, image->w * size, size, r->xmin, r->ymin
+    );
+    sub->rstride = ROWSTRIDE(image->rstride, image->w * size);
+  }
+  if (image->ref && image->refnoise) {
+    if ((status = get_array_converter(image->rndtype, &f, &size)) != RETURN_OK) {
+      return status;
+    }
+    sub->refnoise = view_origin(
+        image->refnoise, image->rnstride, image->w * size, size, r->xmin, r->ymin
+    );
+    sub->rnstride = ROWSTRIDE(image->rnstride, image->w * size);
+  }
+  return status;
+}
+
+/* whether object i of cat, extracted from region r, comes within margin
+ * of an edge of r that is not an edge of the w x h image */
+static int near_inner_edge(
+    const sep_catalog * cat, int64_t i, const region * r, int64_t margin, int64_t w,
+    int64_t h
+) {
+  int64_t rw = r->xmax - r->xmin + 1, rh = r->ymax - r->ymin + 1;
+
+  return (r->xmin > 0 && cat->xmin[i] < margin)
+         || (r->xmax < w - 1 && cat->xmax[i] >= rw - margin)
+         || (r->ymin > 0 && cat->ymin[i] < margin)
+         || (r->ymax < h - 1 && cat->ymax[i] >= rh - margin);
+}
+
+int sep_extract_update(
+    const sep_image * image,
+    const sep_catalog * prev,
+    const int64_t * xmin,
+    const int64_t * xmax,
+    const int64_t * ymin,
+    const int64_t * ymax,
+    int64_t ndirty,
+    float thresh,
+    int thresh_type,
+    int minarea,
+    const float * conv,
+    int64_t convw,
+    int64_t convh,
+    int filter_type,
+    int deblend_nthresh,
+    double deblend_cont,
+    int clean_flag,
+    double clean_param,
+    sep_catalog ** catalog
+) {
+  region *regs, b;
+  sep_catalog **cats, *cat;
+  sep_image sub;
+  BYTE * keep;
+  int64_t i, j, k, m, p, r, nreg, margin, xalign, nkeep, totnpix, w, h;
+  int changed, haspix, hasvalue, hasvar, status;
+
+  status = RETURN_OK;
+  regs = NULL;
+  cats = NULL;
+  cat = NULL;
+  keep = NULL;
+  nreg = 0;
+  w = image->w;
+  h = image->h;
+
+  /* objects of an existing segmentation map are not found by detection */
+  if (image->segmap) {
+    return sep_extract(
+        image, thresh, thresh_type, minarea, conv, convw, convh, filter_type,
+        deblend_nthresh, deblend_cont, clean_flag, clean_param, catalog
+    );
+  }
+
+  /* filtered values within the kernel's reach of a change differ, and an
+   * object can join pixels diagonally across a region edge */
+  margin = (conv ? (convw > convh ? convw : convh) / 2 : 0) + 2;
+  xalign = (image->mask && image->mdtype == SEP_TBIT) ? 8 : 1;
+
+  QMALLOC(regs, region, ndirty > 0 ? ndirty : 1, status);
+  QCALLOC(cats, sep_catalog *, ndirty > 0 ? ndirty : 1, status);
+  QCALLOC(keep, BYTE, prev->nobj > 0 ? prev->nobj : 1, status);
+  for (i = 0; i < ndirty; i++) {
+    b.xmin = xmin[i] > 0 ? xmin[i] : 0;
+    b.xmax = xmax[i] < w - 1 ? xmax[i] : w - 1;
+    b.ymin = ymin[i] > 0 ? ymin[i] : 0;
+    b.ymax = ymax[i] < h - 1 ? ymax[i] : h - 1;
+    if (b.xmin > b.xmax || b.ymin > b.ymax) {
+      continue;
+    }
+    regs[nreg] = b;
+    region_cover(regs + nreg, &b, margin, w, h, xalign);
+    nreg++;
+  }
+
+  for (;;) {
+    /* merge regions that meet, and cover the previous objects they touch,
+     * until neither changes anything */
+    do {
+      changed = 0;
+      for (r = 0; r < nreg; r++) {
+        for (k = r + 1; k < nreg; k++) {
+          if (region_near(regs + r, regs + k, 1)) {
+            region_cover(regs + r, regs + k, 0, w, h, xalign);
+            regs[k--] = regs[--nreg];
+            changed = 1;
+          }
+        }
+      }
+      for (i = 0; i < prev->nobj; i++) {
+        object_box(prev, i, &b);
+        for (r = 0; r < nreg; r++) {
+          if (region_near(regs + r, &b, 1)
+              && region_cover(regs + r, &b, margin, w, h, xalign)) {
+            changed = 1;
+          }
+        }
+      }
+    } while (changed);
+
+    /* extract each region; objects near an inner edge may continue
+     * outside it, so the region grows and everything is done again */
+    for (r = 0; r < nreg; r++) {
+      if ((status = region_image(image, regs + r, &sub)) != RETURN_OK) {
+        goto exit;
+      }
+      status = sep_extract(
+          &sub, thresh, thresh_type, minarea, conv, convw, convh, filter_type,
+          deblend_nthresh, deblend_cont, clean_flag, clean_param, cats + r
+      );
+      if (status != RETURN_OK) {
+        goto exit;
+      }
+    }
+    for (r = 0; r < nreg; r++) {
+      for (i = 0; i < cats[r]->nobj; i++) {
+        if (near_inner_edge(cats[r], i, regs + r, margin, w, h)) {
+          object_box(cats[r], i, &b);
+          b.xmin += regs[r].xmin;
+          b.xmax += regs[r].xmin;
+          b.ymin += regs[r].ymin;
+          b.ymax += regs[r].ymin;
+          changed |= region_cover(regs + r, &b, margin, w, h, xalign);
+        }
+      }
+    }
+    if (!changed) {
+      break;
+    }
+    for (r = 0; r < nreg; r++) {
+      sep_catalog_free(cats[r]);
+      cats[r] = NULL;
+    }
+  }
+
+  /* previous objects outside all regions are kept */
+  nkeep = totnpix = 0;
+  for (i = 0; i < prev->nobj; i++) {
+    object_box(prev, i, &b);
+    keep[i] = 1;
+    for (r = 0; r < nreg && keep[i]; r++) {
+      keep[i] = !region_near(regs + r, &b, 0);
+    }
+    if (keep[i]) {
+      nkeep++;
+      totnpix += prev->npix[i];
+    }
+  }
+  haspix = nkeep == 0 || prev->pix != NULL;
+  hasvalue = sep_get_extract_pixvalues() && (nkeep == 0 || prev->objectsvalue);
+  hasvar = nkeep == 0 || prev->objectsvar != NULL;
+  for (r = 0, k = nkeep; r < nreg; r++) {
+    k += cats[r]->nobj;
+    if (cats[r]->nobj > 0) {
+      hasvalue = hasvalue && cats[r]->objectsvalue != NULL;
+      hasvar = hasvar && cats[r]->objectsvar != NULL;
+    }
+    for (i = 0; i < cats[r]->nobj; i++) {
+      totnpix += cats[r]->npix[i];
+    }
+  }
+
+  QCALLOC(cat, sep_catalog, 1, status);
+  if ((status = alloc_catalog_fields(cat, (int)k)) != RETURN_OK) {
+    goto exit;
+  }
+  if (haspix) {
+    status = alloc_catalog_pixels(cat, k, totnpix, hasvalue, hasvar);
+    if (status != RETURN_OK) {
+      goto exit;
+    }
+  }
+
+  j = 0; /* output object */
+  p = 0; /* position in objectspix */
+  for (i = 0; i < prev->nobj; i++) {
+    if (!keep[i]) {
+      continue;
+    }
+    catalog_copy_object(cat, j, prev, i, 0, 0);
+    if (haspix) {
+      cat->pix[j] = cat->objectspix + p;
+      memcpy(cat->pix[j], prev->pix[i], prev->npix[i] * sizeof(int64_t));
+      catalog_copy_pixvalues(cat, p, prev, i);
+      p += prev->npix[i];
+    }
+    j++;
+  }
+  for (r = 0; r < nreg; r++) {
+    for (i = 0; i < cats[r]->nobj; i++, j++) {
+      catalog_copy_object(cat, j, cats[r], i, regs[r].xmin, regs[r].ymin);
+      if (haspix) {
+        k = regs[r].xmax - regs[r].xmin + 1; /* region width */
+        cat->pix[j] = cat->objectspix + p;
+        catalog_copy_pixvalues(cat, p, cats[r], i);
+        for (m = 0; m < cats[r]->npix[i]; m++, p++) {
+          cat->objectspix[p] = (cats[r]->pix[i][m] % k + regs[r].xmin)
+                               + (cats[r]->pix[i][m] / k + regs[r].ymin) * w;
+        }
+      }
+    }
+  }
+
+exit:
+  if (cats) {
+    for (r = 0; r < nreg; r++) {
+      sep_catalog_free(cats[r]);
+    }
+  }
+  free(cats);
+  free(regs);
+  free(keep);
+  if (status != RETURN_OK) {
+    sep_catalog_free(cat);
+    cat = NULL;
+  }
+  *catalog = cat;
+  return status;
+}
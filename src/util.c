@@ -15,6 +15,8 @@
  *
  *%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%*/
 
+#include <limits.h>
+#include <math.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -34,6 +36,132 @@ static _Thread_local char _errdetail_buffer[DETAILSIZE] = "";
 /****************************************************************************/
 /* data type conversion mechanics for runtime type conversion */
 
+/* 16-bit and byte-swapped types. Every reader of these loads each element
+ * with memcpy, so that the compiler can use unaligned loads and byte-swap
+ * instructions, and converts the loaded value as for the native types. */
+
+static inline uint16_t swap16(uint16_t v) {
+  return (uint16_t)(v << 8 | v >> 8);
+}
+
+static inline uint32_t swap32(uint32_t v) {
+  return (v << 24) | ((v << 8) & 0x00ff0000u) | ((v >> 8) & 0x0000ff00u) | (v >> 24);
+}
+
+static inline uint64_t swap64(uint64_t v) {
+  return ((uint64_t)swap32((uint32_t)v) << 32) | swap32((uint32_t)(v >> 32));
+}
+
+/* load_<name>(p): the element at p as its own type */
+#define LOAD_NATIVE(name, type)                    \
+  static inline type load_##name(const BYTE * p) { \
+    type v;                                        \
+    memcpy(&v, p, sizeof(v));                      \
+    return v;                                      \
+  }
+#define LOAD_SWAPPED(name, type, utype, swap)      \
+  static inline type load_##name(const BYTE * p) { \
+    utype u;                                       \
+    type v;                                        \
+    memcpy(&u, p, sizeof(u));                      \
+    u = swap(u);                                   \
+    memcpy(&v, &u, sizeof(v));                     \
+    return v;                                      \
+  }
+
+LOAD_NATIVE(shr, int16_t)
+LOAD_NATIVE(ush, uint16_t)
+LOAD_SWAPPED(shr_swp, int16_t, uint16_t, swap16)
+LOAD_SWAPPED(ush_swp, uint16_t, uint16_t, swap16)
+LOAD_SWAPPED(int_swp, int32_t, uint32_t, swap32)
+LOAD_SWAPPED(flt_swp, float, uint32_t, swap32)
+LOAD_SWAPPED(dbl_swp, double, uint64_t, swap64)
+
+/* converter, array converter, mask reader and segmentation id readers of
+ * one type (see the native versions below) */
+#define READERS(name, type)                                                    \
+  static PIXTYPE convert_##name(const void * ptr) {                            \
+    return (PIXTYPE)load_##name(ptr);                                          \
+  }                                                                            \
+  static void convert_array_##name(const void * ptr, int64_t n, PIXTYPE * t) { \
+    const BYTE * source = ptr;                                                 \
+    int64_t i;                                                                 \
+    for (i = 0; i < n; i++) {                                                  \
+      t[i] = (PIXTYPE)load_##name(source + i * sizeof(type));                  \
+    }                                                                          \
+  }                                                                            \
+  static void mask_array_##name(                                               \
+      const void * row, int64_t x, int64_t n, double thresh, BYTE * t          \
+  ) {                                                                          \
+    const BYTE * source = (const BYTE *)row + x * sizeof(type);                \
+    int64_t i;                                                                 \
+    for (i = 0; i < n; i++) {                                                  \
+      t[i] = (double)load_##name(source + i * sizeof(type)) > thresh;          \
+    }                                                                          \
+  }                                                                            \
+  static int64_t id_##name(const void * ptr) {                                 \
+    return (int64_t)load_##name(ptr);                                          \
+  }                                                                            \
+  static void id_array_##name(const void * ptr, int64_t n, int64_t * t) {      \
+    const BYTE * source = ptr;                                                 \
+    int64_t i;                                                                 \
+    for (i = 0; i < n; i++) {                                                  \
+      t[i] = (int64_t)load_##name(source + i * sizeof(type));                  \
+    }                                                                          \
+  }
+
+READERS(shr, int16_t)
+READERS(ush, uint16_t)
+READERS(shr_swp, int16_t)
+READERS(ush_swp, uint16_t)
+READERS(int_swp, int32_t)
+READERS(flt_swp, float)
+READERS(dbl_swp, double)
+
+#undef LOAD_NATIVE
+#undef LOAD_SWAPPED
+#undef READERS
+
+typedef struct {
+  int dtype;
+  int64_t size;
+  converter convert;
+  array_converter convert_array;
+  mask_reader mask_array;
+  id_converter id;
+  id_reader id_array;
+} dtypereaders;
+
+#define DTYPE_READERS(dtype, name, type)                                          \
+  {                                                                               \
+    dtype, sizeof(type), convert_##name, convert_array_##name, mask_array_##name, \
+        id_##name, id_array_##name                                                \
+  }
+
+static const dtypereaders extra_dtypes[] = {
+    DTYPE_READERS(SEP_TSHORT, shr, int16_t),
+    DTYPE_READERS(SEP_TUSHORT, ush, uint16_t),
+    DTYPE_READERS(SEP_TSHORT | SEP_TSWAP, shr_swp, int16_t),
+    DTYPE_READERS(SEP_TUSHORT | SEP_TSWAP, ush_swp, uint16_t),
+    DTYPE_READERS(SEP_TINT | SEP_TSWAP, int_swp, int32_t),
+    DTYPE_READERS(SEP_TFLOAT | SEP_TSWAP, flt_swp, float),
+    DTYPE_READERS(SEP_TDOUBLE | SEP_TSWAP, dbl_swp, double),
+};
+
+#undef DTYPE_READERS
+
+/* readers of the types above, or NULL */
+static const dtypereaders * extra_dtype(int dtype) {
+  size_t i;
+
+  for (i = 0; i < sizeof(extra_dtypes) / sizeof(extra_dtypes[0]); i++) {
+    if (extra_dtypes[i].dtype == dtype) {
+      return extra_dtypes + i;
+    }
+  }
+  return NULL;
+}
+
 PIXTYPE convert_dbl(const void * ptr) {
   return *(const double *)ptr;
 }
@@ -52,6 +180,7 @@ PIXTYPE convert_byt(const void * ptr) {
 
 /* return the correct converter depending on the datatype code */
 int get_converter(int dtype, converter * f, int64_t * size) {
+  const dtypereaders * extra;
   int status = RETURN_OK;
 
   if (dtype == SEP_TFLOAT) {
@@ -66,6 +195,9 @@ int get_converter(int dtype, converter * f, int64_t * size) {
   } else if (dtype == SEP_TBYTE) {
     *f = convert_byt;
     *size = sizeof(BYTE);
+  } else if ((extra = extra_dtype(dtype))) {
+    *f = extra->convert;
+    *size = extra->size;
   } else {
     *f = NULL;
     *size = 0;
@@ -108,6 +240,7 @@ void convert_array_byt(const void * ptr, int64_t n, PIXTYPE * target) {
 }
 
 int get_array_converter(int dtype, array_converter * f, int64_t * size) {
+  const dtypereaders * extra;
   int status = RETURN_OK;
 
   if (dtype == SEP_TFLOAT) {
@@ -122,6 +255,276 @@ int get_array_converter(int dtype, array_converter * f, int64_t * size) {
   } else if (dtype == SEP_TDOUBLE) {
     *f = convert_array_dbl;
     *size = sizeof(double);
+  } else if ((extra = extra_dtype(dtype))) {
+    *f = extra->convert_array;
+    *size = extra->size;
+  } else {
+    *f = NULL;
+    *size = 0;
+    status = ILLEGAL_DTYPE;
+  }
+  return status;
+}
+
+
+
+/****************************************************************************/
+/* Mask and segmentation map lines, read in their own type.
+ *
+ * Masks become one byte per pixel (1: masked, i.e., value > thresh) and
+ * segmentation ids 64-bit integers, so that neither is widened to PIXTYPE
+ * nor rounded: ids above 2^24 are exact. The loops are branch-free so that
+ * the compiler can vectorize them.
+ *
+ * A mask reader fills n flags starting at column x of the mask row `row`,
+ * so that packed bit masks, whose pixels do not start on byte boundaries,
+ * are read in the same way as the others. */
+
+/* an integer v is above thresh if it is above floor(thresh); thresholds
+ * outside [lo, hi) mask everything or nothing (NaN masks nothing) */
+#define MASK_INT_THRESH(type, lo, hi, thresh, n, target, t) \
+  if (!((thresh) < (hi))) {                                 \
+    memset(target, 0, (size_t)(n));                         \
+    return;                                                 \
+  }                                                         \
+  if ((thresh) < (lo)) {                                    \
+    memset(target, 1, (size_t)(n));                         \
+    return;                                                 \
+  }                                                         \
+  t = (type)floor(thresh)
+
+void mask_array_byt(
+    const void * row, int64_t x, int64_t n, double thresh, BYTE * target
+) {
+  const BYTE * source = (const BYTE *)row + x;
+  BYTE t;
+  int64_t i;
+  MASK_INT_THRESH(BYTE, 0.0, 255.0, thresh, n, target, t);
+  for (i = 0; i < n; i++) {
+    target[i] = source[i] > t;
+  }
+}
+
+void mask_array_int(
+    const void * row, int64_t x, int64_t n, double thresh, BYTE * target
+) {
+  const int * source = (const int *)row + x;
+  int t;
+  int64_t i;
+  MASK_INT_THRESH(int, (double)INT_MIN, (double)INT_MAX, thresh, n, target, t);
+  for (i = 0; i < n; i++) {
+    target[i] = source[i] > t;
+  }
+}
+
+void mask_array_flt(
+    const void * row, int64_t x, int64_t n, double thresh, BYTE * target
+) {
+  const float * source = (const float *)row + x;
+  int64_t i;
+  for (i = 0; i < n; i++) {
+    target[i] = (double)source[i] > thresh;
+  }
+}
+
+void mask_array_dbl(
+    const void * row, int64_t x, int64_t n, double thresh, BYTE * target
+) {
+  const double * source = (const double *)row + x;
+  int64_t i;
+  for (i = 0; i < n; i++) {
+    target[i] = source[i] > thresh;
+  }
+}
+
+#undef MASK_INT_THRESH
+
+/* expand the 8 bits of a byte, most significant first */
+#define MASK_BITS(byte, target)      \
+  {                                  \
+    (target)[0] = ((byte) >> 7) & 1; \
+    (target)[1] = ((byte) >> 6) & 1; \
+    (target)[2] = ((byte) >> 5) & 1; \
+    (target)[3] = ((byte) >> 4) & 1; \
+    (target)[4] = ((byte) >> 3) & 1; \
+    (target)[5] = ((byte) >> 2) & 1; \
+    (target)[6] = ((byte) >> 1) & 1; \
+    (target)[7] = (byte) & 1;        \
+  }
+
+/* Packed bits, most significant bit first, each row starting on a byte
+ * boundary (as numpy.packbits(mask, axis=1)). Whole 64-pixel words with no
+ * bit set are cleared without looking at their bits. */
+void mask_array_bit(
+    const void * row, int64_t x, int64_t n, double thresh, BYTE * target
+) {
+  const BYTE * source = (const BYTE *)row + x / 8;
+  uint64_t word;
+  int64_t i, k;
+  int bit;
+
+  if (!(thresh < 1.0)) {
+    memset(target, 0, (size_t)n);
+    return;
+  }
+  if (thresh < 0.0) {
+    memset(target, 1, (size_t)n);
+    return;
+  }
+
+  /* leading bits, up to a byte boundary */
+  i = 0;
+  if ((bit = (int)(x % 8))) {
+    for (; i < n && bit < 8; i++, bit++) {
+      target[i] = (*source >> (7 - bit)) & 1;
+    }
+    source++;
+  }
+
+  for (; i + 64 <= n; i += 64, source += 8) {
+    memcpy(&word, source, sizeof(word));
+    if (!word) {
+      memset(target + i, 0, 64);
+      continue;
+    }
+    for (k = 0; k < 8; k++) {
+      MASK_BITS(source[k], target + i + 8 * k);
+    }
+  }
+  for (; i + 8 <= n; i += 8, source++) {
+    MASK_BITS(*source, target + i);
+  }
+  for (bit = 0; i < n; i++, bit++) {
+    target[i] = (*source >> (7 - bit)) & 1;
+  }
+}
+
+#undef MASK_BITS
+
+int get_mask_reader(int dtype, int64_t w, mask_reader * f, int64_t * rowsize) {
+  const dtypereaders * extra;
+  int status = RETURN_OK;
+
+  if (dtype == SEP_TBYTE) {
+    *f = mask_array_byt;
+    *rowsize = w * sizeof(BYTE);
+  } else if (dtype == SEP_TINT) {
+    *f = mask_array_int;
+    *rowsize = w * sizeof(int);
+  } else if (dtype == SEP_TFLOAT) {
+    *f = mask_array_flt;
+    *rowsize = w * sizeof(float);
+  } else if (dtype == SEP_TDOUBLE) {
+    *f = mask_array_dbl;
+    *rowsize = w * sizeof(double);
+  } else if (dtype == SEP_TBIT) {
+    *f = mask_array_bit;
+    *rowsize = (w + 7) / 8;
+  } else if ((extra = extra_dtype(dtype))) {
+    *f = extra->mask_array;
+    *rowsize = w * extra->size;
+  } else {
+    *f = NULL;
+    *rowsize = 0;
+    status = ILLEGAL_DTYPE;
+  }
+  return status;
+}
+
+int64_t id_byt(const void * ptr) {
+  return *(const BYTE *)ptr;
+}
+
+int64_t id_int(const void * ptr) {
+  return *(const int *)ptr;
+}
+
+int64_t id_flt(const void * ptr) {
+  return (int64_t)*(const float *)ptr;
+}
+
+int64_t id_dbl(const void * ptr) {
+  return (int64_t)*(const double *)ptr;
+}
+
+void id_array_byt(const void * ptr, int64_t n, int64_t * target) {
+  const BYTE * source = ptr;
+  int64_t i;
+  for (i = 0; i < n; i++) {
+    target[i] = source[i];
+  }
+}
+
+void id_array_int(const void * ptr, int64_t n, int64_t * target) {
+  const int * source = ptr;
+  int64_t i;
+  for (i = 0; i < n; i++) {
+    target[i] = source[i];
+  }
+}
+
+void id_array_flt(const void * ptr, int64_t n, int64_t * target) {
+  const float * source = ptr;
+  int64_t i;
+  for (i = 0; i < n; i++) {
+    target[i] = (int64_t)source[i];
+  }
+}
+
+void id_array_dbl(const void * ptr, int64_t n, int64_t * target) {
+  const double * source = ptr;
+  int64_t i;
+  for (i = 0; i < n; i++) {
+    target[i] = (int64_t)source[i];
+  }
+}
+
+int get_id_converter(int dtype, id_converter * f, int64_t * size) {
+  const dtypereaders * extra;
+  int status = RETURN_OK;
+
+  if (dtype == SEP_TBYTE) {
+    *f = id_byt;
+    *size = sizeof(BYTE);
+  } else if (dtype == SEP_TINT) {
+    *f = id_int;
+    *size = sizeof(int);
+  } else if (dtype == SEP_TFLOAT) {
+    *f = id_flt;
+    *size = sizeof(float);
+  } else if (dtype == SEP_TDOUBLE) {
+    *f = id_dbl;
+    *size = sizeof(double);
+  } else if ((extra = extra_dtype(dtype))) {
+    *f = extra->id;
+    *size = extra->size;
+  } else {
+    *f = NULL;
+    *size = 0;
+    status = ILLEGAL_DTYPE;
+  }
+  return status;
+}
+
+int get_id_reader(int dtype, id_reader * f, int64_t * size) {
+  const dtypereaders * extra;
+  int status = RETURN_OK;
+
+  if (dtype == SEP_TBYTE) {
+    *f = id_array_byt;
+    *size = sizeof(BYTE);
+  } else if (dtype == SEP_TINT) {
+    *f = id_array_int;
+    *size = sizeof(int);
+  } else if (dtype == SEP_TFLOAT) {
+    *f = id_array_flt;
+    *size = sizeof(float);
+  } else if (dtype == SEP_TDOUBLE) {
+    *f = id_array_dbl;
+    *size = sizeof(double);
+  } else if ((extra = extra_dtype(dtype))) {
+    *f = extra->id_array;
+    *size = extra->size;
   } else {
     *f = NULL;
     *size = 0;
@@ -261,6 +664,9 @@ void sep_get_errmsg(int status, char * errtext)
   case UNKNOWN_NOISE_TYPE:
     strcpy(errtext, "image has unknown noise_type");
     break;
+  case FILE_IO_ERROR:
+    strcpy(errtext, "file could not be opened or written");
+    break;
   default:
     strcpy(errtext, "unknown error status");
     break;
@@ -390,6 +390,200 @@ def test_background_rms():
     assert rms.shape == (ny, nx)
 
 
+@pytest.mark.skipif(NO_FITS, reason="no FITS reader")
+@pytest.mark.parametrize("bw, bh", [(64, 64), (32, 50), (256, 64), (17, 300)])
+def test_background_evaluate(bw, bh):
+    """
+    Test that `sep.Background.evaluate` matches the full-image spline.
+    """
+
+    bkg = sep.Background(image_data, bw=bw, bh=bh)
+    y, x = np.mgrid[: image_data.shape[0], : image_data.shape[1]]
+    back, rms = bkg.evaluate(x, y)
+    assert back.shape == image_data.shape
+    assert_allclose(back, bkg.back(), rtol=1e-5, atol=1e-5)
+    assert_allclose(rms, bkg.rms(), rtol=1e-5)
+
+    # positions off the image take the value at the nearest image pixel
+    h, w = image_data.shape
+    x = [-50.0, w + 100.0, 3.0, np.nan]
+    y = [4.0, h + 700.0, -9.0, 0.0]
+    back, rms = bkg.evaluate(x, y)
+    iy, ix = [4, h - 1, 0], [0, w - 1, 3]
+    assert_allclose(back[:3], bkg.back()[iy, ix], rtol=1e-5, atol=1e-5)
+    assert_allclose(rms[:3], bkg.rms()[iy, ix], rtol=1e-5)
+    assert np.isnan(back[3]) and np.isnan(rms[3])
+
+
+@pytest.mark.skipif(NO_FITS, reason="no FITS reader")
+@pytest.mark.parametrize("bw, bh", [(64, 64), (17, 300), (256, 256)])
+def test_background_tile(bw, bh):
+    """
+    Test that background tiles match the corresponding full-image region.
+    """
+
+    bkg = sep.Background(image_data, bw=bw, bh=bh)
+    back = bkg.back()
+    rms = bkg.rms()
+    for y0, x0, h, w in [(0, 0, 256, 256), (37, 101, 50, 3), (200, 250, 56, 6)]:
+        assert_allclose(bkg.back_tile(x0, y0, w, h), back[y0 : y0 + h, x0 : x0 + w],
+                        rtol=1e-5, atol=1e-5)
+        assert_allclose(bkg.rms_tile(x0, y0, w, h), rms[y0 : y0 + h, x0 : x0 + w],
+                        rtol=1e-5)
+
+        data = image_data[y0 : y0 + h, x0 : x0 + w].copy()
+        bkg.subfrom_tile(data, x0, y0)
+        assert_allclose(data, image_data[y0 : y0 + h, x0 : x0 + w]
+                        - bkg.back_tile(x0, y0, w, h))
+
+    # pixels outside the image take the value of the nearest edge pixel
+    h, w = back.shape
+    for y0, x0 in [(-5, -7), (h - 3, w - 4), (-3000, -3000), (40, w + 3000)]:
+        iy = np.clip(np.arange(y0, y0 + 9), 0, h - 1)[:, None]
+        ix = np.clip(np.arange(x0, x0 + 11), 0, w - 1)[None, :]
+        tile = bkg.back_tile(x0, y0, 11, 9)
+        assert_allclose(tile, back[iy, ix], rtol=1e-5, atol=1e-5)
+        assert_allclose(bkg.rms_tile(x0, y0, 11, 9), rms[iy, ix], rtol=1e-5)
+
+    assert_allclose(bkg[10:-20, 5:], back[10:-20, 5:], rtol=1e-5, atol=1e-5)
+    assert bkg[5:5, :].shape == (0, 256)
+    assert bkg.back_tile(0, 0, 4, 4, dtype=np.float32).dtype == np.float32
+
+
+def test_background_masked():
+    """
+    Test iterative source-masked background against an explicit mask.
+    """
+
+    rng = np.random.default_rng(0)
+    ny, nx = 300, 250
+    data = 100.0 + rng.normal(size=(ny, nx))
+    y, x = np.mgrid[:ny, :nx]
+    for _ in range(40):
+        x0, y0 = rng.uniform(0, nx), rng.uniform(0, ny)
+        data += 50.0 * np.exp(-((x - x0) ** 2 + (y - y0) ** 2) / 8.0)
+
+    bkg0 = sep.Background(data, bw=32, bh=32)
+    bkg1 = sep.Background(data, bw=32, bh=32, niter=1, nsigma=3.0, dilate=2)
+
+    # same exclusion built with full-size arrays
+    sig = ((data.astype(np.float32) - bkg0.back(dtype=np.float32))
+           / bkg0.rms(dtype=np.float32)).astype(np.float64)
+    pad = np.pad(sig, 1)
+    ones = np.pad(np.ones_like(sig), 1)
+    sums = sum(pad[1 + dy : ny + 1 + dy, 1 + dx : nx + 1 + dx]
+               for dy in (-1, 0, 1) for dx in (-1, 0, 1))
+    cnts = sum(ones[1 + dy : ny + 1 + dy, 1 + dx : nx + 1 + dx]
+               for dy in (-1, 0, 1) for dx in (-1, 0, 1))
+    seed = np.pad(sums > 3.0 * np.sqrt(cnts), 2)
+    mask = np.zeros_like(data, dtype=bool)
+    for dy in range(-2, 3):
+        for dx in range(-2, 3):
+            mask |= seed[2 + dy : ny + 2 + dy, 2 + dx : nx + 2 + dx]
+    bkgm = sep.Background(data, mask=mask, bw=32, bh=32)
+    assert_allclose(bkg1.back(), bkgm.back())
+    assert_allclose(bkg1.rms(), bkgm.rms())
+
+    # masking brings the background closer to the true level
+    assert (np.abs(bkg1.back() - 100.0).mean()
+            < np.abs(bkg0.back() - 100.0).mean())
+    assert_allclose(sep.Background(data, bw=32, bh=32, niter=0).back(),
+                    bkg0.back())
+    sep.Background(data, bw=32, bh=32, niter=3)
+
+
+@pytest.mark.skipif(NO_FITS, reason="no FITS reader")
+@pytest.mark.parametrize("bw, bh", [(32, 32), (16, 24)])
+def test_background_multiscale(bw, bh):
+    """
+    Test that multi-scale meshes match separate background estimates.
+    """
+
+    bkgs = sep.background_multiscale(image_data, bw=bw, bh=bh, nscales=4)
+    assert len(bkgs) == 4
+    for i, bkg in enumerate(bkgs):
+        ref = sep.Background(image_data, bw=bw << i, bh=bh << i)
+        if i == 0:
+            assert_equal(bkg.back(), ref.back())
+            assert_equal(bkg.rms(), ref.rms())
+        else:
+            assert_allclose(bkg.back(), ref.back(), atol=0.05 * ref.globalrms)
+            assert_allclose(bkg.rms(), ref.rms(), atol=0.05 * ref.globalrms)
+
+
+def test_background_subsample():
+    """
+    Test subsampled background estimation.
+    """
+
+    rng = np.random.default_rng(0)
+    data = 100.0 + 5.0 * rng.normal(size=(512, 512))
+    bkg1 = sep.Background(data)
+    assert bkg1.subsample == 1
+    assert bkg1.nsample == data.size
+    assert bkg1.backerr.shape == (8, 8)
+
+    try:
+        sep.set_background_subsample(2)
+        assert sep.get_background_subsample() == 2
+        bkg2 = sep.Background(data)
+    finally:
+        sep.set_background_subsample(1)
+
+    assert bkg2.subsample == 2
+    assert bkg2.nsample == data.size // 4
+    assert_allclose(np.median(bkg2.backerr / bkg1.backerr), 2.0, rtol=0.1)
+    assert np.all(np.abs(bkg2.back() - 100.0) < 5 * bkg2.backerr.max())
+    assert_allclose(bkg2.globalrms, bkg1.globalrms, rtol=0.02)
+
+
+def test_stats_box_circann():
+    """
+    Test clipped statistics in boxes and annuli.
+    """
+
+    rng = np.random.default_rng(0)
+    data = 100.0 + 5.0 * rng.normal(size=(256, 256))
+    data[40:44, 100:104] = 1.0e4
+
+    # a box gives the same statistics as a single background mesh
+    iy, ix = np.mgrid[0:4, 0:4]
+    mean, mode, sigma, npix, flag = sep.stats_box(
+        data, 64 * ix, 64 * ix + 63, 64 * iy, 64 * iy + 63)
+    assert mean.shape == (4, 4)
+    for j, i in [(0, 0), (0, 3), (2, 1)]:
+        bkg = sep.Background(data[64*j:64*j+64, 64*i:64*i+64].copy(),
+                             bw=64, bh=64)
+        assert mean[j, i] == bkg.globalback
+        assert sigma[j, i] == bkg.globalrms
+    assert_allclose(mode, 100.0, atol=1.0)
+    assert np.all(npix == 64 * 64)
+    assert np.all(flag == 0)
+
+    # annuli: pixel count, masking and truncation
+    y, x = np.mgrid[0:256, 0:256]
+    mask = np.zeros(data.shape, dtype=np.bool_)
+    mask[50, :] = True
+    mean, mode, sigma, npix, flag = sep.stats_circann(
+        data, [128.0, 128.0, 0.0, 500.0], [50.0, 128.0, 0.0, 500.0], 5.0, 10.0,
+        mask=mask)
+    r2 = (x - 128.0) ** 2 + (y - 50.0) ** 2
+    inann = (r2 >= 25.0) & (r2 < 100.0)
+    assert npix[0] == np.sum(inann & ~mask)
+    assert flag[0] == sep.APER_HASMASKED
+    assert flag[1] == 0
+    assert flag[2] == sep.APER_TRUNC
+    assert npix[3] == 0 and np.isnan(mean[3])
+    assert_allclose(mean[:3], 100.0, atol=1.5)
+    assert_allclose(sigma[:3], 5.0, rtol=0.25)
+
+    # clipping rejects the bright square
+    mean, mode, sigma, npix, flag = sep.stats_circann(data, 101.5, 41.5, 0.0,
+                                                      20.0)
+    assert npix > 16
+    assert abs(mean - 100.0) < 2.0
+
+
 # -----------------------------------------------------------------------------
 # Extract
 
@@ -538,6 +732,84 @@ def test_extract_with_mask():
     assert np.all(objects["y"] < ylim)
 
 
+@pytest.mark.skipif(NO_FITS, reason="no FITS reader")
+def test_extract_with_reference_image():
+    """
+    Test that detecting against a reference image is equivalent to
+    detecting on the difference image, with noise added in quadrature.
+    """
+
+    data = np.copy(image_data).astype(np.float64)
+    bkg = sep.Background(data, bw=64, bh=64, fw=3, fh=3)
+    bkg.subfrom(data)
+    rms = bkg.globalrms
+
+    rng = np.random.default_rng(0)
+    ref = rng.normal(100.0, 5.0, size=data.shape)
+    science = data + 0.5 * ref
+    ref_err = 0.5 * rms * np.ones_like(data)
+
+    # scalar noise on both images
+    objects = sep.extract(science, 1.5, err=rms, ref=ref, ref_scale=0.5, ref_noise=0.5 * rms)
+    expected = sep.extract(data, 1.5, err=np.hypot(rms, 0.25 * rms))
+    assert len(objects) == len(expected)
+    for name in ["x", "y", "flux", "thresh"]:
+        assert_allclose(objects[name], expected[name], rtol=1.0e-4)
+
+    # array reference noise, given as variance
+    objects = sep.extract(
+        science, 1.5, var=rms**2, ref=ref, ref_scale=0.5, ref_noise=ref_err**2
+    )
+    expected = sep.extract(
+        data, 1.5, var=(rms**2 + (0.5 * ref_err) ** 2) * np.ones_like(data)
+    )
+    assert len(objects) == len(expected)
+    for name in ["x", "y", "flux", "thresh"]:
+        assert_allclose(objects[name], expected[name], rtol=1.0e-4)
+
+
+@pytest.mark.skipif(NO_FITS, reason="no FITS reader")
+def test_extract_conv_plan(tmp_path):
+    """
+    Test that separable and direct filtering detect the same objects, and
+    that automatic planning is cached in the tune cache file.
+    """
+
+    data = np.copy(image_data)
+    bkg = sep.Background(data, bw=64, bh=64, fw=3, fh=3)
+    bkg.subfrom(data)
+    gauss = np.outer([1.0, 4.0, 6.0, 4.0, 1.0], [1.0, 4.0, 6.0, 4.0, 1.0])
+
+    assert sep.get_conv_plan() == "direct"  # reproducible default
+    try:
+        objects = {}
+        for plan in ["direct", "separable"]:
+            sep.set_conv_plan(plan)
+            assert sep.get_conv_plan() == plan
+            objects[plan] = sep.extract(
+                data, 1.5, err=bkg.globalrms, filter_kernel=gauss, filter_type="conv"
+            )
+        assert len(objects["direct"]) == len(objects["separable"])
+        for name in ["x", "y", "flux", "npix"]:
+            assert_allclose(objects["direct"][name], objects["separable"][name], rtol=1.0e-4)
+
+        sep.set_conv_plan("auto")
+        cache = tmp_path / "tune.txt"
+        sep.set_tune_cache(str(cache))
+        plan = sep.conv_plan(gauss[:, :3], 256)
+        assert plan in ("direct", "separable")
+        assert cache.read_text() == "conv 3 5 8 {}\n".format(plan)
+        assert sep.conv_plan(gauss[:, :3], 200) == plan  # same width class
+        assert cache.read_text().count("\n") == 1
+
+        # non-separable kernels are always applied directly
+        sep.set_conv_plan("separable")
+        assert sep.conv_plan(np.eye(3), 256) == "direct"
+    finally:
+        sep.set_conv_plan("direct")
+        sep.set_tune_cache(None)
+
+
 @pytest.mark.skipif(NO_FITS, reason="no FITS reader")
 def test_extract_segmentation_map():
     """
@@ -646,6 +918,35 @@ def test_extract_seg_map_array():
         assert_allclose_structured(objects3, objects4)
 
 
+def test_extract_pixel_values():
+    """Test that the member pixels and values of objects are returned."""
+
+    data = np.copy(image_data)
+    bkg = sep.Background(data, bw=64, bh=64, fw=3, fh=3)
+    bkg.subfrom(data)
+
+    objects, segmap, pixels = sep.extract(
+        data, 1.5, bkg.globalrms, segmentation_map=True, pixel_values=True
+    )
+    assert len(pixels) == objects["npix"].sum()
+    ids = np.repeat(np.arange(1, len(objects) + 1), objects["npix"])
+    assert_equal(segmap[pixels["y"], pixels["x"]], ids)
+    assert_allclose(pixels["value"], data[pixels["y"], pixels["x"]])
+    assert_allclose(pixels["var"], bkg.globalrms**2, rtol=1e-6)
+    start = np.cumsum(objects["npix"]) - objects["npix"]
+    flux = np.add.reduceat(pixels["value"], start)
+    cflux = np.add.reduceat(pixels["cvalue"], start)
+    assert_allclose(flux, objects["flux"], rtol=1e-4)
+    assert_allclose(cflux, objects["cflux"], rtol=1e-4)
+
+    # without a filter or noise
+    objects, pixels = sep.extract(
+        data, 1.5 * bkg.globalrms, filter_kernel=None, pixel_values=True
+    )
+    assert_equal(pixels["cvalue"], pixels["value"])
+    assert np.all(np.isnan(pixels["var"]))
+
+
 # -----------------------------------------------------------------------------
 # aperture tests
 
@@ -740,6 +1041,152 @@ def test_apertures_exact():
             assert_allclose(flux, np.pi * ratio * (rout**2 - r**2))
 
 
+def test_apertures_exact_vs_subpix():
+    """
+    Test exact elliptical overlap against fine subpixel sampling.
+    """
+
+    data = np.random.rand(*data_shape)
+    theta = np.random.uniform(-np.pi / 2.0, np.pi / 2.0, naper)
+    ratio = np.random.uniform(0.05, 1.0, naper)
+
+    for r in [0.7, 2.0, 6.0]:
+        flux, _, _ = sep.sum_ellipse(data, x, y, 1.0, ratio, theta, r=r, subpix=0)
+        ref, _, _ = sep.sum_ellipse(data, x, y, 1.0, ratio, theta, r=r, subpix=64)
+        assert_allclose(flux, ref, rtol=0.0, atol=0.02 * r)
+
+
+def test_sum_psf():
+    """
+    Test PSF-weighted fluxes of point sources at sub-pixel positions.
+    """
+
+    def gauss(shape, x, y, sig):
+        iy, ix = np.indices(shape)
+        r2 = (ix - x) ** 2 + (iy - y) ** 2
+        return np.exp(-0.5 * r2 / sig**2) / (2.0 * np.pi * sig**2)
+
+    shape = (64, 128)
+    sig = np.array([1.5, 2.5])
+    xs = np.array([14.3, 40.77, 52.5, 80.12, 100.9])
+    ys = np.array([12.6, 30.01, 50.45, 20.5, 40.25])
+    fluxes = np.array([100.0, 20.0, 50.0, 10.0, 5.0])
+    stamps = np.array([gauss((21, 25), 12, 10, s) for s in sig])
+
+    # without noise, fluxes are recovered up to the sub-pixel binning error
+    data = np.zeros(shape)
+    for xi, yi, f in zip(xs, ys, fluxes):
+        data += f * gauss(shape, xi, yi, sig[0])
+    flux, fluxerr, flag = sep.sum_psf(data, xs, ys, stamps[0])
+    assert_allclose(flux, fluxes, rtol=1.0e-3)
+    assert np.all(fluxerr == 0.0)
+    assert np.all(flag == 0)
+
+    # a grid of stamps: each object gets the PSF of its tile
+    data = np.zeros(shape)
+    for xi, yi, f in zip(xs, ys, fluxes):
+        data += f * gauss(shape, xi, yi, sig[int(xi >= 64)])
+    flux, _, _ = sep.sum_psf(
+        data, xs, ys, stamps[np.newaxis], tilesize=(64, 64), nshift=16
+    )
+    assert_allclose(flux, fluxes, rtol=1.0e-3)
+
+    # error of the linear estimator with uniform noise: PSF at integer
+    # position, so that the stamp is used as is
+    p = stamps[0] / stamps[0].sum()
+    _, fluxerr, _ = sep.sum_psf(data, 40.0, 30.0, stamps[0], err=2.0, nshift=1)
+    assert_approx_equal(fluxerr, 2.0 / np.sqrt((p**2).sum()))
+
+    # masking and truncation
+    data = np.zeros(shape)
+    data += 10.0 * gauss(shape, 40.0, 30.0, sig[0])
+    mask = np.zeros(shape, dtype=np.bool_)
+    mask[30, 40] = True
+    mask[0:30, 0:30] = True
+    flux, _, flag = sep.sum_psf(
+        data, [40.0, 15.0, 2.0], [30.0, 15.0, 50.0], stamps[0], mask=mask, nshift=1
+    )
+    assert_allclose(flux[0], 10.0, rtol=1.0e-6)
+    assert flag[0] == sep.APER_HASMASKED
+    assert np.isnan(flux[1])
+    assert flag[1] == sep.APER_HASMASKED | sep.APER_ALLMASKED
+    assert flag[2] == sep.APER_TRUNC
+
+
+@pytest.mark.skipif(NO_FITS, reason="no FITS reader")
+@pytest.mark.parametrize("rmsmap", [False, True])
+def test_pipeline(rmsmap):
+    """
+    Test that the fused pipeline agrees with background subtraction,
+    extraction and aperture photometry done one step at a time.
+    """
+
+    data = np.copy(image_data)
+    mask = np.zeros(data.shape, dtype=np.bool_)
+    mask[100:110, 100:110] = True
+    apertures = [("circle", 3.0), ("ellipse", 2.5), ("circle", 5.0, 0)]
+
+    bkg = sep.Background(data, mask=mask)
+    sub = data - bkg
+    noise = bkg.rms() if rmsmap else bkg.globalrms
+    objects = sep.extract(sub, 1.5, err=noise, mask=mask)
+    x, y = objects["x"], objects["y"]
+    expected = [
+        sep.sum_circle(sub, x, y, 3.0, err=noise, mask=mask),
+        sep.sum_ellipse(
+            sub, x, y, objects["a"], objects["b"], objects["theta"], 2.5,
+            err=noise, mask=mask
+        ),
+        sep.sum_circle(sub, x, y, 5.0, err=noise, mask=mask, subpix=0),
+    ]
+
+    try:
+        for nthreads in [1, 4]:
+            sep.set_nthreads(nthreads)
+            pbkg, pobjects, flux, fluxerr, flag = sep.pipeline(
+                data, 1.5, mask=mask, rmsmap=rmsmap, apertures=apertures
+            )
+            assert_allclose(pbkg.back(), bkg.back())
+            assert len(pobjects) == len(objects)
+            for name in ["x", "y", "flux", "a", "thresh"]:
+                assert_allclose(pobjects[name], objects[name], rtol=1.0e-5)
+            assert flux.shape == (len(objects), len(apertures))
+            # the background is evaluated per cutout rather than per line,
+            # which changes pixel values in the last float digit
+            for k, (eflux, efluxerr, eflag) in enumerate(expected):
+                assert np.all(np.abs(flux[:, k] - eflux) < 1.0e-2 * efluxerr)
+                assert_allclose(fluxerr[:, k], efluxerr, rtol=1.0e-5)
+                assert_equal(flag[:, k], eflag)
+    finally:
+        sep.set_nthreads(1)
+
+
+def test_apertures_overlap_tolerance():
+    """
+    Test that approximate exact overlap stays within its tolerance.
+    """
+
+    data = np.ones(data_shape)
+    theta = np.random.uniform(-np.pi / 2.0, np.pi / 2.0, naper)
+    ratio = np.random.uniform(0.2, 1.0, naper)
+    tol = 1.0e-5
+
+    for r in [0.5, 3.0, 8.0]:
+        # npix bounds the number of boundary pixels
+        npix = np.pi * (r + 1.5) ** 2
+        ref = sep.sum_circle(data, x, y, r, subpix=0)[0]
+        eref = sep.sum_ellipse(data, x, y, 1.0, ratio, theta, r=r, subpix=0)[0]
+        try:
+            sep.set_overlap_tolerance(tol)
+            assert sep.get_overlap_tolerance() == tol
+            flux = sep.sum_circle(data, x, y, r, subpix=0)[0]
+            eflux = sep.sum_ellipse(data, x, y, 1.0, ratio, theta, r=r, subpix=0)[0]
+        finally:
+            sep.set_overlap_tolerance(0.0)
+        assert np.all(np.abs(flux - ref) <= tol * npix)
+        assert np.all(np.abs(eflux - eref) <= tol * npix)
+
+
 def test_aperture_bkgann_overlapping():
     """
     Test bkgann functionality in circular & elliptical apertures.
@@ -861,6 +1308,150 @@ def test_masked_segmentation_measurements():
         print(rhalf_exact, flux_radius)
 
 
+def test_segmap_large_ids():
+    """
+    Test that segmentation ids above 2^24 (not exact as float) and integer
+    masks compared to a threshold are read exactly.
+    """
+
+    data = np.zeros((40, 60))
+    data[10:20, 10:20] = 1.0
+    data[10:20, 20:30] = 2.0
+    segmap = np.zeros(data.shape, dtype=np.int32)
+    ids = [2**24 + 1, 2**24 + 3]
+    segmap[10:20, 10:20] = ids[0]
+    segmap[10:20, 20:30] = ids[1]
+
+    objects, _ = sep.extract(data, 0.5, segmentation_map=segmap)
+    assert_equal(objects["npix"], [100, 100])
+    assert_allclose(objects["flux"], [100.0, 200.0])
+
+    # the neighbouring object is masked, not the object itself
+    flux, _, flag = sep.sum_circle(
+        data, 14.5, 14.5, 20.0, seg_id=ids[0], segmap=segmap, subpix=1
+    )
+    assert_allclose(flux, 100.0)
+    assert flag & sep.APER_HASMASKED
+
+    # integer mask values at or below maskthresh are not masked
+    mask = np.zeros(data.shape, dtype=np.int32)
+    mask[10:20, 20:30] = 2
+    objects = sep.extract(data, 0.5, mask=mask, maskthresh=2.0)
+    assert len(objects) == 1 and objects["npix"][0] == 200
+    objects = sep.extract(data, 0.5, mask=mask, maskthresh=1.0)
+    assert len(objects) == 1 and objects["npix"][0] == 100
+    bkg = sep.Background(data + 1.0, mask=mask, maskthresh=1.0, bw=20, bh=20)
+    assert np.isfinite(bkg.globalback)
+
+
+def test_segmap_many_ids():
+    """
+    Test that a segmentation map with many ids in no particular order, some
+    of single pixels, is measured the same on one or several threads.
+    """
+
+    rng = np.random.RandomState(5)
+    data = rng.normal(0.0, 1.0, size=(300, 400))
+    segmap = np.zeros(data.shape, dtype=np.int32)
+    ids = rng.permutation(np.arange(1, 2001)) * 7
+    for k, i in enumerate(ids):
+        y, x = divmod(k, 50)
+        size = 1 if k % 3 == 0 else 5
+        segmap[7 * y : 7 * y + size, 8 * x : 8 * x + size] = i
+    npix = np.where(np.arange(2000) % 3 == 0, 1, 25)
+
+    nthreads = sep.get_nthreads()
+    try:
+        sep.set_nthreads(1)
+        expected, _ = sep.extract(data, 1.0, err=1.0, segmentation_map=segmap)
+        sep.set_nthreads(4)
+        objects, _ = sep.extract(data, 1.0, err=1.0, segmentation_map=segmap)
+    finally:
+        sep.set_nthreads(nthreads)
+
+    # objects are in order of increasing id
+    assert_equal(objects["npix"], npix[np.argsort(ids)])
+    single = objects[objects["npix"] == 1]
+    assert_allclose(single["flux"], data[single["ypeak"], single["xpeak"]], rtol=1e-6)
+    assert_equal(single["x"], single["xpeak"])
+    for name in objects.dtype.names:
+        assert_equal(objects[name], expected[name])
+
+
+def test_deblend_sparse_object():
+    """
+    Test deblending a thin diagonal streak, which fills a tiny part of its
+    bounding box, into the sources along it.
+    """
+
+    n = 1200
+    yy, xx = np.mgrid[:n, :n]
+    dist = np.abs(yy - 0.9 * xx - 20.0) / np.hypot(1.0, 0.9)
+    data = 20.0 * np.exp(-0.5 * (dist / 1.5) ** 2)
+    x0 = np.array([150.0, 500.0, 800.0, 1100.0])
+    y0 = 0.9 * x0 + 20.0
+    for xc, yc in zip(x0, y0):
+        data += 500.0 * np.exp(-0.5 * ((xx - xc) ** 2 + (yy - yc) ** 2) / 3.0**2)
+
+    objects, segmap = sep.extract(
+        data, 5.0, err=1.0, deblend_cont=0.001, segmentation_map=True
+    )
+
+    assert len(objects) == len(x0)
+    order = np.argsort(objects["x"])
+    assert_allclose(objects["x"][order], x0, atol=0.5)
+    assert_allclose(objects["y"][order], y0, atol=0.5)
+
+    # every pixel of the streak belongs to one of the sources
+    assert objects["npix"].sum() == np.count_nonzero(segmap)
+    for i, obj in enumerate(objects):
+        assert np.count_nonzero(segmap == i + 1) == obj["npix"]
+
+
+def test_bitmask():
+    """Test that a bit-packed mask gives the same results as a boolean one,
+    for a width that is not a whole number of bytes or 64-bit words."""
+
+    rng = np.random.RandomState(3)
+    data = rng.normal(10.0, 1.0, size=(130, 203))
+    data[40:50, 60:70] += 20.0
+    data[90:100, 150:160] += 20.0
+    mask = np.zeros(data.shape, dtype=np.bool_)
+    mask[:, 197:] = True  # partial last byte
+    mask[45:47, 61:66] = True  # within a source, off byte boundaries
+    mask[rng.rand(*data.shape) < 0.002] = True
+    bits = sep.BitMask(mask)
+    assert bits.shape == (130, 26)
+    assert_equal(bits.unpack(), mask)
+
+    bkg = sep.Background(data, mask=mask, bw=32, bh=32)
+    bkgbits = sep.Background(data, mask=bits, bw=32, bh=32)
+    assert_equal(bkgbits.back(), bkg.back())
+    assert_equal(bkgbits.rms(), bkg.rms())
+
+    objects = sep.extract(data - bkg, 3.0, err=bkg.globalrms, mask=mask)
+    objbits = sep.extract(data - bkg, 3.0, err=bkg.globalrms, mask=bits)
+    assert_equal(objbits, objects)
+
+    x = np.array([64.3, 154.7, 199.0, 3.5])
+    y = np.array([45.1, 95.2, 60.0, 120.5])
+    flux, _, flag = sep.sum_circle(data, x, y, 5.0, mask=mask)
+    fluxbits, _, flagbits = sep.sum_circle(data, x, y, 5.0, mask=bits)
+    assert_equal(fluxbits, flux)
+    assert_equal(flagbits, flag)
+    assert flag[0] & sep.APER_HASMASKED
+
+    mean, _, _, npix, _ = sep.stats_box(data, [0, 190], [60, 202],
+                                        [40, 0], [50, 129], mask=mask)
+    meanbits, _, _, npixbits, _ = sep.stats_box(data, [0, 190], [60, 202],
+                                                [40, 0], [50, 129], mask=bits)
+    assert_equal(npixbits, npix)
+    assert_equal(meanbits, mean)
+
+    with pytest.raises(ValueError):
+        sep.extract(data, 3.0, mask=sep.BitMask(mask[:, :200]))
+
+
 def test_mask_ellipse():
     """
     Test that the correct number of elements are masked with an ellipse.
@@ -890,6 +1481,52 @@ def test_flux_radius():
         assert_allclose(r[:, i], true_r[i], rtol=0.01)
 
 
+def test_winpos_moments():
+    """
+    Windowed second moments of an elliptical Gaussian match the analytic
+    covariance of the profile multiplied by the window.
+    """
+    yy, xx = np.mgrid[:64, :64]
+    s1, s2, rho = 2.0, 1.5, 0.3
+    x0, y0 = 31.3, 32.6
+    cov = np.array([[s1**2, rho * s1 * s2], [rho * s1 * s2, s2**2]])
+    icov = np.linalg.inv(cov)
+    dx, dy = xx - x0, yy - y0
+    data = 1000.0 * np.exp(
+        -0.5 * (icov[0, 0] * dx**2 + 2.0 * icov[0, 1] * dx * dy + icov[1, 1] * dy**2)
+    )
+    sig = 2.5
+    expected = np.linalg.inv(icov + np.eye(2) / sig**2)
+
+    xw, yw, flag = sep.winpos(data, [31.0, 30.0], [32.0, 33.0], sig, subpix=0)
+    res = sep.winpos(data, [31.0, 30.0], [32.0, 33.0], sig, subpix=0, moments=True)
+    xm, ym, x2, y2, xy, a, b, theta, errx2, erry2, errxy, flagm = res
+
+    # positions are unaffected by asking for moments
+    assert_equal(xm, xw)
+    assert_equal(ym, yw)
+    assert_equal(flagm, flag)
+    assert_allclose(xm, x0, atol=1e-4)
+    assert_allclose(ym, y0, atol=1e-4)
+    assert_allclose(x2, expected[0, 0], rtol=1e-4)
+    assert_allclose(y2, expected[1, 1], rtol=1e-4)
+    assert_allclose(xy, expected[0, 1], rtol=1e-4)
+
+    # shape: axes and angle of the same covariance
+    evals, evecs = np.linalg.eigh(expected)
+    assert_allclose(a, np.sqrt(evals[1]), rtol=1e-4)
+    assert_allclose(b, np.sqrt(evals[0]), rtol=1e-4)
+    dtheta = theta - np.arctan2(evecs[1, 1], evecs[0, 1])
+    assert_allclose((dtheta + np.pi / 2) % np.pi - np.pi / 2, 0.0, atol=1e-4)
+
+    # no noise information: zero errors; errors scale with the variance
+    assert np.all(errx2 == 0.0) and np.all(erry2 == 0.0)
+    e1 = sep.winpos(data, 31.0, 32.0, sig, subpix=0, moments=True, err=1.0)
+    e2 = sep.winpos(data, 31.0, 32.0, sig, subpix=0, moments=True, var=4.0)
+    assert e1[8] > 0.0 and e1[9] > 0.0
+    assert_allclose(e2[8:11], 4.0 * np.array(e1[8:11]), rtol=1e-12)
+
+
 def test_mask_ellipse_alt():
     """
     Mask_ellipse with cxx, cyy, cxy parameters.
@@ -905,26 +1542,310 @@ def test_mask_ellipse_alt():
     assert arr.sum() == 13
 
 
+# -----------------------------------------------------------------------------
+# Spatial index
+
+
+@pytest.mark.parametrize("nthreads", [1, 4])
+def test_spatial_index(nthreads):
+    """Check radius and nearest-neighbour queries against brute force."""
+
+    rng = np.random.default_rng(0)
+    px, py = rng.uniform(0.0, 200.0, (2, 1000))
+    px[10] = np.nan
+    qx, qy = rng.uniform(-20.0, 220.0, (2, 300))
+    d = np.hypot(qx[:, None] - px[None, :], qy[:, None] - py[None, :])
+    d[:, 10] = np.inf
+
+    old = sep.get_nthreads()
+    sep.set_nthreads(nthreads)
+    try:
+        index = sep.SpatialIndex(px, py)
+        assert len(index) == 1000
+
+        r = rng.uniform(0.0, 15.0, qx.shape)
+        indices, offsets = index.query_radius(qx, qy, r)
+        assert len(offsets) == len(qx) + 1
+        for i in range(len(qx)):
+            expected = np.flatnonzero(d[i] <= r[i])
+            assert_equal(indices[offsets[i] : offsets[i + 1]], expected)
+
+        dist, idx = index.query_nearest(qx, qy, k=5)
+        assert dist.shape == (300, 5)
+        assert_equal(idx, np.argsort(d, axis=1, kind="stable")[:, :5])
+        assert_allclose(dist, np.sort(d, axis=1)[:, :5])
+    finally:
+        sep.set_nthreads(old)
+
+    # fewer indexed positions than neighbours requested
+    dist, idx = sep.SpatialIndex([1.0, 2.0], [1.0, 1.0]).query_nearest(0.0, 1.0, k=3)
+    assert_equal(idx, [0, 1, -1])
+    assert_allclose(dist[:2], [1.0, 2.0])
+    assert np.isinf(dist[2])
+
+
+@pytest.mark.skipif(NO_FITS, reason="no FITS reader")
+def test_merge_tiles():
+    """Merging overlapping tiles recovers the whole-image catalog."""
+
+    data = image_data.astype(np.float64)
+    bkg = sep.Background(data)
+    data = data - bkg
+    full = sep.extract(data, 1.5, err=bkg.globalrms)
+
+    # 2x2 tiles overlapping by 48 pixels; cores split the overlaps
+    h, w = data.shape[0] // 2, data.shape[1] // 2
+    catalogs, origins, cores = [], [], []
+    for ty in range(2):
+        for tx in range(2):
+            x0, y0 = max(tx * w - 24, 0), max(ty * h - 24, 0)
+            x1, y1 = (tx + 1) * w + 24, (ty + 1) * h + 24
+            tile = np.ascontiguousarray(data[y0:y1, x0:x1])
+            catalogs.append(sep.extract(tile, 1.5, err=bkg.globalrms))
+            origins.append((x0, y0))
+            cores.append(
+                (
+                    tx * w - 0.5 if tx else -np.inf,
+                    (tx + 1) * w - 0.5 if tx == 0 else np.inf,
+                    ty * h - 0.5 if ty else -np.inf,
+                    (ty + 1) * h - 0.5 if ty == 0 else np.inf,
+                )
+            )
+    assert sum(len(c) for c in catalogs) > len(full)
+
+    for match_radius in (0.0, 2.0):
+        merged = sep.merge_tiles(catalogs, origins, cores, match_radius)
+        assert len(merged) == len(full)
+        order = np.lexsort((merged["x"], merged["y"]))
+        expected = np.lexsort((full["x"], full["y"]))
+        for name in ("x", "y"):
+            assert_allclose(merged[name][order], full[name][expected])
+
+
+@pytest.mark.skipif(NO_FITS, reason="no FITS reader")
+@pytest.mark.parametrize("fmt", ["fits", "arrow"])
+def test_catalog_writer(tmp_path, fmt):
+    """Catalogs streamed to a file read back unchanged, in order."""
+
+    data = image_data.astype(np.float64)
+    bkg = sep.Background(data)
+    data = data - bkg
+
+    # one catalog per image quadrant, and an empty one
+    h, w = data.shape[0] // 2, data.shape[1] // 2
+    catalogs = [
+        sep.extract(
+            np.ascontiguousarray(data[y0 : y0 + h, x0 : x0 + w]),
+            1.5,
+            err=bkg.globalrms,
+        )
+        for y0 in (0, h)
+        for x0 in (0, w)
+    ]
+    catalogs.insert(2, catalogs[0][:0])
+    expected = np.concatenate(catalogs)
+    assert len(expected) > 20
+
+    # a small row group, so that writes span several groups
+    path = tmp_path / ("cat." + fmt)
+    rowgroup = 7
+    with sep.CatalogWriter(path, format=fmt, rowgroup=rowgroup) as writer:
+        for i, cat in enumerate(catalogs):
+            writer.write(cat)
+            if i == 0:
+                writer.flush()
+        assert len(writer) == len(expected)
+    writer.close()
+    with pytest.raises(ValueError):
+        writer.write(catalogs[0])
+
+    if fmt == "fits":
+        fits = pytest.importorskip("astropy.io.fits")
+        with fits.open(path) as hdul:
+            table = hdul[1].data
+            names = list(table.columns.names)
+            # FITS is big-endian
+            result = {
+                name: table[name].astype(table[name].dtype.newbyteorder("="))
+                for name in names
+            }
+    else:
+        ipc = pytest.importorskip("pyarrow.ipc")
+        with ipc.open_file(path) as reader:
+            # one batch per full row group, plus the flush after a tile
+            assert reader.num_record_batches > len(expected) // rowgroup
+            table = reader.read_all()
+        names = table.column_names
+        result = {name: table.column(name).to_numpy() for name in names}
+
+    assert list(names) == list(expected.dtype.names)
+    # columns have the types of the C catalog; extract() widens the
+    # single-precision ones, so narrowing them back is exact
+    single = ("thresh", "a", "b", "theta", "cxx", "cyy", "cxy")
+    single += ("cflux", "flux", "cpeak", "peak")
+    for name in names:
+        dt = np.dtype(np.float32) if name in single else expected[name].dtype
+        assert result[name].dtype == dt
+        assert_equal(result[name], expected[name].astype(dt))
+
+
+def test_catalog_writer_errors(tmp_path):
+    with pytest.raises(ValueError):
+        sep.CatalogWriter(tmp_path / "cat.txt", format="csv")
+    with pytest.raises(Exception):
+        sep.CatalogWriter(tmp_path / "missing" / "cat.fits")
+
+
+@pytest.mark.skipif(NO_FITS, reason="no FITS reader")
+def test_extract_update():
+    """Updating a catalog around changed pixels matches a full extraction."""
+
+    data = image_data.astype(np.float64)
+    bkg = sep.Background(data)
+    data = data - bkg
+    # default deblending; cleaning only sees the objects near each change
+    kwargs = dict(err=bkg.globalrms, clean=False)
+    previous = sep.extract(data, 1.5, **kwargs)
+
+    # add a star, and blank a patch
+    new = data.copy()
+    y, x = np.mgrid[100:120, 50:70]
+    new[100:120, 50:70] += 50.0 * np.exp(-((x - 60) ** 2 + (y - 110) ** 2) / 4.0)
+    new[150:180, 120:160] = 0.0
+
+    full = sep.extract(new, 1.5, **kwargs)
+    full = full[np.lexsort((full["x"], full["y"]))]
+    boxes = [[50, 69, 100, 119], [120, 159, 150, 179]]
+    for dirty in (new != data, boxes):
+        objects = sep.extract(new, 1.5, previous=previous, dirty=dirty, **kwargs)
+        assert len(objects) == len(full)
+        objects = objects[np.lexsort((objects["x"], objects["y"]))]
+        for name in full.dtype.names:
+            assert_allclose(objects[name], full[name])
+
+    # a change on a deblended object, whose pixels are drawn at random
+    rng = np.random.RandomState(0)
+    merged = previous[(previous["flag"] & sep.OBJ_MERGED) != 0]
+    assert len(merged) > 5
+    for obj in merged:
+        x0 = max(int(obj["x"]) - 7, 0)
+        y0 = max(int(obj["y"]) - 7, 0)
+        new = data.copy()
+        new[y0 : y0 + 15, x0 : x0 + 15] += rng.normal(0.0, bkg.globalrms, (15, 15))
+        full = sep.extract(new, 1.5, **kwargs)
+        full = full[np.lexsort((full["x"], full["y"]))]
+        dirty = [[x0, x0 + 14, y0, y0 + 14]]
+        objects = sep.extract(new, 1.5, previous=previous, dirty=dirty, **kwargs)
+        assert len(objects) == len(full)
+        objects = objects[np.lexsort((objects["x"], objects["y"]))]
+        for name in full.dtype.names:
+            assert_allclose(objects[name], full[name])
+
+    # nothing changed
+    nothing = np.zeros((0, 4))
+    objects = sep.extract(data, 1.5, previous=previous, dirty=nothing, **kwargs)
+    assert_equal(objects, previous)
+
+    with pytest.raises(ValueError):
+        sep.extract(new, 1.5, previous=previous, **kwargs)
+
+
 # -----------------------------------------------------------------------------
 # General behavior and utilities
 
 
 def test_byte_order_exception():
     """
-    Test that SEP will not run with non-native byte order.
+    Test that SEP will not write to non-native byte order arrays.
 
-    Test that error about byte order is raised with non-native
-    byte order input array. This should happen for Background, extract,
-    and aperture functions.
+    Non-native byte order inputs are read directly, but arrays that are
+    modified in place, such as in Background.subfrom, must be native.
     """
 
     data = np.ones((100, 100), dtype=np.float64)
     data = data.view(data.dtype.newbyteorder("S"))
+    bkg = sep.Background(data)
     with pytest.raises(ValueError) as excinfo:
-        bkg = sep.Background(data)
+        bkg.subfrom(data)
     assert "byte order" in excinfo.value.args[0]
 
 
+def test_input_layouts():
+    """Test that strided, byte-swapped and 16-bit inputs match a native
+    contiguous copy."""
+
+    rng = np.random.default_rng(7)
+    big = (rng.normal(100.0, 5.0, (200, 300))).astype(np.float32)
+    big[50:60, 80:90] += 400.0
+    ref = np.ascontiguousarray(big[20:180, 10:290])
+    x = np.array([40.0, 85.0, 200.0])
+    y = np.array([30.0, 35.0, 120.0])
+
+    def results(data):
+        bkg = sep.Background(data, bw=32, bh=32)
+        flux, _, _ = sep.sum_circle(data, x, y, 5.0)
+        objs = sep.extract(data, 130.0)
+        return bkg.back(), np.append(flux, objs["flux"])
+
+    class DLPackCopy:
+        """Exports a new copy of an array on each DLPack request, so that
+        the exported pixels are owned by nothing but the capsule."""
+
+        def __init__(self, arr):
+            self.arr = arr
+
+        def __dlpack__(self, **kwargs):
+            return self.arr.copy().__dlpack__(**kwargs)
+
+        def __dlpack_device__(self):
+            return self.arr.__dlpack_device__()
+
+    back0, flux0 = results(ref)
+    inputs = [
+        big[20:180, 10:290],
+        ref.astype(ref.dtype.newbyteorder("S")),
+        memoryview(ref),
+        DLPackCopy(ref),
+    ]
+    for data in inputs:
+        back, flux = results(data)
+        assert_allclose(back, back0)
+        assert_allclose(flux, flux0)
+
+    # noise, mask and reference images are kept alive the same way
+    err = np.full(ref.shape, 5.0, dtype=np.float32)
+    mask = np.zeros(ref.shape, dtype=np.bool_)
+    mask[100:110, 100:110] = True
+    objs0 = sep.extract(ref, 3.0, err=err, mask=mask, ref=0.5 * ref, ref_noise=err)
+    objs = sep.extract(
+        DLPackCopy(ref),
+        3.0,
+        err=DLPackCopy(err),
+        mask=DLPackCopy(mask),
+        ref=DLPackCopy(0.5 * ref),
+        ref_noise=DLPackCopy(err),
+    )
+    assert_equal(objs, objs0)
+
+    # reversed rows give a negative row stride
+    back, flux = results(ref[::-1])
+    back1, flux1 = results(ref[::-1].copy())
+    assert_allclose(back, back1)
+    assert_allclose(flux, flux1)
+
+    # 16-bit integers match the same values as float
+    iref = np.round(ref).astype(np.int16)
+    back0, flux0 = results(iref.astype(np.float32))
+    for dt in (np.int16, np.uint16, np.dtype(">i2")):
+        back, flux = results(iref.astype(dt))
+        assert_allclose(back, back0, rtol=1.0e-6)
+        assert_allclose(flux, flux0)
+
+    # pixels within a row must be adjacent
+    with pytest.raises(ValueError):
+        sep.Background(big[:, ::2])
+
+
 def test_set_pixstack():
     """
     Ensure that setting the pixel stack size works.